@@ -0,0 +1,39 @@
+#include <cstdio>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// libstdc++ containers for the value printer and 'bench print'
+// g++ -g -gdwarf-4 -gno-variable-location-views containers.cpp -o containers
+// break containers.cpp:36, then: print numbers, print index, bench print numbers
+
+struct Employee {
+  std::string name;
+  int age;
+};
+
+int main() {
+  std::vector<int> numbers;
+  for (int i = 0; i < 1000000; ++i) {
+    numbers.push_back(i * 3);
+  }
+  std::string greeting = "hello, world";
+  std::string long_text(10000, 'x');
+  std::vector<Employee> staff = { {"Ada", 36}, {"Linus", 28} };
+  std::map<int, std::string> index;
+  std::set<long> primes = { 2, 3, 5, 7, 11, 13 };
+  std::unordered_map<std::string, int> ages;
+  std::unordered_set<int> seen;
+  for (int i = 0; i < 1000; ++i) {
+    index[(i * 7919) % 1000] = std::to_string(i);
+    ages["id" + std::to_string(i)] = i;
+    seen.insert(i * i);
+  }
+  std::vector<std::vector<int>> grid = { {1, 2}, {3}, {} };
+  printf("%zu %s %zu %zu %zu %zu %zu %zu\n", numbers.size(), greeting.c_str(), long_text.size(), staff.size(),
+         index.size(), primes.size(), ages.size(), grid.size() + seen.size());
+  return 0;
+}
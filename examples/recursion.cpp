@@ -0,0 +1,30 @@
+#include <cstdio>
+#include <cstdlib>
+
+// Deep recursion for the unwinder: build it without frame pointers, the backtrace has to come from the CFI
+// g++ -g -gdwarf-4 -gno-variable-location-views -O2 -fomit-frame-pointer recursion.cpp -o recursion
+
+__attribute__((noinline)) void leaf(int depth) {
+  // qsort calls back from libc: a frame of a library in the middle of the stack
+  int values[] = { 3, 1, 2 };
+  qsort(values, 3, sizeof(int), [](const void* a, const void* b) {
+    return *static_cast<const int*>(a) - *static_cast<const int*>(b);
+  });
+  printf("depth %d: %d %d %d\n", depth, values[0], values[1], values[2]);
+}
+
+__attribute__((noipa)) int descend(int depth, int left) {
+  // Something on the stack after the call, so the compiler can't turn the recursion into a loop
+  volatile int level = depth;
+  if (left == 0) {
+    leaf(depth);
+    return depth;
+  }
+  const int result = descend(depth + 1, left - 1);
+  return result + level;
+}
+
+int main(int argc, char** argv) {
+  const int depth = argc > 1 ? atoi(argv[1]) : 1000;
+  return descend(0, depth) > 0 ? 0 : 1;
+}
@@ -0,0 +1,35 @@
+#include <cstdio>
+
+// Nested blocks, a shadowed variable and an inlined call:
+// g++ -g -gdwarf-4 -gno-variable-location-views -O2 scopes.cpp -o scopes
+// break scopes.cpp:21 (the inner total), break scopes.cpp:12 (inside twice), then: info args, info locals
+
+static int counter = 0;
+
+__attribute__((noinline)) int work(int n) {
+  counter += n;
+  return counter * 2;
+}
+
+static inline int twice(int value) {
+  int doubled = value * 2;
+  return work(doubled);
+}
+
+int compute(int limit, const char* label) {
+  int total = 0;
+  for (int i = 0; i < limit; ++i) {
+    int square = i * i;
+    if (square > 10) {
+      int total = square - 10;   // hides the outer total
+      work(total);
+    }
+    total += twice(square);
+  }
+  printf("%s %d\n", label, total);
+  return total;
+}
+
+int main() {
+  return compute(5, "sum") > 0 ? 0 : 1;
+}
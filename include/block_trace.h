@@ -0,0 +1,65 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Branch tracing
+// Single-stepping stops the inferior after every instruction. With PTRACE_SINGLEBLOCK the kernel sets the
+// branch trap flag (BTF, bit 1 of IA32_DEBUGCTL) next to TF, and the CPU traps only after taken branches.
+// Idea:
+//  1. At every stop rip is the target of the branch (to). Its source (from) is the last instruction of the
+//     straight-line run which began at the previous stop, found by decoding that run.
+//  2. (from, to) pairs go into a ring buffer, so memory doesn't grow with the length of the trace.
+//  3. Every run is a block: counting the runs starting at each address gives the block hit counts.
+// Intel SDM Vol. 3, 18.4.3 "Single-Stepping on Branches".
+// Hypervisors don't always pass BTF through, then the kernel falls back to a trap per instruction.
+
+struct BranchRecord {
+  uint64_t from;
+  uint64_t to;
+};
+
+// Keeps the last capacity items, overwriting the oldest (capacity is a power of two)
+template <class T>
+class RingBuffer {
+  std::vector<T> m_items;
+  uint64_t m_pushed = 0;
+
+public:
+  explicit RingBuffer(size_t capacity) : m_items(capacity) {}
+
+  void push(const T& item) { m_items[m_pushed++ & (m_items.size() - 1)] = item; }
+
+  // n-th most recent item, 0 is the last one pushed
+  const T& recent(size_t n) const { return m_items[(m_pushed - 1 - n) & (m_items.size() - 1)]; }
+
+  size_t size() const { return static_cast<size_t>(std::min<uint64_t>(m_pushed, m_items.size())); }
+  uint64_t pushed() const { return m_pushed; }
+  void clear() { m_pushed = 0; }
+};
+
+// A straight-line run of instructions entered at its start address (the key in BlockTrace::blocks).
+// It ends with a taken branch, so not-taken conditional jumps may be inside.
+struct TracedBlock {
+  uint64_t end = 0;              // address after the last instruction
+  uint32_t instructions = 0;
+  uint64_t hits = 0;
+};
+
+struct BlockTrace {
+  RingBuffer<BranchRecord> branches { 1 << 16 };
+  std::unordered_map<uint64_t, TracedBlock> blocks;
+  uint64_t stops = 0;
+  uint64_t instructions = 0;
+  uint64_t fall_throughs = 0;    // stops not after a taken branch: syscalls, or every instruction without BTF
+
+  void clear() {
+    branches.clear();
+    blocks.clear();
+    stops = 0;
+    instructions = 0;
+    fall_throughs = 0;
+  }
+};
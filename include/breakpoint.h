@@ -2,6 +2,7 @@
 
 #include <sys/types.h>
 #include <cstdint>
+#include <string>
 
 // So the questions are:
 //
@@ -30,10 +31,15 @@ public:
 
   auto isEnabled() const -> bool { return m_enabled; }
   auto getAddress() const -> uint64_t { return m_addr; }
+  auto getSavedData() const -> uint8_t { return m_saved_data; }
+  // An expression which must be true for a hit to stop the program, empty for always
+  auto getCondition() const -> const std::string& { return m_condition; }
+  void setCondition(std::string condition) { m_condition = std::move(condition); }
 
 private:
   pid_t m_pid;
   uint64_t m_addr;
   bool m_enabled;
   uint8_t m_saved_data; // data which used to be at the BreakPoint address
+  std::string m_condition;
 };
\ No newline at end of file
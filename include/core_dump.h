@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/user.h>
+
+// Writing an ELF core of the stopped inferior ('gcore')
+//  A snapshot of a misbehaving process, to be opened later (gdb prog core), without killing it. The process is
+//  stopped while its memory is copied out: a word at a time, a GB would take minutes.
+// Idea:
+//  1. The layout is known before a byte of memory is read: the ELF header, a PT_NOTE, a PT_LOAD per mapping of
+//     /proc/pid/maps, the notes (NT_PRSTATUS and NT_PRFPREG per thread, NT_PRPSINFO, NT_AUXV, NT_FILE), then the
+//     contents of the mappings at page-aligned offsets.
+//  2. Contents are read by chunks of 8 MB with process_vm_readv and written with pwrite, except the pages which are
+//     all zeros: they are left as holes of a sparse file (a fresh heap or stack is mostly that).
+//  3. Mappings which aren't readable have no contents, as in the kernel's cores. Read-only mappings of files may
+//     be left out as well (they are in the files): only their first page is kept, which holds the ELF header.
+
+struct CoreThread {
+  pid_t tid = 0;
+  int signal = 0;              // the signal it stopped with
+  user_regs_struct regs;
+  user_fpregs_struct fp_regs;
+};
+
+struct CoreOptions {
+  bool skip_file_read_only = false;
+};
+
+struct CoreStatistics {
+  size_t segments = 0;
+  uint64_t memory = 0;         // bytes of contents
+  uint64_t written = 0;        // of them, not zero pages
+  uint64_t reads = 0;          // process_vm_readv calls
+  uint64_t file_size = 0;
+};
+
+// Writes the core of pid, stopped with its threads, to path. The first thread is the one reported as current.
+// patch may fix a chunk after it is read (the bytes under breakpoints). False, with a message in error, if the
+// core can't be written.
+bool writeCore(pid_t pid, const std::vector<CoreThread>& threads, const std::string& path, const CoreOptions& options,
+               CoreStatistics& statistics, std::string& error,
+               const std::function<void(uint64_t address, uint8_t* bytes, size_t size)>& patch = {});
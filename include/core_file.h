@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "core_dump.h"
+#include "target.h"
+
+// Debugging a core file (debugger --core <core> <program>)
+//  A core is an ELF file: a PT_LOAD per mapping of the process with its contents, and notes with the registers of
+//  every thread (NT_PRSTATUS), the auxiliary vector (NT_AUXV) and the files mapped (NT_FILE). Cores of big
+//  processes are tens of GB: reading one into memory, or even through it, is out of the question.
+// Idea:
+//  1. The core is mapped, never read: a read of the inferior's memory is a memcpy from the PT_LOAD segment holding
+//     it, which faults in the pages it touches and no others (MADV_RANDOM: no read-ahead either).
+//  2. The segments are sorted by address, so finding one is a binary search.
+//  3. Segments whose contents were left out (gcore -s, the kernel's coredump_filter) are read from the file NT_FILE
+//     says was mapped there: the code of the program and of its libraries.
+//  4. The registers come from the NT_PRSTATUS of the selected thread, the first one (which got the signal) to
+//     begin with. The load address of the program is AT_ENTRY in the auxiliary vector minus the entry point of its
+//     ELF header.
+
+class CoreTarget : public Target {
+public:
+  // Maps the core at path, of the program at program_path. Throws std::runtime_error if it isn't an x86-64 ELF core.
+  CoreTarget(const std::string& path, const std::string& program_path);
+  ~CoreTarget() override;
+  CoreTarget(const CoreTarget&) = delete;
+  CoreTarget& operator=(const CoreTarget&) = delete;
+
+  bool live() const override { return false; }
+  pid_t pid() const override { return m_pid; }
+  bool readBytes(uint64_t address, void* buffer, size_t size) override;
+  size_t readAvailable(uint64_t address, void* buffer, size_t size) override;
+  size_t readBlocks(const uint64_t* addresses, size_t count, size_t size, void* buffer) override;
+  bool selectThread(pid_t tid) override;
+  void getRegisters(user_regs_struct& regs) override;
+  std::vector<MemoryMapping> mappings() override;
+  std::string executable() override { return m_executable; }
+  uint64_t loadAddress() override { return m_load_address; }
+
+  const std::vector<CoreThread>& threads() const { return m_threads; }
+  size_t size() const { return m_size; }
+
+private:
+  struct Segment {
+    uint64_t low;
+    uint64_t high;             // low + p_memsz
+    uint64_t file_size;        // of the contents in the core, from low
+    uint32_t flags;            // PF_R, PF_W, PF_X
+    const uint8_t* data;
+  };
+  struct MappedFile {
+    uint64_t low;
+    uint64_t high;
+    uint64_t offset;           // in bytes
+    std::string path;
+  };
+
+  void readNotes(const uint8_t* notes, size_t size);
+  // Up to size bytes at address from the file mapped there, 0 if none is
+  size_t readMappedFile(uint64_t address, uint8_t* buffer, size_t size);
+
+  const uint8_t* m_data = nullptr;
+  size_t m_size = 0;
+  pid_t m_pid = 0;
+  std::vector<Segment> m_segments;       // sorted by low
+  std::vector<MappedFile> m_files;       // NT_FILE
+  std::vector<CoreThread> m_threads;
+  size_t m_thread = 0;                   // selected
+  std::vector<uint64_t> m_auxv;          // (type, value) pairs
+  uint64_t m_load_address = 0;
+  std::string m_executable;
+  std::unordered_map<std::string, int> m_descriptors;   // the files of m_files opened so far, -1 if they can't be
+};
@@ -1,39 +1,128 @@
 #pragma once
 
+#include <functional>
+#include <map>
 #include <unordered_map>
+#include <unordered_set>
 #include <fcntl.h>
 #include <unistd.h>
 #include <csignal>
 
+#include "block_trace.h"
 #include "breakpoint.h"
+#include "core_file.h"
+#include "core_dump.h"
 #include "internal.hh"
 #include "elf++.hh"
+#include "event_loop.h"
+#include "expression.h"
+#include "function_trace.h"
+#include "memory_dump.h"
+#include "memory_format.h"
+#include "memory_search.h"
+#include "profile.h"
+#include "scope_index.h"
+#include "shared_libraries.h"
+#include "split_dwarf.h"
 #include "symbol.h"
+#include "target.h"
+#include "threads.h"
+#include "unwinder.h"
+#include "value_printer.h"
+#include "x86_decoder.h"
 
 class Debugger {
   std::string m_prog_name;
-  pid_t m_pid;
+  pid_t m_process;                          // the thread group
+  pid_t m_pid;                              // the current thread
+  std::unique_ptr<Target> m_target;         // the process, or a core file
+  EventLoop m_events;                       // before anything starts a thread, see event_loop.h
+  std::map<pid_t, InferiorThread> m_threads;
+  unsigned m_thread_count;                  // created so far, for the numbers of threads
+  pid_t m_shown_thread;                     // the last thread a stop was reported for
+  bool m_non_stop;                          // only the thread with an event stops, see threads.h
+  Unwinder m_unwinder;
+  SharedLibraries m_libraries;
+  std::vector<LibraryBreakpoint> m_pending_breakpoints;   // resolved when a library which has them is loaded
+  std::unordered_map<uint64_t, LibraryBreakpoint> m_library_breakpoints;   // set in a library, by address
 
   std::unordered_map<uint64_t, BreakPoint> m_breakpoints;
+  // Breakpoints planted by the stepping engine, not reported as hits
+  std::unordered_set<uint64_t> m_internal_breakpoints;
+  // Breakpoints planted by next and finish: hits are reported, but only in m_stepping_thread
+  std::unordered_set<uint64_t> m_step_breakpoints;
+  pid_t m_stepping_thread;                  // the thread continue was given for, 0 when not running
 
   dwarf::dwarf m_dwarf;
   elf::elf m_elf;
+  SplitDwarf m_split_dwarf;
+  ScopeIndex m_scopes;
+  InstructionCache m_instruction_cache;
+  // Displaced stepping: breakpointed instructions are stepped from a copy in a scratch page of the inferior
+  bool m_displaced_stepping;
+  uint64_t m_scratch_area;      // 0 until it is mapped, ~0 if it can't be
+  uint64_t m_scratch_holds;     // address of the instruction copied there, 0 if none
+  BlockTrace m_block_trace;
+  FunctionTrace m_function_trace;
+  Profile m_profile;
+  ValuePrinter m_value_printer;
+  ExpressionEvaluator m_expressions;
+  std::unordered_map<std::string, const TypeLayout*> m_named_types;   // casts: types by name, nullptr if none
+  std::vector<std::string> m_displays;      // expressions printed at every stop
+  bool m_resume_after_stop;                 // the stop was a breakpoint whose condition is false
+  bool m_exited;
+  bool m_attached;                          // to a running process (-p): let go at the end, not killed
+  bool m_detached;
+  double m_attach_pause;                    // ms the process was stopped for by attach
+  ExamineFormat m_examine;                  // the last format of 'x'
+  uint64_t m_examine_next;                  // where 'x' without an address goes on
   int file_descriptor;
   uint64_t m_load_address;
 
 public:
-  Debugger(std::string prog_name, pid_t pid);
+  Debugger(std::string prog_name, std::unique_ptr<Target> target, const elf::mmap_loader_options& loader_options = {});
   ~Debugger();
 
   void dispose();
+  size_t removeAllBreakpoints();
+  bool attach();
+  void detach();
 
   void waitForSignal();
+  void reportStop(int wait_status);
+  InferiorThread& addThread(pid_t tid);
+  pid_t addClonedThread(pid_t parent);
+  void threadExited(pid_t tid);
+  void selectThread(pid_t tid);
+  void announceThread();
+  void resumeThread(pid_t tid, Resume how);
+  bool waitThread(pid_t tid, int& wait_status, bool block = true);
+  pid_t waitForEvent(int& wait_status, bool block = true);
+  void stopAllThreads();
+  bool reportPendingSignal();
+  void collectEvents(bool block);
+  pid_t reportEvents();
+  void continueNonStop(bool all, bool for_current);
+  void interruptThreads(const std::string& argument);
+  std::vector<pid_t> stopRunningThreads();
+  void resumeThreads(const std::vector<pid_t>& tids);
+  std::vector<pid_t> requestInterrupt(const std::string& argument);
+  unsigned waitEvents();
+  bool programTakesInterrupt(bool from_terminal);
+  void interruptProgram(bool from_terminal);
+  bool waitTracedThread(int& wait_status);
+  void runTypedCommands();
+  void setNonStop(bool on);
+  void printThreads();
+  void switchThread(const std::string& argument);
   void run();
   void handleCommand(const char* command);
   void continueExecution();
   void stepOverBreakpoint();
+  bool displacedStep(uint64_t pc);
+  uint64_t allocateScratchArea();
 
-  void setBreakpointAtAddress(uint64_t addr);
+  void setBreakpointAtAddress(uint64_t addr, const std::string& condition = "");
   void dumpRegisters();
 
   uint64_t getPc();
@@ -50,10 +139,22 @@ public:
   //    2. https://blog.tartanllama.xyz/writing-a-linux-debugger-elf-dwarf/
   dwarf::die getFunctionFromPc(uint64_t pc);
   dwarf::line_table::iterator getLineEntryFromPc(const uint64_t& pc, bool apply_load_address_offset = true);
+  const dwarf::line_table& getLineTableFromPc(uint64_t offset_pc);
+  std::pair<uint64_t, uint64_t> getLineRangeFromPc(uint64_t pc);
 
+  void indexDebugInfo();
   void initializeLoadAddress();
+  void initializeSharedLibraries();
+  void updateSharedLibraries();
+  void setLibraryBreakpoint(const LibraryBreakpoint& breakpoint);
+  bool resolveLibraryBreakpoint(const SharedLibrary& library, const LibraryBreakpoint& breakpoint);
+  std::string librarySourceLine(uint64_t pc);
+  void printSharedLibraries();
   uint64_t offsetLoadAddress(uint64_t addr);
   void printSource(const std::string& file_name, uint32_t line, uint32_t n_lines_context = 2);
+  // Lines [start_line, end_line] with "> " at cursor_line and margin(line) in front of every line
+  void printSourceLines(const std::string& file_name, uint32_t start_line, uint32_t end_line, uint32_t cursor_line,
+                        const std::function<std::string(uint32_t)>& margin = {});
   siginfo_t getSignalInfo();
   void handleSigtrap(siginfo_t const& info);
 
@@ -62,22 +163,85 @@ public:
   void stepOver();
   void stepOut();
   void stepIn();
+  bool stepOutOfRange(uint64_t low, uint64_t high, bool& entered_call);
+  std::vector<uint8_t> readCode(uint64_t address, size_t size);
+  std::vector<Instruction> decodeRange(uint64_t low, uint64_t high);
+  const Instruction* instructionAt(uint64_t address);
+
+  void disassemble(uint64_t low, uint64_t high, const std::function<std::string(uint64_t)>& margin = {});
+  std::pair<uint64_t, uint64_t> getFunctionRange(const dwarf::die& func);
+  dwarf::die getFunctionByName(const std::string& name);
+  std::string symbolize(uint64_t address);
+  void checkInstructionBoundary(uint64_t address);
+  void benchmarkDecoder(const std::string& path, unsigned rounds);
+  void benchmarkBreakpoint(unsigned hits);
+
+  bool blockTrace(uint64_t max_branches, uint64_t max_instructions = UINT64_MAX);
+  uint32_t recordBlock(uint64_t start, uint64_t to);
+  void printBlockTrace(size_t n_blocks);
+  void printBranchHistory(size_t n_branches);
+  std::string describeAddress(uint64_t address);
+  std::string describePc(uint64_t pc);
+  void benchmarkTrace(uint64_t instructions);
+  void benchmarkUnwind(unsigned rounds);
+  void benchmarkPrint(const std::string& expression, unsigned elements);
+  void benchmarkExamine(const std::string& expression, size_t bytes);
+
+  // The number of functions the pattern matches, traced already or not
+  size_t addFunctionTrace(const std::string& pattern);
+  void functionTrace(uint64_t max_calls);
+  void onFunctionEntry(size_t function, uint64_t stack_pointer, FunctionTrace::clock::time_point now);
+  void onFunctionReturn(uint64_t address, uint64_t stack_pointer, FunctionTrace::clock::time_point now);
+  void releaseReturnBreakpoint(uint64_t address);
+  void removeFunctionTraceBreakpoints(bool exited);
+  void printFunctionTrace();
+  void printLatencyHistogram(const std::string& name);
+
+  bool profile(double seconds, unsigned hz);
+  std::string profileFrameName(uint64_t pc, bool innermost);
+  void printProfile(size_t n_functions);
+  void writeFoldedStacks(std::ostream& out);
+  std::vector<std::pair<std::string, unsigned>> resolveLines(const std::vector<uint64_t>& pcs);
+  void annotate(const std::string& function);
+  void benchmarkLines(uint64_t samples);
 
   void removeBreakpoint(uint64_t addr);
   uint64_t offsetDwarfAddress(uint64_t dwarf_addr);
-  uint64_t getReturnAddress() const;
+  uint64_t getReturnAddress();
 
-  void setBreakpointAtFunction(const std::string& name);
+  void setBreakpointAtFunction(const std::string& name, const std::string& condition = "");
 
-  void setBreakpointAtSourceLine(const std::string& file_name, uint32_t line_number);
+  void setBreakpointAtSourceLine(const std::string& file_name, uint32_t line_number,
+                                 const std::string& condition = "");
 
   std::vector<Symbol> lookupSymbol(const std::string& name);
 
 //  void logBacktraceLine(const dwarf::die& func_dwarf_addr);
 
-  void printBacktrace();
-
-  uint64_t unwindFramePointer(uint64_t& frame_pointer) const;
-
-  void readVariables();
+  void printBacktrace(size_t max_frames = 64);
+
+
+  void printVariables(bool parameters, bool locals);
+
+  ExpressionValue evaluateExpression(const std::string& text);
+  bool lookupName(const std::string& name, const user_regs_struct& regs, UnwindFrame& frame, ExpressionValue& value);
+  void variableValue(const ScopeVariable& variable, const FunctionScopes* function, const user_regs_struct& regs,
+                     UnwindFrame& frame, ExpressionValue& value);
+  const TypeLayout* lookupType(const std::string& name);
+  void printExpression(const std::string& text);
+  bool breakpointConditionHolds(uint64_t address);
+  void printDisplays();
+
+  void examine(const std::string& spec, const std::string& expression);
+  void examineStrings(uint64_t address);
+  void findMemory(const std::string& spec, const std::string& arguments);
+  bool evaluateRange(const std::string& start, const std::string& end, uint64_t& low, uint64_t& high);
+  bool writeMemory(uint64_t address, const std::vector<uint8_t>& bytes);
+  bool writeMemory(uint64_t address, const uint8_t* bytes, size_t size);
+  void dumpMemoryToFile(const std::string& path, const std::string& range);
+  void restoreMemoryFromFile(const std::string& path, const std::string& expression);
+  TransferProgress transferProgress(const char* what);
+  void restoreBreakpointBytes(uint64_t address, uint8_t* bytes, size_t size);
+  void generateCore(const std::string& arguments);
+  void printCoreStop();
 };
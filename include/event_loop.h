@@ -0,0 +1,81 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// The event loop
+//  continue blocked in waitpid: while the program ran the debugger heard nothing else. Ctrl-C killed it (and with it a
+//  process it was attached to, left on its int3s), a command typed meanwhile waited for the program to stop, sampling
+//  slept until the next sample whatever happened, and work done on other threads (indexing a library) went unseen.
+// Idea:
+//  1. One epoll instance waits for everything, each source a file descriptor:
+//     - a signalfd for SIGCHLD (a tracee changed state) and SIGINT (Ctrl-C). Both are blocked in the debugger: they
+//       are read, never delivered. The mask is set once the program is forked (a child would inherit it) and before
+//       the debugger starts threads of its own (which would take the signals).
+//     - a pidfd of the process (pidfd_open), readable once it is gone: a wakeup which doesn't depend on SIGCHLD
+//     - a timerfd, armed for a point in time (sampling)
+//     - an eventfd, written by the debugger's other threads when they post work they are done with (post)
+//     - the terminal, only while asked for (watchTerminal)
+//  2. wait returns the set of what happened, after running what was posted. Nothing is lost between a
+//     waitpid(WNOHANG) which found nothing and the wait: the SIGCHLD stays queued in the signalfd until it is read.
+//  3. The terminal is only read while the program runs, and only if stdin is one: at the prompt linenoise reads it
+//     (it can't be multiplexed), and a pipe is read through stdio's buffer, from under which read() would take lines.
+//     While the program runs the terminal is in cooked mode: the lines typed are kept until they are taken (lines).
+
+class EventLoop {
+public:
+  enum Event : unsigned {
+    child = 1,          // SIGCHLD, or the process is gone: waitpid has something
+    interrupt = 2,      // Ctrl-C
+    timer = 4,
+    input = 8,          // a line was typed
+    completion = 16,    // posted work was run
+  };
+
+  EventLoop();
+  ~EventLoop();
+  EventLoop(const EventLoop&) = delete;
+  EventLoop& operator=(const EventLoop&) = delete;
+
+  // The process whose end wakes the loop (its thread group leader)
+  void watchProcess(pid_t pid);
+  void watchTerminal(bool on);
+
+  // Waits up to timeout_ms (-1: until something happens, 0: not at all) and returns the events which came, 0 if none
+  unsigned wait(int timeout_ms = -1);
+
+  // The timer goes off at when (steady_clock), once
+  void setTimer(std::chrono::steady_clock::time_point when);
+  void cancelTimer();
+
+  // From any thread: work runs on the loop's thread, in the next wait
+  void post(std::function<void()> work);
+
+  // Whether the last Ctrl-C came from the terminal (which sent it to its whole foreground process group) rather than
+  // to the debugger alone (kill)
+  bool interruptFromTerminal() const { return m_interrupt_from_terminal; }
+  std::deque<std::string>& lines() { return m_lines; }
+
+private:
+  void add(int descriptor);
+  void remove(int& descriptor);
+  void readSignals(unsigned& events);
+  void readTerminal(unsigned& events);
+
+  int m_epoll = -1;
+  int m_signals = -1;
+  int m_process = -1;
+  int m_timer = -1;
+  int m_wakeup = -1;
+  bool m_terminal = false;          // stdin is in the set
+  bool m_interrupt_from_terminal = false;
+  std::string m_partial;            // typed so far of the line to come
+  std::deque<std::string> m_lines;
+  std::mutex m_mutex;               // guards m_posted
+  std::vector<std::function<void()>> m_posted;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include "value_printer.h"
+
+// C expressions over the inferior: 'print', breakpoint conditions and 'display'
+//  "p->next->count * 2 > limit" needs the types of p, next, count and limit, the addresses they live at and three
+//  loads, and a condition needs all that at every hit of its breakpoint.
+// Idea:
+//  1. Parse the text once (recursive descent with the C precedences) and keep the tree by text: a condition or
+//     a display is parsed the first time it is evaluated only.
+//  2. Evaluate the tree with the TypeLayouts of the ValuePrinter. A variable, a member, an element or *p is an
+//     lvalue, an address and a type: nothing is read until its value is needed, so s.inner.items[3] loads
+//     4 bytes and not all of s.
+//  3. The loads of one evaluation go through a cache of aligned blocks, and missing blocks next to each other are
+//     read with one transfer: p->x + p->y + p->z is a single process_vm_readv. The cache lives for one evaluation
+//     only, the inferior runs in between.
+
+struct ExpressionValue {
+  const TypeLayout* type = nullptr;
+  bool lvalue = false;               // the object is in memory at address, otherwise bytes hold the value
+  uint64_t address = 0;
+  uint8_t bit_size = 0;              // bit-field lvalues: bits from bit_offset of the storage at address
+  uint8_t bit_offset = 0;
+  std::array<uint8_t, 16> bytes {};
+};
+
+class ExpressionError : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+struct ExpressionNode;
+
+class ExpressionEvaluator {
+public:
+  // A variable of the program ("$rip" for a register) in the scope of the stop, false if there is none
+  using NameResolver = std::function<bool(const std::string& name, ExpressionValue& value)>;
+  // A named type of the program (a struct, a typedef...), nullptr if there is none
+  using TypeResolver = std::function<const TypeLayout*(const std::string& name)>;
+
+  ExpressionEvaluator(ValuePrinter& printer, ValueReader reader);
+  ~ExpressionEvaluator();
+
+  // Throw ExpressionError for syntax errors and for what can't be evaluated
+  ExpressionValue evaluate(const std::string& text, const NameResolver& names, const TypeResolver& types);
+  // "(int) 42", "(point) {x = 1, y = 2}" for a value of the last evaluation
+  std::string format(const ExpressionValue& value);
+  // Conditions: a scalar which isn't 0
+  bool isTrue(const ExpressionValue& value);
+  // 'x': a pointer or an integer is an address, an array is the address of its first element and another object
+  // in memory its own
+  uint64_t address(const ExpressionValue& value);
+
+  size_t cachedExpressions() const { return m_parsed.size(); }
+  // Transfers from the inferior since the start
+  uint64_t reads() const { return m_reads; }
+
+private:
+  static constexpr uint64_t BLOCK_SIZE = 256;   // divides the page size, so a block is mapped or not as a whole
+
+  const ExpressionNode& parse(const std::string& text);
+  ExpressionValue evaluate(const ExpressionNode& node);
+  ExpressionValue binary(const ExpressionNode& node);
+  ExpressionValue cast(const ExpressionNode& node);
+  ExpressionValue member(const ExpressionValue& object, const std::string& name);
+  ExpressionValue dereference(const ExpressionValue& pointer, int64_t index);
+  // The value of an lvalue, arrays decayed to a pointer to their first element, references followed
+  ExpressionValue load(ExpressionValue value);
+  ExpressionValue followReference(ExpressionValue value);
+  const TypeLayout& type(const std::string& name, unsigned pointers);
+  const TypeLayout& builtin(const char* name) { return *m_printer.builtin(name); }
+  // The usual arithmetic conversions: int, unsigned int, long or unsigned long
+  const TypeLayout& promote(const TypeLayout& left, const TypeLayout& right);
+  void read(uint64_t address, void* buffer, size_t size);
+
+  ValuePrinter& m_printer;
+  ValueReader m_read;
+  std::unordered_map<std::string, std::unique_ptr<ExpressionNode>> m_parsed;
+  std::unordered_map<uint64_t, std::array<uint8_t, BLOCK_SIZE>> m_blocks;   // by address, for one evaluation
+  const NameResolver* m_names = nullptr;
+  const TypeResolver* m_types = nullptr;
+  uint64_t m_reads = 0;
+};
@@ -7,13 +7,16 @@
 class ExpressionContext : public dwarf::expr_context {
   pid_t m_pid;
   uint64_t m_load_address;
+  uint64_t m_cfa;   // of the frame the expression is evaluated in, 0 if unknown
 public:
-  explicit ExpressionContext (pid_t pid, uint64_t m_load_address) :
+  explicit ExpressionContext (pid_t pid, uint64_t m_load_address, uint64_t cfa = 0) :
     m_pid(pid),
-    m_load_address(m_load_address)
+    m_load_address(m_load_address),
+    m_cfa(cfa)
   {}
 
   dwarf::taddr reg (uint32_t dwarfRNum) override;
   dwarf::taddr pc() override;
   dwarf::taddr deref_size (dwarf::taddr address, uint32_t size) override;
+  dwarf::taddr call_frame_cfa() override;
 };
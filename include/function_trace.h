@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "latency_histogram.h"
+
+// Function entry/exit tracing (ftrace)
+// Idea:
+//  1. A breakpoint on the first instruction of every matching function: there [rsp] is the return address.
+//  2. On entry, a one-shot breakpoint on the return address (as stepOut does) and a timestamp.
+//  3. When it is hit with rsp just above the entry frame, the call has returned: the time between the two
+//     stops goes into the function's histogram. Recursive calls return to the same address with different
+//     stack pointers, so pending calls are kept as a stack and matched by rsp.
+// Both stops are seen by the debugger, so every latency includes a couple of ptrace round trips.
+
+struct TracedFunction {
+  std::string name;
+  uint64_t entry = 0;
+  uint64_t calls = 0;
+  LatencyHistogram latency;   // in nanoseconds
+};
+
+struct FunctionTrace {
+  using clock = std::chrono::steady_clock;
+
+  struct PendingCall {
+    size_t function;
+    uint64_t return_address;
+    uint64_t stack_pointer;   // rsp on entry, pointing at the return address
+    clock::time_point entered;
+  };
+
+  std::vector<TracedFunction> functions;
+  std::unordered_map<uint64_t, size_t> entries;      // entry address -> functions index
+  std::vector<PendingCall> pending;                   // innermost call last
+  std::unordered_map<uint64_t, unsigned> returns;    // return address -> pending calls returning there
+  std::unordered_set<uint64_t> owned;                 // breakpoints set by the tracer (not by the user)
+  uint64_t unwound = 0;                               // calls left without returning (longjmp, exceptions)
+};
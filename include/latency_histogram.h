@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+
+// Latency histogram in the spirit of HdrHistogram (http://hdrhistogram.org)
+// Idea:
+//  Latencies span many orders of magnitude (a cached call takes nanoseconds, one which misses a lock takes
+//  milliseconds), and the interesting part is the tail. Linear buckets are either too coarse for the fast calls
+//  or too many for the slow ones, so every power of two gets the same number of linear sub-buckets:
+//  a value is kept to within 1/SUB_BUCKETS of itself at any magnitude, in a fixed amount of memory,
+//  and recording it is a couple of shifts.
+class LatencyHistogram {
+public:
+  static constexpr unsigned SUB_BUCKET_BITS = 4;
+  static constexpr unsigned SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+  static constexpr size_t BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+  // Values below SUB_BUCKETS have a bucket each, then every power of two [2^k, 2^(k+1)) has SUB_BUCKETS
+  static size_t bucketOf(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+      return value;
+    }
+    const unsigned shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+  }
+
+  static uint64_t lowestOf(size_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+      return bucket;
+    }
+    const unsigned shift = bucket / SUB_BUCKETS - 1;
+    return (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+  }
+
+  static uint64_t highestOf(size_t bucket) {
+    return bucket < SUB_BUCKETS ? bucket : lowestOf(bucket) + (1ULL << (bucket / SUB_BUCKETS - 1)) - 1;
+  }
+
+  void record(uint64_t value) {
+    ++m_counts[bucketOf(value)];
+    ++m_count;
+    m_sum += value;
+    m_min = std::min(m_min, value);
+    m_max = std::max(m_max, value);
+  }
+
+  // The value at or below which percentile % of the recorded values are (within the bucket precision)
+  uint64_t percentile(double percentile) const {
+    const auto wanted = static_cast<uint64_t>(percentile / 100.0 * m_count + 0.5);
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+      seen += m_counts[bucket];
+      if (seen >= std::max<uint64_t>(wanted, 1)) {
+        return std::min(highestOf(bucket), m_max);
+      }
+    }
+    return m_max;
+  }
+
+  uint64_t count() const { return m_count; }
+  uint64_t min() const { return m_count ? m_min : 0; }
+  uint64_t max() const { return m_max; }
+  uint64_t mean() const { return m_count ? m_sum / m_count : 0; }
+  uint64_t countAt(size_t bucket) const { return m_counts[bucket]; }
+
+private:
+  std::array<uint64_t, BUCKETS> m_counts {};
+  uint64_t m_count = 0;
+  uint64_t m_sum = 0;
+  uint64_t m_min = UINT64_MAX;
+  uint64_t m_max = 0;
+};
+
+// "850ns", "12.3us", "4.1ms", "2.0s"
+inline std::string formatNanoseconds(uint64_t ns) {
+  const char* units[] = { "ns", "us", "ms", "s" };
+  double value = static_cast<double>(ns);
+  size_t unit = 0;
+  while (value >= 1000 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+    value /= 1000;
+    ++unit;
+  }
+  char text[32];
+  snprintf(text, sizeof(text), unit ? "%.1f%s" : "%.0f%s", value, units[unit]);
+  return text;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <sys/types.h>
+
+// Copying memory of the inferior to a file and back ('dump memory', 'restore')
+//  An arena of a GB is 128M words: as many PTRACE_PEEKDATA calls, and the same number of writes into a stream.
+// Idea:
+//  1. Dumping reads 64 MB at once with process_vm_readv into one page-aligned buffer, written out with write(2).
+//     (Reading into a shared mapping of the file is slower: each page of the file faults in on its own.)
+//  2. Restoring maps the file and process_vm_writev copies its pages from the page cache, no buffer in between.
+//  3. Both go by chunks of 64 MB, a system call each, so that a progress line can be shown and an unreadable page
+//     stops a dump where it is: the file then holds what could be read, up to there.
+
+struct TransferStatistics {
+  uint64_t bytes = 0;          // copied
+  uint64_t calls = 0;          // process_vm_readv/writev calls
+};
+
+// done of total bytes, after every chunk
+using TransferProgress = std::function<void(uint64_t done, uint64_t total)>;
+
+// Writes the size bytes at address of pid to a new file at path. patch may fix a chunk after it is read (the bytes
+// under breakpoints). False, with a message in error, if the file can't be written or a page can't be read.
+bool dumpMemory(pid_t pid, uint64_t address, uint64_t size, const std::string& path, TransferStatistics& statistics,
+                std::string& error, const TransferProgress& progress = {},
+                const std::function<void(uint64_t address, uint8_t* bytes, size_t size)>& patch = {});
+
+// Writes the file at path to address, a chunk at a time with write (it lifts the breakpoints in the way). False,
+// with a message in error, if the file can't be read or a chunk can't be written.
+bool restoreMemory(const std::string& path, uint64_t address, TransferStatistics& statistics, std::string& error,
+                   const std::function<bool(uint64_t address, const uint8_t* bytes, size_t size)>& write,
+                   const TransferProgress& progress = {});
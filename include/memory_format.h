@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Formatting memory for 'x' (gdb's x/<count><format><unit>)
+//  Dumping a buffer of a few MB is hundreds of thousands of units: a PTRACE_PEEKDATA per word, and an ostream
+//  insertion with std::endl per unit, take minutes.
+// Idea:
+//  1. The whole range is read with one process_vm_readv, before formatting.
+//  2. Units are formatted from the local copy with digit tables and std::to_chars, appended to one string: no
+//     stream, no locale, no allocation per unit.
+//  3. The string is written out by large chunks of whole lines, a flush per chunk instead of per unit.
+
+struct ExamineFormat {
+  char format = 'x';           // x d u o t c a f, s (strings) and i (instructions) are the caller's
+  unsigned unit = 4;           // bytes: 1, 2, 4 or 8 (b, h, w, g)
+  size_t count = 1;
+};
+
+// "/16xw", the part after 'x': the count is 1 if missing, the letters keep their last value. False if it isn't one.
+bool parseExamineFormat(const std::string& spec, ExamineFormat& format);
+
+// Units per line: 8 bytes or halves, 4 words, 2 giants
+size_t unitsPerLine(const ExamineFormat& format);
+
+// Appends the lines for the whole units of bytes, which were read at address. 'a' names addresses with symbolize.
+void formatUnits(std::string& out, uint64_t address, const uint8_t* bytes, size_t size, const ExamineFormat& format,
+                 const std::function<std::string(uint64_t)>& symbolize = {});
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// Searching the memory of the inferior ('find')
+//  A stray pointer or a magic value can be anywhere in a heap of gigabytes. Reading it a word at a time is a syscall
+//  per 8 bytes, and comparing the pattern at every offset is a loop per byte.
+// Idea:
+//  1. Only the readable mappings of /proc/pid/maps intersecting the range are read, each by chunks of megabytes
+//     with one process_vm_readv. The last pattern size - 1 bytes of a chunk are kept in front of the next one, so
+//     a match across the boundary is found, and found once.
+//  2. An exact pattern is searched with memmem, a masked one jumps from candidate to candidate with memchr on one of
+//     its exact bytes (not 0 or 0xff when possible: memory is full of them) and compares the rest under the mask.
+//     glibc's memchr and memmem are vectorized (SSE2/AVX2).
+
+struct SearchPattern {
+  std::vector<uint8_t> bytes;
+  std::vector<uint8_t> mask;   // per byte, the bits which must match. Empty: all of them.
+};
+
+// A pattern written as text:
+//  "GET /\r\n"               the characters of a C string literal, without the terminating NUL
+//  bytes 7f 45 ?? 46         bytes in hex, ?? for any byte
+//  0x1234 -1 [mask 0xff00]   integers of unit bytes (1, 2, 4 or 8), little-endian, the mask applying to each
+// False, with a message in error, if it isn't one.
+bool parsePattern(const std::string& text, unsigned unit, SearchPattern& pattern, std::string& error);
+
+struct MemoryRegion {
+  uint64_t low = 0;
+  uint64_t high = 0;
+  std::string name;            // the path of the mapping, [heap], [stack]... or ""
+};
+
+// The readable mappings of pid, cut to [low, high)
+std::vector<MemoryRegion> readableRegions(pid_t pid, uint64_t low, uint64_t high);
+
+struct SearchStatistics {
+  uint64_t bytes = 0;          // read and searched
+  uint64_t reads = 0;          // process_vm_readv calls
+  uint64_t matches = 0;
+  size_t regions = 0;
+};
+
+// Calls found for every match in the regions, in address order, until it returns false. patch may fix a chunk after
+// it is read (the bytes under breakpoints).
+SearchStatistics searchMemory(pid_t pid, const std::vector<MemoryRegion>& regions, const SearchPattern& pattern,
+                              const std::function<bool(uint64_t address, const MemoryRegion& region)>& found,
+                              const std::function<void(uint64_t address, uint8_t* bytes, size_t size)>& patch = {});
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "latency_histogram.h"
+
+// Sampling profiler
+//  Tracing sees every call but stops the program at each one. Sampling stops it a fixed number of times a second
+//  wherever it is: the functions it spends the most time in are the ones most often on the stack.
+// Idea:
+//  1. Let the program run and stop it hz times a second with PTRACE_INTERRUPT (it is seized, see main.cpp).
+//  2. Unwind its stack (unwinder.h: one read of the stack), keep the return addresses and continue it right away.
+//     Names are only looked up when the profile is printed, so a sample costs a couple of syscalls.
+//  3. Identical stacks are counted together. Written as "main;parse;memcpy 42" (folded stacks) they are the input
+//     of flamegraph.pl (https://github.com/brendangregg/FlameGraph).
+
+struct Profile {
+  std::map<std::vector<uint64_t>, uint64_t> stacks;   // pcs, outermost first -> samples
+  uint64_t samples = 0;
+  uint64_t missed = 0;          // periods which passed while a sample was being taken
+  LatencyHistogram pauses;      // how long (ns) the program was stopped for each sample
+  double seconds = 0;           // of running under the profiler
+};
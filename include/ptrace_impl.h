@@ -3,6 +3,9 @@
 #include <sys/ptrace.h>
 #include <sys/user.h>
 #include <csignal>
+#include <cstdint>
+#include <utility>
+#include <vector>
 
 #if __APPLE__
   #define PTRACE_PEEKDATA PT_READ_D
@@ -12,12 +15,39 @@
 
 namespace Ptrace {
   void traceMe();
+  // Attach without stopping it. The tracee stops after exec and is killed if the debugger exits, the threads it
+  // creates are traced from their start.
+  void seize(pid_t pid);
+  // Attach to a thread of a running process (-p) without stopping it, as seize does, but it isn't killed when the
+  // debugger exits: false if it can't be traced (gone, traced already, not permitted)
+  bool attach(pid_t tid);
+  // Let a stopped thread go on its own with signal (0: none), false if it is gone
+  bool detach(pid_t tid, int signal = 0);
+  // Stop a seized tracee (reported as PTRACE_EVENT_STOP), false if it is gone
+  bool interrupt(pid_t pid);
+  // The tid of the thread created at a PTRACE_EVENT_CLONE stop
+  pid_t getEventMessage(pid_t pid);
   void continueExec(pid_t m_pid);
   void singleStep(pid_t m_pid);
+  void singleBlock(pid_t m_pid);   // run to the next taken branch
   void writeMemory(uint64_t pid, uint64_t address, uint64_t data);
   uint64_t readMemory(uint64_t pid, uint64_t address);
+  // size bytes at once (process_vm_readv), false if any of them isn't mapped instead of exiting
+  bool readBytes(pid_t pid, uint64_t address, void* buffer, size_t size);
+  // count blocks of size bytes from addresses into buffer one after another, with one process_vm_readv per
+  // IOV_MAX blocks: the number read, it stops at the first which isn't mapped
+  size_t readBlocks(pid_t pid, const uint64_t* addresses, size_t count, size_t size, void* buffer);
+  // Up to size bytes at once: how many were read before the first page which isn't mapped
+  size_t readAvailable(pid_t pid, uint64_t address, void* buffer, size_t size);
+  // size bytes at once (process_vm_writev), through /proc/pid/mem for read-only mappings like the code: false if
+  // they couldn't all be written
+  bool writeBytes(pid_t pid, uint64_t address, const void* buffer, size_t size);
+
+  // blocks (address, bytes) through one open of /proc/pid/mem, which writes read-only code too: the number written
+  size_t writeBlocks(pid_t pid, const std::vector<std::pair<uint64_t, std::vector<uint8_t>>>& blocks);
 
   void getRegisters(uint64_t pid, user_regs_struct* user_regs);
+  void getFpRegisters(pid_t pid, user_fpregs_struct* fp_regs);
   void setRegisters(uint64_t pid, user_regs_struct* user_regs);
 
   void getSigInfo(uint64_t pid, siginfo_t* info);
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dwarf++.hh"
+#include "elf++.hh"
+#include "split_dwarf.h"
+
+// The variables and parameters visible at a pc
+//  A function's DIE is a tree: its parameters and variables, a DW_TAG_lexical_block for every { } declaring
+//  something, a DW_TAG_inlined_subroutine for every call inlined into it, holding the parameters, variables and
+//  blocks of the callee. What pc sees is the path of scopes covering it, and 'vars', 'print' and every hit of
+//  a conditional breakpoint would walk the tree again (and the compilation units before it) to find it.
+// Idea:
+//  1. Sort the functions of the program by address once: a pc is a binary search away from its function.
+//  2. Flatten the tree of a function once, when a pc first falls in it: its scopes in pre-order with their pc
+//     ranges and variables. Inlined code only has locations: names and types come from DW_AT_abstract_origin.
+//  3. The scopes covering pc are a path in that array, found without touching a DIE. Inner scopes come first and
+//     a name hides the same name of an outer scope, as in C.
+//  4. Optimized code has location lists (a variable moves between registers and the stack): the entry covering pc
+//     is looked up in .debug_loc.
+
+struct ScopeVariable {
+  std::string name;
+  dwarf::die die;              // the location: the concrete DIE of inlined code
+  dwarf::die declaration;      // the name and the type: DW_AT_abstract_origin of inlined code, die otherwise
+  bool parameter = false;
+};
+
+struct FunctionScopes {
+  struct Scope {
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;   // link-time [low, high), empty: all of the parent
+    std::string inlined;         // the callee of an inlined call, "" for the function and its blocks
+    uint32_t first = 0;          // its variables in FunctionScopes::variables
+    uint32_t count = 0;
+    uint32_t end = 0;            // the scopes inside are [index + 1, end)
+  };
+
+  dwarf::die function;
+  std::string name;
+  std::vector<Scope> scopes;             // pre-order, the function first
+  std::vector<ScopeVariable> variables;   // by scope
+  const uint8_t* frame_base = nullptr;   // DW_AT_frame_base, for DW_OP_fbreg
+  size_t frame_base_size = 0;
+};
+
+class ScopeIndex {
+public:
+  ScopeIndex(const dwarf::dwarf& dwarf, SplitDwarf& split_dwarf, const elf::elf& file) :
+    m_dwarf(dwarf),
+    m_split_dwarf(split_dwarf),
+    m_elf(file)
+  {}
+
+  // The function at a link-time pc, nullptr outside of the functions with debug information
+  const FunctionScopes* function(uint64_t pc);
+  // The variables visible at a link-time pc of function, innermost first. Inside an inlined call these are the
+  // callee's: the call is its own frame.
+  std::vector<const ScopeVariable*> visible(const FunctionScopes& function, uint64_t pc) const;
+  // The location description of a variable at a link-time pc: DW_AT_location itself, or the entry of its location
+  // list covering pc. False if there is none (the variable is optimized out there).
+  bool location(const dwarf::die& variable, uint64_t pc, const uint8_t*& expression, size_t& size);
+
+  size_t cachedFunctions() const { return m_flattened; }
+
+private:
+  struct Range {
+    uint64_t low;
+    uint64_t high;
+    size_t function;   // in m_scopes
+  };
+
+  void indexFunctions(const dwarf::die& parent);
+  void flatten(const dwarf::die& die, FunctionScopes& function);
+
+  const dwarf::dwarf& m_dwarf;
+  SplitDwarf& m_split_dwarf;
+  const elf::elf& m_elf;
+  std::vector<Range> m_ranges;   // sorted by low, a function may have several
+  bool m_indexed = false;
+  std::vector<std::unique_ptr<FunctionScopes>> m_scopes;   // every function, flattened on first use
+  size_t m_flattened = 0;
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dwarf++.hh"
+#include "elf++.hh"
+#include "event_loop.h"
+#include "target.h"
+
+// Shared libraries (the r_debug rendezvous)
+//  Only the program was indexed: a function or a source line of a library it loads (at start or with dlopen) couldn't
+//  be named, so no breakpoint could be set there, and a backtrace through one only had its ELF symbols.
+// Idea:
+//  1. The dynamic loader lists what it loaded for debuggers: struct r_debug (<link.h>), whose address it puts into
+//     the DT_DEBUG entry of the program's dynamic section. r_map is a list of link_map: l_addr (the bias: load address
+//     - link-time address), l_name, l_next. The first entry is the program.
+//  2. The loader calls r_brk (_dl_debug_state, an empty function) before and after it changes the list: r_state is
+//     RT_ADD or RT_DELETE before, RT_CONSISTENT after. An internal breakpoint there re-reads the list at RT_CONSISTENT:
+//     what appeared was loaded, what is gone was unloaded. At the exec stop the loader hasn't run yet (DT_DEBUG is 0),
+//     then r_brk and r_debug are ld.so's _dl_debug_state and _r_debug, ld.so being at AT_BASE of the auxiliary vector.
+//  3. A library's ELF and DWARF are opened and indexed (functions by name) on a thread of its own when it appears:
+//     the program goes on meanwhile, and a lookup in the library waits for its index. Only its program headers are
+//     read right away, for the addresses it spans. The thread posts to the event loop when it is done.
+//  4. The libraries are kept by start address in a std::map: the one holding a pc is an upper_bound away.
+
+// What a library's files tell, in its link-time addresses
+struct LibraryIndex {
+  elf::elf file;                 // not valid if the file can't be read
+  dwarf::dwarf debug;            // not valid without debug information
+  // First instruction after the prologue (from the line table) of the functions with DWARF, the address of the ELF
+  // symbol (.symtab, else .dynsym) for the others
+  std::unordered_map<std::string, uint64_t> functions;
+};
+
+struct SharedLibrary {
+  std::string path;
+  uint64_t bias = 0;             // l_addr
+  uint64_t low = 0;              // the load addresses of its PT_LOAD segments
+  uint64_t high = 0;
+  uint64_t link_map = 0;         // its entry in the list
+  double index_ms = -1;          // how long indexing took, -1 until the event loop hears it is done
+  std::shared_future<std::shared_ptr<const LibraryIndex>> index;
+};
+
+// A breakpoint on a function or a source line the program doesn't have: pending until a library which has it is loaded,
+// and again when that library is unloaded
+struct LibraryBreakpoint {
+  std::string function;          // or file and line
+  std::string file;
+  uint32_t line = 0;
+  std::string condition;
+};
+
+class SharedLibraries {
+public:
+  SharedLibraries(Target& target, EventLoop& events) : m_target(target), m_events(events) {}
+
+  // Finds r_debug for the program loaded at load_address: from its DT_DEBUG, or from ld.so's symbols when it isn't
+  // filled in yet (live processes only). Returns r_brk, 0 if the program is static or it can't be found.
+  uint64_t locate(const elf::elf& program, uint64_t load_address);
+  uint64_t breakAddress() const { return m_break; }
+
+  // Re-reads the list: the libraries which appeared since, and those which are gone (taken out). False if the list is
+  // being changed (r_state isn't RT_CONSISTENT) or can't be read.
+  bool update(std::vector<const SharedLibrary*>& loaded, std::vector<SharedLibrary>& unloaded);
+
+  // The library whose segments hold address, nullptr if none does
+  const SharedLibrary* find(uint64_t address) const;
+  const std::map<uint64_t, SharedLibrary>& libraries() const { return m_libraries; }
+
+  // The index of library, waiting for it to be built
+  const LibraryIndex& index(const SharedLibrary& library) const { return *library.index.get(); }
+  // The load address of a function of library, 0 if it has none of that name
+  uint64_t functionAddress(const SharedLibrary& library, const std::string& name) const;
+  // The load address of the first statement of line in a source file of library whose name ends with file_name, 0 if
+  // there is none
+  uint64_t lineAddress(const SharedLibrary& library, const std::string& file_name, uint32_t line) const;
+  // The source line of a load address of library, false without debug information for it
+  bool sourceLine(const SharedLibrary& library, uint64_t address, std::string& file, unsigned& line) const;
+
+private:
+  bool readString(uint64_t address, std::string& text);
+  // Posted by the thread which indexed the library
+  void indexed(uint64_t link_map, const std::string& path, double milliseconds);
+
+  Target& m_target;
+  EventLoop& m_events;
+  uint64_t m_dynamic = 0;        // the program's dynamic section, where DT_DEBUG is
+  uint64_t m_r_debug = 0;
+  uint64_t m_break = 0;
+  std::map<uint64_t, SharedLibrary> m_libraries;   // by low
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+#include "dwarf++.hh"
+#include "elf++.hh"
+
+// Split DWARF (-gsplit-dwarf)
+//  The executable only keeps skeleton compilation units: the line table, the address range, DW_AT_GNU_dwo_name
+//  and DW_AT_GNU_dwo_id. Functions, variables and types are moved out to:
+//    - a "<object>.dwo" file per compilation unit (found relative to DW_AT_comp_dir), or
+//    - a single "<exe>.dwp" package when the .dwo files were merged by dwp/llvm-dwp.
+//  See https://gcc.gnu.org/wiki/DebugFission
+//  Only this GNU extension of DWARF 4 (-gdwarf-4 -gsplit-dwarf, .debug_cu_index version 2) is read. DWARF 5's
+//  DW_UT_skeleton units with DW_AT_dwo_name and the addrx/strx forms are refused by libelfin with a format_error.
+// Idea:
+//  Resolve a skeleton to its split unit the first time somebody looks inside it. A .dwo is mapped only when
+//  one of its units is resolved, a .dwp is searched through its .debug_cu_index hash table.
+class SplitDwarf {
+  std::string m_prog_name;
+
+  dwarf::dwarf m_package;
+  bool m_package_checked;
+
+  std::unordered_map<std::string, dwarf::dwarf> m_dwo_files;
+  // skeleton unit offset in .debug_info -> split unit (or the skeleton itself if it can't be resolved)
+  std::unordered_map<dwarf::section_offset, dwarf::compilation_unit> m_units;
+
+  dwarf::dwarf openDwo(const std::string& path);
+
+public:
+  explicit SplitDwarf(std::string prog_name) :
+    m_prog_name(std::move(prog_name)),
+    m_package_checked(false)
+  {}
+
+  // Returns the unit holding the DIEs for cu: its split unit for a skeleton, cu itself otherwise.
+  const dwarf::compilation_unit& resolve(const dwarf::compilation_unit& cu);
+};
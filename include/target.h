@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/user.h>
+
+// What the debugger reads from: a live process or a core file
+//  backtrace, vars, print, x and symbol only read memory and registers, but they used to ask ptrace and /proc/pid
+//  for them: without a process there was nothing to look at.
+// Idea:
+//  1. Target holds the reads: memory (a range, what is there of a range, blocks), the registers of a thread, the
+//     mappings as /proc/pid/maps lists them and where the program is loaded.
+//  2. LiveTarget answers from the stopped process (process_vm_readv, PTRACE_GETREGS, /proc/pid), CoreTarget
+//     (core_file.h) from an ELF core. Running, stepping and writing stay with the process (Ptrace::).
+
+struct MemoryMapping {
+  uint64_t low = 0;
+  uint64_t high = 0;
+  uint64_t offset = 0;         // in the file
+  std::string permissions;     // "r-xp"
+  std::string path;            // "" for anonymous memory, [heap], [stack]...
+};
+
+class Target {
+public:
+  virtual ~Target() = default;
+
+  // A process which can run, false for a core
+  virtual bool live() const = 0;
+  virtual pid_t pid() const = 0;
+
+  // size bytes at once, false if any of them isn't there
+  virtual bool readBytes(uint64_t address, void* buffer, size_t size) = 0;
+  // Up to size bytes: how many were read before the first one which isn't there
+  virtual size_t readAvailable(uint64_t address, void* buffer, size_t size) = 0;
+  // count blocks of size bytes from addresses into buffer one after another: the number read, it stops at the
+  // first which isn't there
+  virtual size_t readBlocks(const uint64_t* addresses, size_t count, size_t size, void* buffer) = 0;
+
+  // The thread whose registers getRegisters reads, a tid of the process: false if there is no such thread
+  virtual bool selectThread(pid_t tid) = 0;
+  virtual void getRegisters(user_regs_struct& regs) = 0;
+  virtual std::vector<MemoryMapping> mappings() = 0;
+  // The path of the program's file, "" if it isn't known
+  virtual std::string executable() = 0;
+  // The lowest address the program is mapped at
+  virtual uint64_t loadAddress() = 0;
+};
+
+class LiveTarget : public Target {
+public:
+  explicit LiveTarget(pid_t pid) : m_pid(pid), m_thread(pid) {}
+
+  bool live() const override { return true; }
+  pid_t pid() const override { return m_pid; }
+  bool readBytes(uint64_t address, void* buffer, size_t size) override;
+  size_t readAvailable(uint64_t address, void* buffer, size_t size) override;
+  size_t readBlocks(const uint64_t* addresses, size_t count, size_t size, void* buffer) override;
+  bool selectThread(pid_t tid) override { m_thread = tid; return true; }
+  void getRegisters(user_regs_struct& regs) override;
+  std::vector<MemoryMapping> mappings() override;
+  std::string executable() override;
+  uint64_t loadAddress() override;
+
+private:
+  pid_t m_pid;
+  pid_t m_thread;      // stopped: it reads memory too, the leader may have exited
+};
+
+// /proc/pid/maps
+std::vector<MemoryMapping> readProcessMappings(pid_t pid);
+// /proc/pid/task: the threads of the process, the leader first
+std::vector<pid_t> readProcessThreads(pid_t pid);
+// SigPnd of /proc/tid/status: whether signal is queued for the thread itself
+bool isSignalPending(pid_t tid, int signal);
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <csignal>
+#include <cstdint>
+#include <deque>
+#include <sys/types.h>
+
+// Threads of the inferior (all-stop and non-stop)
+//  Only the first thread used to be traced and waited for: threads the program created ran untraced, and one of them
+//  running into a breakpoint took the int3 as a SIGTRAP of its own and killed the process.
+// Idea:
+//  1. PTRACE_O_TRACECLONE: every thread is traced from its first instruction. The creator reports
+//     PTRACE_EVENT_CLONE with the new tid, the new thread starts with a PTRACE_EVENT_STOP of its own (either may come
+//     first). Neither is shown to the user.
+//  2. All-stop: continue resumes every thread and waits for any of them (waitpid(-1, __WALL), once the event loop says
+//     one changed state, see event_loop.h). When one reports an event, the others are stopped with PTRACE_INTERRUPT
+//     and their stops collected before the prompt comes back.
+//  3. A thread which hit a breakpoint while being stopped is moved back onto the int3 and hits it again when it runs
+//     next: nothing to remember. A signal is kept and reported at the next continue, before anything runs.
+//  4. A breakpoint is stepped over by its thread alone, the others stay stopped: while the int3 is out (or the
+//     scratch page of displaced stepping holds the copy) no other thread can run through the site.
+//  5. Stepping, tracing and profiling run the current thread only.
+//  The registers stay with the kernel: every ptrace request names the tid of the thread it is about.
+//
+// Non-stop (set non-stop on)
+//  All-stop freezes every worker whenever one of them hits a breakpoint, which distorts the timing being looked at.
+// Idea:
+//  1. Only the thread with the event stops, the others go on running. continue resumes the current thread (-a:
+//     every stopped one) and comes back at the first stop, whose thread becomes current. next and finish wait for
+//     the current thread: the stops of others meanwhile are reported as they come.
+//  2. Events are collected without waiting (waitpid(-1, WNOHANG)) before every command, and queued on their thread
+//     until they are reported: a stop seen at the prompt doesn't change the current thread.
+//  3. The breakpoints stay inserted: a thread steps over one from a copy (displaced stepping, see displacedStep).
+//     An instruction which has to be stepped in place has the other threads stopped for that one step.
+//  4. interrupt stops a thread with PTRACE_INTERRUPT (the tracee is seized, see main.cpp), -a all of them.
+//  5. Registers can only be read from a stopped thread: commands which need them want the current one stopped.
+
+enum class Resume { cont, step, block };
+
+enum class StopReason { created, interrupted, breakpoint, step, signal };
+
+struct InferiorThread {
+  unsigned number = 0;                // as thread and info threads show it, in order of creation
+  pid_t tid = 0;
+  bool running = false;
+  Resume resumed = Resume::cont;      // how it was resumed last: again so after a clone event
+  StopReason reason = StopReason::created;
+  int signal = 0;                     // of StopReason::signal
+  bool pending = false;               // the signal wasn't reported yet
+  bool interrupting = false;          // non-stop: interrupt was asked for, its PTRACE_EVENT_STOP is to be reported
+  std::deque<int> events;             // non-stop: wait statuses of stops which weren't reported yet
+};
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include "elf++.hh"
+#include "target.h"
+
+// Stack unwinding with DWARF Call Frame Information (CFI)
+//  Walking the rbp chain only works if every function keeps a frame pointer, and -O2 code doesn't
+//  (-fomit-frame-pointer): rbp is just another register there. But the compiler describes every frame anyway,
+//  the C++ runtime needs it to unwind for exceptions.
+// Idea:
+//  1. CFI is a table giving, for every code address, how to compute the CFA (canonical frame address: rsp in the
+//     caller before the call) and where the caller's registers were saved relative to it.
+//     DWARF 4, 6.4 "Call Frame Information".
+//  2. The table is compressed: a CIE (common information) shared by many functions and an FDE per function,
+//     each holding a bytecode program which builds the rows of the table one code address at a time.
+//  3. .eh_frame (always there) has the same format with small changes (pointer encodings, relative CIE pointers),
+//     see https://refspecs.linuxfoundation.org/LSB_5.0.0/LSB-Core-generic/LSB-Core-generic/ehframechpt.html.
+//     .eh_frame_hdr holds a sorted (function start, FDE) table for binary search.
+//     .debug_frame comes with -g and is searched when .eh_frame doesn't cover pc.
+//  4. Running the FDE program again for every frame would be the slow part, so the rows of an FDE are decoded once
+//     and kept: a frame then costs a binary search and the memory reads for the saved registers.
+
+// DWARF register numbers of x86-64 (see registers.h): 0-15 general purpose, 16 the return address
+constexpr unsigned CFI_REGISTERS = 17;
+constexpr unsigned CFI_RBP = 6;
+constexpr unsigned CFI_RSP = 7;
+constexpr unsigned CFI_RA = 16;
+
+// How to find the caller's value of a register
+struct CfiRule {
+  enum class Kind : uint8_t {
+    same_value,      // not saved, the caller's value is ours (also the default)
+    undefined,       // lost (the return address of the outermost frame)
+    offset,          // saved at CFA + value
+    val_offset,      // is CFA + value
+    reg,             // in register value
+    expression,      // saved at the address computed by the expression
+    val_expression   // is the value computed by the expression
+  };
+  Kind kind = Kind::same_value;
+  int64_t value = 0;
+  const uint8_t* expression = nullptr;
+  size_t expression_size = 0;
+};
+
+// A row of the table: the rules for the code addresses [low, high)
+struct CfiRow {
+  uint64_t low = 0;
+  uint64_t high = 0;
+  uint32_t cfa_register = CFI_RSP;   // CFA = cfa_register + cfa_offset, unless cfa_expression is set
+  int64_t cfa_offset = 8;
+  const uint8_t* cfa_expression = nullptr;
+  size_t cfa_expression_size = 0;
+  std::array<CfiRule, CFI_REGISTERS> registers;
+};
+
+// The CFI of one ELF file, in its link-time addresses
+class CallFrameInfo {
+public:
+  explicit CallFrameInfo(const elf::elf& file);
+
+  // The row for pc, nullptr if no FDE covers it. signal_frame tells whether it is a signal trampoline (CIE 'S').
+  const CfiRow* find(uint64_t pc, bool& signal_frame);
+
+  size_t cachedFdes() const { return m_rows.size(); }
+  void clearCache() { m_rows.clear(); }
+
+private:
+  struct Section {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    uint64_t address = 0;
+  };
+  struct IndexEntry {
+    uint64_t low;
+    uint64_t high;
+    size_t offset;
+    bool debug_frame;
+  };
+  struct DecodedFde {
+    std::vector<CfiRow> rows;
+    bool signal_frame = false;
+  };
+
+  const IndexEntry* findFde(uint64_t pc);
+  const IndexEntry* searchHeader(uint64_t pc);
+  void buildIndex(const Section& section, bool debug_frame, std::vector<IndexEntry>& index);
+  DecodedFde decode(const IndexEntry& fde);
+
+  elf::elf m_file;   // keeps the sections mapped
+  Section m_eh_frame;
+  Section m_eh_frame_hdr;
+  Section m_debug_frame;
+  const uint8_t* m_header_table = nullptr;   // .eh_frame_hdr (initial location, FDE) pairs, 0 if unusable
+  uint64_t m_header_entries = 0;
+
+  // When .eh_frame_hdr has no usable table, and for .debug_frame: FDEs sorted by address, built on first use
+  std::vector<IndexEntry> m_eh_index;
+  std::vector<IndexEntry> m_debug_index;
+  bool m_eh_indexed = false;
+  bool m_debug_indexed = false;
+  IndexEntry m_found {};
+
+  std::unordered_map<size_t, DecodedFde> m_rows;   // by FDE offset (| 1 for .debug_frame)
+};
+
+// A frame of the inferior: the registers as they are in that frame
+struct UnwindFrame {
+  uint64_t pc = 0;
+  uint64_t cfa = 0;
+  std::array<uint64_t, CFI_REGISTERS> registers {};
+  uint32_t valid = 0;            // bit per register
+  bool signal_frame = false;
+  bool from_cfi = true;          // false: guessed from the rbp chain
+
+  bool has(unsigned reg) const { return valid & (1u << reg); }
+  void set(unsigned reg, uint64_t value) { registers[reg] = value; valid |= 1u << reg; }
+};
+
+// Where a DWARF location description (DW_AT_location) puts a variable
+struct VariableLocation {
+  enum class Kind : uint8_t { memory, reg, value };
+  Kind kind = Kind::memory;
+  uint64_t value = 0;            // the address, the DWARF register number or the value itself (DW_OP_stack_value)
+};
+
+// Reads size bytes of the inferior, false if they aren't all mapped
+using MemoryReader = std::function<bool(uint64_t address, void* buffer, size_t size)>;
+
+// A copy of the stack of the stopped inferior
+//  Unwinding chases the saved registers and return addresses through the stack, 8 bytes at a time: two reads per
+//  frame with the rbp chain, one per saved register with CFI. Each is a syscall (PTRACE_PEEKDATA or
+//  process_vm_readv), so a deep recursion costs thousands of them.
+// Idea:
+//  1. Everything the unwinder reads lives between rsp and the top of the stack (the end of the mapping holding rsp
+//     in /proc/pid/maps), so read that range once, up to a limit.
+//  2. Then unwind from the local copy, reading the inferior only for what lies outside (an expression pointing
+//     elsewhere, a signal frame on an alternate stack, a stack deeper than the limit).
+struct StackSnapshot {
+  uint64_t low = 0;                // rsp
+  std::vector<uint8_t> bytes;
+
+  bool contains(uint64_t address, size_t size) const {
+    return address >= low && address - low <= bytes.size() && bytes.size() - (address - low) >= size;
+  }
+  uint64_t word(uint64_t address) const {
+    uint64_t value;
+    std::memcpy(&value, bytes.data() + (address - low), sizeof(value));
+    return value;
+  }
+};
+
+// Unwinds the stack of the inferior through every ELF file mapped into it (the mappings of the target)
+class Unwinder {
+public:
+  struct Module {
+    std::string path;
+    uint64_t low = 0;                // executable mapping
+    uint64_t high = 0;
+    uint64_t bias = 0;               // load address - link-time address
+    bool main_program = false;
+    elf::elf file;
+    std::shared_ptr<CallFrameInfo> cfi;
+    struct Symbol {
+      uint64_t address;   // link-time
+      uint64_t size;
+      std::string name;
+    };
+    std::vector<Symbol> symbols;     // functions sorted by address, built on first use
+    bool symbols_read = false;
+  };
+
+  explicit Unwinder(Target& target) : m_target(target) {}
+
+  // Frames from the registers of the stopped inferior, innermost first, unwound from a snapshot of its stack
+  std::vector<UnwindFrame> backtrace(const user_regs_struct& regs, size_t max_frames = SIZE_MAX);
+
+  // At most this many bytes of the stack are copied per backtrace, 0 reads every word from the inferior instead
+  void setStackLimit(uint64_t bytes) { m_stack_limit = bytes; }
+  uint64_t stackLimit() const { return m_stack_limit; }
+  // Reads of the inferior since the start (a snapshot is one)
+  uint64_t reads() const { return m_reads; }
+
+  // The caller of frame (whose cfa is filled in), false at the end of the stack
+  bool step(UnwindFrame& frame, UnwindFrame& caller, bool innermost);
+  // A location description evaluated in frame, DW_OP_fbreg relative to frame_base, the DW_OP_addr of the file
+  // loaded bias away from its link-time addresses. False if it needs what frame doesn't have or isn't supported
+  // (pieces, DW_OP_entry_value...).
+  bool locate(const uint8_t* expression, size_t size, const UnwindFrame& frame, const uint64_t* frame_base,
+              uint64_t bias, VariableLocation& location);
+
+  const Module* findModule(uint64_t pc);
+  // "memcpy+16 in libc.so.6", from the ELF symbol tables
+  std::string symbolize(uint64_t pc);
+  // Just the name of the function ("memcpy"), "[libc.so.6]" without a symbol, "" outside of any file
+  std::string functionName(uint64_t pc);
+
+  // Forget the mappings and the decoded rows (they are also re-read when pc is in none of the known mappings)
+  void reset();
+  size_t cachedFdes() const;
+
+private:
+  Module* moduleAt(uint64_t pc);
+  const Module::Symbol* symbolAt(Module& module, uint64_t address);
+  void readMappings();
+  void takeSnapshot(uint64_t stack_pointer);
+  bool read(uint64_t address, uint64_t& value);
+  bool evaluate(const uint8_t* expression, size_t size, const UnwindFrame& frame, const uint64_t* initial,
+                uint64_t& result, bool* stack_value = nullptr, uint64_t bias = 0);
+  bool stepWithFramePointer(UnwindFrame& frame, UnwindFrame& caller);
+
+  Target& m_target;
+  std::vector<Module> m_modules;   // sorted by address
+  std::unordered_map<std::string, std::pair<elf::elf, std::shared_ptr<CallFrameInfo>>> m_files;
+  bool m_mappings_fresh = false;   // read since the last miss
+
+  uint64_t m_stack_limit = 8 << 20;   // the default ulimit -s
+  std::pair<uint64_t, uint64_t> m_stack_mapping {};   // the last mapping a snapshot was taken in
+  StackSnapshot m_snapshot;
+  uint64_t m_reads = 0;
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dwarf++.hh"
+
+// Printing values by their DWARF type
+//  A variable's DW_AT_type points at a chain of type DIEs: typedefs and cv-qualifiers lead to a base type, a pointer,
+//  a struct with its members at byte offsets, an array of elements... Walking that chain for every value read would
+//  mean decoding the same DIEs again and again.
+// Idea:
+//  1. Flatten a type once into a TypeLayout (kind, size, members/elements/enumerators) and keep it by DIE.
+//     Types referring to themselves (struct node { node* next; }) are cut at pointers: pointees are laid out lazily.
+//  2. Read the whole object from the inferior in one transfer, then format it from the local copy: a struct of
+//     a hundred members is one process_vm_readv instead of a PTRACE_PEEKDATA per 8 bytes.
+//  3. Nested aggregates and long arrays are cut at a depth and an element limit.
+//
+// libstdc++ containers
+//  A std::vector is three pointers and a std::map a tree header: printed as structures they tell nothing, and
+//  following their pointers a word at a time takes a syscall per 8 bytes of every element and node.
+// Idea:
+//  1. Recognize vector, basic_string, (multi)map/set and unordered_(multi)map/set by the name of their DIE when the
+//     type is laid out, and find their fields by member name (_M_start, _M_node_count...) in the layout.
+//     The element types are the template parameters.
+//  2. A vector or a string is one read of the elements shown.
+//  3. Tree and hash nodes are read by whole pages, so nodes allocated one after another cost one read, and a read
+//     brings the pages of the nodes known to come next too (the children and parents seen so far), all in one
+//     process_vm_readv with an iovec per page.
+
+struct TypeLayout {
+  enum class Kind : uint8_t { base, pointer, reference, structure, array, enumeration, function, void_, unknown };
+  struct Member {
+    std::string name;
+    uint64_t offset = 0;
+    const TypeLayout* type = nullptr;
+    uint8_t bit_size = 0;      // bit-fields: bits from bit_offset (from the lowest bit of the storage unit at offset)
+    uint8_t bit_offset = 0;
+  };
+
+  Kind kind = Kind::unknown;
+  std::string name;                  // "int", "test", "char *", "int [42]"
+  uint64_t size = 0;
+  dwarf::DW_ATE encoding = dwarf::DW_ATE::signed_;   // base types and enumerations
+  std::vector<Member> members;                        // structures, classes and unions
+  const TypeLayout* element = nullptr;                // arrays: the element type (the next dimension)
+  uint64_t count = 0;                                 // arrays: elements
+  std::vector<std::pair<int64_t, std::string>> enumerators;
+  dwarf::die pointee;                                 // pointers and references, invalid for void*
+  const TypeLayout* target = nullptr;                 // pointers made up by the debugger (&x, casts): the pointee
+
+  // libstdc++ containers: where their fields are and what they hold
+  struct Container {
+    enum class Kind : uint8_t { none, vector, string, tree, hashtable };
+    Kind kind = Kind::none;
+    std::string name;            // "std::map"
+    uint64_t first = 0;          // vector: _M_start, string: _M_p, tree: _M_header, hashtable: _M_before_begin
+    uint64_t second = 0;         // vector: _M_finish, string: _M_string_length, tree and hashtable: the count
+    uint64_t third = 0;          // vector: _M_end_of_storage
+    uint64_t links[3] {};        // tree nodes: parent, left and right
+    dwarf::die key;              // the element of vectors and sets, the key of maps
+    dwarf::die mapped;           // maps: the value, invalid for the others
+  } container;
+};
+
+// Reads size bytes of the inferior, false if they aren't all mapped
+using ValueReader = std::function<bool(uint64_t address, void* buffer, size_t size)>;
+// Reads count blocks of size bytes into buffer one after another, returns how many were read (it stops at the first
+// which isn't mapped)
+using BlockReader = std::function<size_t(const uint64_t* addresses, size_t count, size_t size, void* buffer)>;
+
+// c as it is written in a C string literal: a, \n, \033
+void appendEscaped(std::string& out, char c);
+
+class ValuePrinter {
+public:
+  explicit ValuePrinter(ValueReader reader, BlockReader blocks = {}) :
+    m_read(std::move(reader)),
+    m_read_blocks(std::move(blocks))
+  {
+    m_void.kind = TypeLayout::Kind::void_;
+    m_void.name = "void";
+  }
+
+  // The layout of a type DIE, or of the type of a variable, parameter or member DIE
+  const TypeLayout& layout(const dwarf::die& type);
+  const TypeLayout& pointee(const TypeLayout& pointer);
+  // Types no DIE stands for: a C base type by name ("unsigned long", nullptr if it isn't one) and T* for any T
+  const TypeLayout* builtin(const std::string& name);
+  const TypeLayout& pointerTo(const TypeLayout& type);
+  // A member by name, also in base classes and anonymous unions: offset is advanced to it
+  static const TypeLayout::Member* findMember(const TypeLayout& type, const std::string& name, uint64_t& offset);
+
+  // The object of the given type at address in the inferior, read with one transfer
+  std::string print(const TypeLayout& type, uint64_t address);
+  // A value which isn't in memory (a register): bytes holds it
+  std::string format(const TypeLayout& type, const uint8_t* bytes, size_t size);
+
+  unsigned max_depth = 3;
+  unsigned max_elements = 16;       // of arrays and containers
+  unsigned max_characters = 256;    // of strings
+  uint64_t max_read = 1 << 20;   // bytes of one object read at most
+  size_t cachedLayouts() const { return m_layouts.size(); }
+  uint64_t reads() const { return m_reads; }
+
+private:
+  struct Key {
+    const void* section;   // .debug_info of the main file or of a .dwo
+    dwarf::section_offset offset;
+    bool operator==(const Key& o) const { return section == o.section && offset == o.offset; }
+  };
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      return std::hash<const void*>()(key.section) ^ (std::hash<uint64_t>()(key.offset) << 1);
+    }
+  };
+
+  TypeLayout* build(const dwarf::die& type);
+  void formatValue(std::string& out, const TypeLayout& type, const uint8_t* bytes, size_t size, unsigned depth);
+  std::string readString(uint64_t address, size_t limit);
+  void detectContainer(const dwarf::die& die, TypeLayout& layout);
+  bool formatContainer(std::string& out, const TypeLayout& type, const uint8_t* bytes, size_t size, unsigned depth);
+  void formatTree(std::string& out, const TypeLayout& type, const uint8_t* bytes, unsigned depth);
+  void formatHashtable(std::string& out, const TypeLayout& type, const uint8_t* bytes, unsigned depth);
+  void formatElement(std::string& out, const TypeLayout& type, const TypeLayout* mapped, const uint8_t* node,
+                     uint64_t offset, unsigned depth);
+  // From the pages read for the nodes when they hold it all (a short string inside a node), else from the inferior
+  bool readCached(uint64_t address, void* buffer, size_t size);
+  // size bytes of a node through the page cache, reading the pages of the next nodes along: false if unmapped
+  bool readNode(uint64_t address, void* buffer, size_t size, std::vector<uint64_t>& next);
+
+  ValueReader m_read;
+  BlockReader m_read_blocks;
+  // Pages read while printing one value, by address (nullptr: unmapped)
+  std::unordered_map<uint64_t, std::unique_ptr<uint8_t[]>> m_pages;
+  unsigned m_printing = 0;   // nested print()/format() calls, the pages are dropped when the outermost starts
+  std::unordered_map<Key, std::unique_ptr<TypeLayout>, KeyHash> m_layouts;
+  std::vector<std::unique_ptr<TypeLayout>> m_dimensions;   // inner dimensions of multi-dimensional arrays
+  std::unordered_map<std::string, std::unique_ptr<TypeLayout>> m_builtins;
+  std::unordered_map<const TypeLayout*, std::unique_ptr<TypeLayout>> m_pointers;
+  TypeLayout m_void;
+  uint64_t m_reads = 0;
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// x86-64 instruction decoder
+//  An instruction is:  [prefixes] [REX | VEX | EVEX] opcode [ModRM [SIB] [displacement]] [immediate]
+//  Intel SDM Vol. 2, Chapter 2 "Instruction Format" and Appendix A "Opcode Map".
+// Idea:
+//  Opcode maps are tables telling, for every opcode, whether a ModRM byte follows and how big the immediate is.
+//  That is all we need to find the length of an instruction and where its operands are,
+//  which in turn is enough to find out where control goes next.
+//  A second set of tables gives the mnemonic and the operand templates (SDM notation: Ev, Gv, Ib, Jz, ...),
+//  which are filled in from the ModRM/SIB/displacement/immediate bytes found by the first pass.
+
+// How an instruction transfers control
+enum class FlowType : uint8_t {
+  sequential,        // falls through to the next instruction
+  jump,              // jmp rel
+  conditional_jump,  // jcc rel, loop, jrcxz
+  call,              // call rel
+  ret,               // ret, retf, iret
+  indirect_jump,     // jmp r/m
+  indirect_call,     // call r/m
+  syscall,           // syscall, sysenter, int n: the kernel returns to the next instruction
+  trap               // int3, ud2, hlt: doesn't return to the next instruction on its own
+};
+
+enum class OperandType : uint8_t {
+  none,
+  reg,
+  mem,
+  imm,
+  rel                // branch target, already resolved to an absolute address
+};
+
+enum class RegClass : uint8_t {
+  gpr,               // rax..r15 of the operand's size
+  gpr8_legacy,       // ah, ch, dh, bh (byte registers 4-7 without REX)
+  seg,
+  xmm, ymm, zmm,
+  mmx,
+  cr, dr,
+  x87               // st(i)
+};
+
+struct Operand {
+  static constexpr int8_t NO_REGISTER = -1;
+  static constexpr int8_t RIP_REGISTER = 16;
+
+  OperandType type = OperandType::none;
+  uint8_t size = 0;            // in bytes, 0 if it has no size of its own (lea, prefetch)
+
+  // reg
+  RegClass reg_class = RegClass::gpr;
+  uint8_t reg = 0;
+
+  // mem: segment:[base + index * scale + disp]
+  int8_t base = NO_REGISTER;   // RIP_REGISTER for rip-relative
+  int8_t index = NO_REGISTER;
+  uint8_t scale = 1;
+  uint8_t segment = 0;         // 0 or the override prefix (0x64 fs, 0x65 gs)
+  uint8_t address_size = 8;    // 4 with a 67 prefix
+  int64_t disp = 0;
+
+  // imm / rel
+  int64_t imm = 0;
+};
+
+struct Instruction {
+  uint64_t address = 0;
+  uint8_t length = 0;
+  FlowType flow = FlowType::sequential;
+  uint64_t target = 0;      // destination of direct jumps and calls
+
+  // Layout of the encoding, as offsets from the first byte (0 if absent)
+  uint8_t opcode_offset = 0;
+  uint8_t modrm_offset = 0;
+  uint8_t disp_offset = 0;
+  uint8_t disp_size = 0;
+  uint8_t imm_offset = 0;
+  uint8_t imm_size = 0;
+  bool has_modrm = false;
+  bool rip_relative = false; // ModRM addresses memory relative to the next instruction
+
+  // Operands, in Intel order (destination first)
+  std::string_view prefix;     // lock, rep, repe, repne
+  std::string_view mnemonic;
+  Operand operands[4];
+  uint8_t operand_count = 0;
+
+  // Does execution continue at address + length (possibly after a branch is not taken)?
+  bool fallsThrough() const {
+    return flow == FlowType::sequential || flow == FlowType::conditional_jump ||
+           flow == FlowType::syscall || flow == FlowType::call || flow == FlowType::indirect_call;
+  }
+  uint64_t next() const { return address + length; }
+};
+
+// Decode one instruction at code[0..size) which lives at address in the inferior.
+// Returns false if the bytes are not a valid instruction or it doesn't fit in size bytes.
+bool decodeInstruction(const uint8_t* code, size_t size, uint64_t address, Instruction& out);
+
+// Names an address ("main+16"), or returns an empty string if it can't
+using Symbolizer = std::function<std::string(uint64_t)>;
+
+// Intel syntax, e.g. "mov qword ptr [rbp-0x8], rax".
+// Branch targets and rip-relative addresses are resolved and passed to symbolize if given.
+std::string toString(const Instruction& instruction, const Symbolizer& symbolize = {});
+
+// Decoded instructions by address.
+// The debugger decodes the original code (with its own int3 patched out), so entries only go stale when the
+// inferior's code is written to, which the debugger does through the memory command.
+class InstructionCache {
+  std::unordered_map<uint64_t, Instruction> m_instructions;
+
+public:
+  const Instruction* find(uint64_t address) const {
+    auto it = m_instructions.find(address);
+    return it == m_instructions.end() ? nullptr : &it->second;
+  }
+
+  const Instruction& insert(const Instruction& instruction) {
+    return m_instructions[instruction.address] = instruction;
+  }
+
+  // Forget every instruction overlapping [address, address + size)
+  void invalidate(uint64_t address, size_t size);
+
+  void clear() { m_instructions.clear(); }
+  size_t size() const { return m_instructions.size(); }
+};
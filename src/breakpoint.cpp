@@ -1,22 +1,41 @@
+#include <cerrno>
+
 #include "breakpoint.h"
 #include "ptrace_impl.h"
 
-void BreakPoint::enable() {
-  uint64_t data = Ptrace::readMemory(m_pid, m_addr);
-  if (data) {
-    m_saved_data = static_cast<uint8_t>(data & 0xff); // save the first byte
-    uint64_t int3 = 0xcc;
-    uint64_t data_with_int3 = ((data & ~0xff) | int3); // zeros the first byte and set it to 0xcc
-    Ptrace::writeMemory(m_pid, m_addr, data_with_int3);
+namespace {
 
-    m_enabled = true;
+// Puts byte at address, the byte which was there in saved. PTRACE_PEEKDATA/POKEDATA need the thread stopped: in
+// non-stop mode it may be running, then /proc/pid/mem (Ptrace::writeBytes) writes the byte, at once.
+bool patchByte(pid_t pid, uint64_t address, uint8_t byte, uint8_t* saved) {
+  errno = 0;
+  const long data = ptrace(PTRACE_PEEKDATA, pid, address, nullptr);
+  if (errno == 0) {
+    if (saved) {
+      *saved = static_cast<uint8_t>(data & 0xff);
+    }
+    Ptrace::writeMemory(pid, address, (data & ~0xffUL) | byte);
+    return true;
+  }
+  uint8_t old;
+  if (!Ptrace::readBytes(pid, address, &old, 1) || !Ptrace::writeBytes(pid, address, &byte, 1)) {
+    return false;
   }
+  if (saved) {
+    *saved = old;
+  }
+  return true;
 }
 
-void BreakPoint::disable() {
-  uint64_t data = Ptrace::readMemory(m_pid, m_addr);
-  uint64_t restored_data = ((data & ~0xff) | m_saved_data); // zeros the first byte and restore it to the initial value
-  Ptrace::writeMemory(m_pid, m_addr, restored_data);
+} // namespace
 
+void BreakPoint::enable() {
+  // save the first byte and set it to 0xcc (int3)
+  m_enabled = patchByte(m_pid, m_addr, 0xcc, &m_saved_data);
+}
+
+void BreakPoint::disable() {
+  // restore the first byte to the initial value
+  patchByte(m_pid, m_addr, m_saved_data, nullptr);
   m_enabled = false;
-}
\ No newline at end of file
+}
@@ -0,0 +1,268 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/procfs.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "core_dump.h"
+#include "ptrace_impl.h"
+#include "target.h"
+
+namespace {
+
+constexpr uint64_t PAGE = 4096;
+constexpr size_t CHUNK = 8 << 20;
+
+// The bytes of a mapping the core holds
+uint64_t contentSize(const MemoryMapping& mapping, const CoreOptions& options) {
+  // process_vm_readv can't read them: the vDSO's data is the kernel's, vsyscall is emulated
+  if (mapping.permissions[0] != 'r' || mapping.path == "[vvar]" || mapping.path == "[vvar_vclock]" ||
+      mapping.path == "[vsyscall]") {
+    return 0;
+  }
+  if (options.skip_file_read_only && mapping.permissions[1] != 'w' && !mapping.path.empty() &&
+      mapping.path[0] == '/') {
+    return mapping.offset == 0 ? std::min(PAGE, mapping.high - mapping.low) : 0;
+  }
+  return mapping.high - mapping.low;
+}
+
+std::string readFile(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void addNote(std::string& notes, uint32_t type, const void* description, size_t size) {
+  constexpr char NAME[] = "CORE";
+  Elf64_Nhdr header {};
+  header.n_namesz = sizeof(NAME);
+  header.n_descsz = size;
+  header.n_type = type;
+  notes.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  notes.append(NAME, sizeof(NAME));
+  notes.resize((notes.size() + 3) / 4 * 4, '\0');
+  notes.append(static_cast<const char*>(description), size);
+  notes.resize((notes.size() + 3) / 4 * 4, '\0');
+}
+
+struct ProcessIds {
+  pid_t ppid = 0;
+  pid_t pgrp = 0;
+  pid_t sid = 0;
+  char state = 'R';
+  std::string name;
+};
+
+// /proc/pid/stat: pid (name) state ppid pgrp session... The name may hold spaces and parentheses.
+ProcessIds readIds(pid_t pid) {
+  ProcessIds ids;
+  const std::string stat = readFile("/proc/" + std::to_string(pid) + "/stat");
+  const size_t open = stat.find('(');
+  const size_t close = stat.rfind(')');
+  if (open == std::string::npos || close == std::string::npos || close < open) {
+    return ids;
+  }
+  ids.name = stat.substr(open + 1, close - open - 1);
+  std::istringstream in(stat.substr(close + 1));
+  in >> ids.state >> ids.ppid >> ids.pgrp >> ids.sid;
+  return ids;
+}
+
+void addThreadNotes(std::string& notes, const CoreThread& thread, const ProcessIds& ids) {
+  elf_prstatus status {};
+  status.pr_info.si_signo = thread.signal;
+  status.pr_cursig = thread.signal;
+  status.pr_pid = thread.tid;
+  status.pr_ppid = ids.ppid;
+  status.pr_pgrp = ids.pgrp;
+  status.pr_sid = ids.sid;
+  static_assert(sizeof(status.pr_reg) == sizeof(thread.regs), "elf_gregset_t is user_regs_struct");
+  std::memcpy(&status.pr_reg, &thread.regs, sizeof(thread.regs));
+  status.pr_fpvalid = 1;
+  addNote(notes, NT_PRSTATUS, &status, sizeof(status));
+}
+
+std::string buildNotes(pid_t pid, const std::vector<CoreThread>& threads, const std::vector<MemoryMapping>& mappings) {
+  const ProcessIds ids = readIds(pid);
+  std::string notes;
+  // The current thread first, with the notes of the process after its NT_PRSTATUS: the order of the kernel's cores
+  addThreadNotes(notes, threads.front(), ids);
+
+  elf_prpsinfo process {};
+  process.pr_state = ids.state;
+  process.pr_sname = ids.state;
+  process.pr_pid = pid;
+  process.pr_ppid = ids.ppid;
+  process.pr_pgrp = ids.pgrp;
+  process.pr_sid = ids.sid;
+  struct stat proc_status;
+  if (stat(("/proc/" + std::to_string(pid)).c_str(), &proc_status) == 0) {
+    process.pr_uid = proc_status.st_uid;
+    process.pr_gid = proc_status.st_gid;
+  }
+  std::strncpy(process.pr_fname, ids.name.c_str(), sizeof(process.pr_fname) - 1);
+  std::string arguments = readFile("/proc/" + std::to_string(pid) + "/cmdline");
+  std::replace(arguments.begin(), arguments.end(), '\0', ' ');
+  while (!arguments.empty() && arguments.back() == ' ') {
+    arguments.pop_back();
+  }
+  std::strncpy(process.pr_psargs, arguments.c_str(), sizeof(process.pr_psargs) - 1);
+  addNote(notes, NT_PRPSINFO, &process, sizeof(process));
+
+  const std::string auxv = readFile("/proc/" + std::to_string(pid) + "/auxv");
+  addNote(notes, NT_AUXV, auxv.data(), auxv.size());
+
+  // NT_FILE: count, page size, (start, end, offset in pages) per file mapping, then their names
+  std::vector<uint64_t> table = { 0, PAGE };
+  std::string names;
+  for (const MemoryMapping& mapping : mappings) {
+    if (!mapping.path.empty() && mapping.path[0] == '/') {
+      table.insert(table.end(), { mapping.low, mapping.high, mapping.offset / PAGE });
+      names.append(mapping.path.c_str(), mapping.path.size() + 1);
+      ++table[0];
+    }
+  }
+  std::string files(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(uint64_t));
+  files += names;
+  addNote(notes, NT_FILE, files.data(), files.size());
+
+  addNote(notes, NT_FPREGSET, &threads.front().fp_regs, sizeof(threads.front().fp_regs));
+  for (size_t i = 1; i < threads.size(); ++i) {
+    addThreadNotes(notes, threads[i], ids);
+    addNote(notes, NT_FPREGSET, &threads[i].fp_regs, sizeof(threads[i].fp_regs));
+  }
+  return notes;
+}
+
+bool writeAll(int file, const void* data, size_t size, uint64_t offset) {
+  for (size_t done = 0; done < size;) {
+    const ssize_t written = pwrite(file, static_cast<const uint8_t*>(data) + done, size - done, offset + done);
+    if (written <= 0) {
+      return false;
+    }
+    done += static_cast<size_t>(written);
+  }
+  return true;
+}
+
+} // namespace
+
+bool writeCore(pid_t pid, const std::vector<CoreThread>& threads, const std::string& path, const CoreOptions& options,
+               CoreStatistics& statistics, std::string& error,
+               const std::function<void(uint64_t address, uint8_t* bytes, size_t size)>& patch) {
+  statistics = CoreStatistics();
+  if (threads.empty()) {
+    error = "No thread";
+    return false;
+  }
+  const std::vector<MemoryMapping> mappings = readProcessMappings(pid);
+  const std::string notes = buildNotes(pid, threads, mappings);
+
+  Elf64_Ehdr header {};
+  std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+  header.e_ident[EI_CLASS] = ELFCLASS64;
+  header.e_ident[EI_DATA] = ELFDATA2LSB;
+  header.e_ident[EI_VERSION] = EV_CURRENT;
+  header.e_ident[EI_OSABI] = ELFOSABI_NONE;
+  header.e_type = ET_CORE;
+  header.e_machine = EM_X86_64;
+  header.e_version = EV_CURRENT;
+  header.e_phoff = sizeof(header);
+  header.e_ehsize = sizeof(header);
+  header.e_phentsize = sizeof(Elf64_Phdr);
+  header.e_phnum = mappings.size() + 1;
+
+  std::vector<Elf64_Phdr> segments(mappings.size() + 1);
+  segments[0].p_type = PT_NOTE;
+  segments[0].p_offset = sizeof(header) + segments.size() * sizeof(Elf64_Phdr);
+  segments[0].p_filesz = notes.size();
+  segments[0].p_align = 4;
+  uint64_t offset = (segments[0].p_offset + notes.size() + PAGE - 1) / PAGE * PAGE;
+  for (size_t i = 0; i < mappings.size(); ++i) {
+    const MemoryMapping& mapping = mappings[i];
+    Elf64_Phdr& segment = segments[i + 1];
+    segment.p_type = PT_LOAD;
+    segment.p_flags = (mapping.permissions[0] == 'r' ? PF_R : 0) | (mapping.permissions[1] == 'w' ? PF_W : 0) |
+                      (mapping.permissions[2] == 'x' ? PF_X : 0);
+    segment.p_vaddr = mapping.low;
+    segment.p_memsz = mapping.high - mapping.low;
+    segment.p_filesz = contentSize(mapping, options);
+    segment.p_offset = offset;
+    segment.p_align = PAGE;
+    offset += segment.p_filesz;
+  }
+  statistics.segments = mappings.size();
+  statistics.file_size = offset;
+
+  const int file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (file < 0) {
+    error = "Cannot create " + path + ": " + std::strerror(errno);
+    return false;
+  }
+  auto fail = [&](const char* what) {
+    error = std::string(what) + " " + path + ": " + std::strerror(errno);
+    close(file);
+    return false;
+  };
+  if (!writeAll(file, &header, sizeof(header), 0) ||
+      !writeAll(file, segments.data(), segments.size() * sizeof(Elf64_Phdr), header.e_phoff) ||
+      !writeAll(file, notes.data(), notes.size(), segments[0].p_offset)) {
+    return fail("Cannot write");
+  }
+
+  static const uint8_t ZEROS[PAGE] = {};
+  std::unique_ptr<uint8_t, decltype(&std::free)> buffer(static_cast<uint8_t*>(std::aligned_alloc(PAGE, CHUNK)),
+                                                        &std::free);
+  for (size_t i = 1; i < segments.size(); ++i) {
+    const Elf64_Phdr& segment = segments[i];
+    statistics.memory += segment.p_filesz;
+    for (uint64_t done = 0; done < segment.p_filesz;) {
+      const size_t wanted = std::min<uint64_t>(CHUNK, segment.p_filesz - done);
+      const uint64_t address = segment.p_vaddr + done;
+      size_t read = Ptrace::readAvailable(pid, address, buffer.get(), wanted);
+      ++statistics.reads;
+      if (read && patch) {
+        patch(address, buffer.get(), read);
+      }
+      // An unreadable page (past the end of a mapped file) stays a hole: zeros
+      if (read < wanted) {
+        std::memset(buffer.get() + read, 0, PAGE);
+        read += PAGE;
+      }
+      // Runs of pages which aren't all zeros, a pwrite each
+      for (size_t page = 0; page < read;) {
+        const size_t size = std::min<size_t>(PAGE, read - page);
+        if (std::memcmp(buffer.get() + page, ZEROS, size) == 0) {
+          page += size;
+          continue;
+        }
+        size_t end = page + size;
+        while (end < read && std::memcmp(buffer.get() + end, ZEROS, std::min<size_t>(PAGE, read - end)) != 0) {
+          end += std::min<size_t>(PAGE, read - end);
+        }
+        if (!writeAll(file, buffer.get() + page, end - page, segment.p_offset + done + page)) {
+          return fail("Cannot write");
+        }
+        statistics.written += end - page;
+        page = end;
+      }
+      done += read;
+    }
+  }
+  // The holes at the end
+  if (ftruncate(file, offset) != 0) {
+    return fail("Cannot extend");
+  }
+  if (close(file) != 0) {
+    error = "Cannot write " + path + ": " + std::strerror(errno);
+    return false;
+  }
+  return true;
+}
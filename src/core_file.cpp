@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/procfs.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "core_file.h"
+
+CoreTarget::CoreTarget(const std::string& path, const std::string& program_path) {
+  const int file = open(path.c_str(), O_RDONLY);
+  if (file < 0) {
+    throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+  }
+  struct stat status;
+  if (fstat(file, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(Elf64_Ehdr))) {
+    close(file);
+    throw std::runtime_error(path + " isn't a core file");
+  }
+  m_size = status.st_size;
+  void* mapped = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  if (mapped == MAP_FAILED) {
+    throw std::runtime_error("Cannot map " + path + ": " + std::strerror(errno));
+  }
+  m_data = static_cast<const uint8_t*>(mapped);
+  madvise(mapped, m_size, MADV_RANDOM);
+
+  Elf64_Ehdr header;
+  std::memcpy(&header, m_data, sizeof(header));
+  if (std::memcmp(header.e_ident, ELFMAG, SELFMAG) != 0 || header.e_ident[EI_CLASS] != ELFCLASS64 ||
+      header.e_type != ET_CORE || header.e_machine != EM_X86_64 || header.e_phentsize != sizeof(Elf64_Phdr) ||
+      header.e_phoff + header.e_phnum * sizeof(Elf64_Phdr) > m_size) {
+    munmap(mapped, m_size);
+    throw std::runtime_error(path + " isn't an x86-64 ELF core file");
+  }
+  for (size_t i = 0; i < header.e_phnum; ++i) {
+    Elf64_Phdr segment;
+    std::memcpy(&segment, m_data + header.e_phoff + i * sizeof(segment), sizeof(segment));
+    if (segment.p_offset > m_size) {
+      continue;
+    }
+    // A truncated core (the disk filled up) has what it has
+    const uint64_t file_size = std::min<uint64_t>(segment.p_filesz, m_size - segment.p_offset);
+    if (segment.p_type == PT_NOTE) {
+      readNotes(m_data + segment.p_offset, file_size);
+    } else if (segment.p_type == PT_LOAD) {
+      m_segments.push_back({ segment.p_vaddr, segment.p_vaddr + segment.p_memsz, file_size, segment.p_flags,
+                             m_data + segment.p_offset });
+    }
+  }
+  std::sort(m_segments.begin(), m_segments.end(), [](const Segment& a, const Segment& b) { return a.low < b.low; });
+  if (m_threads.empty()) {
+    munmap(mapped, m_size);
+    throw std::runtime_error(path + " has no NT_PRSTATUS: no registers");
+  }
+
+  // The program's entry point, from its ELF header
+  uint64_t entry = 0;
+  for (size_t i = 0; i + 1 < m_auxv.size(); i += 2) {
+    if (m_auxv[i] == AT_ENTRY) {
+      entry = m_auxv[i + 1];
+    }
+  }
+  Elf64_Ehdr program;
+  const int program_file = open(program_path.c_str(), O_RDONLY);
+  const bool has_header = program_file >= 0 && pread(program_file, &program, sizeof(program), 0) == sizeof(program);
+  if (program_file >= 0) {
+    close(program_file);
+  }
+  if (has_header && entry && program.e_type == ET_DYN) {
+    m_load_address = entry - program.e_entry;
+  }
+  for (const MappedFile& mapped_file : m_files) {
+    if (entry >= mapped_file.low && entry < mapped_file.high) {
+      m_executable = mapped_file.path;
+    }
+  }
+  if (m_executable.empty()) {
+    char resolved[PATH_MAX];
+    m_executable = realpath(program_path.c_str(), resolved) ? resolved : program_path;
+  }
+}
+
+CoreTarget::~CoreTarget() {
+  for (const auto& [path, descriptor] : m_descriptors) {
+    if (descriptor >= 0) {
+      close(descriptor);
+    }
+  }
+  munmap(const_cast<uint8_t*>(m_data), m_size);
+}
+
+// Notes: a header (name size, description size, type), the name and the description, each padded to 4 bytes
+void CoreTarget::readNotes(const uint8_t* notes, size_t size) {
+  for (size_t offset = 0; offset + sizeof(Elf64_Nhdr) <= size;) {
+    Elf64_Nhdr header;
+    std::memcpy(&header, notes + offset, sizeof(header));
+    offset += sizeof(header) + (header.n_namesz + 3ULL) / 4 * 4;
+    if (offset + header.n_descsz > size) {
+      break;
+    }
+    const uint8_t* description = notes + offset;
+    offset += (header.n_descsz + 3ULL) / 4 * 4;
+    switch (header.n_type) {
+      case NT_PRSTATUS: {
+        elf_prstatus status;
+        if (header.n_descsz < sizeof(status)) {
+          break;
+        }
+        std::memcpy(&status, description, sizeof(status));
+        CoreThread thread;
+        thread.tid = status.pr_pid;
+        thread.signal = status.pr_cursig;
+        std::memcpy(&thread.regs, &status.pr_reg, sizeof(thread.regs));
+        std::memset(&thread.fp_regs, 0, sizeof(thread.fp_regs));
+        m_threads.push_back(thread);
+        if (m_pid == 0) {
+          m_pid = status.pr_pid;
+        }
+        break;
+      }
+      case NT_FPREGSET:
+        if (!m_threads.empty() && header.n_descsz >= sizeof(user_fpregs_struct)) {
+          std::memcpy(&m_threads.back().fp_regs, description, sizeof(user_fpregs_struct));
+        }
+        break;
+      case NT_PRPSINFO: {
+        elf_prpsinfo process;
+        if (header.n_descsz >= sizeof(process)) {
+          std::memcpy(&process, description, sizeof(process));
+          m_pid = process.pr_pid;
+        }
+        break;
+      }
+      case NT_AUXV:
+        m_auxv.resize(header.n_descsz / sizeof(uint64_t));
+        std::memcpy(m_auxv.data(), description, m_auxv.size() * sizeof(uint64_t));
+        break;
+      case NT_FILE: {
+        // count, page size, (start, end, offset in pages) per file, then their names
+        uint64_t count;
+        uint64_t page_size;
+        if (header.n_descsz < 2 * sizeof(uint64_t)) {
+          break;
+        }
+        std::memcpy(&count, description, sizeof(count));
+        std::memcpy(&page_size, description + sizeof(count), sizeof(page_size));
+        if (count > header.n_descsz / (3 * sizeof(uint64_t))) {
+          break;
+        }
+        const char* name = reinterpret_cast<const char*>(description + (2 + 3 * count) * sizeof(uint64_t));
+        const char* end = reinterpret_cast<const char*>(description + header.n_descsz);
+        for (uint64_t i = 0; i < count && name < end; ++i) {
+          uint64_t entry[3];
+          std::memcpy(entry, description + (2 + 3 * i) * sizeof(uint64_t), sizeof(entry));
+          const size_t length = strnlen(name, end - name);
+          m_files.push_back({ entry[0], entry[1], entry[2] * page_size, std::string(name, length) });
+          name += length + 1;
+        }
+        break;
+      }
+      default:
+        break;
+    }
+  }
+}
+
+size_t CoreTarget::readMappedFile(uint64_t address, uint8_t* buffer, size_t size) {
+  for (const MappedFile& file : m_files) {
+    if (address < file.low || address >= file.high) {
+      continue;
+    }
+    auto descriptor = m_descriptors.find(file.path);
+    if (descriptor == m_descriptors.end()) {
+      descriptor = m_descriptors.emplace(file.path, open(file.path.c_str(), O_RDONLY)).first;
+    }
+    if (descriptor->second < 0) {
+      return 0;
+    }
+    const ssize_t read = pread(descriptor->second, buffer, std::min<uint64_t>(size, file.high - address),
+                               file.offset + (address - file.low));
+    return read > 0 ? static_cast<size_t>(read) : 0;
+  }
+  return 0;
+}
+
+size_t CoreTarget::readAvailable(uint64_t address, void* buffer, size_t size) {
+  auto* out = static_cast<uint8_t*>(buffer);
+  size_t done = 0;
+  while (done < size) {
+    const uint64_t at = address + done;
+    auto after = std::upper_bound(m_segments.begin(), m_segments.end(), at,
+                                  [](uint64_t at, const Segment& segment) { return at < segment.low; });
+    if (after == m_segments.begin() || at >= std::prev(after)->high) {
+      break;
+    }
+    const Segment& segment = *std::prev(after);
+    const uint64_t offset = at - segment.low;
+    size_t copied;
+    if (offset < segment.file_size) {
+      copied = std::min<uint64_t>(size - done, segment.file_size - offset);
+      std::memcpy(out + done, segment.data + offset, copied);
+    } else {
+      // Left out of the core: the file mapped there has it
+      copied = readMappedFile(at, out + done, std::min<uint64_t>(size - done, segment.high - at));
+      if (copied == 0) {
+        break;
+      }
+    }
+    done += copied;
+  }
+  return done;
+}
+
+bool CoreTarget::readBytes(uint64_t address, void* buffer, size_t size) {
+  return readAvailable(address, buffer, size) == size;
+}
+
+size_t CoreTarget::readBlocks(const uint64_t* addresses, size_t count, size_t size, void* buffer) {
+  for (size_t i = 0; i < count; ++i) {
+    if (!readBytes(addresses[i], static_cast<uint8_t*>(buffer) + i * size, size)) {
+      return i;
+    }
+  }
+  return count;
+}
+
+bool CoreTarget::selectThread(pid_t tid) {
+  for (size_t i = 0; i < m_threads.size(); ++i) {
+    if (m_threads[i].tid == tid) {
+      m_thread = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+void CoreTarget::getRegisters(user_regs_struct& regs) {
+  regs = m_threads[m_thread].regs;
+}
+
+std::vector<MemoryMapping> CoreTarget::mappings() {
+  std::vector<MemoryMapping> mappings;
+  for (const Segment& segment : m_segments) {
+    MemoryMapping mapping;
+    mapping.low = segment.low;
+    mapping.high = segment.high;
+    mapping.permissions = std::string(segment.flags & PF_R ? "r" : "-") + (segment.flags & PF_W ? "w" : "-") +
+                          (segment.flags & PF_X ? "x" : "-") + "p";
+    for (const MappedFile& file : m_files) {
+      if (segment.low >= file.low && segment.low < file.high) {
+        mapping.path = file.path;
+        mapping.offset = file.offset + (segment.low - file.low);
+      }
+    }
+    mappings.push_back(std::move(mapping));
+  }
+  return mappings;
+}
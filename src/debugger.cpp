@@ -2,18 +2,29 @@
 #include <vector>
 #include <iomanip>
 #include <fstream>
+#include <map>
 #include <sstream>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <fnmatch.h>
+#include <random>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #if __linux__
   #include <wait.h>
 #endif
 
-#include "expression_context.h"
 #include "debugger.h"
 #include "linenoise.h"
 #include "ptrace_impl.h"
 #include "registers.h"
 #include "symbol.h"
+#include "x86_decoder.h"
 
 template <class Output>
 void split(const std::string &s, char delimiter, Output result) {
@@ -39,21 +50,62 @@ bool is_suffix(const std::string& s, const std::string& of) {
   return std::equal(s.begin(), s.end(), of.begin() + diff);
 }
 
-Debugger::Debugger(std::string prog_name, pid_t pid) :
+Debugger::Debugger(std::string prog_name, std::unique_ptr<Target> target,
+                   const elf::mmap_loader_options& loader_options) :
     m_prog_name(std::move(prog_name)),
-    m_pid(pid),
+    m_process(target->pid()),
+    m_pid(target->pid()),
+    m_target(std::move(target)),
+    m_thread_count(0),
+    m_shown_thread(m_pid),
+    m_non_stop(false),
+    m_unwinder(*m_target),
+    m_libraries(*m_target, m_events),
+    m_stepping_thread(0),
+    m_split_dwarf(m_prog_name),
+    m_scopes(m_dwarf, m_split_dwarf, m_elf),
+    m_displaced_stepping(true),
+    m_scratch_area(0),
+    m_scratch_holds(0),
+    m_value_printer([this](uint64_t address, void* buffer, size_t size) {
+      return m_target->readBytes(address, buffer, size);
+    }, [this](const uint64_t* addresses, size_t count, size_t size, void* buffer) {
+      return m_target->readBlocks(addresses, count, size, buffer);
+    }),
+    m_expressions(m_value_printer, [this](uint64_t address, void* buffer, size_t size) {
+      return m_target->readBytes(address, buffer, size);
+    }),
+    m_resume_after_stop(false),
+    m_exited(false),
+    m_attached(false),
+    m_detached(false),
+    m_attach_pause(0),
+    m_examine_next(0),
     m_load_address(0)
 {
+  if (m_target->live()) {
+    m_events.watchProcess(m_process);
+  }
   // open is used instead of std::ifstream because the elf loader needs a UNIX file descriptor to pass
   // to mmap so that it can map the file into memory rather than reading it a bit at a time.
   file_descriptor = open(m_prog_name.c_str(), O_RDONLY);
 
   // g++ -g helloworld.cpp -o helloworld (-g for generating DWARF)
-  m_elf = elf::elf{elf::create_mmap_loader(file_descriptor)};
-  m_dwarf = dwarf::dwarf{dwarf::elf::create_loader(m_elf)};
+  m_elf = elf::elf{elf::create_mmap_loader(file_descriptor, loader_options)};
+  try {
+    m_dwarf = dwarf::dwarf{dwarf::elf::create_loader(m_elf)};
+    indexDebugInfo();
+  } catch (dwarf::format_error& e) {
+    // DWARF libelfin can't read (DWARF 5, its split units included): the symbols only, as for a library
+    std::cerr << "Cannot read the debug info of " << m_prog_name << ": " << e.what() << std::endl;
+    m_dwarf = dwarf::dwarf {};
+  }
 }
 
 Debugger::~Debugger() {
+  if (m_attached && !m_exited && !m_detached) {
+    detach();
+  }
   dispose();
   close(file_descriptor);
 }
@@ -65,37 +117,227 @@ uint64_t Debugger::convertArgToHexAddress(const std::string& arg) {
 }
 
 void Debugger::run() {
-  std::cout << "Debugger::run -> Before waitpid() on pid = " << m_pid << "\n";
-  waitForSignal();
-  initializeLoadAddress();
-  std::cout << "Debugger::run -> After waitpid() on pid = " << m_pid << "\n";
-  std::cout << "Debugee loaded at the address: " << (void*)m_load_address << "\n";
+  if (m_attached) {
+    // Stopped by attach already
+    std::cout << "Stopped at 0x" << std::hex << getPc() << ' ' << describePc(getPc()) << std::endl;
+  } else if (m_target->live()) {
+    addThread(m_pid);
+    waitForSignal();
+    initializeLoadAddress();
+    std::cout << "Debugee loaded at the address: " << (void*)m_load_address << "\n";
+    initializeSharedLibraries();
+  } else {
+    // Every thread of a core is stopped for good, the one which got the signal first
+    for (const CoreThread& thread : static_cast<CoreTarget*>(m_target.get())->threads()) {
+      InferiorThread& stopped = addThread(thread.tid);
+      stopped.reason = thread.signal ? StopReason::signal : StopReason::interrupted;
+      stopped.signal = thread.signal;
+    }
+    selectThread(static_cast<CoreTarget*>(m_target.get())->threads().front().tid);
+    m_shown_thread = m_pid;
+    initializeLoadAddress();
+    initializeSharedLibraries();
+    printCoreStop();
+  }
 
-  char* line;
-  while ((line = linenoise("minidbg> ")) != nullptr) {
+  while (!m_detached) {
+    // linenoise reads the terminal at the prompt. What was typed while the program ran comes first.
+    m_events.watchTerminal(false);
+    if (!m_events.lines().empty()) {
+      const std::string typed = m_events.lines().front();
+      m_events.lines().pop_front();
+      std::cout << "minidbg> " << typed << std::endl;
+      handleCommand(typed.c_str());
+      linenoiseHistoryAdd(typed.c_str());
+      continue;
+    }
+    char* line = linenoise("minidbg> ");
+    if (line == nullptr) {
+      break;
+    }
     handleCommand(line);
     linenoiseHistoryAdd(line);
     linenoiseFree(line);
   }
 }
 
+// Attaching to a running process (debugger -p <pid>)
+//  A service in production can't be restarted under the debugger: it is attached to where it runs, stopped for as
+//  short as possible, and let go as it was.
+// Idea:
+//  1. PTRACE_SEIZE every thread of /proc/pid/task without stopping it (no PTRACE_O_EXITKILL: it lives on when the
+//     debugger is gone). Threads created meanwhile are seized by the kernel (PTRACE_O_TRACECLONE) once their creator
+//     is, or found by reading /proc/pid/task again, until no new one turns up.
+//  2. Then they are stopped all at once, as all-stop stops them (stopAllThreads): the pause starts here.
+//  3. The load address is AT_ENTRY of the auxiliary vector less the program's entry point: it doesn't need the
+//     randomization turned off, as processes started by the debugger have it (LiveTarget::loadAddress).
+//  4. detach takes out every breakpoint in one batch (a read and a write per page, see removeAllBreakpoints) and lets
+//     the threads go, delivering the signals which weren't reported. A debugger which exits detaches first.
+//  The time the process was stopped for by attach and detach is reported.
+
+// Returns false if the process can't be traced
+bool Debugger::attach() {
+  using clock = std::chrono::steady_clock;
+  const auto start = clock::now();
+  if (!Ptrace::attach(m_process)) {
+    std::cerr << "Cannot attach to process " << std::dec << m_process << ": " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  addThread(m_process).running = true;
+  for (bool found = true; found;) {
+    found = false;
+    for (const pid_t tid : readProcessThreads(m_process)) {
+      if (!m_threads.count(tid) && Ptrace::attach(tid)) {
+        addThread(tid).running = true;
+        found = true;
+      }
+    }
+  }
+  const auto seized = clock::now();
+  stopAllThreads();
+  const auto stopped = clock::now();
+  m_attached = true;
+  m_attach_pause = std::chrono::duration<double, std::milli>(stopped - seized).count();
+  selectThread(m_process);
+  m_shown_thread = m_pid;
+  initializeLoadAddress();
+  std::cout << "Attached to process " << std::dec << m_process << " (" << m_target->executable() << "), "
+            << m_threads.size() << (m_threads.size() == 1 ? " thread" : " threads") << ": seized in " << std::fixed
+            << std::setprecision(3) << std::chrono::duration<double, std::milli>(seized - start).count()
+            << " ms (running), stopped in " << m_attach_pause << " ms" << std::defaultfloat << std::endl;
+  std::cout << "Debugee loaded at the address: " << (void*)m_load_address << std::endl;
+  initializeSharedLibraries();
+  return true;
+}
+
+// detach: the process goes on without the debugger, which quits
+void Debugger::detach() {
+  using clock = std::chrono::steady_clock;
+  const auto start = clock::now();
+  // The threads running in non-stop mode are stopped: PTRACE_DETACH wants them stopped, and a breakpoint one of them
+  // hits meanwhile is rewound onto its int3 (stopAllThreads), which comes out now
+  stopRunningThreads();
+  const size_t breakpoints = m_breakpoints.size();
+  const size_t writes = removeAllBreakpoints();
+  size_t threads = 0;
+  for (const auto& [tid, thread] : m_threads) {
+    threads += Ptrace::detach(tid, thread.pending ? thread.signal : 0);
+  }
+  const double pause = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+  m_threads.clear();
+  m_detached = true;
+  std::cout << "Detached from process " << std::dec << m_process << ", " << threads
+            << (threads == 1 ? " thread" : " threads") << ": " << breakpoints << " breakpoints removed with " << writes
+            << " writes, stopped for " << std::fixed << std::setprecision(3) << pause << " ms";
+  if (m_attached) {
+    std::cout << " (attach and detach: " << m_attach_pause + pause << " ms)";
+  }
+  std::cout << std::defaultfloat << std::endl;
+}
+
 void Debugger::handleCommand(const char* line) {
   std::vector<std::string> args;
   split(line, ' ', std::back_inserter(args));
 //  std::cout << "Size of args:" << args.size() << "\n";
   auto command = args.empty() ? "" : args[0];
 
-  if (is_prefix(command, "continue")) {
-    continueExecution();
+  // Expressions are the rest of the line, spaces included
+  const std::string text = line;
+  auto rest = [&text](size_t words) {
+    size_t position = 0;
+    for (size_t i = 0; i < words && position != std::string::npos; ++i) {
+      position = text.find_first_not_of(' ', position);
+      position = position == std::string::npos ? position : text.find(' ', position);
+    }
+    position = position == std::string::npos ? position : text.find_first_not_of(' ', position);
+    return position == std::string::npos ? std::string() : text.substr(position);
+  };
+
+  // A core file has memory and registers but no process: only the commands which read them
+  if (!m_target->live()) {
+    if (is_prefix(command, "backtrace")) {
+      printBacktrace(args.size() > 1 ? std::stoul(args[1]) : 64);
+    } else if (is_prefix(command, "print")) {
+      if (args.size() < 2) {
+        std::cerr << "Usage: print <expression>\n";
+      } else {
+        printExpression(rest(1));
+      }
+    } else if (is_prefix(command, "vars")) {
+      printVariables(true, true);
+    } else if (is_prefix(command, "info") && args.size() > 1 && is_prefix(args[1], "locals")) {
+      printVariables(false, true);
+    } else if (is_prefix(command, "info") && args.size() > 1 && is_prefix(args[1], "args")) {
+      printVariables(true, false);
+    } else if (is_prefix(command, "info") && args.size() > 1 && is_prefix(args[1], "threads")) {
+      printThreads();
+    } else if (is_prefix(command, "info") && args.size() > 1 && is_prefix(args[1], "sharedlibrary")) {
+      printSharedLibraries();
+    } else if (command == "thread") {
+      switchThread(rest(1));
+    } else if (command == "x" || command.compare(0, 2, "x/") == 0) {
+      examine(command.substr(1), rest(1));
+    } else if (is_prefix(command, "symbol") && args.size() > 1) {
+      for (const Symbol& symbol : lookupSymbol(args[1])) {
+        std::cout << symbol;
+      }
+    } else {
+      std::cerr << "Not with a core file: backtrace, print, vars, info locals|args|threads|sharedlibrary, thread, x, "
+                << "symbol only\n";
+    }
+    return;
+  }
+
+  // Runs the work other threads posted meanwhile. A Ctrl-C which came while no thread ran is forgotten: it isn't to
+  // interrupt the next continue.
+  m_events.wait(0);
+
+  if (m_non_stop && !m_exited) {
+    // What the running threads did since the last command
+    collectEvents(false);
+    reportEvents();
+    // Prefixes only for the commands which are dispatched first of those they begin: s is step, not set
+    const bool anywhere = is_prefix(command, "continue") || command == "thread" || command == "interrupt" ||
+                          command == "detach" ||
+                          is_prefix(command, "break") || command == "set" ||
+                          (is_prefix(command, "info") && args.size() > 1 && is_prefix(args[1], "threads"));
+    if (!anywhere && m_threads.count(m_pid) && m_threads[m_pid].running) {
+      std::cerr << "Thread " << std::dec << m_threads[m_pid].number << " is running: interrupt it, or switch to a "
+                << "stopped one (info threads)" << std::endl;
+      return;
+    }
+  }
+
+  if (command == "detach") {
+    detach();
+  } else if (is_prefix(command, "continue")) {
+    if (m_non_stop) {
+      continueNonStop(args.size() > 1 && args[1] == "-a", false);
+    } else {
+      continueExecution();
+    }
+    printDisplays();
   } else if(is_prefix(command, "break")) {
+    // break <location> if <condition>
+    const std::string condition = args.size() > 3 && args[2] == "if" ? rest(3) : "";
     if (args[1][0] == '0' && args[1][1] == 'x') {
-      setBreakpointAtAddress(convertArgToHexAddress(args[1]));
+      const uint64_t address = convertArgToHexAddress(args[1]);
+      checkInstructionBoundary(address);
+      setBreakpointAtAddress(address, condition);
     } else if (args[1].find(':') != std::string::npos) {
       std::vector<std::string> file_and_line;
       split(args[1], ':', std::back_inserter(file_and_line));
-      setBreakpointAtSourceLine(file_and_line[0], std::stoi(file_and_line[1]));
+      setBreakpointAtSourceLine(file_and_line[0], std::stoi(file_and_line[1]), condition);
+    } else {
+      setBreakpointAtFunction(args[1], condition);
+    }
+  } else if(is_prefix(command, "condition")) {
+    auto breakpoint = args.size() > 1 && args[1].size() > 2 ? m_breakpoints.find(convertArgToHexAddress(args[1]))
+                                                             : m_breakpoints.end();
+    if (breakpoint == m_breakpoints.end()) {
+      std::cerr << "Usage: condition <breakpoint address> [expression]   (no expression: always stop)\n";
     } else {
-      setBreakpointAtFunction(args[1]);
+      breakpoint->second.setCondition(rest(2));
     }
   } else if (is_prefix(command, "register")) {
     if (is_prefix(args[1], "dump")) {
@@ -113,41 +355,292 @@ void Debugger::handleCommand(const char* line) {
       << Ptrace::readMemory(m_pid, convertArgToHexAddress(args[2]))
       << std::endl;
     }
-    if (is_prefix(args[1], "write")) {
-      Ptrace::writeMemory(m_pid,
-                          convertArgToHexAddress(args[2]),
-                          convertArgToHexAddress(args[3]));
+    if (is_prefix(args[1], "write") && args.size() > 3) {
+      // A 64-bit word (0x...), the characters of a C string literal ("...") or bytes in hex (bytes 48656c6c6f)
+      std::vector<uint8_t> bytes;
+      if (args[3][0] == '"' || args[3] == "bytes") {
+        SearchPattern pattern;
+        std::string error;
+        if (!parsePattern(rest(3), sizeof(uint64_t), pattern, error) || !pattern.mask.empty()) {
+          std::cerr << (error.empty() ? "?? can't be written" : error) << std::endl;
+          return;
+        }
+        bytes = std::move(pattern.bytes);
+      } else {
+        const uint64_t word = convertArgToHexAddress(args[3]);
+        bytes.resize(sizeof(word));
+        std::memcpy(bytes.data(), &word, sizeof(word));
+      }
+      const uint64_t address = convertArgToHexAddress(args[2]);
+      if (!writeMemory(address, bytes)) {
+        std::cerr << "Cannot write " << std::dec << bytes.size() << " bytes at 0x" << std::hex << address << std::endl;
+      }
     }
+  } else if(is_prefix(command, "step")) {
+    // checked before stepi, otherwise "step" would be taken for an abbreviation of "stepi"
+    stepIn();
+    printDisplays();
   } else if(is_prefix(command, "stepi")) {
     singleStepInstructionWithBreakpointCheck();
     auto line_entry = getLineEntryFromPc(getPc());
     printSource(line_entry->file->path, line_entry->line);
-  } else if(is_prefix(command, "step")) {
-    stepIn();
+    printDisplays();
   } else if(is_prefix(command, "next")) {
     stepOver();
+    printDisplays();
   } else if(is_prefix(command, "finish")) {
     stepOut();
+    printDisplays();
   } else if(is_prefix(command, "symbol")) {
     auto symbol_vector = lookupSymbol(args[1]);
     for (const Symbol& symbol : symbol_vector) {
       std::cout << symbol;
     }
   } else if(is_prefix(command, "backtrace")) {
-    printBacktrace();
+    printBacktrace(args.size() > 1 ? std::stoul(args[1]) : 64);
   } else if(is_prefix(command, "vars")) {
-    readVariables();
+    printVariables(true, true);
+  } else if(command == "x" || command.compare(0, 2, "x/") == 0) {
+    examine(command.substr(1), rest(1));
+  } else if(command == "thread") {
+    switchThread(rest(1));
+  } else if(command == "interrupt") {
+    interruptThreads(rest(1));
+  } else if(command == "gcore") {
+    generateCore(rest(1));
+  } else if(command == "dump" && args.size() > 3 && args[1] == "memory") {
+    dumpMemoryToFile(args[2], rest(3));
+  } else if(command == "restore" && args.size() > 2) {
+    restoreMemoryFromFile(args[1], rest(2));
+  } else if(command == "find" || command.compare(0, 5, "find/") == 0) {
+    findMemory(command.substr(4), rest(1));
+  } else if(is_prefix(command, "info")) {
+    if (args.size() > 1 && is_prefix(args[1], "locals")) {
+      printVariables(false, true);
+    } else if (args.size() > 1 && is_prefix(args[1], "args")) {
+      printVariables(true, false);
+    } else if (args.size() > 1 && is_prefix(args[1], "threads")) {
+      printThreads();
+    } else if (args.size() > 1 && is_prefix(args[1], "sharedlibrary")) {
+      printSharedLibraries();
+    } else {
+      std::cerr << "Usage: info locals|args|threads|sharedlibrary\n";
+    }
+  } else if(is_prefix(command, "disassemble")) {
+    try {
+      std::pair<uint64_t, uint64_t> range;
+      if (args.size() < 2) {
+        range = getFunctionRange(getFunctionFromPc(getPc()));
+      } else if (args[1].find(',') != std::string::npos) {   // 0xADDR,LEN
+        std::vector<std::string> address_and_length;
+        split(args[1], ',', std::back_inserter(address_and_length));
+        if (address_and_length.size() != 2) {
+          throw std::invalid_argument { args[1] };
+        }
+        range.first = convertArgToHexAddress(address_and_length[0]);
+        range.second = range.first + std::stoul(address_and_length[1], nullptr, 0);
+      } else if (args[1][0] == '0' && args[1][1] == 'x') {
+        range = getFunctionRange(getFunctionFromPc(convertArgToHexAddress(args[1])));
+      } else {
+        range = getFunctionRange(getFunctionByName(args[1]));
+      }
+      disassemble(range.first, range.second);
+    } catch (std::invalid_argument&) {
+      // An address or a length which isn't a number (stoul)
+      std::cerr << "Usage: disassemble [function | 0xADDRESS | 0xADDRESS,LENGTH]" << std::endl;
+    } catch (std::out_of_range& e) {
+      std::cerr << e.what() << std::endl;
+    }
+  } else if(is_prefix(command, "display")) {
+    // checked after disassemble, "d" and "dis" stay abbreviations of disassemble
+    if (args.size() > 1) {
+      m_displays.push_back(rest(1));
+      printExpression(m_displays.back());
+    } else {
+      printDisplays();
+    }
+  } else if(is_prefix(command, "undisplay")) {
+    const size_t number = args.size() > 1 ? std::stoul(args[1]) : 0;
+    if (number == 0 || number > m_displays.size()) {
+      std::cerr << "Usage: undisplay <number>\n";
+    } else {
+      m_displays.erase(m_displays.begin() + number - 1);
+    }
+  } else if(is_prefix(command, "bench")) {
+    bool usage = false;
+    try {
+      if (args.size() > 1 && is_prefix(args[1], "decode")) {
+        benchmarkDecoder(args.size() > 2 ? args[2] : "", args.size() > 3 ? std::stoul(args[3]) : 20);
+      } else if (args.size() > 1 && is_prefix(args[1], "breakpoint")) {
+        benchmarkBreakpoint(args.size() > 2 ? std::stoul(args[2]) : 10000);
+      } else if (args.size() > 1 && is_prefix(args[1], "trace")) {
+        benchmarkTrace(args.size() > 2 ? std::stoul(args[2]) : 100000);
+      } else if (args.size() > 1 && is_prefix(args[1], "lines")) {
+        benchmarkLines(args.size() > 2 ? std::stoull(args[2]) : 1000000);
+      } else if (args.size() > 1 && is_prefix(args[1], "unwind")) {
+        benchmarkUnwind(args.size() > 2 ? std::stoul(args[2]) : 1000);
+      } else if (args.size() > 2 && is_prefix(args[1], "print")) {
+        benchmarkPrint(args[2], args.size() > 3 ? std::stoul(args[3]) : 1000000);
+      } else if (args.size() > 2 && is_prefix(args[1], "examine")) {
+        benchmarkExamine(args[2], args.size() > 3 ? std::stoul(args[3], nullptr, 0) : 4 << 20);
+      } else {
+        usage = true;
+      }
+    } catch (std::invalid_argument&) {
+      usage = true;   // a count which isn't a number (stoul)
+    } catch (std::out_of_range& e) {
+      std::cerr << e.what() << std::endl;
+    }
+    if (usage) {
+      std::cerr << "Usage: bench decode [file] [rounds]\n"
+                << "       bench breakpoint [hits]\n"
+                << "       bench trace [instructions]\n"
+                << "       bench unwind [rounds]\n"
+                << "       bench lines [samples]\n"
+                << "       bench print <expression> [elements]\n"
+                << "       bench examine <address> [bytes]\n";
+    }
+  } else if(is_prefix(command, "set")) {
+    if (args.size() > 2 && args[1] == "stack-limit") {
+      m_unwinder.setStackLimit(std::stoull(args[2], nullptr, 0));
+    } else if (args.size() > 2 && args[1] == "print-depth") {
+      m_value_printer.max_depth = std::stoul(args[2]);
+    } else if (args.size() > 2 && args[1] == "print-elements") {
+      m_value_printer.max_elements = std::stoul(args[2]);
+    } else if (args.size() > 2 && args[1] == "print-characters") {
+      m_value_printer.max_characters = std::stoul(args[2]);
+    } else if (args.size() > 2 && args[1] == "non-stop" && (args[2] == "on" || args[2] == "off")) {
+      setNonStop(args[2] == "on");
+    } else {
+      std::cerr << "Usage: set stack-limit <bytes>   (bytes of stack copied per backtrace, 0 reads word by word)\n"
+                << "       set print-depth <n>       (nested structures and arrays printed)\n"
+                << "       set print-elements <n>    (array and container elements printed)\n"
+                << "       set print-characters <n>  (string characters printed)\n"
+                << "       set non-stop on|off       (only the thread with an event stops)\n";
+    }
+  } else if(is_prefix(command, "ftrace")) {
+    if (args.size() < 2) {
+      std::cerr << "Usage: ftrace <pattern> [calls] | ftrace report | ftrace histogram <function> | ftrace clear\n";
+    } else if (args[1] == "report") {
+      printFunctionTrace();
+    } else if (args[1] == "histogram" && args.size() > 2) {
+      printLatencyHistogram(args[2]);
+    } else if (args[1] == "clear") {
+      m_function_trace = {};
+    } else if (addFunctionTrace(args[1]) == 0) {
+      std::cerr << "No function matches " << args[1] << std::endl;
+    } else {
+      functionTrace(args.size() > 2 ? std::stoull(args[2]) : UINT64_MAX);
+    }
+  } else if(is_prefix(command, "annotate")) {
+    if (args.size() < 2) {
+      std::cerr << "Usage: annotate <function>\n";
+    } else {
+      try {
+        annotate(args[1]);
+      } catch (std::out_of_range& e) {
+        std::cerr << e.what() << std::endl;
+      }
+    }
+  } else if(is_prefix(command, "print")) {
+    // checked before profile: "p" is print
+    if (args.size() < 2) {
+      std::cerr << "Usage: print <expression>\n";
+    } else {
+      printExpression(rest(1));
+    }
+  } else if(is_prefix(command, "profile")) {
+    if (args.size() > 1 && args[1] == "report") {
+      printProfile(args.size() > 2 ? std::stoul(args[2]) : 20);
+    } else if (args.size() > 1 && args[1] == "folded") {
+      if (args.size() > 2) {
+        std::ofstream out(args[2]);
+        writeFoldedStacks(out);
+      } else {
+        writeFoldedStacks(std::cout);
+      }
+    } else if (args.size() > 1 && args[1] == "clear") {
+      m_profile = {};
+    } else if (args.size() > 1) {
+      profile(std::stod(args[1]), args.size() > 2 ? std::stoul(args[2]) : 99);
+      printProfile(10);
+      if (args.size() > 3) {
+        std::ofstream out(args[3]);
+        writeFoldedStacks(out);
+      }
+    } else {
+      std::cerr << "Usage: profile <seconds> [hz] [folded file] | profile report [n] | profile folded [file] | "
+                   "profile clear\n";
+    }
+  } else if(is_prefix(command, "blocktrace")) {
+    if (args.size() > 1 && is_prefix(args[1], "report")) {
+      printBlockTrace(args.size() > 2 ? std::stoul(args[2]) : 20);
+    } else if (args.size() > 1 && is_prefix(args[1], "history")) {
+      printBranchHistory(args.size() > 2 ? std::stoul(args[2]) : 20);
+    } else if (args.size() > 1 && is_prefix(args[1], "clear")) {
+      m_block_trace.clear();
+    } else {
+      const uint64_t stops = m_block_trace.stops;
+      const auto start = std::chrono::steady_clock::now();
+      blockTrace(args.size() > 1 ? std::stoull(args[1]) : 1000000);
+      const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      std::cout << std::dec << m_block_trace.stops - stops << " stops in " << seconds << " s" << std::endl;
+    }
   } else {
     std::cerr << "Unknown command\n";
   }
 }
 
+// All-stop, see threads.h: every thread runs until one of them stops, then they all are
 void Debugger::continueExecution() {
-  stepOverBreakpoint();
-  // MacOS: error =  Operation not supported, request = 7, pid = 31429, addr = Segmentation fault: 11
-  // Possible way to fix https://www.jetbrains.com/help/clion/attaching-to-local-process.html#prereq-ubuntu (solution for Ubuntu)
-  Ptrace::continueExec(m_pid);
-  waitForSignal();
+  if (m_non_stop) {
+    continueNonStop(false, true);
+    return;
+  }
+  // next and finish plant breakpoints for this thread: others running into them go on (handleSigtrap)
+  const pid_t current = m_pid;
+  m_stepping_thread = current;
+  // A breakpoint whose condition is false resumes the program right away
+  do {
+    m_resume_after_stop = false;
+    if (reportPendingSignal()) {
+      m_stepping_thread = 0;
+      return;
+    }
+    // Threads which reported a breakpoint hit step over it one at a time, the current one wherever it is
+    for (const auto& [tid, thread] : m_threads) {
+      if (tid != current && thread.reason == StopReason::breakpoint) {
+        selectThread(tid);
+        stepOverBreakpoint();
+      }
+    }
+    if (m_threads.count(current)) {
+      selectThread(current);
+      stepOverBreakpoint();
+    }
+    if (m_exited) {
+      m_stepping_thread = 0;
+      return;
+    }
+    // MacOS: error =  Operation not supported, request = 7, pid = 31429, addr = Segmentation fault: 11
+    // Possible way to fix https://www.jetbrains.com/help/clion/attaching-to-local-process.html#prereq-ubuntu (solution for Ubuntu)
+    for (const auto& [tid, thread] : m_threads) {
+      if (!thread.running) {
+        resumeThread(tid, Resume::cont);
+      }
+    }
+    int wait_status;
+    const pid_t tid = waitForEvent(wait_status);
+    if (WIFSTOPPED(wait_status)) {
+      stopAllThreads();
+    }
+    selectThread(tid);
+    reportStop(wait_status);
+    if (m_resume_after_stop && m_threads.count(current)) {
+      selectThread(current);
+    }
+  } while (m_resume_after_stop);
+  m_stepping_thread = 0;
 }
 
 // Debugger Part 2: Breakpoints
@@ -161,18 +654,47 @@ void Debugger::continueExecution() {
 // P.S> On x86 you can only have four hardware breakpoints set at a given time, but they give you the power to make them
 // fire on reading from or writing to a given address rather than only executing code there.
 
-void Debugger::setBreakpointAtAddress(uint64_t addr) {
+void Debugger::setBreakpointAtAddress(uint64_t addr, const std::string& condition) {
   std::cout << "Set breakpoint at the address " << std::hex << addr << std::endl;
-  BreakPoint bp {m_pid, addr};
+  BreakPoint bp {m_process, addr};
+  bp.setCondition(condition);
   bp.enable();
   m_breakpoints[addr] = bp;
 }
 
 void Debugger::dispose()  {
-  for (auto & break_point : m_breakpoints) {
-    break_point.second.disable();
+  removeAllBreakpoints();
+}
+
+// Every breakpoint out at once rather than a PTRACE_PEEKDATA and a POKEDATA each (ftrace plants thousands): the bytes
+// from the first to the last breakpoint of a page are read in one process_vm_readv, the original bytes put back in
+// them and the spans written through one open of /proc/pid/mem. Pages without breakpoints aren't touched, so they
+// stay shared with the file. Returns the number of writes.
+size_t Debugger::removeAllBreakpoints() {
+  std::vector<uint64_t> addresses;
+  for (const auto& [address, bp] : m_breakpoints) {
+    if (bp.isEnabled()) {
+      addresses.push_back(address);
+    }
+  }
+  std::sort(addresses.begin(), addresses.end());
+  constexpr uint64_t PAGE = 0x1000;
+  std::vector<std::pair<uint64_t, std::vector<uint8_t>>> spans;
+  for (size_t i = 0; i < addresses.size();) {
+    size_t last = i;
+    while (last + 1 < addresses.size() && addresses[last + 1] / PAGE == addresses[i] / PAGE) {
+      ++last;
+    }
+    std::vector<uint8_t> bytes(addresses[last] - addresses[i] + 1);
+    if (!m_exited && Ptrace::readBytes(m_pid, addresses[i], bytes.data(), bytes.size())) {
+      restoreBreakpointBytes(addresses[i], bytes.data(), bytes.size());
+      spans.emplace_back(addresses[i], std::move(bytes));
+    }
+    i = last + 1;
   }
+  const size_t written = spans.empty() ? 0 : Ptrace::writeBlocks(m_pid, spans);
   m_breakpoints.clear();
+  return written;
 }
 
 // Debugger Part 3: Registers and memory
@@ -187,9 +709,9 @@ void Debugger::dumpRegisters() {
 }
 
 uint64_t Debugger::getPc() {
-  const uint64_t value = getRegisterValue(m_pid, Reg::rip);
-//  std::cout << "getPc, pc = " << value << "\n";
-  return value;
+  user_regs_struct regs;
+  m_target->getRegisters(regs);
+  return regs.rip;
 }
 
 void Debugger::setPc(uint64_t pc) {
@@ -203,147 +725,1061 @@ void Debugger::stepOverBreakpoint() {
   if (m_breakpoints.count(pc)) {
     auto& bp = m_breakpoints[pc];
     if (bp.isEnabled()) {
+      if (m_displaced_stepping && displacedStep(pc)) {
+        return;
+      }
+      // Without the int3 the site is unguarded: in non-stop mode the other threads stop for the step
+      const std::vector<pid_t> stopped = stopRunningThreads();
       bp.disable();
-      Ptrace::singleStep(m_pid);
+      resumeThread(m_pid, Resume::step);
       waitForSignal();
       bp.enable();
+      resumeThreads(stopped);
+    }
+  }
+}
+
+// Displaced stepping
+// Stepping over a breakpoint in place takes the int3 out, single-steps and puts it back: two memory patches per hit,
+// and while the int3 is out the site is unguarded (another thread running through it wouldn't stop).
+// Idea:
+//  1. Copy the original instruction into a scratch page of the inferior. Rip-relative displacements are
+//     adjusted so that the copy still addresses the same data.
+//  2. Point rip at the copy and single-step it. The breakpoint stays inserted the whole time.
+//  3. Move rip back: falling through or taking a relative branch lands relative to the copy, so add (pc - scratch).
+//     Absolute targets (ret, jmp/call r/m) are left alone. Calls pushed the copy's return address: rewrite it.
+// Returns false if the instruction has to be stepped in place: syscalls (the kernel may hand rip to someone,
+// think of rt_sigreturn), traps, xbegin (its abort target is relative) and copies whose displacement doesn't fit.
+bool Debugger::displacedStep(uint64_t pc) {
+  constexpr size_t MAX_INSTRUCTION_LENGTH = 15;
+  constexpr size_t COPY_SIZE = 2 * sizeof(uint64_t);
+
+  constexpr uint64_t UNAVAILABLE = ~0ULL;
+  if (!m_scratch_area) {
+    m_scratch_area = allocateScratchArea();
+    if (!m_scratch_area) {
+      std::cerr << "Cannot map a scratch page in the inferior, stepping over breakpoints in place" << std::endl;
+      m_scratch_area = UNAVAILABLE;
+    }
+  }
+  if (m_scratch_area == UNAVAILABLE) {
+    return false;
+  }
+
+  const std::vector<Instruction> decoded = decodeRange(pc, pc + MAX_INSTRUCTION_LENGTH);
+  if (decoded.empty()) {
+    return false;
+  }
+  const Instruction& instruction = decoded.front();
+  if (instruction.flow == FlowType::syscall || instruction.flow == FlowType::trap || instruction.mnemonic == "xbegin") {
+    return false;
+  }
+
+  // A hot breakpoint is stepped over again and again, so the copy is only written when it changes
+  if (m_scratch_holds != pc) {
+    std::vector<uint8_t> copy = readCode(pc, instruction.length);
+    copy.resize(COPY_SIZE, 0xcc);   // int3 after the copy, in case anything runs past it
+    if (instruction.rip_relative) {
+      int32_t disp;
+      std::memcpy(&disp, copy.data() + instruction.disp_offset, sizeof(disp));
+      const int64_t moved = disp + static_cast<int64_t>(pc - m_scratch_area);
+      if (moved != static_cast<int32_t>(moved)) {
+        return false;
+      }
+      disp = static_cast<int32_t>(moved);
+      std::memcpy(copy.data() + instruction.disp_offset, &disp, sizeof(disp));
+    }
+    for (size_t i = 0; i < COPY_SIZE; i += sizeof(uint64_t)) {
+      uint64_t word;
+      std::memcpy(&word, copy.data() + i, sizeof(word));
+      Ptrace::writeMemory(m_pid, m_scratch_area + i, word);
+    }
+    m_scratch_holds = pc;
+  }
+
+  user_regs_struct regs;
+  Ptrace::getRegisters(m_pid, &regs);
+  regs.rip = m_scratch_area;
+  Ptrace::setRegisters(m_pid, &regs);
+  // A rep-prefixed string instruction stays at the same rip until its count runs out
+  do {
+    resumeThread(m_pid, Resume::step);
+    waitForSignal();
+    Ptrace::getRegisters(m_pid, &regs);
+  } while (regs.rip == m_scratch_area && !instruction.prefix.empty() && getSignalInfo().si_signo == SIGTRAP);
+
+  const uint64_t return_address = pc + instruction.length;
+  if (regs.rip == m_scratch_area) {
+    // Stopped by a signal before the instruction completed: back to the breakpoint
+    regs.rip = pc;
+  } else {
+    switch (instruction.flow) {
+      case FlowType::ret:
+      case FlowType::indirect_jump:
+        break;
+      case FlowType::indirect_call:
+        Ptrace::writeMemory(m_pid, regs.rsp, return_address);
+        break;
+      case FlowType::call:
+        Ptrace::writeMemory(m_pid, regs.rsp, return_address);
+        regs.rip += pc - m_scratch_area;
+        break;
+      default:
+        regs.rip += pc - m_scratch_area;
+        break;
     }
   }
+  Ptrace::setRegisters(m_pid, &regs);
+  return true;
+}
+
+// Maps one page in the inferior by making it call mmap: a syscall instruction is written over the code at pc and
+// executed with the arguments in registers, then the code and the registers are put back.
+uint64_t Debugger::allocateScratchArea() {
+  constexpr uint64_t SYSCALL = 0x050f;   // 0f 05
+  const uint64_t page_size = sysconf(_SC_PAGESIZE);
+  // The syscall is written over the code at pc, a breakpoint site: in non-stop mode the other threads stop meanwhile,
+  // or one running through the site would make the syscall with its own registers instead of hitting the int3
+  const std::vector<pid_t> stopped = stopRunningThreads();
+
+  user_regs_struct saved;
+  Ptrace::getRegisters(m_pid, &saved);
+  const uint64_t saved_code = Ptrace::readMemory(m_pid, saved.rip);
+  Ptrace::writeMemory(m_pid, saved.rip, (saved_code & ~0xffffULL) | SYSCALL);
+
+  // Ask for a page close to the code, so that rip-relative displacements of the copies still fit in 32 bits.
+  // It is only a hint: if the range is taken the kernel maps the page elsewhere.
+  const uint64_t code_page = saved.rip & ~(page_size - 1);
+  user_regs_struct regs = saved;
+  regs.rax = SYS_mmap;
+  regs.rdi = code_page > (32 << 20) ? code_page - (16 << 20) : (1 << 20);
+  regs.rsi = page_size;
+  regs.rdx = PROT_READ | PROT_EXEC;   // ptrace writes through the protection
+  regs.r10 = MAP_PRIVATE | MAP_ANONYMOUS;
+  regs.r8 = static_cast<uint64_t>(-1);
+  regs.r9 = 0;
+  Ptrace::setRegisters(m_pid, &regs);
+  // Not waitForSignal: stepping over a syscall reports TRAP_BRKPT, which it would take for a breakpoint hit
+  resumeThread(m_pid, Resume::step);
+  int wait_status;
+  waitThread(m_pid, wait_status);
+  Ptrace::getRegisters(m_pid, &regs);
+
+  Ptrace::writeMemory(m_pid, saved.rip, saved_code);
+  Ptrace::setRegisters(m_pid, &saved);
+  resumeThreads(stopped);
+
+  const auto result = static_cast<int64_t>(regs.rax);
+  return result < 0 && result > -4096 ? 0 : regs.rax;
 }
 
+// The current thread alone ran (a step): the others are stopped
 void Debugger::waitForSignal() {
   int wait_status;
-  auto options = 0;
-  waitpid(m_pid, &wait_status, options);
+  waitThread(m_pid, wait_status);
+  reportStop(wait_status);
+}
+
+// Why the current thread stopped, wait_status from waitpid
+void Debugger::reportStop(int wait_status) {
+  if (WIFEXITED(wait_status) || WIFSIGNALED(wait_status)) {
+    if (m_pid != m_process) {
+      threadExited(m_pid);
+      return;
+    }
+    m_exited = true;
+    m_threads.clear();
+    std::cout << "Program exited" << std::endl;
+    return;
+  }
+  if (wait_status >> 16 == PTRACE_EVENT_STOP) {
+    // interrupt (non-stop)
+    m_threads[m_pid].reason = StopReason::interrupted;
+    announceThread();
+    std::cout << "Interrupted at 0x" << std::hex << getPc() << ' ' << describePc(getPc()) << std::endl;
+    return;
+  }
 
   auto siginfo = getSignalInfo();
+  InferiorThread& thread = m_threads[m_pid];
+  thread.reason = StopReason::signal;
+  thread.signal = siginfo.si_signo;
 
   switch (siginfo.si_signo) {
     case SIGTRAP:
+      thread.reason = siginfo.si_code == SI_KERNEL || siginfo.si_code == TRAP_BRKPT ? StopReason::breakpoint
+                                                                                      : StopReason::step;
       handleSigtrap(siginfo);
       break;
     case SIGSEGV:
+      announceThread();
       std::cout << "Segmentation fault signal. Reason: " << siginfo.si_code << std::endl;
       break;
     default:
+      announceThread();
       std::cout << "Got signal " << strsignal(siginfo.si_signo) << std::endl;
   }
 }
 
-// Debugger Part 5: Source and signals
-// https://blog.tartanllama.xyz/writing-a-linux-debugger-source-signal/
+// Threads, see threads.h
 
-// Idea:
-//  1, Iterate through compilation units until you find the one containing the program counter.
-//  2. Iterating through the children until we find the relevant function (DW_TAG_subprogram).
-dwarf::die Debugger::getFunctionFromPc(uint64_t pc) {
-  auto offset_pc = offsetLoadAddress(pc); // remember to offset the pc for querying DWARF
+InferiorThread& Debugger::addThread(pid_t tid) {
+  InferiorThread& thread = m_threads[tid];
+  thread.tid = tid;
+  thread.number = ++m_thread_count;
+  return thread;
+}
 
-//  std::cerr  << "getFunctionFromPc, pc = " << offset_pc << "\n";
-  // We find the correct compilation unit, then ask the line table to get us the relevant entry.
-  for (const auto &compilationUnit : m_dwarf.compilation_units()) {
-    if (die_pc_range(compilationUnit.root()).contains(offset_pc)) {
-      for (const auto& die : compilationUnit.root()) {
-        if (die.tag == dwarf::DW_TAG::subprogram) {
-          if (die_pc_range(die).contains(offset_pc)) {
-            return die;
-          }
-        }
-      }
-    }
+// At a PTRACE_EVENT_CLONE stop of parent: the new thread, stopped. Its first stop may have been collected already
+// (waitForEvent), otherwise it is waited for here.
+pid_t Debugger::addClonedThread(pid_t parent) {
+  const pid_t tid = Ptrace::getEventMessage(parent);
+  if (!m_threads.count(tid)) {
+    int wait_status;
+    waitpid(tid, &wait_status, __WALL);
+    addThread(tid);
   }
-  throw std::out_of_range{"Cannot find function"};
+  return tid;
 }
 
-// Idea:
-//  1, Iterate through compilation units until you find the one containing the program counter.
-//  2. Iterating through the children until we find the relevant line entry.
-dwarf::line_table::iterator Debugger::getLineEntryFromPc(const uint64_t& pc, bool apply_load_address_offset) {
-  auto offset_pc = apply_load_address_offset ? offsetLoadAddress(pc) : pc; // remember to offset the pc for querying DWARF
-
-//  std::cerr  << "getLineEntryFromPc, pc = " << offset_pc << "\n";
-  for (auto &compilationUnit : m_dwarf.compilation_units()) {
-    if (die_pc_range(compilationUnit.root()).contains(offset_pc)) {
-      const dwarf::line_table& lineTable = compilationUnit.get_line_table();
-      auto it = lineTable.find_address(offset_pc);
-      if (it == lineTable.end()) {
-        throw std::out_of_range { "Cannot find line entry" };
-      } else {
-        return it;
-      }
-    }
+void Debugger::threadExited(pid_t tid) {
+  std::cout << "[Thread " << std::dec << m_threads[tid].number << " (tid " << tid << ") exited]" << std::endl;
+  m_threads.erase(tid);
+  if (tid == m_pid && !m_threads.empty()) {
+    selectThread(m_threads.count(m_process) ? m_process : m_threads.begin()->first);
   }
-
-  throw std::out_of_range { "Cannot find line entry" };
 }
 
-void Debugger::initializeLoadAddress() {
-  // If this is a dynamic library (e.g. PIE)
-  if (m_elf.get_hdr().type == elf::et::dyn) {
-    // The load address is found in /proc/pid/maps
-    std::ifstream map("/proc/" + std::to_string(m_pid) + "/maps");
-
-    // Read the first address from the file
-    std::string addr;
-    std::getline(map, addr, '-');
+void Debugger::selectThread(pid_t tid) {
+  m_pid = tid;
+  m_target->selectThread(tid);
+}
 
-    m_load_address = std::stol(addr, nullptr, 16);
+// Before a stop is shown: which thread it is about, when it isn't the one shown last
+void Debugger::announceThread() {
+  if (m_pid != m_shown_thread) {
+    // In non-stop mode a stop doesn't make its thread the current one
+    std::cout << (m_non_stop ? "[Thread " : "[Switching to thread ") << std::dec << m_threads[m_pid].number
+              << " (tid " << m_pid << ")]" << std::endl;
+    m_shown_thread = m_pid;
   }
 }
 
-// Addresses based on where the binary was loaded, but the original binary may be position-independent and use offsets as addresses.
-// -> We need to offset the address so it’s using the right base.
-uint64_t Debugger::offsetLoadAddress(uint64_t addr) {
-  return addr - m_load_address;
+void Debugger::resumeThread(pid_t tid, Resume how) {
+  InferiorThread& thread = m_threads[tid];
+  thread.running = true;
+  thread.resumed = how;
+  switch (how) {
+    case Resume::cont:
+      Ptrace::continueExec(tid);
+      break;
+    case Resume::step:
+      Ptrace::singleStep(tid);
+      break;
+    case Resume::block:
+      Ptrace::singleBlock(tid);
+      break;
+  }
 }
 
-// A helper to offset addresses from DWARF info by the load address:
-uint64_t Debugger::offsetDwarfAddress(uint64_t dwarf_addr) {
-  return dwarf_addr + m_load_address;
+// waitpid for one thread, which may not be the leader (__WALL). Threads it creates meanwhile are recorded and left
+// stopped, and it is resumed the way it was. Without block, false if it hasn't stopped yet.
+bool Debugger::waitThread(pid_t tid, int& wait_status, bool block) {
+  while (true) {
+    wait_status = 0;   // gone already: taken for an exit
+    const pid_t waited = waitpid(tid, &wait_status, __WALL | (block ? 0 : WNOHANG));
+    if (waited == 0) {
+      return false;
+    }
+    if (waited > 0 && WIFSTOPPED(wait_status) && wait_status >> 16 == PTRACE_EVENT_CLONE) {
+      addClonedThread(tid);
+      resumeThread(tid, m_threads[tid].resumed);
+      continue;
+    }
+    m_threads[tid].running = false;
+    return true;
+  }
 }
 
-// todo: check the value of n_lines_context
-void Debugger::printSource(const std::string& file_name, uint32_t line, uint32_t n_lines_context) {
-  std::ifstream file { file_name };
-
-  // Work out a window around the desired line
-  uint32_t start_line = (line <= n_lines_context) ? 1 : line - n_lines_context;
-  uint32_t end_line = line + n_lines_context + (line < n_lines_context ? n_lines_context - line : 0) + 1;
-
-  char c = 0;
-  uint32_t current_line = 1;
-  // Skip lines up until start_line
-  while (current_line != start_line && file.get(c)) {
-    if (c == '\n') {
-      ++current_line;
+// All threads run: the first event of any of them the user is to see. Thread creations and exits, and the stops
+// left by PTRACE_INTERRUPT, are taken care of on the way. Returns the tid. With block, the event loop is waited on
+// until waitpid has something: Ctrl-C and commands typed meanwhile are seen to.
+pid_t Debugger::waitForEvent(int& wait_status, bool block) {
+  while (true) {
+    wait_status = 0;
+    const pid_t tid = waitpid(-1, &wait_status, __WALL | WNOHANG);
+    if (tid == 0) {
+      if (!block) {
+        return 0;         // no event yet
+      }
+      waitEvents();
+      continue;
+    }
+    if (tid < 0) {
+      return m_process;   // nothing left to wait for: an exit
+    }
+    auto thread = m_threads.find(tid);
+    if (thread == m_threads.end()) {
+      // The first stop of a thread whose creator hasn't reported PTRACE_EVENT_CLONE yet
+      addThread(tid);
+      resumeThread(tid, Resume::cont);
+      continue;
+    }
+    if (WIFEXITED(wait_status) || WIFSIGNALED(wait_status)) {
+      if (tid == m_process) {
+        return tid;
+      }
+      threadExited(tid);
+      continue;
+    }
+    thread->second.running = false;
+    const int event = wait_status >> 16;
+    if (event == PTRACE_EVENT_CLONE) {
+      const pid_t created = addClonedThread(tid);
+      if (!m_threads[created].running) {
+        resumeThread(created, Resume::cont);
+      }
+      resumeThread(tid, Resume::cont);
+      continue;
     }
+    if (event == PTRACE_EVENT_STOP && !thread->second.interrupting) {
+      // An interrupt which came after the thread had stopped for something else, or a group-stop
+      resumeThread(tid, Resume::cont);
+      continue;
+    }
+    // An interrupt asked for is done with by any stop
+    thread->second.interrupting = false;
+    return tid;
   }
+}
 
-  // Output cursor if we're at the current line
-  std::cout << (current_line==line ? "> " : "  ");
-
-  // Write lines up until end_line
-  while (current_line <= end_line && file.get(c)) {
-    std::cout << c;
-    if (c == '\n') {
-      ++current_line;
-      // Output cursor if we're at the current line
-      std::cout << (current_line==line ? "> " : "  ");
+// All-stop: PTRACE_INTERRUPT to every running thread, then its stop. One which stopped for something else first is
+// still to take the interrupt: continued, it does before it runs an instruction (as in profile).
+void Debugger::stopAllThreads() {
+  for (const auto& [tid, thread] : m_threads) {
+    if (thread.running) {
+      Ptrace::interrupt(tid);
     }
   }
-
-  // Write newline and make sure that the stream is flushed properly
-  std::cout << std::endl;
+  for (auto it = m_threads.begin(); it != m_threads.end();) {
+    const pid_t tid = it->first;
+    InferiorThread& thread = it->second;
+    if (!thread.running) {
+      ++it;
+      continue;
+    }
+    int wait_status = 0;
+    waitpid(tid, &wait_status, __WALL);
+    thread.running = false;
+    if (WIFEXITED(wait_status) || WIFSIGNALED(wait_status)) {
+      ++it;
+      if (tid == m_process) {
+        m_exited = true;
+      } else {
+        threadExited(tid);
+      }
+      continue;
+    }
+    const int event = wait_status >> 16;
+    if (event == PTRACE_EVENT_STOP) {
+      thread.reason = StopReason::interrupted;
+      ++it;
+      continue;
+    }
+    if (event == PTRACE_EVENT_CLONE) {
+      addClonedThread(tid);
+    } else if (WSTOPSIG(wait_status) == SIGTRAP) {
+      // A breakpoint hit: back onto the int3, hit again when the thread runs next if it is still there
+      user_regs_struct regs;
+      Ptrace::getRegisters(tid, &regs);
+      if (m_breakpoints.count(regs.rip - 1)) {
+        --regs.rip;
+        Ptrace::setRegisters(tid, &regs);
+      }
+    } else {
+      thread.reason = StopReason::signal;
+      thread.signal = WSTOPSIG(wait_status);
+      thread.pending = true;
+    }
+    resumeThread(tid, Resume::cont);
+  }
 }
 
-siginfo_t Debugger::getSignalInfo() {
-  siginfo_t info;
-  Ptrace::getSigInfo(m_pid, &info);
-  return info;
+// Non-stop, see threads.h
+
+// The events of the running threads which have come, each queued on its thread, which stays stopped until it is
+// resumed. With block, waits for one if there is none.
+void Debugger::collectEvents(bool block) {
+  int wait_status;
+  for (pid_t tid; !m_exited && (tid = waitForEvent(wait_status, block)) != 0; block = false) {
+    m_threads[tid].events.push_back(wait_status);
+    if (tid == m_process && !WIFSTOPPED(wait_status)) {
+      break;
+    }
+  }
 }
 
-void Debugger::handleSigtrap(siginfo_t const& info) {
-  switch (info.si_code) {
+// Reports the stops queued on the threads, and the signals stopAllThreads kept. A breakpoint whose condition is false,
+// or one of next and finish hit by another thread, resumes its thread. The current thread stays current. Returns
+// the first thread whose stop was reported, 0 if none.
+pid_t Debugger::reportEvents() {
+  const pid_t current = m_pid;
+  std::vector<pid_t> stopped;
+  for (const auto& [tid, thread] : m_threads) {
+    if (!thread.events.empty() || thread.pending) {
+      stopped.push_back(tid);
+    }
+  }
+  pid_t reported = 0;
+  for (const pid_t tid : stopped) {
+    if (m_exited || !m_threads.count(tid)) {
+      continue;
+    }
+    selectThread(tid);
+    if (m_threads[tid].pending) {
+      m_threads[tid].pending = false;
+      announceThread();
+      std::cout << "Got signal " << strsignal(m_threads[tid].signal) << std::endl;
+      reported = reported ? reported : tid;
+    }
+    while (!m_exited && m_threads.count(tid) && !m_threads[tid].events.empty()) {
+      const int wait_status = m_threads[tid].events.front();
+      m_threads[tid].events.pop_front();
+      m_resume_after_stop = false;
+      reportStop(wait_status);
+      if (m_resume_after_stop && m_threads.count(tid)) {
+        m_resume_after_stop = false;
+        stepOverBreakpoint();
+        resumeThread(tid, Resume::cont);
+      } else {
+        reported = reported ? reported : tid;
+      }
+    }
+  }
+  if (!m_exited && m_threads.count(current)) {
+    selectThread(current);
+  }
+  return reported;
+}
+
+// Resumes the current thread (all: every stopped thread) and waits until a thread stops, which becomes current. With
+// for_current (next, finish), until the current thread stops: the stops of others meanwhile are reported as they come.
+void Debugger::continueNonStop(bool all, bool for_current) {
+  const pid_t current = m_pid;
+  m_stepping_thread = current;
+  std::vector<pid_t> resumed;
+  for (const auto& [tid, thread] : m_threads) {
+    if (!thread.running && (all || tid == current)) {
+      resumed.push_back(tid);
+    }
+  }
+  for (const pid_t tid : resumed) {
+    selectThread(tid);
+    stepOverBreakpoint();
+    if (m_exited) {
+      m_stepping_thread = 0;
+      return;
+    }
+    if (m_threads.count(tid) && !m_threads[tid].running) {
+      resumeThread(tid, Resume::cont);
+    }
+  }
+  if (m_threads.count(current)) {
+    selectThread(current);
+  }
+
+  while (!m_exited) {
+    collectEvents(true);
+    const pid_t stopped = reportEvents();
+    if (m_exited || !m_threads.count(current)) {
+      break;
+    }
+    if (!m_threads[current].running) {
+      break;
+    }
+    if (stopped && !for_current) {
+      selectThread(stopped);
+      break;
+    }
+  }
+  m_stepping_thread = 0;
+}
+
+// interrupt [-a|number]: stops the current thread, the one numbered or every thread, and waits for them to stop
+void Debugger::interruptThreads(const std::string& argument) {
+  if (!m_non_stop) {
+    std::cerr << "Every thread is stopped at the prompt in all-stop mode (set non-stop on)" << std::endl;
+    return;
+  }
+  const std::vector<pid_t> targets = requestInterrupt(argument);
+  auto running = [&]() {
+    for (const pid_t tid : targets) {
+      if (m_threads.count(tid) && m_threads[tid].running) {
+        return true;
+      }
+    }
+    return false;
+  };
+  while (!m_exited && running()) {
+    collectEvents(true);
+  }
+  reportEvents();
+}
+
+// The threads interrupt [-a|number] is about, each sent PTRACE_INTERRUPT if it runs. Their stops are collected as any
+// others.
+std::vector<pid_t> Debugger::requestInterrupt(const std::string& argument) {
+  std::vector<pid_t> targets;
+  for (const auto& [tid, thread] : m_threads) {
+    if (argument == "-a" || (argument.empty() && tid == m_pid) ||
+        (!argument.empty() && std::to_string(thread.number) == argument)) {
+      targets.push_back(tid);
+    }
+  }
+  if (targets.empty()) {
+    std::cerr << "No thread " << argument << " (info threads lists them)" << std::endl;
+  }
+  for (const pid_t tid : targets) {
+    InferiorThread& thread = m_threads[tid];
+    if (thread.running && !thread.interrupting && Ptrace::interrupt(tid)) {
+      thread.interrupting = true;
+    }
+  }
+  return targets;
+}
+
+// The event loop, see event_loop.h
+
+// Waits while the program runs, until something happens: Ctrl-C and the commands typed are seen to here, the rest is
+// for the caller. The terminal is read in non-stop mode (threads run in the background, as with gdb's continue &) and
+// for a process attached to, whose input isn't the debugger's terminal: in all-stop mode a program started by the
+// debugger has the terminal while it runs.
+unsigned Debugger::waitEvents() {
+  m_events.watchTerminal(m_non_stop || m_attached);
+  const unsigned events = m_events.wait();
+  if (events & EventLoop::interrupt) {
+    interruptProgram(m_events.interruptFromTerminal());
+  }
+  if (events & EventLoop::input) {
+    runTypedCommands();
+  }
+  return events;
+}
+
+// A Ctrl-C from the terminal of all-stop mode reached the program as well when it is in the debugger's process group:
+// its stop on SIGINT ends the wait, as in gdb, and an interrupt on top would stop it twice
+bool Debugger::programTakesInterrupt(bool from_terminal) {
+  return !m_non_stop && from_terminal && getpgid(m_process) == getpgrp();
+}
+
+// Ctrl-C while the program runs: the thread continue was for is interrupted, else the first running one
+void Debugger::interruptProgram(bool from_terminal) {
+  if (programTakesInterrupt(from_terminal)) {
+    return;
+  }
+  pid_t target = 0;
+  for (const auto& [tid, thread] : m_threads) {
+    if (thread.running && (target == 0 || tid == m_stepping_thread)) {
+      target = tid;
+    }
+  }
+  if (target && !m_threads[target].interrupting && Ptrace::interrupt(target)) {
+    m_threads[target].interrupting = true;
+  }
+}
+
+// The current thread alone runs (ftrace, blocktrace): waits for its stop through the event loop. False on Ctrl-C:
+// it is stopped then (stopAllThreads: a stop of its own which came first is kept, as for the other threads).
+bool Debugger::waitTracedThread(int& wait_status) {
+  while (!waitThread(m_pid, wait_status, false)) {
+    if ((m_events.wait() & EventLoop::interrupt) && !programTakesInterrupt(m_events.interruptFromTerminal())) {
+      const Resume resumed = m_threads[m_pid].resumed;
+      stopAllThreads();
+      if (!m_exited && resumed != Resume::cont && isSignalPending(m_pid, SIGTRAP)) {
+        // Stepped out of the syscall the interrupt broke: the SIGTRAP of the step is queued behind the interrupt's
+        // stop. Taken now (a resumed thread dequeues it before anything else), or it would be delivered after detach.
+        resumeThread(m_pid, Resume::cont);
+        waitThread(m_pid, wait_status);
+      }
+      if (!m_exited) {
+        std::cout << "Interrupted at 0x" << std::hex << getPc() << ' ' << describePc(getPc()) << std::endl;
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+// Lines typed while the program runs: interrupt [-a|number] and info threads are done right away, the others wait
+// for the program to stop (run)
+void Debugger::runTypedCommands() {
+  std::vector<std::vector<std::string>> now;
+  auto& lines = m_events.lines();
+  for (auto line = lines.begin(); line != lines.end();) {
+    std::vector<std::string> args;
+    split(*line, ' ', std::back_inserter(args));
+    args.erase(std::remove(args.begin(), args.end(), ""), args.end());
+    if ((!args.empty() && args[0] == "interrupt") ||
+        (args.size() > 1 && is_prefix(args[0], "info") && is_prefix(args[1], "threads"))) {
+      now.push_back(args);
+      line = lines.erase(line);
+    } else {
+      ++line;
+    }
+  }
+  for (const std::vector<std::string>& args : now) {
+    if (args[0] != "interrupt") {
+      printThreads();
+    } else if (m_non_stop) {
+      // Not interruptThreads: its stops are collected and reported by the continue waiting
+      requestInterrupt(args.size() > 1 ? args[1] : "");
+    } else {
+      interruptProgram(false);
+    }
+  }
+}
+
+// For what needs every thread stopped: in non-stop mode, stops the running ones and returns them for resumeThreads
+std::vector<pid_t> Debugger::stopRunningThreads() {
+  std::vector<pid_t> running;
+  for (const auto& [tid, thread] : m_threads) {
+    if (thread.running) {
+      running.push_back(tid);
+    }
+  }
+  if (!running.empty()) {
+    stopAllThreads();
+  }
+  return running;
+}
+
+// Those which have nothing to report
+void Debugger::resumeThreads(const std::vector<pid_t>& tids) {
+  for (const pid_t tid : tids) {
+    auto thread = m_threads.find(tid);
+    if (thread != m_threads.end() && !thread->second.running && !thread->second.pending &&
+        thread->second.events.empty()) {
+      resumeThread(tid, Resume::cont);
+    }
+  }
+}
+
+void Debugger::setNonStop(bool on) {
+  if (!on && m_non_stop) {
+    // Back to all-stop: every thread stopped and its stop reported
+    bool running = true;
+    while (!m_exited && running) {
+      stopAllThreads();
+      reportEvents();
+      running = false;
+      for (const auto& [tid, thread] : m_threads) {
+        running = running || thread.running;
+      }
+    }
+  }
+  m_non_stop = on;
+}
+
+// A signal which arrived while the threads were being stopped: it is reported instead of running the program
+bool Debugger::reportPendingSignal() {
+  for (auto& [tid, thread] : m_threads) {
+    if (thread.pending) {
+      thread.pending = false;
+      selectThread(tid);
+      announceThread();
+      std::cout << "Got signal " << strsignal(thread.signal) << std::endl;
+      return true;
+    }
+  }
+  return false;
+}
+
+// info threads: every thread, where it is stopped and why
+void Debugger::printThreads() {
+  if (m_exited) {
+    std::cerr << "The program has exited" << std::endl;
+    return;
+  }
+  static const char* const REASONS[] = { "created", "interrupted", "breakpoint", "step", "signal" };
+  std::vector<const InferiorThread*> threads;
+  for (const auto& [tid, thread] : m_threads) {
+    threads.push_back(&thread);
+  }
+  std::sort(threads.begin(), threads.end(),
+            [](const InferiorThread* a, const InferiorThread* b) { return a->number < b->number; });
+  std::cout << "  Id    Tid       Stopped by    Where\n";
+  user_regs_struct regs;
+  for (const InferiorThread* thread : threads) {
+    if (thread->running) {
+      std::cout << (thread->tid == m_pid ? "* " : "  ") << std::left << std::dec << std::setw(6) << thread->number
+                << std::setw(10) << thread->tid << "(running)" << std::right << '\n';
+      continue;
+    }
+    m_target->selectThread(thread->tid);
+    m_target->getRegisters(regs);
+    std::string reason = REASONS[static_cast<int>(thread->reason)];
+    if (thread->reason == StopReason::signal) {
+      reason = sigabbrev_np(thread->signal) ? std::string("SIG") + sigabbrev_np(thread->signal) : "signal";
+    }
+    std::cout << (thread->tid == m_pid ? "* " : "  ") << std::left << std::dec << std::setw(6) << thread->number
+              << std::setw(10) << thread->tid << std::setw(14) << reason << std::right << "0x" << std::hex
+              << regs.rip << ' ' << describePc(regs.rip) << '\n';
+  }
+  m_target->selectThread(m_pid);
+  std::cout << std::flush;
+}
+
+// thread [number]: the current thread, or switch to another one
+void Debugger::switchThread(const std::string& argument) {
+  if (m_exited) {
+    std::cerr << "The program has exited" << std::endl;
+    return;
+  }
+  if (argument.empty()) {
+    std::cout << "[Current thread is " << std::dec << m_threads[m_pid].number << " (tid " << m_pid << ")]"
+              << std::endl;
+    return;
+  }
+  char* end;
+  const unsigned long number = std::strtoul(argument.c_str(), &end, 10);
+  for (const auto& [tid, thread] : m_threads) {
+    if (*end == '\0' && thread.number == number) {
+      selectThread(tid);
+      m_shown_thread = tid;
+      std::cout << "[Switching to thread " << std::dec << number << " (tid " << tid << ")]"
+                << (thread.running ? " (running)" : "") << std::endl;
+      if (thread.running) {
+        return;
+      }
+      const uint64_t pc = getPc();
+      try {
+        auto line_entry = getLineEntryFromPc(pc);
+        printSource(line_entry->file->path, line_entry->line);
+      } catch (std::out_of_range&) {
+        std::cout << "0x" << std::hex << pc << ' ' << describePc(pc) << std::endl;
+      }
+      return;
+    }
+  }
+  std::cerr << "No thread " << argument << " (info threads lists them)" << std::endl;
+}
+
+// Debugger Part 5: Source and signals
+// https://blog.tartanllama.xyz/writing-a-linux-debugger-source-signal/
+
+// Idea:
+//  1, Iterate through compilation units until you find the one containing the program counter.
+//  2. Iterating through the children until we find the relevant function (DW_TAG_subprogram).
+dwarf::die Debugger::getFunctionFromPc(uint64_t pc) {
+  auto offset_pc = offsetLoadAddress(pc); // remember to offset the pc for querying DWARF
+
+//  std::cerr  << "getFunctionFromPc, pc = " << offset_pc << "\n";
+  // We find the correct compilation unit, then ask the line table to get us the relevant entry.
+  for (const auto &compilationUnit : m_dwarf.compilation_units()) {
+    if (die_pc_range(compilationUnit.root()).contains(offset_pc)) {
+      // With -gsplit-dwarf the functions live in the split unit, not in the skeleton
+      for (const auto& die : m_split_dwarf.resolve(compilationUnit).root()) {
+        // Declarations of functions defined elsewhere (printf) have no code
+        if (die.tag == dwarf::DW_TAG::subprogram && (die.has(dwarf::DW_AT::low_pc) || die.has(dwarf::DW_AT::ranges))) {
+          if (die_pc_range(die).contains(offset_pc)) {
+            return die;
+          }
+        }
+      }
+    }
+  }
+  throw std::out_of_range{"Cannot find function"};
+}
+
+// Idea:
+//  1, Iterate through compilation units until you find the one containing the program counter.
+//  2. Iterating through the children until we find the relevant line entry.
+dwarf::line_table::iterator Debugger::getLineEntryFromPc(const uint64_t& pc, bool apply_load_address_offset) {
+  auto offset_pc = apply_load_address_offset ? offsetLoadAddress(pc) : pc; // remember to offset the pc for querying DWARF
+
+//  std::cerr  << "getLineEntryFromPc, pc = " << offset_pc << "\n";
+  const dwarf::line_table& lineTable = getLineTableFromPc(offset_pc);
+  auto it = lineTable.find_address(offset_pc);
+  if (it == lineTable.end()) {
+    throw std::out_of_range { "Cannot find line entry" };
+  }
+  return it;
+}
+
+const dwarf::line_table& Debugger::getLineTableFromPc(uint64_t offset_pc) {
+  for (auto &compilationUnit : m_dwarf.compilation_units()) {
+    if (die_pc_range(compilationUnit.root()).contains(offset_pc)) {
+      return compilationUnit.get_line_table();
+    }
+  }
+
+  throw std::out_of_range { "Cannot find line entry" };
+}
+
+// The addresses [low, high) of the line containing pc: the line table row for pc and all following rows
+// for the same line. Both are load addresses.
+std::pair<uint64_t, uint64_t> Debugger::getLineRangeFromPc(uint64_t pc) {
+  const uint64_t offset_pc = offsetLoadAddress(pc);
+  const dwarf::line_table& lineTable = getLineTableFromPc(offset_pc);
+  auto it = lineTable.find_address(offset_pc);
+  if (it == lineTable.end()) {
+    throw std::out_of_range { "Cannot find line entry" };
+  }
+
+  const uint64_t low = it->address;
+  auto next = it;
+  ++next;
+  while (next != lineTable.end() && !next->end_sequence && next->line == it->line && next->file == it->file) {
+    ++next;
+  }
+  const uint64_t high = (next != lineTable.end()) ? next->address : low + 1;
+  return { offsetDwarfAddress(low), offsetDwarfAddress(high) };
+}
+
+// Cold-cache startup on big binaries is I/O-bound: the debug sections are mapped, not read, so every first touch
+// of a page during indexing is a page fault that blocks on the disk.
+// Idea:
+//  1. Tell the kernel the debug sections are read front to back (more readahead) and needed right now.
+//  2. Let a helper thread fault in .debug_info and .debug_line while we parse from the front.
+//  3. Once indexed, lookups are random, and .debug_abbrev is parsed into per-unit tables, so its pages can go.
+void Debugger::indexDebugInfo() {
+  rusage usage_before {};
+  getrusage(RUSAGE_SELF, &usage_before);
+  auto start = std::chrono::steady_clock::now();
+
+  for (const char* name : {".debug_info", ".debug_abbrev", ".debug_line", ".debug_str"}) {
+    const elf::section& section = m_elf.get_section(name);
+    if (section.valid()) {
+      section.advise(elf::access_hint::sequential);
+      section.advise(elf::access_hint::willneed);
+    }
+  }
+  for (const char* name : {".debug_info", ".debug_line"}) {
+    const elf::section& section = m_elf.get_section(name);
+    if (section.valid()) {
+      section.prefault();
+    }
+  }
+
+  size_t n_units = 0;
+  for (const auto& compilation_unit : m_dwarf.compilation_units()) {
+    compilation_unit.root();
+    compilation_unit.get_line_table();
+    ++n_units;
+  }
+
+  for (const char* name : {".debug_info", ".debug_line", ".debug_str"}) {
+    const elf::section& section = m_elf.get_section(name);
+    if (section.valid()) {
+      section.advise(elf::access_hint::random);
+    }
+  }
+  const elf::section& abbrev = m_elf.get_section(".debug_abbrev");
+  if (abbrev.valid()) {
+    abbrev.advise(elf::access_hint::dontneed);
+  }
+
+  rusage usage_after {};
+  getrusage(RUSAGE_SELF, &usage_after);
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << "Indexed " << std::dec << n_units << " compilation units in " << elapsed.count() << " ms"
+            << " (page faults: " << usage_after.ru_majflt - usage_before.ru_majflt << " major, "
+            << usage_after.ru_minflt - usage_before.ru_minflt << " minor)\n";
+}
+
+void Debugger::initializeLoadAddress() {
+  // If this is a dynamic library (e.g. PIE)
+  if (m_elf.get_hdr().type == elf::et::dyn) {
+    // AT_ENTRY of the auxiliary vector (/proc/pid/auxv, or the core's NT_AUXV) less the program's entry point. The
+    // first mapping of /proc/pid/maps if the auxiliary vector can't be read.
+    m_load_address = m_target->loadAddress();
+  }
+}
+
+// Addresses based on where the binary was loaded, but the original binary may be position-independent and use offsets as addresses.
+// -> We need to offset the address so it’s using the right base.
+uint64_t Debugger::offsetLoadAddress(uint64_t addr) {
+  return addr - m_load_address;
+}
+
+// A helper to offset addresses from DWARF info by the load address:
+uint64_t Debugger::offsetDwarfAddress(uint64_t dwarf_addr) {
+  return dwarf_addr + m_load_address;
+}
+
+// Shared libraries, see shared_libraries.h
+
+// Once the program is loaded: an internal breakpoint on the loader's r_brk, and the libraries it has already (all of
+// them when attached, or in a core)
+void Debugger::initializeSharedLibraries() {
+  const uint64_t address = m_libraries.locate(m_elf, m_load_address);
+  if (address && m_target->live() && !m_breakpoints.count(address)) {
+    BreakPoint bp { m_process, address };
+    bp.enable();
+    m_breakpoints[address] = bp;
+    m_internal_breakpoints.insert(address);
+  }
+  updateSharedLibraries();
+}
+
+// At r_brk: reports what was loaded and unloaded. The pending breakpoints are tried in the new libraries, and the
+// breakpoints of unloaded ones dropped: their code is gone, nothing to write back.
+void Debugger::updateSharedLibraries() {
+  std::vector<const SharedLibrary*> loaded;
+  std::vector<SharedLibrary> unloaded;
+  if (!m_libraries.update(loaded, unloaded)) {
+    return;
+  }
+  for (const SharedLibrary& library : unloaded) {
+    std::cout << "[Unloaded " << library.path << "]" << std::endl;
+    for (auto it = m_breakpoints.begin(); it != m_breakpoints.end();) {
+      const uint64_t address = it->first;
+      // Those of next and finish are removed by them
+      if (address < library.low || address >= library.high || m_internal_breakpoints.count(address) ||
+          m_step_breakpoints.count(address)) {
+        ++it;
+        continue;
+      }
+      auto by_name = m_library_breakpoints.find(address);
+      if (by_name != m_library_breakpoints.end()) {
+        m_pending_breakpoints.push_back(by_name->second);
+        m_library_breakpoints.erase(by_name);
+      }
+      it = m_breakpoints.erase(it);
+    }
+    m_instruction_cache.invalidate(library.low, library.high - library.low);
+  }
+  for (const SharedLibrary* library : loaded) {
+    std::cout << "[Loaded " << library->path << " at 0x" << std::hex << library->low << "]" << std::endl;
+    for (auto pending = m_pending_breakpoints.begin(); pending != m_pending_breakpoints.end();) {
+      pending = resolveLibraryBreakpoint(*library, *pending) ? m_pending_breakpoints.erase(pending) : pending + 1;
+    }
+  }
+  if (!loaded.empty() || !unloaded.empty()) {
+    // Its modules are read from the mappings again
+    m_unwinder.reset();
+  }
+}
+
+// A function or line the program doesn't have: in every library loaded which has it, pending if none has
+void Debugger::setLibraryBreakpoint(const LibraryBreakpoint& breakpoint) {
+  bool set = false;
+  for (const auto& [low, library] : m_libraries.libraries()) {
+    set = resolveLibraryBreakpoint(library, breakpoint) || set;
+  }
+  if (!set) {
+    m_pending_breakpoints.push_back(breakpoint);
+    std::cout << "No " << (breakpoint.function.empty() ? breakpoint.file + ":" + std::to_string(breakpoint.line)
+                                                       : breakpoint.function)
+              << " in the program or its libraries: the breakpoint is pending until a library which has it is loaded"
+              << std::endl;
+  }
+}
+
+bool Debugger::resolveLibraryBreakpoint(const SharedLibrary& library, const LibraryBreakpoint& breakpoint) {
+  const uint64_t address = breakpoint.function.empty()
+                               ? m_libraries.lineAddress(library, breakpoint.file, breakpoint.line)
+                               : m_libraries.functionAddress(library, breakpoint.function);
+  if (address == 0) {
+    return false;
+  }
+  if (!m_breakpoints.count(address)) {
+    setBreakpointAtAddress(address, breakpoint.condition);
+    std::cout << "  in " << library.path << std::endl;
+    m_library_breakpoints[address] = breakpoint;
+  }
+  return true;
+}
+
+// " at file:line" for a pc in a library with debug information, "" otherwise
+std::string Debugger::librarySourceLine(uint64_t pc) {
+  const SharedLibrary* library = m_libraries.find(pc);
+  std::string file;
+  unsigned line;
+  if (!library || !m_libraries.sourceLine(*library, pc, file, line)) {
+    return "";
+  }
+  return " at " + file + ":" + std::to_string(line);
+}
+
+// info sharedlibrary: the libraries loaded, and whether their index is built (the event loop hears when it is)
+void Debugger::printSharedLibraries() {
+  m_events.wait(0);
+  if (m_libraries.libraries().empty()) {
+    std::cout << "No shared libraries loaded" << std::endl;
+    return;
+  }
+  std::cout << std::left << std::setw(20) << "From" << std::setw(20) << "To" << std::setw(32) << "Index" << "Library\n";
+  for (const auto& [low, library] : m_libraries.libraries()) {
+    std::string index = "indexing";
+    if (library.index_ms >= 0) {
+      const LibraryIndex& built = m_libraries.index(library);
+      std::ostringstream text;
+      text << std::dec << built.functions.size() << " functions" << (built.debug.valid() ? ", DWARF" : "") << ", "
+           << std::fixed << std::setprecision(3) << library.index_ms << " ms";
+      index = text.str();
+    }
+    std::ostringstream range;
+    range << "0x" << std::hex << std::setfill('0') << std::setw(16) << library.low << "  0x" << std::setw(16)
+          << library.high;
+    std::cout << range.str() << "  " << std::setw(32) << index << library.path << '\n';
+  }
+  std::cout << std::right << std::flush;
+}
+
+// todo: check the value of n_lines_context
+void Debugger::printSource(const std::string& file_name, uint32_t line, uint32_t n_lines_context) {
+  // Work out a window around the desired line
+  uint32_t start_line = (line <= n_lines_context) ? 1 : line - n_lines_context;
+  uint32_t end_line = line + n_lines_context + (line < n_lines_context ? n_lines_context - line : 0) + 1;
+  printSourceLines(file_name, start_line, end_line, line);
+}
+
+void Debugger::printSourceLines(const std::string& file_name, uint32_t start_line, uint32_t end_line,
+                                uint32_t cursor_line, const std::function<std::string(uint32_t)>& margin) {
+  std::ifstream file { file_name };
+
+  char c = 0;
+  uint32_t current_line = 1;
+  // Skip lines up until start_line
+  while (current_line != start_line && file.get(c)) {
+    if (c == '\n') {
+      ++current_line;
+    }
+  }
+
+  // Output cursor if we're at the current line
+  auto line_prefix = [&]() {
+    if (margin) {
+      std::cout << margin(current_line);
+    }
+    std::cout << (current_line == cursor_line ? "> " : "  ");
+  };
+  line_prefix();
+
+  // Write lines up until end_line
+  while (current_line <= end_line && file.get(c)) {
+    std::cout << c;
+    if (c == '\n') {
+      ++current_line;
+      if (current_line <= end_line) {
+        line_prefix();
+      }
+    }
+  }
+
+  // Write newline and make sure that the stream is flushed properly
+  std::cout << std::endl;
+}
+
+siginfo_t Debugger::getSignalInfo() {
+  siginfo_t info;
+  Ptrace::getSigInfo(m_pid, &info);
+  return info;
+}
+
+void Debugger::handleSigtrap(siginfo_t const& info) {
+  switch (info.si_code) {
     // one of these will be set if a breakpoint was hit
     case SI_KERNEL:
     case TRAP_BRKPT:
@@ -353,192 +1789,1619 @@ void Debugger::handleSigtrap(siginfo_t const& info) {
       // 2. Therefore when the debugger is notified, the debugee's PC is already one byte after the breakpoint and
       // you have to move PC one byte back.
       setPc(getPc() - 1);
+      uint8_t code;
+      if (!m_breakpoints.count(getPc()) && m_target->readBytes(getPc(), &code, 1) && code != 0xcc) {
+        // A breakpoint removed since this thread hit it (non-stop: one of next's, the hit waiting to be reported):
+        // as if it never got there
+        m_resume_after_stop = true;
+        return;
+      }
+      if (getPc() == m_libraries.breakAddress()) {
+        // The loader changed its list of libraries: never a stop, whichever thread it is
+        updateSharedLibraries();
+        m_resume_after_stop = true;
+        return;
+      }
+      if (m_stepping_thread && m_pid != m_stepping_thread &&
+          (m_internal_breakpoints.count(getPc()) || m_step_breakpoints.count(getPc()))) {
+        m_resume_after_stop = true;
+        return;
+      }
+      if (m_internal_breakpoints.count(getPc())) {
+        return;
+      }
+      if (!breakpointConditionHolds(getPc())) {
+        m_resume_after_stop = true;
+        return;
+      }
+      announceThread();
       std::cout << "Hit breakpoint at address " << std::hex << getPc() << std::endl;
+      if (const SharedLibrary* library = m_libraries.find(getPc())) {
+        std::string file;
+        unsigned line;
+        if (m_libraries.sourceLine(*library, getPc(), file, line)) {
+          printSource(file, line);
+        } else {
+          std::cout << describePc(getPc()) << std::endl;
+        }
+        return;
+      }
       auto line_entry = getLineEntryFromPc(getPc());
       printSource(line_entry->file->path, line_entry->line);
       return;
     }
-      // this will be set if the signal was sent by single stepping
-    case TRAP_TRACE:
+      // this will be set if the signal was sent by single stepping
+    case TRAP_TRACE:
+      return;
+      // the program was just loaded (see main.cpp)
+    case SIGTRAP | (PTRACE_EVENT_EXEC << 8):
+      return;
+    default:
+      std::cout << "Unknown SIGTRAP code " << info.si_code << std::endl;
+      return;
+  }
+}
+
+// Debugger Part 6: Source-level stepping
+// https://blog.tartanllama.xyz/writing-a-linux-debugger-dwarf-step/
+
+void Debugger::singleStepInstruction() {
+  resumeThread(m_pid, Resume::step);
+  waitForSignal();
+}
+
+// Ensures that any breakpoints are disabled and re-enabled.
+void Debugger::singleStepInstructionWithBreakpointCheck() {
+  if (m_breakpoints.count(getPc())) {
+    stepOverBreakpoint();
+  } else {
+    singleStepInstruction();
+  }
+}
+
+// Set a breakpoint at the return address of the function and continue.
+void Debugger::stepOut() {
+  uint64_t return_address = getReturnAddress();
+
+  bool should_remove_breakpoint = false;
+  if (!m_breakpoints.count(return_address)) {
+    setBreakpointAtAddress(return_address);
+    m_step_breakpoints.insert(return_address);
+    should_remove_breakpoint = true;
+  }
+
+  continueExecution();
+
+  if (should_remove_breakpoint) {
+    m_step_breakpoints.erase(return_address);
+    removeBreakpoint(return_address);
+  }
+}
+
+void Debugger::removeBreakpoint(uint64_t addr) {
+  BreakPoint& point = m_breakpoints.at(addr);
+  if (point.isEnabled()) {
+    point.disable();
+  }
+  m_breakpoints.erase(addr);
+}
+
+// Range stepping
+//  Stepping instruction by instruction until the line changes costs a ptrace stop per instruction,
+//  and a line with a loop in it can cost millions of them.
+// Idea:
+//  1. Take the address range of the current line from the line table.
+//  2. Decode the instructions in it and put temporary breakpoints on every place where control can leave it:
+//     targets of jumps and calls outside the range and the first address after the range.
+//  3. Indirect branches (ret, jmp/call through a register or memory) only know their target when we get there,
+//     so put the breakpoint on the branch itself and single-step it.
+//  4. Continue, and repeat while we are still on the same line.
+void Debugger::stepIn() {
+  auto start_entry = getLineEntryFromPc(getPc());
+  const unsigned start_line = start_entry->line;
+  const std::string start_file = start_entry->file->path;
+
+  while (true) {
+    auto range = getLineRangeFromPc(getPc());
+    bool entered_call = false;
+    if (!stepOutOfRange(range.first, range.second, entered_call)) {
+      return;  // stopped for some other reason (a user breakpoint, a signal), it has been reported already
+    }
+
+    unsigned line;
+    std::string file;
+    try {
+      auto line_entry = getLineEntryFromPc(getPc());
+      line = line_entry->line;
+      file = line_entry->file->path;
+    } catch (std::out_of_range&) {
+      if (!entered_call) {
+        std::cout << "Stepped to 0x" << std::hex << getPc() << " which has no line information" << std::endl;
+        return;
+      }
+      // Called a function without debug information (e.g. through the PLT): we are at its first instruction,
+      // so the return address is on top of the stack. Run until it returns and keep stepping our line.
+      const uint64_t return_address = Ptrace::readMemory(m_pid, getRegisterValue(m_pid, Reg::rsp));
+      const bool should_remove_breakpoint = !m_breakpoints.count(return_address);
+      if (should_remove_breakpoint) {
+        BreakPoint bp { m_process, return_address };
+        bp.enable();
+        m_breakpoints[return_address] = bp;
+        m_internal_breakpoints.insert(return_address);
+      }
+      continueExecution();
+      if (should_remove_breakpoint) {
+        m_internal_breakpoints.erase(return_address);
+        removeBreakpoint(return_address);
+      }
+      if (getPc() != return_address) {
+        return;
+      }
+      continue;
+    }
+
+    if (line != start_line || file != start_file) {
+      printSource(file, line);
+      return;
+    }
+  }
+}
+
+// Runs the inferior until it leaves [low, high). Returns false if it stopped anywhere else first.
+// entered_call is set if control left the range through a call.
+bool Debugger::stepOutOfRange(uint64_t low, uint64_t high, bool& entered_call) {
+  const uint64_t pc = getPc();
+  const std::vector<Instruction> instructions = decodeRange(low, high);
+  if (instructions.empty() || instructions.back().next() != high) {
+    // Can't see where control goes, step the old way
+    while (getPc() >= low && getPc() < high) {
+      singleStepInstructionWithBreakpointCheck();
+    }
+    return true;
+  }
+
+  std::unordered_set<uint64_t> exits;           // where control lands after leaving the range
+  std::unordered_map<uint64_t, FlowType> indirect_sites;  // indirect branches, single-stepped when reached
+  std::unordered_set<uint64_t> call_targets;
+  exits.insert(high);
+
+  for (const Instruction& instruction : instructions) {
+    switch (instruction.flow) {
+      case FlowType::jump:
+      case FlowType::conditional_jump:
+      case FlowType::call:
+        if (instruction.target < low || instruction.target >= high) {
+          exits.insert(instruction.target);
+          if (instruction.flow == FlowType::call) {
+            call_targets.insert(instruction.target);
+          }
+        }
+        break;
+      case FlowType::ret:
+      case FlowType::indirect_jump:
+      case FlowType::indirect_call:
+        indirect_sites[instruction.address] = instruction.flow;
+        break;
+      default:
+        break;
+    }
+  }
+
+  // Already sitting on an indirect branch: there is nothing to run to
+  if (indirect_sites.count(pc)) {
+    singleStepInstructionWithBreakpointCheck();
+    entered_call = indirect_sites[pc] == FlowType::indirect_call;
+    return true;
+  }
+
+  std::vector<uint64_t> planted;
+  auto plant = [this, &planted](uint64_t address) {
+    if (m_breakpoints.count(address)) {
+      return;
+    }
+    BreakPoint bp { m_process, address };
+    bp.enable();
+    m_breakpoints[address] = bp;
+    m_internal_breakpoints.insert(address);
+    planted.push_back(address);
+  };
+  for (uint64_t address : exits) {
+    plant(address);
+  }
+  for (const auto& site : indirect_sites) {
+    plant(site.first);
+  }
+
+  continueExecution();
+
+  for (uint64_t address : planted) {
+    m_internal_breakpoints.erase(address);
+    removeBreakpoint(address);
+  }
+
+  const uint64_t stop_pc = getPc();
+  if (indirect_sites.count(stop_pc)) {
+    singleStepInstructionWithBreakpointCheck();
+    entered_call = indirect_sites[stop_pc] == FlowType::indirect_call;
+    return true;
+  }
+  if (exits.count(stop_pc)) {
+    entered_call = call_targets.count(stop_pc) != 0;
+    return true;
+  }
+  return false;
+}
+
+// Reads code from the inferior as it was before we put our breakpoints into it.
+std::vector<uint8_t> Debugger::readCode(uint64_t address, size_t size) {
+  // Shorter if the end isn't mapped
+  std::vector<uint8_t> code(size);
+  code.resize(m_target->readAvailable(address, code.data(), size));
+  restoreBreakpointBytes(address, code.data(), code.size());
+  return code;
+}
+
+// Decodes the instructions in [low, high). Lines are stepped over again and again (think of a loop body),
+// so decoded instructions are kept by address and the inferior is only read when one is missing.
+// Stops early at bytes which don't decode or at an instruction running past high.
+std::vector<Instruction> Debugger::decodeRange(uint64_t low, uint64_t high) {
+  std::vector<Instruction> instructions;
+  std::vector<uint8_t> code;
+  uint64_t address = low;
+  while (address < high) {
+    if (const Instruction* cached = m_instruction_cache.find(address)) {
+      if (cached->next() > high) {
+        break;
+      }
+      instructions.push_back(*cached);
+      address = cached->next();
+      continue;
+    }
+
+    if (code.empty()) {
+      code = readCode(low, high - low);
+    }
+    Instruction instruction;
+    if (address - low >= code.size() ||
+        !decodeInstruction(code.data() + (address - low), code.size() - (address - low), address, instruction)) {
+      break;
+    }
+    instructions.push_back(m_instruction_cache.insert(instruction));
+    address = instruction.next();
+  }
+  return instructions;
+}
+
+// The instruction at address, or nullptr if it doesn't decode. On a cache miss the code after it is decoded too,
+// up to the end of the page (the next one may not be mapped) unless the instruction itself runs into it.
+const Instruction* Debugger::instructionAt(uint64_t address) {
+  constexpr uint64_t DECODE_AHEAD = 64;
+  constexpr uint64_t MAX_INSTRUCTION_LENGTH = 15;
+  if (const Instruction* cached = m_instruction_cache.find(address)) {
+    return cached;
+  }
+  const uint64_t page_end = (address & ~(sysconf(_SC_PAGESIZE) - 1)) + sysconf(_SC_PAGESIZE);
+  decodeRange(address, std::min(address + DECODE_AHEAD, page_end));
+  if (const Instruction* decoded = m_instruction_cache.find(address)) {
+    return decoded;
+  }
+  decodeRange(address, address + MAX_INSTRUCTION_LENGTH);
+  return m_instruction_cache.find(address);
+}
+
+// Real debuggers will often examine what instruction is being executed and work out all of the possible branch targets,
+// then set breakpoints on all of them.
+// Two approaches:
+//  1) Stepping until we’re at a new line in the current function
+//  2) To set a breakpoint at every line in the current function.
+// Solution:
+//  - If we’re stepping over a function call, we need to single step through every single instruction in that call graph.
+//  - So use the 2nd approach
+void Debugger::stepOver() {
+  const uint64_t pc = getPc();
+  dwarf::die const func_die = getFunctionFromPc(pc);
+  uint64_t func_entry = at_low_pc(func_die); // DW_AT::low_pc
+  uint64_t func_end = at_high_pc(func_die); // DW_AT::high_pc
+
+  auto curr_line = getLineEntryFromPc(func_entry, false);
+  auto start_line = getLineEntryFromPc(pc);
+
+  std::vector<uint64_t> to_delete;
+
+  while (curr_line->address < func_end) {
+    const uint64_t current_address = curr_line->address;
+    const uint64_t load_address = offsetDwarfAddress(current_address);
+    if (current_address != start_line->address && !m_breakpoints.count(load_address)) {
+      setBreakpointAtAddress(load_address);
+      to_delete.push_back(load_address);
+    }
+    ++curr_line;
+  }
+
+  uint64_t return_address = getReturnAddress();
+  if (!m_breakpoints.count(return_address)) {
+    setBreakpointAtAddress(return_address);
+    to_delete.push_back(return_address);
+  }
+
+
+  m_step_breakpoints.insert(to_delete.begin(), to_delete.end());
+  continueExecution();
+
+  for (auto addr : to_delete) {
+    m_step_breakpoints.erase(addr);
+    removeBreakpoint(addr);
+  }
+}
+
+// The caller's frame from the CFI, which is right in prologues, epilogues and code without a frame pointer
+uint64_t Debugger::getReturnAddress() {
+  user_regs_struct regs;
+  Ptrace::getRegisters(m_pid, &regs);
+  const std::vector<UnwindFrame> frames = m_unwinder.backtrace(regs, 2);
+  if (frames.size() > 1) {
+    return frames[1].pc;
+  }
+  // Return address is stored 8 bytes after the start of a stack frame.
+  return Ptrace::readMemory(m_pid, regs.rbp + 8);
+}
+
+// Debugger Part 7: Source-level breakpoints
+// https://blog.tartanllama.xyz/writing-a-linux-debugger-source-break/
+//    DWARF contains the address ranges of functions and a line table which lets you
+// translate code positions between abstraction levels.
+
+//  Function entry (onyly for global scope)
+//  Idea:
+//    Iterate through all of the CU and search for functions with names which match what we’re looking for.
+void Debugger::setBreakpointAtFunction(const std::string& name, const std::string& condition) {
+  bool found = false;
+  for (const auto& compilation_unit : m_dwarf.compilation_units()) {
+    for (const auto& die : m_split_dwarf.resolve(compilation_unit).root()) {
+      // A declaration (printf) has no code: the library defining it has
+      if (die.has(dwarf::DW_AT::name) && die.has(dwarf::DW_AT::low_pc) && at_name(die) == name) {
+        found = true;
+        auto low_pc = at_low_pc(die);
+        // DW_AT_low_pc for a function points to the start of the prologue.
+        auto entry = getLineEntryFromPc(low_pc, false);
+        // Hack: increment the line entry by one to get the first line of the user code instead of the prologue.
+        ++entry;
+        setBreakpointAtAddress(offsetDwarfAddress(entry->address), condition);
+      }
+    }
+  }
+  if (!found) {
+    setLibraryBreakpoint({ name, "", 0, condition });
+  }
+}
+
+// Source line
+//  Idea: Translate this line number into an address by looking it up in the DWARF.
+//  1. Iterate through the CU looking for one whose name matches the given file.
+//  2. Look for the entry which corresponds to the given line.
+void Debugger::setBreakpointAtSourceLine(const std::string& file_name, uint32_t line_number,
+                                         const std::string& condition) {
+  for (const auto& compilation_unit : m_dwarf.compilation_units()) {
+    // A skeleton unit has no DW_AT_name, take it from the split unit
+    if (is_suffix(file_name, at_name(m_split_dwarf.resolve(compilation_unit).root()))) {
+      const auto& line_table = compilation_unit.get_line_table();
+
+      for (const auto& entry : line_table) {
+        // entry.is_stmt is checking that the line table entry is marked as the beginning of a statement,
+        // which is set by the compiler on the address it thinks is the best target for a breakpoint.
+        if (entry.is_stmt && entry.line == line_number) {
+          setBreakpointAtAddress(offsetDwarfAddress(entry.address), condition);
+          return;
+        }
+      }
+    }
+  }
+  setLibraryBreakpoint({ "", file_name, line_number, condition });
+}
+
+// Symbol lookup
+// Idea: take a look at the .symtab section of a binary, produced with readelf
+std::vector<Symbol> Debugger::lookupSymbol(const std::string& name) {
+  std::vector<Symbol> symbols;
+  for (const auto &section : m_elf.sections()) {
+    const elf::sht section_type = section.get_hdr().type;
+    if (section_type != elf::sht::symtab && section_type != elf::sht::dynsym) {
+      continue;
+    }
+
+    for (const elf::sym symbol : section.as_symtab()) {
+      const std::string& symbol_name = symbol.get_name();
+      if (symbol_name == name) {
+        symbols.emplace_back(symbol.get_data(), symbol_name);
+      }
+    }
+  }
+
+  return symbols;
+}
+
+// Disassembly
+// Idea:
+//  1. Decode the function linearly from DW_AT_low_pc: compilers don't put data into .text on x86-64,
+//  so every instruction starts where the previous one ends.
+//  2. Walk the line table rows of the function once, and print the source line whenever it changes.
+std::pair<uint64_t, uint64_t> Debugger::getFunctionRange(const dwarf::die& func) {
+  return { offsetDwarfAddress(at_low_pc(func)), offsetDwarfAddress(at_high_pc(func)) };
+}
+
+dwarf::die Debugger::getFunctionByName(const std::string& name) {
+  for (const auto& compilation_unit : m_dwarf.compilation_units()) {
+    for (const auto& die : m_split_dwarf.resolve(compilation_unit).root()) {
+      if (die.tag == dwarf::DW_TAG::subprogram && die.has(dwarf::DW_AT::name) && die.has(dwarf::DW_AT::low_pc) &&
+          at_name(die) == name) {
+        return die;
+      }
+    }
+  }
+  throw std::out_of_range { "Cannot find function " + name };
+}
+
+// "main+16" for an address in main, from DWARF or else from the ELF symbol table.
+std::string Debugger::symbolize(uint64_t address) {
+  const uint64_t offset_address = offsetLoadAddress(address);
+  auto with_offset = [](const std::string& name, uint64_t offset) {
+    return offset ? name + "+" + std::to_string(offset) : name;
+  };
+
+  try {
+    const dwarf::die func = getFunctionFromPc(address);
+    return with_offset(at_name(func), offset_address - at_low_pc(func));
+  } catch (std::out_of_range&) {
+  }
+
+  for (const auto& section : m_elf.sections()) {
+    if (section.get_hdr().type != elf::sht::symtab) {
+      continue;
+    }
+    for (const elf::sym symbol : section.as_symtab()) {
+      const auto& data = symbol.get_data();
+      if (data.type() == elf::stt::func && offset_address >= data.value && offset_address < data.value + data.size) {
+        return with_offset(symbol.get_name(), offset_address - data.value);
+      }
+    }
+  }
+  return "";
+}
+
+void Debugger::disassemble(uint64_t low, uint64_t high, const std::function<std::string(uint64_t)>& margin) {
+  const std::vector<Instruction> instructions = decodeRange(low, high);
+  const std::vector<uint8_t> code = readCode(low, high - low);
+  const uint64_t pc = getPc();
+
+  // Line table rows covering [low, high): a row is in effect from its address to the next row's one
+  struct Row {
+    uint64_t address;
+    unsigned line;
+    std::string file;
+  };
+  std::vector<Row> rows;
+  try {
+    const dwarf::line_table& line_table = getLineTableFromPc(offsetLoadAddress(low));
+    for (const auto& entry : line_table) {
+      const uint64_t address = offsetDwarfAddress(entry.address);
+      if (address < high && !entry.end_sequence) {
+        rows.push_back({ address, entry.line, entry.file->path });
+      }
+    }
+    std::stable_sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) { return a.address < b.address; });
+  } catch (std::out_of_range&) {
+    // no line information, plain disassembly
+  }
+
+  std::unordered_map<std::string, std::vector<std::string>> sources;
+  auto source_line = [&sources](const std::string& file, unsigned line) -> std::string {
+    auto it = sources.find(file);
+    if (it == sources.end()) {
+      std::ifstream stream { file };
+      std::vector<std::string> lines;
+      for (std::string text; std::getline(stream, text);) {
+        lines.push_back(text);
+      }
+      it = sources.emplace(file, std::move(lines)).first;
+    }
+    return line >= 1 && line <= it->second.size() ? it->second[line - 1] : "";
+  };
+
+  const Symbolizer symbolizer = [this](uint64_t address) { return symbolize(address); };
+  size_t row = 0;
+  const Row* shown = nullptr;
+  for (const Instruction& instruction : instructions) {
+    while (row + 1 < rows.size() && rows[row + 1].address <= instruction.address) {
+      ++row;
+    }
+    if (row < rows.size() && rows[row].address <= instruction.address &&
+        (!shown || shown->line != rows[row].line || shown->file != rows[row].file)) {
+      shown = &rows[row];
+      std::cout << shown->file << ":" << std::dec << shown->line << "\t" << source_line(shown->file, shown->line) << "\n";
+    }
+
+    std::ostringstream bytes;
+    for (uint8_t i = 0; i < instruction.length && i < 8; ++i) {
+      bytes << std::hex << std::setw(2) << std::setfill('0')
+            << static_cast<unsigned>(code[instruction.address - low + i]) << ' ';
+    }
+    if (instruction.length > 8) {
+      bytes << "...";
+    }
+    if (margin) {
+      std::cout << margin(instruction.address);
+    }
+    std::cout << (instruction.address == pc ? "=> " : "   ") << "0x" << std::hex << instruction.address
+              << " <" << symbolize(instruction.address) << ">:\t"
+              << std::left << std::setw(28) << std::setfill(' ') << bytes.str() << std::right
+              << toString(instruction, symbolizer) << "\n";
+  }
+
+  const uint64_t decoded_end = instructions.empty() ? low : instructions.back().next();
+  if (decoded_end < high) {
+    std::cout << "0x" << std::hex << decoded_end << ": no instruction decodes in the remaining "
+              << std::dec << high - decoded_end << " bytes\n";
+  }
+  std::cout << std::flush;
+}
+
+// A breakpoint in the middle of an instruction corrupts it instead of stopping there
+void Debugger::checkInstructionBoundary(uint64_t address) {
+  std::pair<uint64_t, uint64_t> range;
+  try {
+    range = getFunctionRange(getFunctionFromPc(address));
+  } catch (std::out_of_range&) {
+    return;   // not in a function we know the start of
+  }
+  for (const Instruction& instruction : decodeRange(range.first, range.second)) {
+    if (instruction.address == address) {
       return;
-    default:
-      std::cout << "Unknown SIGTRAP code " << info.si_code << std::endl;
+    }
+    if (instruction.address < address && address < instruction.next()) {
+      std::cerr << "Warning: 0x" << std::hex << address << " is inside the instruction at 0x" << instruction.address
+                << " (" << toString(instruction) << ")" << std::endl;
       return;
+    }
   }
 }
 
-// Debugger Part 6: Source-level stepping
-// https://blog.tartanllama.xyz/writing-a-linux-debugger-dwarf-step/
+// Decoder throughput over the .text of this program (or of another ELF file).
+// Decodes linearly, skipping a byte when something doesn't decode (padding, data in code).
+void Debugger::benchmarkDecoder(const std::string& path, unsigned rounds) {
+  elf::elf binary;
+  try {
+    binary = path.empty() ? m_elf : elf::elf { elf::create_mmap_loader(open(path.c_str(), O_RDONLY)) };
+  } catch (std::exception& e) {
+    std::cerr << "Cannot open " << path << ": " << e.what() << std::endl;
+    return;
+  }
+  const elf::section& text = binary.get_section(".text");
+  if (!text.valid()) {
+    std::cerr << "No .text section" << std::endl;
+    return;
+  }
+  const auto* data = static_cast<const uint8_t*>(text.data());
+  const size_t size = text.size();
+  const uint64_t base = text.get_hdr().addr;
+  rounds = std::max(rounds, 1u);
 
-void Debugger::singleStepInstruction() {
-  Ptrace::singleStep(m_pid);
-  waitForSignal();
+  using clock = std::chrono::steady_clock;
+  auto report = [&](const char* what, size_t count, clock::duration elapsed) {
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    std::cout << "  " << std::left << std::setw(16) << what << std::right << std::fixed << std::setprecision(1)
+              << count / seconds / 1e6 << " M instructions/s, "
+              << static_cast<double>(size) * rounds / seconds / (1 << 20) << " MB/s\n";
+  };
+
+  // 1. Decode: length, control flow and operands
+  Instruction instruction;
+  size_t count = 0;
+  size_t undecodable = 0;
+  auto start = clock::now();
+  for (unsigned round = 0; round < rounds; ++round) {
+    for (size_t offset = 0; offset < size;) {
+      if (decodeInstruction(data + offset, size - offset, base + offset, instruction)) {
+        offset += instruction.length;
+        ++count;
+      } else {
+        ++offset;
+        ++undecodable;
+      }
+    }
+  }
+  const auto decode_time = clock::now() - start;
+  std::cout << std::dec << ".text: " << size << " bytes, " << count / rounds << " instructions, "
+            << undecodable / rounds << " undecodable bytes, " << rounds << " rounds\n";
+  report("decode", count, decode_time);
+
+  // 2. Decode and print
+  start = clock::now();
+  for (unsigned round = 0; round < rounds; ++round) {
+    for (size_t offset = 0; offset < size;) {
+      if (decodeInstruction(data + offset, size - offset, base + offset, instruction)) {
+        toString(instruction);
+        offset += instruction.length;
+      } else {
+        ++offset;
+      }
+    }
+  }
+  report("decode+format", count, clock::now() - start);
+
+  // 3. Cache hits, what stepping over an already decoded line costs
+  InstructionCache cache;
+  for (size_t offset = 0; offset < size;) {
+    if (decodeInstruction(data + offset, size - offset, base + offset, instruction)) {
+      offset = cache.insert(instruction).next() - base;
+    } else {
+      ++offset;
+    }
+  }
+  size_t hits = 0;
+  start = clock::now();
+  for (unsigned round = 0; round < rounds; ++round) {
+    for (uint64_t address = base; address < base + size;) {
+      const Instruction* cached = cache.find(address);
+      address = cached ? cached->next() : address + 1;
+      hits += cached != nullptr;
+    }
+  }
+  report("cache lookup", hits, clock::now() - start);
+
+  // 4. What a cache miss costs when debugging: reading the code out of the inferior first
+  if (path.empty()) {
+    count = 0;
+    start = clock::now();
+    for (unsigned round = 0; round < rounds; ++round) {
+      const std::vector<uint8_t> code = readCode(offsetDwarfAddress(base), size);
+      for (size_t offset = 0; offset < size;) {
+        if (decodeInstruction(code.data() + offset, size - offset, base + offset, instruction)) {
+          offset += instruction.length;
+          ++count;
+        } else {
+          ++offset;
+        }
+      }
+    }
+    report("read+decode", count, clock::now() - start);
+  }
+  std::cout << std::defaultfloat << std::flush;
 }
 
-// Ensures that any breakpoints are disabled and re-enabled.
-void Debugger::singleStepInstructionWithBreakpointCheck() {
-  if (m_breakpoints.count(getPc())) {
+// Breakpoint hits per second, stepping over it in place and displaced.
+// Run it stopped at a breakpoint the program hits again and again (in a loop body).
+void Debugger::benchmarkBreakpoint(unsigned hits) {
+  const uint64_t pc = getPc();
+  if (!m_breakpoints.count(pc)) {
+    std::cerr << "Not stopped at a breakpoint" << std::endl;
+    return;
+  }
+  // Internal breakpoints aren't reported, otherwise we would be timing printSource
+  const bool was_internal = !m_internal_breakpoints.insert(pc).second;
+  const bool displaced_stepping = m_displaced_stepping;
+
+  using clock = std::chrono::steady_clock;
+  for (bool displaced : {false, true}) {
+    m_displaced_stepping = displaced;
+    unsigned count = 0;
+    const auto start = clock::now();
+    while (count < hits) {
+      continueExecution();
+      if (getPc() != pc) {
+        break;
+      }
+      ++count;
+    }
+    const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+    std::cout << "  " << std::left << std::setw(16) << (displaced ? "displaced" : "in place") << std::right
+              << std::dec << std::fixed << std::setprecision(0) << count / seconds << " hits/s ("
+              << count << " hits)\n" << std::defaultfloat;
+    if (count < hits) {
+      std::cout << "Stopped somewhere else after " << count << " hits" << std::endl;
+      break;
+    }
+  }
+  m_displaced_stepping = displaced_stepping;
+  if (!was_internal) {
+    m_internal_breakpoints.erase(pc);
+  }
+  std::cout << std::flush;
+}
+
+// Branch tracing, see block_trace.h
+
+// Runs the program a taken branch at a time until max_branches branches were traced or max_instructions
+// instructions were covered, a breakpoint is hit, a signal arrives or Ctrl-C. Returns false if the program has exited.
+bool Debugger::blockTrace(uint64_t max_branches, uint64_t max_instructions) {
+  uint64_t block_start = getPc();
+  uint64_t branches = 0;
+  uint64_t instructions = 0;
+  if (m_breakpoints.count(block_start)) {
+    // Stepped over on its own: it is a block of one instruction
     stepOverBreakpoint();
+    instructions += recordBlock(block_start, getPc());
+    block_start = getPc();
+  }
+
+  while (branches < max_branches && instructions < max_instructions) {
+    resumeThread(m_pid, Resume::block);
+    int wait_status;
+    if (!waitTracedThread(wait_status)) {
+      return !m_exited;
+    }
+    if (WIFEXITED(wait_status) || WIFSIGNALED(wait_status)) {
+      std::cout << "Program exited after " << std::dec << branches << " branches" << std::endl;
+      return false;
+    }
+
+    const siginfo_t info = getSignalInfo();
+    if (info.si_signo != SIGTRAP) {
+      std::cout << "Got signal " << strsignal(info.si_signo) << std::endl;
+      break;
+    }
+    const uint64_t pc = getPc();
+    if (info.si_code == SI_KERNEL && m_breakpoints.count(pc - 1)) {
+      m_resume_after_stop = false;
+      handleSigtrap(info);
+      if (!m_resume_after_stop) {
+        break;
+      }
+      // The loader's r_brk, or a breakpoint whose condition is false: the trace goes on after it
+      m_resume_after_stop = false;
+      stepOverBreakpoint();
+      block_start = getPc();
+      continue;
+    }
+    instructions += recordBlock(block_start, pc);
+    ++branches;
+    block_start = pc;
+  }
+  return true;
+}
+
+// Counts a run of instructions from start which ended with a stop at to, and records the branch which ended it.
+// Returns the number of instructions in the run.
+uint32_t Debugger::recordBlock(uint64_t start, uint64_t to) {
+  constexpr uint32_t MAX_BLOCK_INSTRUCTIONS = 4096;
+  uint64_t from = start;
+  uint64_t end = start;
+  uint32_t count = 0;
+  while (count < MAX_BLOCK_INSTRUCTIONS) {
+    const Instruction* instruction = instructionAt(end);
+    if (!instruction) {
+      break;
+    }
+    ++count;
+    from = end;
+    end = instruction->next();
+
+    // Which instruction could the stop have followed?
+    bool last = true;
+    switch (instruction->flow) {
+      case FlowType::sequential:
+        // Only a trap per instruction (no BTF) stops right after the first one
+        last = count == 1 && end == to;
+        break;
+      case FlowType::syscall:
+        // The kernel reports a trap on the way back from a syscall
+        last = end == to;
+        break;
+      case FlowType::conditional_jump:
+        last = instruction->target == to || (count == 1 && end == to);
+        break;
+      default:
+        break;
+    }
+    if (last) {
+      break;
+    }
+  }
+
+  TracedBlock& block = m_block_trace.blocks[start];
+  block.end = end;
+  block.instructions = count;
+  ++block.hits;
+  ++m_block_trace.stops;
+  m_block_trace.instructions += count;
+  if (end == to) {
+    ++m_block_trace.fall_throughs;
   } else {
-    singleStepInstruction();
+    m_block_trace.branches.push({from, to});
   }
+  return count;
 }
 
-// Set a breakpoint at the return address of the function and continue.
-void Debugger::stepOut() {
-  uint64_t return_address = getReturnAddress();
+// "main+16 at test.cpp:12"
+std::string Debugger::describeAddress(uint64_t address) {
+  std::string description = symbolize(address);
+  if (description.empty()) {
+    std::ostringstream hex;
+    hex << "0x" << std::hex << address;
+    description = hex.str();
+  }
+  try {
+    auto line_entry = getLineEntryFromPc(address);
+    description += " at " + line_entry->file->path + ":" + std::to_string(line_entry->line);
+  } catch (std::out_of_range&) {
+  }
+  return description;
+}
 
-  bool should_remove_breakpoint = false;
-  if (!m_breakpoints.count(return_address)) {
-    setBreakpointAtAddress(return_address);
-    should_remove_breakpoint = true;
+// Where a thread is: the program's functions with their lines, the libraries' from their symbol tables
+std::string Debugger::describePc(uint64_t pc) {
+  return symbolize(pc).empty() ? m_unwinder.symbolize(pc) + librarySourceLine(pc) : describeAddress(pc);
+}
+
+// The blocks entered most often
+void Debugger::printBlockTrace(size_t n_blocks) {
+  std::cout << std::dec << m_block_trace.stops << " stops, " << m_block_trace.instructions << " instructions, "
+            << m_block_trace.branches.pushed() << " taken branches, " << m_block_trace.blocks.size() << " blocks\n";
+  if (m_block_trace.stops && m_block_trace.fall_throughs * 2 > m_block_trace.stops) {
+    std::cout << "Most stops didn't follow a branch: BTF seems to be unavailable (virtual machine?), "
+                 "the kernel traps on every instruction instead\n";
   }
 
-  continueExecution();
+  std::vector<std::pair<uint64_t, TracedBlock>> blocks(m_block_trace.blocks.begin(), m_block_trace.blocks.end());
+  n_blocks = std::min(n_blocks, blocks.size());
+  std::partial_sort(blocks.begin(), blocks.begin() + n_blocks, blocks.end(), [](const auto& a, const auto& b) {
+    return a.second.hits > b.second.hits;
+  });
+  std::cout << std::setw(10) << "hits" << std::setw(8) << "instrs" << "  block\n";
+  for (size_t i = 0; i < n_blocks; ++i) {
+    const auto& [start, block] = blocks[i];
+    std::cout << std::dec << std::setw(10) << block.hits << std::setw(8) << block.instructions << "  0x" << std::hex
+              << start << "-0x" << block.end << "  " << describeAddress(start) << "\n";
+  }
+  std::cout << std::flush;
+}
 
-  if (should_remove_breakpoint) {
-    removeBreakpoint(return_address);
+// The last branches taken, oldest first
+void Debugger::printBranchHistory(size_t n_branches) {
+  n_branches = std::min(n_branches, m_block_trace.branches.size());
+  for (size_t i = n_branches; i-- > 0;) {
+    const BranchRecord& branch = m_block_trace.branches.recent(i);
+    std::cout << "  " << describeAddress(branch.from) << "\n    -> " << describeAddress(branch.to) << "\n";
   }
+  std::cout << std::flush;
 }
 
-void Debugger::removeBreakpoint(uint64_t addr) {
-  BreakPoint& point = m_breakpoints.at(addr);
-  if (point.isEnabled()) {
-    point.disable();
+// Instructions covered per second by single-stepping (stepi) and by tracing blocks, from where the program is stopped
+void Debugger::benchmarkTrace(uint64_t instructions) {
+  using clock = std::chrono::steady_clock;
+  auto report = [](const char* what, uint64_t stops, uint64_t covered, clock::duration elapsed) {
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    std::cout << "  " << std::left << std::setw(12) << what << std::right << std::dec << std::fixed
+              << std::setprecision(0) << stops / seconds << " stops/s, " << covered / seconds << " instructions/s ("
+              << covered << " instructions, " << stops << " stops)\n" << std::defaultfloat;
+  };
+
+  auto start = clock::now();
+  uint64_t steps = 0;
+  for (; steps < instructions; ++steps) {
+    if (m_breakpoints.count(getPc())) {
+      stepOverBreakpoint();
+      continue;
+    }
+    resumeThread(m_pid, Resume::step);
+    int wait_status;
+    waitThread(m_pid, wait_status);
+    if (WIFEXITED(wait_status) || WIFSIGNALED(wait_status)) {
+      std::cout << "Program exited after " << std::dec << steps << " steps" << std::endl;
+      return;
+    }
+    getSignalInfo();
   }
-  m_breakpoints.erase(addr);
+  report("stepi", steps, steps, clock::now() - start);
+
+  const uint64_t stops = m_block_trace.stops;
+  const uint64_t covered = m_block_trace.instructions;
+  start = clock::now();
+  const bool running = blockTrace(UINT64_MAX, instructions);
+  report("blocktrace", m_block_trace.stops - stops, m_block_trace.instructions - covered, clock::now() - start);
+  if (running && m_block_trace.fall_throughs * 2 > m_block_trace.stops) {
+    std::cout << "BTF seems to be unavailable (virtual machine?), the kernel traps on every instruction instead\n";
+  }
+  std::cout << std::flush;
 }
 
-// Just keep on stepping over instructions until we get to a new line.
-void Debugger::stepIn() {
-  const uint64_t pc = getPc();
-  auto dwarf_table_line = getLineEntryFromPc(pc)->line;
+// Frames unwound per second from where the program is stopped: cold (the mappings, ELF files and CFI rows are
+// read again each round), warm (the decoded rows are reused) and warm without the stack snapshot
+void Debugger::benchmarkUnwind(unsigned rounds) {
+  using clock = std::chrono::steady_clock;
+  user_regs_struct regs;
+  Ptrace::getRegisters(m_pid, &regs);
 
-  while (getLineEntryFromPc(pc)->line == dwarf_table_line) {
-    singleStepInstructionWithBreakpointCheck();
+  auto measure = [&](const char* what, unsigned rounds, bool cold) {
+    uint64_t frames = 0;
+    const uint64_t reads = m_unwinder.reads();
+    const auto start = clock::now();
+    for (unsigned round = 0; round < rounds; ++round) {
+      if (cold) {
+        m_unwinder.reset();
+      }
+      frames += m_unwinder.backtrace(regs).size();
+    }
+    const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+    rounds = std::max(rounds, 1u);
+    std::cout << "  " << std::left << std::setw(10) << what << std::right << std::dec << std::fixed
+              << std::setprecision(0) << frames / seconds << " frames/s, " << std::setprecision(2)
+              << seconds * 1e6 / rounds << " us per backtrace (" << frames / rounds << " frames, "
+              << (m_unwinder.reads() - reads) / rounds << " reads)\n" << std::defaultfloat;
+  };
+  measure("cold", std::max(rounds / 10, 1u), true);
+  measure("warm", rounds, false);
+  const uint64_t stack_limit = m_unwinder.stackLimit();
+  m_unwinder.setStackLimit(0);
+  measure("per word", rounds, false);
+  m_unwinder.setStackLimit(stack_limit);
+  std::cout << "  " << m_unwinder.cachedFdes() << " FDEs decoded" << std::endl;
+}
+
+// Prints the value of an expression with up to elements elements as 'print' does (bulk reads, nodes by pages), then
+// with a reader going word by word with PTRACE_PEEKDATA
+void Debugger::benchmarkPrint(const std::string& expression, unsigned elements) {
+  using clock = std::chrono::steady_clock;
+  ExpressionValue value;
+  try {
+    value = evaluateExpression(expression);
+  } catch (ExpressionError& e) {
+    std::cerr << e.what() << std::endl;
+    return;
+  }
+  if (!value.lvalue) {
+    std::cerr << expression << " isn't in memory" << std::endl;
+    return;
+  }
+
+  uint64_t peeks = 0;
+  const pid_t pid = m_pid;
+  ValuePrinter word_by_word([pid, &peeks](uint64_t address, void* buffer, size_t size) {
+    auto* out = static_cast<uint8_t*>(buffer);
+    for (size_t done = 0; done < size; done += sizeof(uint64_t)) {
+      errno = 0;
+      const long word = ptrace(PTRACE_PEEKDATA, pid, address + done, nullptr);
+      ++peeks;
+      if (errno) {
+        return false;
+      }
+      std::memcpy(out + done, &word, std::min(sizeof(word), size - done));
+    }
+    return true;
+  });
+  word_by_word.max_depth = m_value_printer.max_depth;
+  word_by_word.max_characters = m_value_printer.max_characters;
+
+  auto measure = [&](const char* what, ValuePrinter& printer, const std::function<uint64_t()>& reads) {
+    const unsigned max_elements = printer.max_elements;
+    const uint64_t max_read = printer.max_read;
+    printer.max_elements = elements;
+    printer.max_read = UINT64_MAX;
+    const uint64_t before = reads();
+    const auto start = clock::now();
+    const std::string text = printer.print(*value.type, value.address);
+    const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+    printer.max_elements = max_elements;
+    printer.max_read = max_read;
+    std::cout << "  " << std::left << std::setw(14) << what << std::right << std::dec << std::fixed
+              << std::setprecision(4) << seconds << " s, " << reads() - before << " reads, " << text.size()
+              << " characters\n" << std::defaultfloat;
+  };
+  measure("bulk", m_value_printer, [this]() { return m_value_printer.reads(); });
+  measure("word by word", word_by_word, [&peeks]() { return peeks; });
+}
+
+// Function tracing, see function_trace.h
+
+// Adds the functions whose names match pattern (shell wildcards: "parse*"). Returns how many are traced.
+size_t Debugger::addFunctionTrace(const std::string& pattern) {
+  FunctionTrace& trace = m_function_trace;
+  size_t matched = 0;
+  for (const auto& compilation_unit : m_dwarf.compilation_units()) {
+    for (const auto& die : m_split_dwarf.resolve(compilation_unit).root()) {
+      if (die.tag != dwarf::DW_TAG::subprogram || !die.has(dwarf::DW_AT::name) || !die.has(dwarf::DW_AT::low_pc)) {
+        continue;
+      }
+      const std::string name = at_name(die);
+      // The first instruction, not the one after the prologue (see setBreakpointAtFunction): [rsp] is the return address
+      const uint64_t entry = offsetDwarfAddress(at_low_pc(die));
+      if (fnmatch(pattern.c_str(), name.c_str(), 0) != 0) {
+        continue;
+      }
+      ++matched;
+      if (!trace.entries.count(entry)) {
+        TracedFunction function;
+        function.name = name;
+        function.entry = entry;
+        trace.entries[entry] = trace.functions.size();
+        trace.functions.push_back(std::move(function));
+      }
+    }
+  }
+  return matched;
+}
+
+// Runs the program until max_calls calls were traced, it stops at one of the user's breakpoints, gets a signal
+// or exits, or Ctrl-C. The tracer's breakpoints are only in place while it runs.
+void Debugger::functionTrace(uint64_t max_calls) {
+  FunctionTrace& trace = m_function_trace;
+  for (const auto& [entry, function] : trace.entries) {
+    if (!m_breakpoints.count(entry)) {
+      BreakPoint bp {m_process, entry};
+      bp.enable();
+      m_breakpoints[entry] = bp;
+      trace.owned.insert(entry);
+      m_internal_breakpoints.insert(entry);
+    }
+  }
+
+  uint64_t calls = 0;
+  uint64_t stops = 0;
+  bool exited = false;
+  const auto start = FunctionTrace::clock::now();
+  while (calls < max_calls) {
+    stepOverBreakpoint();
+    resumeThread(m_pid, Resume::cont);
+    int wait_status;
+    if (!waitTracedThread(wait_status)) {
+      exited = m_exited;
+      break;
+    }
+    const auto now = FunctionTrace::clock::now();
+    if (WIFEXITED(wait_status) || WIFSIGNALED(wait_status)) {
+      std::cout << "Program exited" << std::endl;
+      exited = true;
+      break;
+    }
+
+    const siginfo_t info = getSignalInfo();
+    if (info.si_signo != SIGTRAP || (info.si_code != SI_KERNEL && info.si_code != TRAP_BRKPT)) {
+      std::cout << "Got signal " << strsignal(info.si_signo) << std::endl;
+      break;
+    }
+    user_regs_struct regs;
+    Ptrace::getRegisters(m_pid, &regs);
+    const uint64_t address = regs.rip - 1;
+    if (!m_breakpoints.count(address)) {
+      std::cout << "Stopped by an int3 of the program at " << std::hex << address << std::endl;
+      break;
+    }
+    regs.rip = address;
+    Ptrace::setRegisters(m_pid, &regs);
+    ++stops;
+    if (address == m_libraries.breakAddress()) {
+      updateSharedLibraries();
+      continue;
+    }
+    const bool users_breakpoint = !trace.owned.count(address);   // before a return breakpoint is released
+
+    // A return first: the same address may be an entry too (a call right before another function)
+    if (trace.returns.count(address)) {
+      onFunctionReturn(address, regs.rsp, now);
+    }
+    auto entry = trace.entries.find(address);
+    if (entry != trace.entries.end()) {
+      onFunctionEntry(entry->second, regs.rsp, now);
+      ++calls;
+    }
+    if (users_breakpoint) {
+      std::cout << "Hit breakpoint at address " << std::hex << address << std::endl;
+      try {
+        auto line_entry = getLineEntryFromPc(address);
+        printSource(line_entry->file->path, line_entry->line);
+      } catch (std::out_of_range&) {
+      }
+      break;
+    }
   }
+  const double seconds = std::chrono::duration<double>(FunctionTrace::clock::now() - start).count();
 
-  auto line_entry = getLineEntryFromPc(pc);
-  printSource(line_entry->file->path, line_entry->line);
+  if (!trace.pending.empty()) {
+    std::cout << std::dec << trace.pending.size() << " calls were still running" << std::endl;
+  }
+  removeFunctionTraceBreakpoints(exited);
+  std::cout << std::dec << calls << " calls, " << stops << " stops in " << seconds << " s ("
+            << static_cast<uint64_t>(stops / seconds) << " stops/s)\n";
+  printFunctionTrace();
 }
 
-// Real debuggers will often examine what instruction is being executed and work out all of the possible branch targets,
-// then set breakpoints on all of them.
-// Two approaches:
-//  1) Stepping until we’re at a new line in the current function
-//  2) To set a breakpoint at every line in the current function.
-// Solution:
-//  - If we’re stepping over a function call, we need to single step through every single instruction in that call graph.
-//  - So use the 2nd approach
-void Debugger::stepOver() {
-  const uint64_t pc = getPc();
-  dwarf::die const func_die = getFunctionFromPc(pc);
-  uint64_t func_entry = at_low_pc(func_die); // DW_AT::low_pc
-  uint64_t func_end = at_high_pc(func_die); // DW_AT::high_pc
+void Debugger::onFunctionEntry(size_t function, uint64_t stack_pointer, FunctionTrace::clock::time_point now) {
+  FunctionTrace& trace = m_function_trace;
+  const uint64_t return_address = Ptrace::readMemory(m_pid, stack_pointer);
+  trace.pending.push_back({function, return_address, stack_pointer, now});
+  ++trace.functions[function].calls;
 
-  auto curr_line = getLineEntryFromPc(func_entry, false);
-  auto start_line = getLineEntryFromPc(pc);
+  if (trace.returns[return_address]++ == 0 && !m_breakpoints.count(return_address)) {
+    BreakPoint bp {m_process, return_address};
+    bp.enable();
+    m_breakpoints[return_address] = bp;
+    trace.owned.insert(return_address);
+    m_internal_breakpoints.insert(return_address);
+  }
+}
 
-  std::vector<uint64_t> to_delete;
+void Debugger::onFunctionReturn(uint64_t address, uint64_t stack_pointer, FunctionTrace::clock::time_point now) {
+  FunctionTrace& trace = m_function_trace;
+  // ret popped the return address, so the returning call is the one with rsp 8 below ours.
+  // Calls deeper than that have been unwound without returning (longjmp, exceptions).
+  while (!trace.pending.empty() && trace.pending.back().stack_pointer + sizeof(uint64_t) < stack_pointer) {
+    releaseReturnBreakpoint(trace.pending.back().return_address);
+    trace.pending.pop_back();
+    ++trace.unwound;
+  }
+  if (trace.pending.empty()) {
+    return;
+  }
+  const FunctionTrace::PendingCall call = trace.pending.back();
+  if (call.stack_pointer + sizeof(uint64_t) != stack_pointer || call.return_address != address) {
+    return;   // got here some other way than by returning
+  }
+  trace.pending.pop_back();
+  const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(now - call.entered).count();
+  trace.functions[call.function].latency.record(static_cast<uint64_t>(latency));
+  releaseReturnBreakpoint(address);
+}
 
-  while (curr_line->address < func_end) {
-    const uint64_t current_address = curr_line->address;
-    const uint64_t load_address = offsetDwarfAddress(current_address);
-    if (current_address != start_line->address && !m_breakpoints.count(load_address)) {
-      setBreakpointAtAddress(load_address);
-      to_delete.push_back(load_address);
+// One call less returns to address: remove its breakpoint once none does
+void Debugger::releaseReturnBreakpoint(uint64_t address) {
+  FunctionTrace& trace = m_function_trace;
+  auto it = trace.returns.find(address);
+  if (it == trace.returns.end() || --it->second > 0) {
+    return;
+  }
+  trace.returns.erase(it);
+  if (trace.owned.count(address) && !trace.entries.count(address)) {
+    removeBreakpoint(address);
+    trace.owned.erase(address);
+    m_internal_breakpoints.erase(address);
+  }
+}
+
+// After the program exited there is no code to restore
+void Debugger::removeFunctionTraceBreakpoints(bool exited) {
+  FunctionTrace& trace = m_function_trace;
+  for (uint64_t address : trace.owned) {
+    if (exited) {
+      m_breakpoints.erase(address);
+    } else {
+      removeBreakpoint(address);
+    }
+    m_internal_breakpoints.erase(address);
+  }
+  trace.owned.clear();
+  trace.returns.clear();
+  trace.pending.clear();
+}
+
+void Debugger::printFunctionTrace() {
+  std::vector<const TracedFunction*> functions;
+  for (const TracedFunction& function : m_function_trace.functions) {
+    if (function.calls) {
+      functions.push_back(&function);
     }
-    ++curr_line;
   }
+  std::sort(functions.begin(), functions.end(), [](auto* a, auto* b) { return a->calls > b->calls; });
 
-  uint64_t return_address = getReturnAddress();
-  if (!m_breakpoints.count(return_address)) {
-    setBreakpointAtAddress(return_address);
-    to_delete.push_back(return_address);
+  std::cout << std::left << std::setw(24) << "function" << std::right << std::setw(10) << "calls"
+            << std::setw(10) << "returned";
+  for (const char* column : { "min", "p50", "p90", "p99", "p99.9", "max", "mean" }) {
+    std::cout << std::setw(9) << column;
+  }
+  std::cout << "\n";
+  for (const TracedFunction* function : functions) {
+    const LatencyHistogram& latency = function->latency;
+    std::cout << std::left << std::setw(24) << function->name << std::right << std::dec << std::setw(10)
+              << function->calls << std::setw(10) << latency.count();
+    for (uint64_t value : { latency.min(), latency.percentile(50), latency.percentile(90), latency.percentile(99),
+                            latency.percentile(99.9), latency.max(), latency.mean() }) {
+      std::cout << std::setw(9) << formatNanoseconds(value);
+    }
+    std::cout << "\n";
+  }
+  if (m_function_trace.unwound) {
+    std::cout << m_function_trace.unwound << " calls were unwound without returning\n";
+  }
+  std::cout << std::flush;
+}
+
+void Debugger::printLatencyHistogram(const std::string& name) {
+  for (const TracedFunction& function : m_function_trace.functions) {
+    if (function.name != name) {
+      continue;
+    }
+    const LatencyHistogram& latency = function.latency;
+    uint64_t highest = 0;
+    for (size_t bucket = 0; bucket < LatencyHistogram::BUCKETS; ++bucket) {
+      highest = std::max(highest, latency.countAt(bucket));
+    }
+    constexpr int BAR_WIDTH = 40;
+    for (size_t bucket = 0; bucket < LatencyHistogram::BUCKETS; ++bucket) {
+      const uint64_t count = latency.countAt(bucket);
+      if (count) {
+        std::cout << std::setw(9) << formatNanoseconds(LatencyHistogram::lowestOf(bucket)) << " - "
+                  << std::left << std::setw(9) << formatNanoseconds(LatencyHistogram::highestOf(bucket))
+                  << std::right << std::dec << std::setw(10) << count << " "
+                  << std::string(std::max<uint64_t>(1, count * BAR_WIDTH / highest), '#') << "\n";
+      }
+    }
+    std::cout << std::flush;
+    return;
+  }
+  std::cerr << "Function " << name << " is not traced" << std::endl;
+}
+
+// Sampling profiler, see profile.h
+
+// Runs the program for seconds, sampling its stack hz times a second. Stops early at a breakpoint, a signal of
+// its own (which is left for the user, as continue does), its exit or Ctrl-C. Returns whether it is still running.
+// Between samples the event loop waits for the timer: a stop of the thread is seen when it comes.
+bool Debugger::profile(double seconds, unsigned hz) {
+  using clock = std::chrono::steady_clock;
+  Profile& profile = m_profile;
+  const auto period = std::chrono::nanoseconds(static_cast<uint64_t>(1e9 / std::max(hz, 1u)));
+  const uint64_t samples = profile.samples;
+
+  stepOverBreakpoint();
+  const auto start = clock::now();
+  const auto end = start + std::chrono::nanoseconds(static_cast<uint64_t>(seconds * 1e9));
+  auto next = start + period;
+  resumeThread(m_pid, Resume::cont);
+
+  bool running = true;
+  int wait_status;
+  while (true) {
+    bool last = next >= end;
+    m_events.setTimer(last ? end : next);
+    bool stopped = false;
+    while (true) {
+      const unsigned events = m_events.wait();
+      // The SIGCHLD may be another thread's (non-stop)
+      if ((events & EventLoop::child) && waitThread(m_pid, wait_status, false)) {
+        stopped = true;
+        break;
+      }
+      if (events & EventLoop::interrupt) {
+        last = true;   // the sample due now is the last
+        break;
+      }
+      if (events & EventLoop::timer) {
+        break;
+      }
+    }
+    m_events.cancelTimer();
+    const auto paused = clock::now();
+
+    // Stopped on its own meanwhile? Otherwise interrupt it. A pending interrupt would stop it again on the
+    // next continue, so it is only sent to a running tracee.
+    bool interrupted = false;
+    if (!stopped && !waitThread(m_pid, wait_status, false)) {
+      interrupted = Ptrace::interrupt(m_pid);
+      waitThread(m_pid, wait_status);
+    }
+    if (WIFEXITED(wait_status) || WIFSIGNALED(wait_status)) {
+      std::cout << "Program exited" << std::endl;
+      running = false;
+      break;
+    }
+
+    if (wait_status >> 16 != PTRACE_EVENT_STOP) {
+      const siginfo_t info = getSignalInfo();
+      m_resume_after_stop = false;
+      if (info.si_signo == SIGTRAP) {
+        handleSigtrap(info);
+      } else {
+        std::cout << "Got signal " << strsignal(info.si_signo) << std::endl;
+      }
+      if (interrupted) {
+        // From a signal stop the interrupt is taken before the tracee gets back to user mode: no instruction runs
+        resumeThread(m_pid, Resume::cont);
+        waitThread(m_pid, wait_status);
+      }
+      if (!m_resume_after_stop) {
+        break;
+      }
+      // The loader's r_brk, or a breakpoint whose condition is false: sampling goes on
+      m_resume_after_stop = false;
+      stepOverBreakpoint();
+      resumeThread(m_pid, Resume::cont);
+      continue;
+    }
+
+    user_regs_struct regs;
+    Ptrace::getRegisters(m_pid, &regs);
+    const std::vector<UnwindFrame> frames = m_unwinder.backtrace(regs, 256);
+    std::vector<uint64_t> stack;
+    stack.reserve(frames.size());
+    for (auto frame = frames.rbegin(); frame != frames.rend(); ++frame) {
+      stack.push_back(frame->pc);
+    }
+    ++profile.stacks[stack];
+    ++profile.samples;
+    if (last) {
+      break;   // and leave it stopped
+    }
+    resumeThread(m_pid, Resume::cont);
+    const auto resumed = clock::now();
+    profile.pauses.record(std::chrono::duration_cast<std::chrono::nanoseconds>(resumed - paused).count());
+
+    next += period;
+    if (next < resumed) {
+      // Sampling can't keep up with hz: skip the periods which are over rather than sample back to back
+      const auto behind = (resumed - next) / period + 1;
+      profile.missed += behind;
+      next += behind * period;
+    }
+  }
+  const double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  profile.seconds += elapsed;
+  std::cout << std::dec << profile.samples - samples << " samples in " << elapsed << " s" << std::endl;
+  return running;
+}
+
+// Function name for the folded stacks: from DWARF in the program, from the symbol tables in libraries.
+// pc of a caller is a return address, which can be past the end of the function (a call to a noreturn function).
+std::string Debugger::profileFrameName(uint64_t pc, bool innermost) {
+  const uint64_t address = innermost ? pc : pc - 1;
+  const Unwinder::Module* module = m_unwinder.findModule(address);
+  if (module && module->main_program) {
+    const std::string name = symbolize(address);
+    if (!name.empty()) {
+      return name.substr(0, name.rfind('+'));
+    }
+  }
+  const std::string name = m_unwinder.functionName(address);
+  if (!name.empty()) {
+    return name;
+  }
+  std::ostringstream hex;
+  hex << "0x" << std::hex << pc;
+  return hex.str();
+}
+
+// Samples per function: self (it was running) and total (it was on the stack)
+void Debugger::printProfile(size_t n_functions) {
+  const Profile& profile = m_profile;
+  std::unordered_map<uint64_t, std::string> names;
+  auto name_of = [&](uint64_t pc, bool innermost) -> const std::string& {
+    const uint64_t key = pc * 2 + innermost;
+    auto it = names.find(key);
+    return it != names.end() ? it->second : names.emplace(key, profileFrameName(pc, innermost)).first->second;
+  };
+
+  struct Samples {
+    uint64_t self = 0;
+    uint64_t total = 0;
+  };
+  std::unordered_map<std::string, Samples> functions;
+  for (const auto& [stack, count] : profile.stacks) {
+    std::unordered_set<std::string> seen;   // a recursive function counts once per sample
+    for (size_t i = 0; i < stack.size(); ++i) {
+      const std::string& name = name_of(stack[i], i + 1 == stack.size());
+      if (seen.insert(name).second) {
+        functions[name].total += count;
+      }
+    }
+    if (!stack.empty()) {
+      functions[name_of(stack.back(), true)].self += count;
+    }
   }
 
-  continueExecution();
+  std::vector<std::pair<std::string, Samples>> sorted(functions.begin(), functions.end());
+  std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+    return a.second.self != b.second.self ? a.second.self > b.second.self : a.second.total > b.second.total;
+  });
+  n_functions = std::min(n_functions, sorted.size());
 
-  for (auto addr : to_delete) {
-    removeBreakpoint(addr);
+  std::cout << std::dec << profile.samples << " samples, " << profile.stacks.size() << " distinct stacks";
+  if (profile.missed) {
+    std::cout << ", " << profile.missed << " periods missed";
+  }
+  const LatencyHistogram& pauses = profile.pauses;
+  std::cout << "\npause per sample: p50 " << formatNanoseconds(pauses.percentile(50)) << ", p99 "
+            << formatNanoseconds(pauses.percentile(99)) << ", max " << formatNanoseconds(pauses.max()) << ", "
+            << std::fixed << std::setprecision(2)
+            << (profile.seconds > 0 ? pauses.mean() * pauses.count() / (profile.seconds * 1e7) : 0.0)
+            << "% of the time\n";
+  const double percent = profile.samples ? 100.0 / profile.samples : 0;
+  std::cout << std::setw(8) << "self" << std::setw(8) << "%" << std::setw(8) << "total" << std::setw(8) << "%"
+            << "  function\n";
+  for (size_t i = 0; i < n_functions; ++i) {
+    const auto& [name, samples] = sorted[i];
+    std::cout << std::setw(8) << samples.self << std::setw(7) << samples.self * percent << "%" << std::setw(8)
+              << samples.total << std::setw(7) << samples.total * percent << "%  " << name << "\n";
   }
+  std::cout << std::defaultfloat << std::flush;
 }
 
-uint64_t Debugger::getReturnAddress() const {
-  // Return address is stored 8 bytes after the start of a stack frame.
-  uint64_t frame_pointer = getRegisterValue(m_pid, Reg::rbp);
-  return Ptrace::readMemory(m_pid, frame_pointer + 8);
+// One line per distinct stack, outermost function first: "main;parse;memcpy 42"
+void Debugger::writeFoldedStacks(std::ostream& out) {
+  std::map<std::string, uint64_t> folded;   // stacks with different pcs can have the same functions
+  for (const auto& [stack, count] : m_profile.stacks) {
+    std::string line;
+    for (size_t i = 0; i < stack.size(); ++i) {
+      line += (i ? ";" : "") + profileFrameName(stack[i], i + 1 == stack.size());
+    }
+    folded[line] += count;
+  }
+  for (const auto& [line, count] : folded) {
+    out << line << ' ' << std::dec << count << '\n';
+  }
+  out << std::flush;
 }
 
-uint64_t Debugger::unwindFramePointer(uint64_t& frame_pointer) const {
-  // Return address is stored 8 bytes after the start of a stack frame.
-  frame_pointer = Ptrace::readMemory(m_pid, frame_pointer);
-  return Ptrace::readMemory(m_pid, frame_pointer + 8);
-}
+// Source lines of many load addresses at once, pcs sorted: getLineEntryFromPc searches the units and then the line
+// table for every address, here the rows of each unit are sorted once and merged with the addresses.
+// Addresses without a line get ("", 0).
+std::vector<std::pair<std::string, unsigned>> Debugger::resolveLines(const std::vector<uint64_t>& pcs) {
+  std::vector<std::pair<std::string, unsigned>> lines(pcs.size(), { "", 0 });
+  struct Row {
+    uint64_t address;
+    unsigned line;
+    const std::string* file;   // nullptr: end of a sequence, no line until the next row
+  };
+  for (const auto& compilation_unit : m_dwarf.compilation_units()) {
+    const auto range = die_pc_range(compilation_unit.root());
+    std::vector<size_t> in_unit;
+    for (size_t i = 0; i < pcs.size(); ++i) {
+      if (lines[i].second == 0 && range.contains(offsetLoadAddress(pcs[i]))) {
+        in_unit.push_back(i);
+      }
+    }
+    if (in_unit.empty()) {
+      continue;
+    }
 
-// Debugger Part 7: Source-level breakpoints
-// https://blog.tartanllama.xyz/writing-a-linux-debugger-source-break/
-//    DWARF contains the address ranges of functions and a line table which lets you
-// translate code positions between abstraction levels.
+    std::vector<Row> rows;
+    for (const auto& entry : compilation_unit.get_line_table()) {
+      rows.push_back({ entry.address, entry.line, entry.end_sequence ? nullptr : &entry.file->path });
+    }
+    // Sequences may come in any order, within one the addresses only grow
+    std::stable_sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) { return a.address < b.address; });
 
-//  Function entry (onyly for global scope)
-//  Idea:
-//    Iterate through all of the CU and search for functions with names which match what we’re looking for.
-void Debugger::setBreakpointAtFunction(const std::string& name) {
-  for (const auto& compilation_unit : m_dwarf.compilation_units()) {
-    for (const auto& die : compilation_unit.root()) {
-      if (die.has(dwarf::DW_AT::name) && at_name(die) == name) {
-        auto low_pc = at_low_pc(die);
-        // DW_AT_low_pc for a function points to the start of the prologue.
-        auto entry = getLineEntryFromPc(low_pc, false);
-        // Hack: increment the line entry by one to get the first line of the user code instead of the prologue.
-        ++entry;
-        setBreakpointAtAddress(offsetDwarfAddress(entry->address));
+    size_t row = 0;
+    for (size_t i : in_unit) {
+      const uint64_t address = offsetLoadAddress(pcs[i]);
+      while (row < rows.size() && rows[row].address <= address) {
+        ++row;
+      }
+      if (row > 0 && rows[row - 1].file) {
+        lines[i] = { *rows[row - 1].file, rows[row - 1].line };
       }
     }
   }
+  return lines;
 }
 
-// Source line
-//  Idea: Translate this line number into an address by looking it up in the DWARF.
-//  1. Iterate through the CU looking for one whose name matches the given file.
-//  2. Look for the entry which corresponds to the given line.
-void Debugger::setBreakpointAtSourceLine(const std::string& file_name, uint32_t line_number) {
-  for (const auto& compilation_unit : m_dwarf.compilation_units()) {
-    if (is_suffix(file_name, at_name(compilation_unit.root()))) {
-      const auto& line_table = compilation_unit.get_line_table();
+// Samples of the profile in function, by source line and by instruction
+void Debugger::annotate(const std::string& name) {
+  const std::pair<uint64_t, uint64_t> range = getFunctionRange(getFunctionByName(name));
 
-      for (const auto& entry : line_table) {
-        // entry.is_stmt is checking that the line table entry is marked as the beginning of a statement,
-        // which is set by the compiler on the address it thinks is the best target for a breakpoint.
-        if (entry.is_stmt && entry.line == line_number) {
-          setBreakpointAtAddress(offsetDwarfAddress(entry.address));
-          return;
-        }
-      }
+  // Only where the program was running (the innermost pc), not the calls it was in the middle of
+  std::map<uint64_t, uint64_t> hits;
+  uint64_t samples = 0;
+  for (const auto& [stack, count] : m_profile.stacks) {
+    if (!stack.empty() && stack.back() >= range.first && stack.back() < range.second) {
+      hits[stack.back()] += count;
+      samples += count;
     }
   }
-}
+  if (samples == 0) {
+    std::cout << "No samples in " << name << " (" << std::dec << m_profile.samples << " samples in the profile)"
+              << std::endl;
+    return;
+  }
 
-// Symbol lookup
-// Idea: take a look at the .symtab section of a binary, produced with readelf
-std::vector<Symbol> Debugger::lookupSymbol(const std::string& name) {
-  std::vector<Symbol> symbols;
-  for (const auto &section : m_elf.sections()) {
-    const elf::sht section_type = section.get_hdr().type;
-    if (section_type != elf::sht::symtab && section_type != elf::sht::dynsym) {
-      continue;
+  std::vector<uint64_t> pcs;
+  for (const auto& [pc, count] : hits) {
+    pcs.push_back(pc);
+  }
+  const std::vector<std::pair<std::string, unsigned>> lines = resolveLines(pcs);
+  std::map<std::pair<std::string, unsigned>, uint64_t> line_hits;
+  for (size_t i = 0; i < pcs.size(); ++i) {
+    line_hits[lines[i]] += hits[pcs[i]];
+  }
+
+  // The source of the function: the lines its own rows in the line table span (inlined code from other files
+  // is listed below it)
+  const std::string file = getLineEntryFromPc(range.first)->file->path;
+  unsigned first_line = UINT_MAX;
+  unsigned last_line = 0;
+  const dwarf::line_table& line_table = getLineTableFromPc(offsetLoadAddress(range.first));
+  for (const auto& entry : line_table) {
+    const uint64_t address = offsetDwarfAddress(entry.address);
+    if (address >= range.first && address < range.second && !entry.end_sequence && entry.file->path == file) {
+      first_line = std::min(first_line, entry.line);
+      last_line = std::max(last_line, entry.line);
     }
+  }
 
-    for (const elf::sym symbol : section.as_symtab()) {
-      const std::string& symbol_name = symbol.get_name();
-      if (symbol_name == name) {
-        symbols.emplace_back(symbol.get_data(), symbol_name);
+  const double percent = 100.0 / samples;
+  auto margin = [percent](uint64_t count) {
+    std::ostringstream text;
+    if (count) {
+      text << std::dec << std::setw(8) << count << std::fixed << std::setprecision(1) << std::setw(7)
+           << count * percent << "%  ";
+    } else {
+      text << std::string(18, ' ');
+    }
+    return text.str();
+  };
+
+  std::cout << std::dec << samples << " samples in " << name << " (" << std::fixed << std::setprecision(1)
+            << samples * 100.0 / m_profile.samples << "% of " << m_profile.samples << ")" << std::defaultfloat
+            << "\n" << file << ":\n";
+  printSourceLines(file, first_line, last_line, 0, [&](uint32_t line) {
+    auto it = line_hits.find({ file, line });
+    return margin(it != line_hits.end() ? it->second : 0);
+  });
+  for (const auto& [location, count] : line_hits) {
+    if (location.first != file) {
+      std::cout << margin(count) << (location.second ? location.first + ":" + std::to_string(location.second)
+                                                     : std::string("(no line)")) << "\n";
+    }
+  }
+  std::cout << "\n";
+  disassemble(range.first, range.second, [&](uint64_t address) {
+    auto it = hits.find(address);
+    return margin(it != hits.end() ? it->second : 0);
+  });
+}
+
+// Lines of samples per second: a sample at a random instruction of the program's functions, resolved one at a time
+// with getLineEntryFromPc and in a batch with resolveLines
+void Debugger::benchmarkLines(uint64_t samples) {
+  using clock = std::chrono::steady_clock;
+  std::vector<std::pair<uint64_t, uint64_t>> functions;
+  for (const auto& compilation_unit : m_dwarf.compilation_units()) {
+    for (const auto& die : m_split_dwarf.resolve(compilation_unit).root()) {
+      if (die.tag == dwarf::DW_TAG::subprogram && die.has(dwarf::DW_AT::low_pc) && die.has(dwarf::DW_AT::high_pc)) {
+        functions.push_back(getFunctionRange(die));
       }
     }
   }
+  if (functions.empty()) {
+    std::cerr << "No functions with code in the program" << std::endl;
+    return;
+  }
+  std::mt19937_64 random(42);
+  std::vector<uint64_t> pcs(samples);
+  for (uint64_t& pc : pcs) {
+    const auto& function = functions[random() % functions.size()];
+    pc = function.first + random() % std::max<uint64_t>(function.second - function.first, 1);
+  }
 
-  return symbols;
+  // One at a time, on a slice: at this rate all of them would take too long
+  const size_t slice = std::min<size_t>(pcs.size(), 20000);
+  auto start = clock::now();
+  uint64_t found = 0;
+  for (size_t i = 0; i < slice; ++i) {
+    try {
+      found += getLineEntryFromPc(pcs[i])->line != 0;
+    } catch (std::out_of_range&) {
+    }
+  }
+  const double single = std::chrono::duration<double>(clock::now() - start).count() / std::max<size_t>(slice, 1);
+
+  // The way annotate does it: count by address, then resolve the distinct addresses together
+  start = clock::now();
+  std::unordered_map<uint64_t, uint64_t> hits;
+  for (uint64_t pc : pcs) {
+    ++hits[pc];
+  }
+  std::vector<uint64_t> distinct;
+  distinct.reserve(hits.size());
+  for (const auto& [pc, count] : hits) {
+    distinct.push_back(pc);
+  }
+  std::sort(distinct.begin(), distinct.end());
+  const auto lines = resolveLines(distinct);
+  const double batched = std::chrono::duration<double>(clock::now() - start).count();
+
+  std::cout << std::dec << samples << " samples over " << functions.size() << " functions, " << distinct.size()
+            << " distinct addresses\n" << std::fixed << std::setprecision(3)
+            << "  one at a time  " << single * samples << " s (measured on " << slice << ", "
+            << std::setprecision(0) << 1 / single << " samples/s)\n" << std::setprecision(3)
+            << "  batched        " << batched << " s (" << std::setprecision(0) << samples / batched
+            << " samples/s)\n" << std::defaultfloat << std::flush;
 }
 
 // Debugger Part 8: Stack unwinding
@@ -576,27 +3439,34 @@ std::vector<Symbol> Debugger::lookupSymbol(const std::string& name) {
 //            << ' ' << dwarf::at_name(func_dwarf_addr) << std::endl;
 //}
 
-void Debugger::printBacktrace() {
-  auto output_frame = [frame_number = 0] (auto&& func) mutable {
-    std::cout << "frame #" << frame_number++ << ": 0x" << dwarf::at_low_pc(func)
-              << ' ' << dwarf::at_name(func) << std::endl;
-  };
-  dwarf::die current_func = getFunctionFromPc(getPc());
-  output_frame(current_func);
-
-  uint64_t frame_pointer = getRegisterValue(m_pid, Reg::rbp);
-  uint64_t return_address = Ptrace::readMemory(m_pid, frame_pointer + 8);
-
-  // Options:
-  // 1. To keep unwinding until the debugger hits main
-  // 2. To stop when the frame pointer is 0x0, which will get you the functions which your implementation
-  // called before main as well.
-  // Idea:
-  //  To grab the frame pointer and return address from each frame and print out the information as we go.
-  while (dwarf::at_name(current_func) != "main") {
-    current_func = getFunctionFromPc(return_address);
-    output_frame(current_func);
-    return_address = unwindFramePointer(frame_pointer);
+// The frame pointer chain above is only there when every function keeps one (-O0 or -fno-omit-frame-pointer).
+// The frames come from the unwinder instead (see unwinder.h), through the libraries as well.
+void Debugger::printBacktrace(size_t max_frames) {
+  user_regs_struct regs;
+  m_target->getRegisters(regs);
+  const std::vector<UnwindFrame> frames = m_unwinder.backtrace(regs, max_frames + 1);
+  for (size_t i = 0; i < std::min(frames.size(), max_frames); ++i) {
+    const UnwindFrame& frame = frames[i];
+    std::string description;
+    const Unwinder::Module* module = m_unwinder.findModule(frame.pc);
+    if (module && module->main_program) {
+      description = symbolize(frame.pc);
+      // The line of the call, not of the instruction after it
+      try {
+        auto line_entry = getLineEntryFromPc(i == 0 || frame.signal_frame ? frame.pc : frame.pc - 1);
+        description += " at " + line_entry->file->path + ":" + std::to_string(line_entry->line);
+      } catch (std::out_of_range&) {
+      }
+    } else {
+      // The line of the call here too
+      description = m_unwinder.symbolize(frame.pc) +
+                    librarySourceLine(i == 0 || frame.signal_frame ? frame.pc : frame.pc - 1);
+    }
+    std::cout << "frame #" << std::dec << i << ": 0x" << std::hex << frame.pc << ' ' << description
+              << (frame.from_cfi ? "" : " (frame pointer)") << std::endl;
+  }
+  if (frames.size() > max_frames) {
+    std::cout << "(more frames follow)" << std::endl;
   }
 }
 
@@ -625,40 +3495,654 @@ void Debugger::printBacktrace() {
 //    A variable whose location moves between registers depending on the current value of the program counter
 
 
-void Debugger::readVariables() {
-  // find the function which we’re currently in
-  auto func = getFunctionFromPc(getPc());
+// The variables visible at pc, innermost scope first, from the scopes of the function built once
+void Debugger::printVariables(bool parameters, bool locals) {
+  user_regs_struct regs;
+  m_target->getRegisters(regs);
+  const uint64_t pc = offsetLoadAddress(regs.rip);
+  const FunctionScopes* function = m_scopes.function(pc);
+  if (!function) {
+    std::cerr << "No debug information for the function at 0x" << std::hex << regs.rip << std::endl;
+    return;
+  }
+
+  UnwindFrame frame;
+  size_t printed = 0;
+  for (const ScopeVariable* variable : m_scopes.visible(*function, pc)) {
+    if (variable->parameter ? !parameters : !locals) {
+      continue;
+    }
+    ++printed;
+    std::cout << variable->name;
+    try {
+      ExpressionValue value;
+      variableValue(*variable, function, regs, frame, value);
+      // The value printer walks DW_AT_type and reads the whole object at once
+      if (value.lvalue) {
+        std::cout << " (0x" << std::hex << value.address << ") = " << m_value_printer.print(*value.type, value.address);
+      } else {
+        std::cout << " = " << m_value_printer.format(*value.type, value.bytes.data(), value.bytes.size());
+      }
+    } catch (ExpressionError& e) {
+      std::cout << " = <" << e.what() << ">";
+    }
+    std::cout << std::endl;
+  }
+  if (printed == 0) {
+    std::cout << (locals ? parameters ? "No variables." : "No locals." : "No arguments.") << std::endl;
+  }
+}
 
-  // loop through the entries in that function, looking for variables
-  for (const auto& die : func) {
-    if (die.tag == dwarf::DW_TAG::variable) {
-      auto loc_val = die[dwarf::DW_AT::location];
+// Expressions are evaluated in the innermost frame: its CFA is only unwound when a local variable is needed
+ExpressionValue Debugger::evaluateExpression(const std::string& text) {
+  user_regs_struct regs;
+  m_target->getRegisters(regs);
+  UnwindFrame frame;
+  return m_expressions.evaluate(
+      text,
+      [&](const std::string& name, ExpressionValue& value) { return lookupName(name, regs, frame, value); },
+      [this](const std::string& name) { return lookupType(name); });
+}
 
-      if (loc_val.get_type() == dwarf::value::type::exprloc) {
-        ExpressionContext context{m_pid, m_load_address};
-        auto result = loc_val.as_exprloc().evaluate(&context);
+// Registers ($rip), then the variables and parameters visible at pc, then the globals
+bool Debugger::lookupName(const std::string& name, const user_regs_struct& regs, UnwindFrame& frame,
+                          ExpressionValue& value) {
+  if (name[0] == '$') {
+    for (size_t i = 0; i < n_registers; ++i) {
+      if (GLOBAL_REGISTER_DESC_TABLE[i].name == name.substr(1)) {
+        // user_regs_struct has the layout of the table. Addresses are void *, they print in hex.
+        const uint64_t contents = reinterpret_cast<const uint64_t*>(&regs)[i];
+        const Reg reg = GLOBAL_REGISTER_DESC_TABLE[i].r;
+        value.type = reg == Reg::rip || reg == Reg::rsp || reg == Reg::rbp
+                         ? &m_value_printer.pointerTo(*m_value_printer.builtin("void"))
+                         : m_value_printer.builtin("unsigned long");
+        std::memcpy(value.bytes.data(), &contents, sizeof(contents));
+        return true;
+      }
+    }
+    return false;
+  }
 
-        const uint64_t offset_address = result.value;
-//        std::cout << "offset_address" << (void *)offset_address << "\n";
-        switch (result.location_type) {
-          case dwarf::expr_result::type::address:
-          {
-            auto value = Ptrace::readMemory(m_pid, offset_address);
-            std::cout << at_name(die) << " (0x" << std::hex << offset_address << ") = " << value << std::endl;
-            break;
-          }
-          case dwarf::expr_result::type::reg:
-          {
-            auto value = getRegisterValueFromDwarfRegister(m_pid, offset_address);
-            std::cout << at_name(die) << " (reg " << offset_address << ") = " << value << std::endl;
-            break;
+  const uint64_t pc = offsetLoadAddress(regs.rip);
+  if (const FunctionScopes* function = m_scopes.function(pc)) {
+    for (const ScopeVariable* variable : m_scopes.visible(*function, pc)) {
+      if (variable->name == name) {
+        variableValue(*variable, function, regs, frame, value);
+        return true;
+      }
+    }
+  }
+  for (const auto& compilation_unit : m_dwarf.compilation_units()) {
+    for (const auto& die : m_split_dwarf.resolve(compilation_unit).root()) {
+      if (die.tag == dwarf::DW_TAG::variable && die.has(dwarf::DW_AT::location) && die.has(dwarf::DW_AT::name) &&
+          at_name(die) == name) {
+        variableValue({name, die, die, false}, nullptr, regs, frame, value);
+        return true;
+      }
+      // Enumerators of the enumerations at namespace scope: ref.color == green
+      if (die.tag == dwarf::DW_TAG::enumeration_type) {
+        const TypeLayout& type = m_value_printer.layout(die);
+        for (const auto& [number, enumerator] : type.enumerators) {
+          if (enumerator == name) {
+            value.type = &type;
+            std::memcpy(value.bytes.data(), &number, std::min<size_t>(type.size, sizeof(number)));
+            return true;
           }
-          default:
-            throw std::runtime_error{"Unhandled variable location"};
         }
-      } else {
-        throw std::runtime_error{"Unhandled variable location"};
       }
     }
   }
-}
\ No newline at end of file
+  return false;
+}
+
+// The location description at pc, evaluated in the innermost frame. The frame is unwound (for its CFA) the first
+// time a variable isn't a global: registers and DW_OP_fbreg need it.
+void Debugger::variableValue(const ScopeVariable& variable, const FunctionScopes* function,
+                             const user_regs_struct& regs, UnwindFrame& frame, ExpressionValue& value) {
+  using dwarf::DW_AT;
+  value.type = &m_value_printer.layout(variable.declaration);
+  const uint8_t* ops = nullptr;
+  size_t size = 0;
+  if (!m_scopes.location(variable.die, offsetLoadAddress(regs.rip), ops, size)) {
+    // Constants the optimizer folded away keep their value
+    const dwarf::die& constant = variable.die.has(DW_AT::const_value) ? variable.die : variable.declaration;
+    if (!constant.has(DW_AT::const_value)) {
+      throw ExpressionError(variable.name + " is optimized out");
+    }
+    const dwarf::value contents = constant[DW_AT::const_value];
+    if (contents.get_type() == dwarf::value::type::block) {
+      size_t length = 0;
+      const void* block = contents.as_block(&length);
+      std::memcpy(value.bytes.data(), block, std::min(length, value.bytes.size()));
+    } else {
+      const uint64_t number = contents.get_type() == dwarf::value::type::sconstant ? contents.as_sconstant()
+                                                                                    : contents.as_uconstant();
+      std::memcpy(value.bytes.data(), &number, sizeof(number));
+    }
+    return;
+  }
+
+  if (!frame.valid) {
+    frame = m_unwinder.backtrace(regs, 2).front();
+  }
+  // The frame base of gcc is DW_OP_call_frame_cfa, of clang -O0 DW_OP_reg6 (rbp)
+  VariableLocation base;
+  const bool has_base = function && function->frame_base &&
+                        m_unwinder.locate(function->frame_base, function->frame_base_size, frame, nullptr,
+                                          m_load_address, base);
+  if (has_base && base.kind == VariableLocation::Kind::reg) {
+    base.value = base.value < CFI_REGISTERS && frame.has(base.value) ? frame.registers[base.value] : 0;
+  }
+  VariableLocation location;
+  // DW_OP_addr (globals, statics, &table[0] as a value at -O2) is a link-time address of the program
+  if (!m_unwinder.locate(ops, size, frame, has_base ? &base.value : nullptr, m_load_address, location)) {
+    throw ExpressionError("Can't locate " + variable.name + " at this pc");
+  }
+  switch (location.kind) {
+    case VariableLocation::Kind::memory:
+      value.lvalue = true;
+      value.address = location.value;
+      return;
+    case VariableLocation::Kind::reg:
+      // The vector registers (floating point at -O2) aren't in the frame
+      if (location.value >= CFI_REGISTERS || !frame.has(location.value)) {
+        throw ExpressionError(variable.name + " is in DWARF register " + std::to_string(location.value) +
+                              " which can't be read");
+      }
+      std::memcpy(value.bytes.data(), &frame.registers[location.value], sizeof(uint64_t));
+      return;
+    case VariableLocation::Kind::value:
+      std::memcpy(value.bytes.data(), &location.value, sizeof(location.value));
+      return;
+  }
+}
+
+// Types for casts: the first structure, class, union, enumeration, typedef or base type with that name
+const TypeLayout* Debugger::lookupType(const std::string& name) {
+  auto cached = m_named_types.find(name);
+  if (cached != m_named_types.end()) {
+    return cached->second;
+  }
+  const TypeLayout* found = nullptr;
+  for (const auto& compilation_unit : m_dwarf.compilation_units()) {
+    for (const auto& die : m_split_dwarf.resolve(compilation_unit).root()) {
+      const bool type = die.tag == dwarf::DW_TAG::structure_type || die.tag == dwarf::DW_TAG::class_type ||
+                        die.tag == dwarf::DW_TAG::union_type || die.tag == dwarf::DW_TAG::enumeration_type ||
+                        die.tag == dwarf::DW_TAG::typedef_ || die.tag == dwarf::DW_TAG::base_type;
+      if (type && !die.has(dwarf::DW_AT::declaration) && die.has(dwarf::DW_AT::name) && at_name(die) == name) {
+        found = &m_value_printer.layout(die);
+        break;
+      }
+    }
+    if (found) {
+      break;
+    }
+  }
+  return m_named_types[name] = found;
+}
+
+void Debugger::printExpression(const std::string& text) {
+  try {
+    const ExpressionValue value = evaluateExpression(text);
+    std::cout << m_expressions.format(value) << std::endl;
+  } catch (ExpressionError& e) {
+    std::cerr << e.what() << std::endl;
+  }
+}
+
+// A breakpoint without a condition always stops, and so does one whose condition can't be evaluated
+bool Debugger::breakpointConditionHolds(uint64_t address) {
+  auto breakpoint = m_breakpoints.find(address);
+  if (breakpoint == m_breakpoints.end() || breakpoint->second.getCondition().empty()) {
+    return true;
+  }
+  try {
+    return m_expressions.isTrue(evaluateExpression(breakpoint->second.getCondition()));
+  } catch (ExpressionError& e) {
+    std::cerr << "Error in the condition of the breakpoint at 0x" << std::hex << address << ": " << e.what()
+              << std::endl;
+    return true;
+  }
+}
+
+void Debugger::printDisplays() {
+  if (m_exited) {
+    return;
+  }
+  for (size_t i = 0; i < m_displays.size(); ++i) {
+    std::cout << std::dec << i + 1 << ": " << m_displays[i] << " = ";
+    try {
+      const ExpressionValue value = evaluateExpression(m_displays[i]);
+      std::cout << m_expressions.format(value) << std::endl;
+    } catch (ExpressionError& e) {
+      std::cout << "<" << e.what() << ">" << std::endl;
+    }
+  }
+}
+
+// x/<count><format><unit> [address]: count units of memory, read at once and formatted into a buffer written out by
+// chunks of lines. Without an address it goes on after the last unit shown.
+void Debugger::examine(const std::string& spec, const std::string& expression) {
+  if (!parseExamineFormat(spec, m_examine)) {
+    std::cerr << "Usage: x/<count><format><unit> <address>, format x d u o t c a f s i, unit b h w g" << std::endl;
+    return;
+  }
+  uint64_t address = m_examine_next;
+  if (!expression.empty()) {
+    try {
+      address = m_expressions.address(evaluateExpression(expression));
+    } catch (ExpressionError& e) {
+      std::cerr << e.what() << std::endl;
+      return;
+    }
+  }
+
+  if (m_examine.format == 'i') {
+    const std::vector<Instruction> instructions = decodeRange(address, address + m_examine.count * 15);
+    if (instructions.empty()) {
+      std::cerr << "No instruction decodes at 0x" << std::hex << address << std::endl;
+      return;
+    }
+    m_examine_next = instructions[std::min(m_examine.count, instructions.size()) - 1].next();
+    disassemble(address, m_examine_next);
+    return;
+  }
+  if (m_examine.format == 's') {
+    examineStrings(address);
+    return;
+  }
+
+  const size_t size = m_examine.count * m_examine.unit;
+  std::vector<uint8_t> bytes(size);
+  const size_t read = m_target->readAvailable(address, bytes.data(), size);
+  restoreBreakpointBytes(address, bytes.data(), read);
+  const Symbolizer symbolizer = [this](uint64_t value) {
+    return value >= m_load_address ? symbolize(value) : std::string();
+  };
+  const size_t chunk = unitsPerLine(m_examine) * m_examine.unit * 4096;
+  std::string out;
+  for (size_t done = 0; done < read; done += chunk) {
+    out.clear();
+    formatUnits(out, address + done, bytes.data() + done, std::min(chunk, read - done), m_examine, symbolizer);
+    std::cout.write(out.data(), out.size());
+  }
+  std::cout << std::flush;
+  if (read < size) {
+    std::cerr << "Cannot access memory at 0x" << std::hex << address + read << std::endl;
+  }
+  m_examine_next = address + read / m_examine.unit * m_examine.unit;
+}
+
+// NUL-terminated strings, each cut at print-characters, from windows of a page read at once
+void Debugger::examineStrings(uint64_t address) {
+  constexpr size_t WINDOW = 4096;
+  std::vector<char> window(WINDOW);
+  uint64_t window_address = 0;
+  size_t window_size = 0;
+  std::string out;
+  for (size_t i = 0; i < m_examine.count; ++i) {
+    char text[20];
+    out += "0x";
+    out.append(text, std::to_chars(text, text + sizeof(text), address, 16).ptr);
+    out += ":\t\"";
+    const uint64_t start = address;
+    bool ended = false;
+    bool unreadable = false;
+    while (address - start < m_value_printer.max_characters) {
+      if (address < window_address || address >= window_address + window_size) {
+        window_address = address;
+        window_size = m_target->readAvailable(address, window.data(), WINDOW);
+        if (window_size == 0) {
+          unreadable = true;
+          break;
+        }
+      }
+      const char c = window[address - window_address];
+      ++address;
+      if (c == '\0') {
+        ended = true;
+        break;
+      }
+      appendEscaped(out, c);
+    }
+    out += ended ? "\"\n" : unreadable ? "\" <unreadable>\n" : "\"...\n";
+    if (unreadable) {
+      break;
+    }
+  }
+  std::cout << out << std::flush;
+  m_examine_next = address;
+}
+
+// Any number of bytes in one transfer. The breakpoints in the range are lifted around the write and planted again,
+// so they keep the new bytes as their original ones.
+bool Debugger::writeMemory(uint64_t address, const std::vector<uint8_t>& bytes) {
+  return writeMemory(address, bytes.data(), bytes.size());
+}
+
+bool Debugger::writeMemory(uint64_t address, const uint8_t* bytes, size_t size) {
+  std::vector<BreakPoint*> covered;
+  for (auto& [bp_address, bp] : m_breakpoints) {
+    if (bp.isEnabled() && bp_address >= address && bp_address < address + size) {
+      bp.disable();
+      covered.push_back(&bp);
+    }
+  }
+  const bool written = Ptrace::writeBytes(m_pid, address, bytes, size);
+  for (BreakPoint* bp : covered) {
+    bp->enable();
+  }
+  m_instruction_cache.invalidate(address, size);
+  m_scratch_holds = 0;
+  return written;
+}
+
+// Formats bytes of memory as x/<n>xg does (one read, formatted into a buffer), then reading them a word at a time
+// with PTRACE_PEEKDATA into a stream flushed with std::endl per word. Both outputs are discarded.
+void Debugger::benchmarkExamine(const std::string& expression, size_t bytes) {
+  using clock = std::chrono::steady_clock;
+  uint64_t address;
+  try {
+    address = m_expressions.address(evaluateExpression(expression));
+  } catch (ExpressionError& e) {
+    std::cerr << e.what() << std::endl;
+    return;
+  }
+  bytes = bytes / sizeof(uint64_t) * sizeof(uint64_t);
+  std::ofstream null("/dev/null");
+  auto report = [](const char* what, clock::time_point start, size_t read, size_t syscalls) {
+    const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+    std::cout << "  " << std::left << std::setw(14) << what << std::right << std::dec << std::fixed
+              << std::setprecision(4) << seconds << " s, " << read << " bytes, " << syscalls << " reads\n"
+              << std::defaultfloat;
+  };
+
+  ExamineFormat format;
+  format.format = 'x';
+  format.unit = sizeof(uint64_t);
+  auto start = clock::now();
+  std::vector<uint8_t> buffer(bytes);
+  const size_t read = Ptrace::readAvailable(m_pid, address, buffer.data(), bytes);
+  std::string out;
+  formatUnits(out, address, buffer.data(), read, format);
+  null.write(out.data(), out.size());
+  null.flush();
+  report("bulk", start, read, 1);
+
+  start = clock::now();
+  size_t peeked = 0;
+  for (; peeked < read; peeked += sizeof(uint64_t)) {
+    errno = 0;
+    const long word = ptrace(PTRACE_PEEKDATA, m_pid, address + peeked, nullptr);
+    if (errno) {
+      break;
+    }
+    if (peeked % 16 == 0) {
+      null << "0x" << std::hex << address + peeked << ":";
+    }
+    null << "\t0x" << std::setw(16) << std::setfill('0') << static_cast<uint64_t>(word) << std::setfill(' ');
+    if (peeked % 16 == 8) {
+      null << std::endl;
+    }
+  }
+  null << std::endl;
+  report("word by word", start, peeked, peeked / sizeof(uint64_t));
+}
+
+// find[/<count>][b|h|w|g] <start>, <end|+length>, <pattern>: every readable mapping in the range is searched by
+// chunks of megabytes, the first count matches printed (all of them by default)
+void Debugger::findMemory(const std::string& spec, const std::string& arguments) {
+  using clock = std::chrono::steady_clock;
+  auto usage = []() {
+    std::cerr << "Usage: find[/<count>][b|h|w|g] <start>, <end|+length>, \"string\" | bytes 7f 45 ?? 46 | "
+                 "<values> [mask <value>]" << std::endl;
+  };
+  unsigned unit = sizeof(uint64_t);
+  uint64_t max_matches = UINT64_MAX;
+  for (size_t i = 1; i < spec.size(); ++i) {
+    if (std::isdigit(static_cast<unsigned char>(spec[i]))) {
+      size_t digits;
+      max_matches = std::stoull(spec.substr(i), &digits);
+      i += digits - 1;
+    } else if (spec[i] == 'b' || spec[i] == 'h' || spec[i] == 'w' || spec[i] == 'g') {
+      unit = spec[i] == 'b' ? 1 : spec[i] == 'h' ? 2 : spec[i] == 'w' ? 4 : 8;
+    } else {
+      usage();
+      return;
+    }
+  }
+  const size_t first_comma = arguments.find(',');
+  const size_t second_comma = first_comma == std::string::npos ? first_comma : arguments.find(',', first_comma + 1);
+  if (second_comma == std::string::npos || max_matches == 0) {
+    usage();
+    return;
+  }
+
+  SearchPattern pattern;
+  std::string error;
+  if (!parsePattern(arguments.substr(second_comma + 1), unit, pattern, error)) {
+    std::cerr << error << std::endl;
+    return;
+  }
+  uint64_t low;
+  uint64_t high;
+  if (!evaluateRange(arguments.substr(0, first_comma),
+                     arguments.substr(first_comma + 1, second_comma - first_comma - 1), low, high)) {
+    return;
+  }
+
+  const auto start = clock::now();
+  std::string out;
+  uint64_t last = 0;
+  auto found = [&](uint64_t address, const MemoryRegion& region) {
+    char text[20];
+    out += "0x";
+    out.append(text, std::to_chars(text, text + sizeof(text), address, 16).ptr);
+    if (!region.name.empty()) {
+      out += "  ";
+      out += region.name;
+    }
+    out += '\n';
+    if (out.size() > 1 << 16) {
+      std::cout.write(out.data(), out.size());
+      out.clear();
+    }
+    last = address;
+    return --max_matches > 0;
+  };
+  const SearchStatistics statistics = searchMemory(m_pid, readableRegions(m_pid, low, high), pattern, found,
+    [this](uint64_t address, uint8_t* bytes, size_t size) { restoreBreakpointBytes(address, bytes, size); });
+  const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+  std::cout.write(out.data(), out.size());
+
+  std::cout << std::dec << statistics.matches << (statistics.matches == 1 ? " match, " : " matches, ") << std::fixed
+            << std::setprecision(1);
+  if (statistics.bytes < 1 << 20) {
+    std::cout << statistics.bytes << " bytes";
+  } else {
+    std::cout << statistics.bytes / 1048576.0 << " MB";
+  }
+  std::cout << " searched in " << statistics.regions
+            << (statistics.regions == 1 ? " region (" : " regions (") << statistics.reads << " reads), "
+            << std::setprecision(4) << seconds << " s, " << std::setprecision(2)
+            << (seconds > 0 ? statistics.bytes / seconds / 1e9 : 0.0) << " GB/s" << std::defaultfloat << std::endl;
+  if (statistics.matches) {
+    m_examine_next = last;
+  }
+}
+
+// [low, high) from the expressions of its start and of its end, or of its length after a '+'
+bool Debugger::evaluateRange(const std::string& start, const std::string& end, uint64_t& low, uint64_t& high) {
+  try {
+    low = m_expressions.address(evaluateExpression(start));
+    const size_t first = end.find_first_not_of(" \t");
+    const bool length = first != std::string::npos && end[first] == '+';
+    high = m_expressions.address(evaluateExpression(length ? end.substr(first + 1) : end));
+    if (length) {
+      high = high > UINT64_MAX - low ? UINT64_MAX : low + high;
+    }
+  } catch (ExpressionError& e) {
+    std::cerr << e.what() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// A line on stderr rewritten at most twice a second, erased at the end
+TransferProgress Debugger::transferProgress(const char* what) {
+  using clock = std::chrono::steady_clock;
+  return [what, last = clock::now(), shown = false](uint64_t done, uint64_t total) mutable {
+    const auto now = clock::now();
+    if (done < total && now - last < std::chrono::milliseconds(500)) {
+      return;
+    }
+    if (done < total) {
+      std::cerr << '\r' << what << ' ' << done * 100 / total << "% (" << (done >> 20) << " of " << (total >> 20)
+                << " MB)" << std::flush;
+      shown = true;
+      last = now;
+    } else if (shown) {
+      std::cerr << "\r\033[K" << std::flush;
+    }
+  };
+}
+
+// dump memory <file> <start> <end|+length>: read by chunks of 64 MB into one page-aligned buffer, each written to the
+// file with write(2) before the next is read
+void Debugger::dumpMemoryToFile(const std::string& path, const std::string& range) {
+  using clock = std::chrono::steady_clock;
+  // "start end", or "start, end" for expressions with spaces
+  size_t separator = range.find(',');
+  size_t end_at = separator + 1;
+  if (separator == std::string::npos) {
+    separator = range.find_first_of(" \t");
+    end_at = separator;
+  }
+  uint64_t low;
+  uint64_t high;
+  if (separator == std::string::npos) {
+    std::cerr << "Usage: dump memory <file> <start> <end|+length>" << std::endl;
+    return;
+  }
+  if (!evaluateRange(range.substr(0, separator), range.substr(end_at), low, high)) {
+    return;
+  }
+  if (high < low) {
+    std::cerr << "The end is before the start" << std::endl;
+    return;
+  }
+
+  const auto start = clock::now();
+  TransferStatistics statistics;
+  std::string error;
+  const bool dumped = dumpMemory(m_pid, low, high - low, path, statistics, error, transferProgress("Dumping"),
+    [this](uint64_t address, uint8_t* bytes, size_t size) { restoreBreakpointBytes(address, bytes, size); });
+  const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+  if (!dumped) {
+    std::cerr << error << std::endl;
+  }
+  std::cout << std::dec << statistics.bytes << " bytes from 0x" << std::hex << low << " to " << path << std::dec
+            << ", " << statistics.calls << " reads, " << std::fixed << std::setprecision(4) << seconds << " s, "
+            << std::setprecision(2) << (seconds > 0 ? statistics.bytes / seconds / 1e9 : 0.0) << " GB/s"
+            << std::defaultfloat << std::endl;
+}
+
+// restore <file> <address>: the mapped file written back by chunks, the breakpoints in each lifted around it
+void Debugger::restoreMemoryFromFile(const std::string& path, const std::string& expression) {
+  using clock = std::chrono::steady_clock;
+  uint64_t address;
+  try {
+    address = m_expressions.address(evaluateExpression(expression));
+  } catch (ExpressionError& e) {
+    std::cerr << e.what() << std::endl;
+    return;
+  }
+
+  auto write = [this](uint64_t address, const uint8_t* bytes, size_t size) {
+    return writeMemory(address, bytes, size);
+  };
+  const auto start = clock::now();
+  TransferStatistics statistics;
+  std::string error;
+  const bool restored = restoreMemory(path, address, statistics, error, write, transferProgress("Restoring"));
+  const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+  if (!restored) {
+    std::cerr << error << std::endl;
+  }
+  std::cout << std::dec << statistics.bytes << " bytes from " << path << " to 0x" << std::hex << address << std::dec
+            << ", " << statistics.calls << " writes, " << std::fixed << std::setprecision(4) << seconds << " s, "
+            << std::setprecision(2) << (seconds > 0 ? statistics.bytes / seconds / 1e9 : 0.0) << " GB/s"
+            << std::defaultfloat << std::endl;
+}
+
+// The code as it is in the file, not the int3 of the breakpoints, in bytes read from address
+void Debugger::restoreBreakpointBytes(uint64_t address, uint8_t* bytes, size_t size) {
+  for (const auto& [bp_address, bp] : m_breakpoints) {
+    if (bp.isEnabled() && bp_address >= address && bp_address < address + size) {
+      bytes[bp_address - address] = bp.getSavedData();
+    }
+  }
+}
+
+// gcore [-s] [file]: an ELF core of the program as it is stopped, core.<pid> by default. -s leaves out the read-only
+// mappings of files but their first page (the code of the program and its libraries: they are in the files).
+void Debugger::generateCore(const std::string& arguments) {
+  using clock = std::chrono::steady_clock;
+  CoreOptions options;
+  std::string path = "core." + std::to_string(m_process);
+  std::istringstream in(arguments);
+  for (std::string word; in >> word;) {
+    if (word == "-s") {
+      options.skip_file_read_only = true;
+    } else if (word[0] == '-') {
+      std::cerr << "Usage: gcore [-s] [file]" << std::endl;
+      return;
+    } else {
+      path = word;
+    }
+  }
+
+  const auto start = clock::now();
+  // Every thread, the current one first: a debugger opening the core starts with it
+  const std::vector<pid_t> stopped = stopRunningThreads();
+  std::vector<CoreThread> threads;
+  for (const auto& [tid, stopped] : m_threads) {
+    CoreThread thread;
+    thread.tid = tid;
+    thread.signal = tid == m_pid ? getSignalInfo().si_signo : 0;
+    Ptrace::getRegisters(tid, &thread.regs);
+    Ptrace::getFpRegisters(tid, &thread.fp_regs);
+    threads.insert(tid == m_pid ? threads.begin() : threads.end(), thread);
+  }
+  CoreStatistics statistics;
+  std::string error;
+  auto patch = [this](uint64_t address, uint8_t* bytes, size_t size) { restoreBreakpointBytes(address, bytes, size); };
+  const bool written = writeCore(m_process, threads, path, options, statistics, error, patch);
+  resumeThreads(stopped);
+  if (!written) {
+    std::cerr << error << std::endl;
+    return;
+  }
+  const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+  std::cout << "Saved " << path << ": " << std::dec << threads.size()
+            << (threads.size() == 1 ? " thread, " : " threads, ") << statistics.segments << " segments, " << std::fixed
+            << std::setprecision(1) << statistics.memory / 1048576.0 << " MB of memory in " << statistics.reads
+            << " reads, " << statistics.written / 1048576.0 << " MB written (zero pages are holes), "
+            << std::setprecision(4) << seconds << " s" << std::defaultfloat << std::endl;
+}
+
+// Where the program of a core stopped, and why
+void Debugger::printCoreStop() {
+  const auto* core = static_cast<CoreTarget*>(m_target.get());
+  const CoreThread& thread = core->threads().front();
+  std::cout << "Core of process " << std::dec << m_process << " (" << core->threads().size()
+            << (core->threads().size() == 1 ? " thread, " : " threads, ") << (core->size() >> 20) << " MB), "
+            << "loaded at 0x" << std::hex << m_load_address << std::endl;
+  std::cout << "Program terminated with signal " << std::dec << thread.signal << " (" << strsignal(thread.signal)
+            << ") at 0x" << std::hex << thread.regs.rip << ' ' << m_unwinder.symbolize(thread.regs.rip) << std::endl;
+  try {
+    auto line_entry = getLineEntryFromPc(thread.regs.rip);
+    printSource(line_entry->file->path, line_entry->line);
+  } catch (std::out_of_range&) {
+  }
+}
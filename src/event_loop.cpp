@@ -0,0 +1,169 @@
+#include <csignal>
+#include <cstdint>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "event_loop.h"
+
+EventLoop::EventLoop() {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigaddset(&mask, SIGINT);
+  pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+  m_epoll = epoll_create1(EPOLL_CLOEXEC);
+  m_signals = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  m_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  add(m_signals);
+  add(m_timer);
+  add(m_wakeup);
+}
+
+EventLoop::~EventLoop() {
+  // The signals stay blocked: one still queued would end the debugger on its way out
+  for (const int descriptor : { m_signals, m_process, m_timer, m_wakeup, m_epoll }) {
+    if (descriptor >= 0) {
+      close(descriptor);
+    }
+  }
+}
+
+void EventLoop::add(int descriptor) {
+  if (m_epoll < 0 || descriptor < 0) {
+    return;
+  }
+  epoll_event event {};
+  event.events = EPOLLIN;
+  event.data.fd = descriptor;
+  epoll_ctl(m_epoll, EPOLL_CTL_ADD, descriptor, &event);
+}
+
+void EventLoop::remove(int& descriptor) {
+  if (descriptor >= 0) {
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, descriptor, nullptr);
+    if (descriptor != STDIN_FILENO) {
+      close(descriptor);
+    }
+  }
+  descriptor = -1;
+}
+
+void EventLoop::watchProcess(pid_t pid) {
+  remove(m_process);
+  // glibc has had pidfd_open since 2.36 only
+  m_process = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+  add(m_process);
+}
+
+void EventLoop::watchTerminal(bool on) {
+  on = on && isatty(STDIN_FILENO);
+  if (on == m_terminal) {
+    return;
+  }
+  m_terminal = on;
+  if (on) {
+    add(STDIN_FILENO);
+  } else {
+    int terminal = STDIN_FILENO;
+    remove(terminal);
+  }
+}
+
+unsigned EventLoop::wait(int timeout_ms) {
+  epoll_event ready[8];
+  const int count = epoll_wait(m_epoll, ready, 8, timeout_ms);
+  unsigned events = 0;
+  for (int i = 0; i < count; ++i) {
+    const int descriptor = ready[i].data.fd;
+    if (descriptor == m_signals) {
+      readSignals(events);
+    } else if (descriptor == m_process) {
+      // Readable for good once the process is gone: once is enough
+      remove(m_process);
+      events |= child;
+    } else if (descriptor == m_timer) {
+      uint64_t expirations;
+      if (read(m_timer, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+        events |= timer;
+      }
+    } else if (descriptor == m_wakeup) {
+      uint64_t posts;
+      if (read(m_wakeup, &posts, sizeof(posts)) != sizeof(posts)) {
+        continue;
+      }
+      std::vector<std::function<void()>> posted;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        posted.swap(m_posted);
+      }
+      for (const auto& work : posted) {
+        work();
+      }
+      events |= completion;
+    } else if (descriptor == STDIN_FILENO) {
+      readTerminal(events);
+    }
+  }
+  return events;
+}
+
+void EventLoop::readSignals(unsigned& events) {
+  signalfd_siginfo info[16];
+  ssize_t read_size;
+  while ((read_size = read(m_signals, info, sizeof(info))) > 0) {
+    for (size_t i = 0; i < read_size / sizeof(signalfd_siginfo); ++i) {
+      if (info[i].ssi_signo == SIGCHLD) {
+        events |= child;
+      } else if (info[i].ssi_signo == SIGINT) {
+        m_interrupt_from_terminal = info[i].ssi_code == SI_KERNEL;
+        events |= interrupt;
+      }
+    }
+  }
+}
+
+void EventLoop::readTerminal(unsigned& events) {
+  char buffer[4096];
+  const ssize_t read_size = read(STDIN_FILENO, buffer, sizeof(buffer));
+  if (read_size <= 0) {
+    return;   // Ctrl-D
+  }
+  m_partial.append(buffer, read_size);
+  for (size_t end; (end = m_partial.find('\n')) != std::string::npos;) {
+    m_lines.push_back(m_partial.substr(0, end));
+    m_partial.erase(0, end + 1);
+    events |= input;
+  }
+}
+
+void EventLoop::setTimer(std::chrono::steady_clock::time_point when) {
+  // steady_clock is CLOCK_MONOTONIC. A zero it_value disarms the timer: a time already past is 1 ns.
+  const auto since = std::chrono::duration_cast<std::chrono::nanoseconds>(when.time_since_epoch()).count();
+  itimerspec value {};
+  value.it_value.tv_sec = since > 0 ? since / 1000000000 : 0;
+  value.it_value.tv_nsec = since > 0 ? since % 1000000000 : 1;
+  timerfd_settime(m_timer, TFD_TIMER_ABSTIME, &value, nullptr);
+}
+
+void EventLoop::cancelTimer() {
+  // Which also forgets an expiration not read yet
+  const itimerspec value {};
+  timerfd_settime(m_timer, 0, &value, nullptr);
+}
+
+void EventLoop::post(std::function<void()> work) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_posted.push_back(std::move(work));
+  }
+  const uint64_t one = 1;
+  if (write(m_wakeup, &one, sizeof(one)) != sizeof(one)) {
+    // The counter is saturated: a wakeup is pending anyway
+  }
+}
@@ -0,0 +1,901 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include "expression.h"
+
+struct ExpressionNode {
+  enum class Op : uint8_t {
+    integer, floating, name, member, arrow, index, dereference, address_of, negate, logical_not, bit_not, cast,
+    multiply, divide, modulo, add, subtract, shift_left, shift_right, less, less_equal, greater, greater_equal,
+    equal, not_equal, bit_and, bit_xor, bit_or, logical_and, logical_or, conditional
+  };
+
+  Op op = Op::integer;
+  std::string name;           // variables and registers, members, the type of literals and casts
+  unsigned pointers = 0;      // casts: (name **)
+  uint64_t integer = 0;
+  double floating = 0;
+  std::unique_ptr<ExpressionNode> operands[3];
+};
+
+namespace {
+
+using Node = std::unique_ptr<ExpressionNode>;
+using Op = ExpressionNode::Op;
+
+// Recursive descent, a function per precedence level
+class Parser {
+public:
+  explicit Parser(const std::string& text) : m_text(text) {}
+
+  Node parse() {
+    Node node = conditional();
+    skipSpace();
+    if (m_pos != m_text.size()) {
+      fail("unexpected '" + m_text.substr(m_pos) + "'");
+    }
+    return node;
+  }
+
+private:
+  [[noreturn]] void fail(const std::string& message) {
+    throw ExpressionError("Syntax error in \"" + m_text + "\": " + message);
+  }
+
+  static Node make(Op op, Node first = {}, Node second = {}, Node third = {}) {
+    Node node = std::make_unique<ExpressionNode>();
+    node->op = op;
+    node->operands[0] = std::move(first);
+    node->operands[1] = std::move(second);
+    node->operands[2] = std::move(third);
+    return node;
+  }
+
+  void skipSpace() {
+    while (m_pos < m_text.size() && std::isspace(static_cast<unsigned char>(m_text[m_pos]))) {
+      ++m_pos;
+    }
+  }
+
+  // The longest operator at the current position, "" if there is none
+  std::string peekOperator() {
+    static const char* operators[] = {"->", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||", "+", "-", "*", "/",
+                                      "%", "<", ">", "&", "|", "^", "!", "~", "?", ":", "(", ")", "[", "]", "."};
+    skipSpace();
+    for (const char* op : operators) {
+      if (m_text.compare(m_pos, std::strlen(op), op) == 0) {
+        return op;
+      }
+    }
+    return "";
+  }
+
+  bool accept(const char* op) {
+    if (peekOperator() != op) {
+      return false;
+    }
+    m_pos += std::strlen(op);
+    return true;
+  }
+
+  void expect(const char* op) {
+    if (!accept(op)) {
+      fail(std::string("expected '") + op + "'");
+    }
+  }
+
+  static bool startsIdentifier(char c) {
+    return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+  }
+
+  static bool isDigit(char c) {
+    return std::isdigit(static_cast<unsigned char>(c));
+  }
+
+  // "count", "ns::value", "" if there is no identifier here
+  std::string identifier() {
+    skipSpace();
+    const size_t start = m_pos;
+    for (;;) {
+      if (m_pos >= m_text.size() || !startsIdentifier(m_text[m_pos])) {
+        m_pos = start;
+        return "";
+      }
+      while (m_pos < m_text.size() && (startsIdentifier(m_text[m_pos]) || isDigit(m_text[m_pos]))) {
+        ++m_pos;
+      }
+      if (m_text.compare(m_pos, 2, "::") != 0) {
+        return m_text.substr(start, m_pos - start);
+      }
+      m_pos += 2;
+    }
+  }
+
+  Node conditional() {
+    Node condition = binary(0);
+    if (!accept("?")) {
+      return condition;
+    }
+    Node if_true = conditional();
+    expect(":");
+    Node if_false = conditional();
+    return make(Op::conditional, std::move(condition), std::move(if_true), std::move(if_false));
+  }
+
+  Node binary(size_t level) {
+    struct Operator {
+      const char* text;
+      Op op;
+    };
+    static const std::vector<std::vector<Operator>> levels = {
+        {{"||", Op::logical_or}},
+        {{"&&", Op::logical_and}},
+        {{"|", Op::bit_or}},
+        {{"^", Op::bit_xor}},
+        {{"&", Op::bit_and}},
+        {{"==", Op::equal}, {"!=", Op::not_equal}},
+        {{"<", Op::less}, {"<=", Op::less_equal}, {">", Op::greater}, {">=", Op::greater_equal}},
+        {{"<<", Op::shift_left}, {">>", Op::shift_right}},
+        {{"+", Op::add}, {"-", Op::subtract}},
+        {{"*", Op::multiply}, {"/", Op::divide}, {"%", Op::modulo}}};
+    if (level == levels.size()) {
+      return unary();
+    }
+    Node left = binary(level + 1);
+    for (;;) {
+      const std::string text = peekOperator();
+      const Operator* match = nullptr;
+      for (const Operator& candidate : levels[level]) {
+        if (text == candidate.text) {
+          match = &candidate;
+        }
+      }
+      if (!match) {
+        return left;
+      }
+      m_pos += text.size();
+      Node right = binary(level + 1);
+      left = make(match->op, std::move(left), std::move(right));
+    }
+  }
+
+  Node unary() {
+    if (accept("-")) {
+      return make(Op::negate, unary());
+    }
+    if (accept("+")) {
+      return unary();
+    }
+    if (accept("!")) {
+      return make(Op::logical_not, unary());
+    }
+    if (accept("~")) {
+      return make(Op::bit_not, unary());
+    }
+    if (accept("*")) {
+      return make(Op::dereference, unary());
+    }
+    if (accept("&")) {
+      return make(Op::address_of, unary());
+    }
+    const size_t start = m_pos;
+    if (accept("(")) {
+      Node node = castType();
+      if (node) {
+        node->operands[0] = unary();
+        return node;
+      }
+      m_pos = start;
+    }
+    return postfix(primary());
+  }
+
+  // After '(': "unsigned long)", "struct node *)" make a cast, nullptr if the parenthesis holds an expression
+  Node castType() {
+    static const char* qualifiers[] = {"struct", "class", "union", "enum", "const", "volatile"};
+    static const char* keywords[] = {"unsigned", "signed", "char", "short", "int", "long", "float", "double",
+                                     "bool", "void"};
+    std::string name;
+    bool keyword = false;
+    for (std::string word = identifier(); !word.empty(); word = identifier()) {
+      if (std::find(std::begin(qualifiers), std::end(qualifiers), word) != std::end(qualifiers)) {
+        keyword = true;
+        continue;
+      }
+      if (std::find(std::begin(keywords), std::end(keywords), word) != std::end(keywords)) {
+        keyword = true;
+      } else if (!name.empty() && !keyword) {
+        return nullptr;
+      }
+      name += (name.empty() ? "" : " ") + word;
+    }
+    if (name.empty()) {
+      return nullptr;
+    }
+    unsigned pointers = 0;
+    while (accept("*")) {
+      ++pointers;
+    }
+    if (!accept(")")) {
+      return nullptr;
+    }
+    // (x) - 1 is a subtraction, (size_t) n a cast: without a keyword or a '*', the operand must follow
+    skipSpace();
+    const char next = m_pos < m_text.size() ? m_text[m_pos] : '\0';
+    if (!keyword && pointers == 0 &&
+        !(startsIdentifier(next) || isDigit(next) || next == '(' || next == '$' || next == '\'')) {
+      return nullptr;
+    }
+    Node node = make(Op::cast);
+    node->name = name;
+    node->pointers = pointers;
+    return node;
+  }
+
+  Node postfix(Node node) {
+    for (;;) {
+      if (accept(".") || accept("->")) {
+        const bool arrow = m_text[m_pos - 1] == '>';
+        const std::string name = identifier();
+        if (name.empty()) {
+          fail("member name expected");
+        }
+        node = make(arrow ? Op::arrow : Op::member, std::move(node));
+        node->name = name;
+      } else if (accept("[")) {
+        Node index = conditional();
+        expect("]");
+        node = make(Op::index, std::move(node), std::move(index));
+      } else {
+        return node;
+      }
+    }
+  }
+
+  Node primary() {
+    skipSpace();
+    if (m_pos >= m_text.size()) {
+      fail("expression expected");
+    }
+    const char c = m_text[m_pos];
+    if (isDigit(c)) {
+      return number();
+    }
+    if (c == '\'') {
+      return character();
+    }
+    if (accept("(")) {
+      Node node = conditional();
+      expect(")");
+      return node;
+    }
+    if (c == '$') {
+      ++m_pos;
+      const std::string name = identifier();
+      if (name.empty()) {
+        fail("register name expected");
+      }
+      Node node = make(Op::name);
+      node->name = "$" + name;
+      return node;
+    }
+    const std::string name = identifier();
+    if (name.empty()) {
+      fail("unexpected '" + m_text.substr(m_pos) + "'");
+    }
+    if (name == "true" || name == "false" || name == "nullptr") {
+      Node node = make(Op::integer);
+      node->name = name == "nullptr" ? "long" : "bool";
+      node->integer = name == "true";
+      return node;
+    }
+    Node node = make(Op::name);
+    node->name = name;
+    return node;
+  }
+
+  // 42, 0x2a, 052, 42ul, 4.2, 4.2e1f
+  Node number() {
+    const char* start = m_text.c_str() + m_pos;
+    char* end = nullptr;
+    const bool hex = m_text.compare(m_pos, 2, "0x") == 0 || m_text.compare(m_pos, 2, "0X") == 0;
+    size_t digits = m_pos;
+    while (digits < m_text.size() && (std::isxdigit(static_cast<unsigned char>(m_text[digits])) ||
+                                      m_text[digits] == 'x' || m_text[digits] == 'X')) {
+      ++digits;
+    }
+    const bool floating = !hex && digits < m_text.size() && (m_text[digits] == '.' || m_text[digits] == 'e' ||
+                                                            m_text[digits] == 'E');
+    Node node;
+    if (floating) {
+      node = make(Op::floating);
+      node->floating = std::strtod(start, &end);
+      m_pos += end - start;
+      if (m_pos < m_text.size() && (m_text[m_pos] == 'f' || m_text[m_pos] == 'F')) {
+        ++m_pos;
+      }
+      return node;
+    }
+    node = make(Op::integer);
+    errno = 0;
+    node->integer = std::strtoull(start, &end, 0);
+    if (errno == ERANGE) {
+      fail("integer constant is too large");
+    }
+    m_pos += end - start;
+    bool is_unsigned = false;
+    bool is_long = false;
+    for (; m_pos < m_text.size() && std::strchr("uUlL", m_text[m_pos]); ++m_pos) {
+      (std::tolower(m_text[m_pos]) == 'u' ? is_unsigned : is_long) = true;
+    }
+    if (is_unsigned) {
+      node->name = !is_long && node->integer <= UINT32_MAX ? "unsigned int" : "unsigned long";
+    } else if (!is_long && node->integer <= INT32_MAX) {
+      node->name = "int";
+    } else {
+      node->name = node->integer <= INT64_MAX ? "long" : "unsigned long";
+    }
+    return node;
+  }
+
+  // 'a', '\n', '\0', '\x41'
+  Node character() {
+    ++m_pos;
+    if (m_pos >= m_text.size()) {
+      fail("unterminated character constant");
+    }
+    uint64_t value = static_cast<unsigned char>(m_text[m_pos++]);
+    if (value == '\\' && m_pos < m_text.size()) {
+      const char escape = m_text[m_pos++];
+      switch (escape) {
+        case 'n': value = '\n'; break;
+        case 't': value = '\t'; break;
+        case 'r': value = '\r'; break;
+        case '0': value = 0; break;
+        case 'x': {
+          char* end = nullptr;
+          value = std::strtoul(m_text.c_str() + m_pos, &end, 16) & 0xff;
+          m_pos = end - m_text.c_str();
+          break;
+        }
+        default: value = static_cast<unsigned char>(escape); break;
+      }
+    }
+    if (m_pos >= m_text.size() || m_text[m_pos] != '\'') {
+      fail("unterminated character constant");
+    }
+    ++m_pos;
+    Node node = make(Op::integer);
+    node->name = "char";
+    node->integer = value;
+    return node;
+  }
+
+  const std::string& m_text;
+  size_t m_pos = 0;
+};
+
+bool isFloat(const TypeLayout& type) {
+  return type.kind == TypeLayout::Kind::base && type.encoding == dwarf::DW_ATE::float_;
+}
+
+bool isInteger(const TypeLayout& type) {
+  return (type.kind == TypeLayout::Kind::base && !isFloat(type)) || type.kind == TypeLayout::Kind::enumeration;
+}
+
+bool isSigned(const TypeLayout& type) {
+  if (type.kind == TypeLayout::Kind::enumeration) {
+    return type.encoding != dwarf::DW_ATE::unsigned_ && type.encoding != dwarf::DW_ATE::unsigned_char;
+  }
+  return type.kind == TypeLayout::Kind::base &&
+         (type.encoding == dwarf::DW_ATE::signed_ || type.encoding == dwarf::DW_ATE::signed_char || isFloat(type));
+}
+
+// An integer or a pointer as 64 bits, sign-extended for signed types
+uint64_t bits(const ExpressionValue& value) {
+  const size_t size = std::min<size_t>(value.type->size, sizeof(uint64_t));
+  uint64_t result = 0;
+  std::memcpy(&result, value.bytes.data(), size);
+  if (size && size < sizeof(uint64_t) && isSigned(*value.type)) {
+    const unsigned shift = 64 - size * 8;
+    result = static_cast<uint64_t>(static_cast<int64_t>(result << shift) >> shift);
+  }
+  return result;
+}
+
+double asDouble(const ExpressionValue& value) {
+  if (!isFloat(*value.type)) {
+    return isSigned(*value.type) ? static_cast<double>(static_cast<int64_t>(bits(value)))
+                                 : static_cast<double>(bits(value));
+  }
+  if (value.type->size == sizeof(float)) {
+    float result;
+    std::memcpy(&result, value.bytes.data(), sizeof(result));
+    return result;
+  }
+  if (value.type->size == sizeof(double)) {
+    double result;
+    std::memcpy(&result, value.bytes.data(), sizeof(result));
+    return result;
+  }
+  long double result = 0;
+  std::memcpy(&result, value.bytes.data(), std::min<size_t>(value.type->size, sizeof(result)));
+  return static_cast<double>(result);
+}
+
+ExpressionValue scalar(const TypeLayout& type, uint64_t bits) {
+  ExpressionValue value;
+  value.type = &type;
+  std::memcpy(value.bytes.data(), &bits, std::min<size_t>(type.size, sizeof(bits)));
+  return value;
+}
+
+ExpressionValue floating(const TypeLayout& type, double number) {
+  ExpressionValue value;
+  value.type = &type;
+  if (type.size == sizeof(float)) {
+    const float narrow = static_cast<float>(number);
+    std::memcpy(value.bytes.data(), &narrow, sizeof(narrow));
+  } else if (type.size == sizeof(double)) {
+    std::memcpy(value.bytes.data(), &number, sizeof(number));
+  } else {
+    const long double wide = number;
+    std::memcpy(value.bytes.data(), &wide, std::min<size_t>(sizeof(wide), value.bytes.size()));
+  }
+  return value;
+}
+
+std::string hex(uint64_t value) {
+  std::ostringstream text;
+  text << "0x" << std::hex << value;
+  return text.str();
+}
+
+} // namespace
+
+ExpressionEvaluator::ExpressionEvaluator(ValuePrinter& printer, ValueReader reader) :
+    m_printer(printer),
+    m_read(std::move(reader))
+{}
+
+ExpressionEvaluator::~ExpressionEvaluator() = default;
+
+const ExpressionNode& ExpressionEvaluator::parse(const std::string& text) {
+  auto cached = m_parsed.find(text);
+  if (cached != m_parsed.end()) {
+    return *cached->second;
+  }
+  Node tree = Parser(text).parse();
+  return *(m_parsed[text] = std::move(tree));
+}
+
+ExpressionValue ExpressionEvaluator::evaluate(const std::string& text, const NameResolver& names,
+                                              const TypeResolver& types) {
+  const ExpressionNode& tree = parse(text);
+  m_blocks.clear();
+  m_names = &names;
+  m_types = &types;
+  return evaluate(tree);
+}
+
+ExpressionValue ExpressionEvaluator::evaluate(const ExpressionNode& node) {
+  switch (node.op) {
+    case Op::integer:
+      return scalar(builtin(node.name.c_str()), node.integer);
+    case Op::floating:
+      return floating(builtin("double"), node.floating);
+    case Op::name: {
+      ExpressionValue value;
+      if (!(*m_names)(node.name, value)) {
+        throw ExpressionError("No symbol \"" + node.name + "\" in the current context");
+      }
+      return value;
+    }
+    case Op::member:
+      return member(evaluate(*node.operands[0]), node.name);
+    case Op::arrow:
+      return member(dereference(load(evaluate(*node.operands[0])), 0), node.name);
+    case Op::index: {
+      ExpressionValue base = load(evaluate(*node.operands[0]));
+      // v[i] of a std::vector is _M_start[i]
+      if (base.lvalue && base.type->container.kind == TypeLayout::Container::Kind::vector) {
+        uint64_t start = 0;
+        read(base.address + base.type->container.first, &start, sizeof(start));
+        base = scalar(m_printer.pointerTo(m_printer.layout(base.type->container.key)), start);
+      }
+      const ExpressionValue index = load(evaluate(*node.operands[1]));
+      if (!isInteger(*index.type)) {
+        throw ExpressionError("The index is a " + index.type->name + ", not an integer");
+      }
+      return dereference(base, static_cast<int64_t>(bits(index)));
+    }
+    case Op::dereference:
+      return dereference(load(evaluate(*node.operands[0])), 0);
+    case Op::address_of: {
+      const ExpressionValue object = followReference(evaluate(*node.operands[0]));
+      if (!object.lvalue || object.bit_size) {
+        throw ExpressionError("Can't take the address of a value which isn't in memory");
+      }
+      return scalar(m_printer.pointerTo(*object.type), object.address);
+    }
+    case Op::negate: {
+      const ExpressionValue value = load(evaluate(*node.operands[0]));
+      if (isFloat(*value.type)) {
+        return floating(*value.type, -asDouble(value));
+      }
+      if (!isInteger(*value.type)) {
+        throw ExpressionError("Can't negate a " + value.type->name);
+      }
+      return scalar(promote(*value.type, *value.type), -bits(value));
+    }
+    case Op::bit_not: {
+      const ExpressionValue value = load(evaluate(*node.operands[0]));
+      if (!isInteger(*value.type)) {
+        throw ExpressionError("Can't complement a " + value.type->name);
+      }
+      return scalar(promote(*value.type, *value.type), ~bits(value));
+    }
+    case Op::logical_not:
+      return scalar(builtin("bool"), !isTrue(evaluate(*node.operands[0])));
+    case Op::cast:
+      return cast(node);
+    // && and || don't evaluate their right operand if the left one decides
+    case Op::logical_and:
+      return scalar(builtin("bool"), isTrue(evaluate(*node.operands[0])) && isTrue(evaluate(*node.operands[1])));
+    case Op::logical_or:
+      return scalar(builtin("bool"), isTrue(evaluate(*node.operands[0])) || isTrue(evaluate(*node.operands[1])));
+    case Op::conditional:
+      return isTrue(evaluate(*node.operands[0])) ? evaluate(*node.operands[1]) : evaluate(*node.operands[2]);
+    default:
+      return binary(node);
+  }
+}
+
+ExpressionValue ExpressionEvaluator::binary(const ExpressionNode& node) {
+  const ExpressionValue left = load(evaluate(*node.operands[0]));
+  const ExpressionValue right = load(evaluate(*node.operands[1]));
+  const bool left_pointer = left.type->kind == TypeLayout::Kind::pointer;
+  const bool right_pointer = right.type->kind == TypeLayout::Kind::pointer;
+  const bool comparison = node.op >= Op::less && node.op <= Op::not_equal;
+
+  if (left_pointer || right_pointer) {
+    if (comparison && (left_pointer || isInteger(*left.type)) && (right_pointer || isInteger(*right.type))) {
+      const uint64_t x = bits(left);
+      const uint64_t y = bits(right);
+      bool result = false;
+      switch (node.op) {
+        case Op::less: result = x < y; break;
+        case Op::less_equal: result = x <= y; break;
+        case Op::greater: result = x > y; break;
+        case Op::greater_equal: result = x >= y; break;
+        case Op::equal: result = x == y; break;
+        default: result = x != y; break;
+      }
+      return scalar(builtin("bool"), result);
+    }
+    // p + n and p - n step over n objects, p - q counts the objects between
+    const ExpressionValue& pointer = left_pointer ? left : right;
+    const ExpressionValue& other = left_pointer ? right : left;
+    const uint64_t stride = std::max<uint64_t>(m_printer.pointee(*pointer.type).size, 1);
+    if (node.op == Op::add && isInteger(*other.type)) {
+      return scalar(*pointer.type, bits(pointer) + bits(other) * stride);
+    }
+    if (node.op == Op::subtract && left_pointer && isInteger(*right.type)) {
+      return scalar(*pointer.type, bits(left) - bits(right) * stride);
+    }
+    if (node.op == Op::subtract && left_pointer && right_pointer) {
+      return scalar(builtin("long"), static_cast<uint64_t>(static_cast<int64_t>(bits(left) - bits(right)) /
+                                                             static_cast<int64_t>(stride)));
+    }
+    throw ExpressionError("Invalid operands: " + left.type->name + " and " + right.type->name);
+  }
+
+  const bool arithmetic = (isInteger(*left.type) || isFloat(*left.type)) &&
+                          (isInteger(*right.type) || isFloat(*right.type));
+  if (!arithmetic) {
+    throw ExpressionError("Invalid operands: " + left.type->name + " and " + right.type->name);
+  }
+
+  if (isFloat(*left.type) || isFloat(*right.type)) {
+    const double x = asDouble(left);
+    const double y = asDouble(right);
+    switch (node.op) {
+      case Op::multiply: return floating(builtin("double"), x * y);
+      case Op::divide: return floating(builtin("double"), x / y);
+      case Op::add: return floating(builtin("double"), x + y);
+      case Op::subtract: return floating(builtin("double"), x - y);
+      case Op::less: return scalar(builtin("bool"), x < y);
+      case Op::less_equal: return scalar(builtin("bool"), x <= y);
+      case Op::greater: return scalar(builtin("bool"), x > y);
+      case Op::greater_equal: return scalar(builtin("bool"), x >= y);
+      case Op::equal: return scalar(builtin("bool"), x == y);
+      case Op::not_equal: return scalar(builtin("bool"), x != y);
+      default: throw ExpressionError("Invalid operands: " + left.type->name + " and " + right.type->name);
+    }
+  }
+
+  // Both operands converted to the common type first, shifts keep the type of the left one
+  const bool shift = node.op == Op::shift_left || node.op == Op::shift_right;
+  const TypeLayout& common = shift ? promote(*left.type, *left.type) : promote(*left.type, *right.type);
+  const bool is_signed = isSigned(common);
+  const uint64_t x = bits(scalar(common, bits(left)));
+  const uint64_t y = shift ? bits(right) : bits(scalar(common, bits(right)));
+  const auto sx = static_cast<int64_t>(x);
+  const auto sy = static_cast<int64_t>(y);
+  switch (node.op) {
+    case Op::multiply: return scalar(common, x * y);
+    case Op::divide:
+    case Op::modulo: {
+      if (y == 0) {
+        throw ExpressionError("Division by zero");
+      }
+      const bool divide = node.op == Op::divide;
+      if (!is_signed) {
+        return scalar(common, divide ? x / y : x % y);
+      }
+      if (sy == -1) {   // INT64_MIN / -1 traps
+        return scalar(common, divide ? 0 - x : 0);
+      }
+      return scalar(common, static_cast<uint64_t>(divide ? sx / sy : sx % sy));
+    }
+    case Op::add: return scalar(common, x + y);
+    case Op::subtract: return scalar(common, x - y);
+    case Op::shift_left: return scalar(common, x << (y & 63));
+    case Op::shift_right: return scalar(common, is_signed ? static_cast<uint64_t>(sx >> (y & 63)) : x >> (y & 63));
+    case Op::bit_and: return scalar(common, x & y);
+    case Op::bit_xor: return scalar(common, x ^ y);
+    case Op::bit_or: return scalar(common, x | y);
+    case Op::less: return scalar(builtin("bool"), is_signed ? sx < sy : x < y);
+    case Op::less_equal: return scalar(builtin("bool"), is_signed ? sx <= sy : x <= y);
+    case Op::greater: return scalar(builtin("bool"), is_signed ? sx > sy : x > y);
+    case Op::greater_equal: return scalar(builtin("bool"), is_signed ? sx >= sy : x >= y);
+    case Op::equal: return scalar(builtin("bool"), x == y);
+    case Op::not_equal: return scalar(builtin("bool"), x != y);
+    default: throw ExpressionError("Unsupported operator");
+  }
+}
+
+ExpressionValue ExpressionEvaluator::cast(const ExpressionNode& node) {
+  using Kind = TypeLayout::Kind;
+  const TypeLayout& target = type(node.name, node.pointers);
+  ExpressionValue value = followReference(evaluate(*node.operands[0]));
+
+  // (struct node) x looks at the object of x as a node
+  if (target.kind == Kind::structure || target.kind == Kind::array) {
+    if (!value.lvalue || value.bit_size) {
+      throw ExpressionError("Can't cast a value which isn't in memory to " + target.name);
+    }
+    value.type = &target;
+    return value;
+  }
+  value = load(value);
+  const bool from_number = isInteger(*value.type) || isFloat(*value.type);
+  if (isFloat(target)) {
+    if (!from_number) {
+      throw ExpressionError("Can't cast a " + value.type->name + " to " + target.name);
+    }
+    return floating(target, asDouble(value));
+  }
+  if (isInteger(target) || target.kind == Kind::pointer) {
+    uint64_t result;
+    if (isFloat(*value.type)) {
+      const double number = asDouble(value);
+      result = isSigned(target) ? static_cast<uint64_t>(static_cast<int64_t>(number)) : static_cast<uint64_t>(number);
+    } else if (from_number || value.type->kind == Kind::pointer) {
+      result = bits(value);
+    } else {
+      throw ExpressionError("Can't cast a " + value.type->name + " to " + target.name);
+    }
+    if (target.kind == Kind::base && target.encoding == dwarf::DW_ATE::boolean) {
+      result = result != 0;
+    }
+    return scalar(target, result);
+  }
+  throw ExpressionError("Can't cast to " + target.name);
+}
+
+ExpressionValue ExpressionEvaluator::member(const ExpressionValue& object, const std::string& name) {
+  const ExpressionValue value = followReference(object);
+  if (value.type->kind != TypeLayout::Kind::structure) {
+    throw ExpressionError("Can't take the member " + name + " of a " + value.type->name);
+  }
+  uint64_t offset = 0;
+  const TypeLayout::Member* found = ValuePrinter::findMember(*value.type, name, offset);
+  if (!found) {
+    throw ExpressionError("There is no member named " + name + " in " + value.type->name);
+  }
+  ExpressionValue result;
+  result.type = found->type;
+  result.bit_size = found->bit_size;
+  result.bit_offset = found->bit_offset;
+  if (value.lvalue) {
+    result.lvalue = true;
+    result.address = value.address + offset;
+  } else if (!found->bit_size && offset + found->type->size <= value.bytes.size()) {
+    std::memcpy(result.bytes.data(), value.bytes.data() + offset, found->type->size);
+  } else {
+    throw ExpressionError("The member " + name + " isn't available");
+  }
+  return result;
+}
+
+ExpressionValue ExpressionEvaluator::dereference(const ExpressionValue& pointer, int64_t index) {
+  if (pointer.type->kind != TypeLayout::Kind::pointer) {
+    throw ExpressionError("A " + pointer.type->name + " isn't a pointer");
+  }
+  const TypeLayout& target = m_printer.pointee(*pointer.type);
+  if (target.kind == TypeLayout::Kind::void_) {
+    throw ExpressionError("Can't dereference a void pointer");
+  }
+  ExpressionValue result;
+  result.type = &target;
+  result.lvalue = true;
+  result.address = bits(pointer) + static_cast<uint64_t>(index) * target.size;
+  return result;
+}
+
+ExpressionValue ExpressionEvaluator::followReference(ExpressionValue value) {
+  if (value.type->kind != TypeLayout::Kind::reference) {
+    return value;
+  }
+  uint64_t address = 0;
+  if (value.lvalue) {
+    read(value.address, &address, sizeof(address));
+  } else {
+    std::memcpy(&address, value.bytes.data(), sizeof(address));
+  }
+  ExpressionValue result;
+  result.type = &m_printer.pointee(*value.type);
+  result.lvalue = true;
+  result.address = address;
+  return result;
+}
+
+ExpressionValue ExpressionEvaluator::load(ExpressionValue value) {
+  using Kind = TypeLayout::Kind;
+  value = followReference(value);
+  if (!value.lvalue) {
+    return value;
+  }
+  switch (value.type->kind) {
+    case Kind::array:
+      return scalar(m_printer.pointerTo(*value.type->element), value.address);
+    case Kind::function:
+      return scalar(m_printer.pointerTo(*value.type), value.address);
+    case Kind::base:
+    case Kind::enumeration:
+    case Kind::pointer:
+      break;
+    default:
+      return value;   // aggregates stay in memory
+  }
+  if (value.type->size > value.bytes.size()) {
+    return value;
+  }
+  ExpressionValue result;
+  result.type = value.type;
+  if (!value.bit_size) {
+    read(value.address, result.bytes.data(), value.type->size);
+    return result;
+  }
+  uint64_t storage = 0;
+  read(value.address, &storage, (value.bit_offset + value.bit_size + 7) / 8);
+  storage >>= value.bit_offset;
+  if (value.bit_size < 64) {
+    storage &= (1ULL << value.bit_size) - 1;
+    if (isSigned(*value.type) && (storage >> (value.bit_size - 1)) & 1) {
+      storage |= ~((1ULL << value.bit_size) - 1);
+    }
+  }
+  return scalar(*value.type, storage);
+}
+
+bool ExpressionEvaluator::isTrue(const ExpressionValue& value) {
+  const ExpressionValue scalar = load(value);
+  if (isFloat(*scalar.type)) {
+    return asDouble(scalar) != 0;
+  }
+  if (isInteger(*scalar.type) || scalar.type->kind == TypeLayout::Kind::pointer) {
+    return bits(scalar) != 0;
+  }
+  throw ExpressionError("A " + scalar.type->name + " is neither true nor false");
+}
+
+uint64_t ExpressionEvaluator::address(const ExpressionValue& value) {
+  const ExpressionValue scalar = load(value);
+  if (isInteger(*scalar.type) || scalar.type->kind == TypeLayout::Kind::pointer) {
+    return bits(scalar);
+  }
+  if (scalar.lvalue) {
+    return scalar.address;
+  }
+  throw ExpressionError("A " + scalar.type->name + " isn't an address");
+}
+
+const TypeLayout& ExpressionEvaluator::type(const std::string& name, unsigned pointers) {
+  const TypeLayout* type = m_printer.builtin(name);
+  if (!type) {
+    type = (*m_types)(name);
+  }
+  if (!type) {
+    throw ExpressionError("No type named " + name);
+  }
+  for (unsigned i = 0; i < pointers; ++i) {
+    type = &m_printer.pointerTo(*type);
+  }
+  return *type;
+}
+
+const TypeLayout& ExpressionEvaluator::promote(const TypeLayout& left, const TypeLayout& right) {
+  // bool, char and short become int, the larger type wins, unsigned wins at the same size
+  const uint64_t size = std::max<uint64_t>({left.size, right.size, 4}) > 4 ? 8 : 4;
+  const bool is_unsigned = (!isSigned(left) && left.size >= size) || (!isSigned(right) && right.size >= size);
+  if (size == 8) {
+    return builtin(is_unsigned ? "unsigned long" : "long");
+  }
+  return builtin(is_unsigned ? "unsigned int" : "int");
+}
+
+std::string ExpressionEvaluator::format(const ExpressionValue& value) {
+  const ExpressionValue shown = value.bit_size ? load(value) : value;
+  const TypeLayout& type = *shown.type;
+  // Containers say what they are ("std::map with 3 elements"), their template names are long
+  const std::string prefix = type.container.kind != TypeLayout::Container::Kind::none ? std::string()
+      : "(" + (type.name.empty() ? std::string("<anonymous>") : type.name) + ") ";
+  if (!shown.lvalue) {
+    return prefix + m_printer.format(type, shown.bytes.data(), std::min<size_t>(type.size, shown.bytes.size()));
+  }
+  // Small objects from the blocks the evaluation read already, large ones with a read of their own
+  if (type.size > 4 * BLOCK_SIZE) {
+    return prefix + m_printer.print(type, shown.address);
+  }
+  std::vector<uint8_t> bytes(type.size);
+  read(shown.address, bytes.data(), bytes.size());
+  return prefix + m_printer.format(type, bytes.data(), bytes.size());
+}
+
+// size bytes from the blocks of this evaluation, reading the missing ones: each run of adjacent missing blocks with
+// one transfer
+void ExpressionEvaluator::read(uint64_t address, void* buffer, size_t size) {
+  if (size == 0) {
+    return;
+  }
+  if (address + size < address || address + size > UINT64_MAX - BLOCK_SIZE) {
+    throw ExpressionError("Cannot access memory at address " + hex(address));
+  }
+  const uint64_t first = address & ~(BLOCK_SIZE - 1);
+  const uint64_t last = (address + size - 1) & ~(BLOCK_SIZE - 1);
+  for (uint64_t block = first; block <= last;) {
+    if (m_blocks.count(block)) {
+      block += BLOCK_SIZE;
+      continue;
+    }
+    uint64_t end = block;
+    while (end <= last && !m_blocks.count(end)) {
+      end += BLOCK_SIZE;
+    }
+    std::vector<uint8_t> run(end - block);
+    ++m_reads;
+    if (!m_read(block, run.data(), run.size())) {
+      throw ExpressionError("Cannot access memory at address " + hex(address));
+    }
+    for (uint64_t offset = 0; offset < run.size(); offset += BLOCK_SIZE) {
+      std::memcpy(m_blocks[block + offset].data(), run.data() + offset, BLOCK_SIZE);
+    }
+    block = end;
+  }
+  auto* out = static_cast<uint8_t*>(buffer);
+  for (uint64_t at = address; at < address + size;) {
+    const uint64_t block = at & ~(BLOCK_SIZE - 1);
+    const size_t n = std::min<uint64_t>(block + BLOCK_SIZE - at, address + size - at);
+    std::memcpy(out, m_blocks[block].data() + (at - block), n);
+    out += n;
+    at += n;
+  }
+}
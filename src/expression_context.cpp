@@ -13,3 +13,8 @@ dwarf::taddr ExpressionContext::pc() {
 dwarf::taddr ExpressionContext::deref_size(dwarf::taddr address, uint32_t size) {
   return Ptrace::readMemory(m_pid, address + m_load_address);
 }
+
+// DW_AT_frame_base of gcc is DW_OP_call_frame_cfa: the CFA from the unwinder, which is right at any pc
+dwarf::taddr ExpressionContext::call_frame_cfa() {
+  return m_cfa ? m_cfa : dwarf::expr_context::call_frame_cfa();
+}
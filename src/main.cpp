@@ -1,4 +1,7 @@
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <unistd.h>
 
 #if __linux__
@@ -9,12 +12,80 @@
 #include "ptrace_impl.h"
 
 int main(int argc, char** argv) {
-  if (argc < 2) {
+  // Loader tuning flags go before the program name:
+  //  --no-madvise   don't pass access hints for the debug sections to the kernel
+  //  --no-prefault  don't fault in .debug_info/.debug_line on a helper thread
+  //  --no-release   keep pages of sections we are done with
+  //  --populate     read the whole file up front (MAP_POPULATE)
+  // --core <file> debugs a core file of the program instead of running it
+  // -p <pid> attaches to a running process, the program is then /proc/<pid>/exe unless given
+  elf::mmap_loader_options loader_options;
+  std::string core;
+  pid_t attach_pid = 0;
+  int arg = 1;
+  for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+    std::string option = argv[arg];
+    if (option == "--core" && arg + 1 < argc) {
+      core = argv[++arg];
+    } else if ((option == "-p" || option == "--pid") && arg + 1 < argc) {
+      attach_pid = std::atoi(argv[++arg]);
+    } else if (option == "--no-madvise") {
+      loader_options.advise = false;
+    } else if (option == "--no-prefault") {
+      loader_options.prefault = false;
+    } else if (option == "--no-release") {
+      loader_options.release = false;
+    } else if (option == "--populate") {
+      loader_options.populate = true;
+    } else {
+      std::cerr << "Unknown option " << option << "\n";
+      return -1;
+    }
+  }
+
+  if (attach_pid > 0) {
+    std::string programm = arg < argc ? argv[arg] : "";
+    if (programm.empty()) {
+      // The file the process runs, which may have been replaced or deleted since: /proc/pid/exe opens it anyway
+      const std::string exe = "/proc/" + std::to_string(attach_pid) + "/exe";
+      char path[4096];
+      const ssize_t length = readlink(exe.c_str(), path, sizeof(path) - 1);
+      programm = length > 0 && access(std::string(path, length).c_str(), R_OK) == 0 ? std::string(path, length) : exe;
+    }
+    if (access(programm.c_str(), R_OK) != 0) {
+      std::cerr << "Cannot read the program of process " << attach_pid << ": " << programm << "\n";
+      return -1;
+    }
+    Debugger dbg { programm, std::make_unique<LiveTarget>(attach_pid), loader_options };
+    if (!dbg.attach()) {
+      return -1;
+    }
+    dbg.run();
+    return 0;
+  }
+
+  if (arg >= argc) {
     std::cerr << "Program name not specified";
     return -1;
   }
 
-  auto programm = argv[1];
+  auto programm = argv[arg];
+  if (!core.empty()) {
+    if (access(programm, R_OK) != 0) {
+      std::cerr << "Cannot read the program of core " << core << ": " << programm << "\n";
+      return -1;
+    }
+    std::unique_ptr<Target> target;
+    try {
+      target = std::make_unique<CoreTarget>(core, programm);
+    } catch (std::runtime_error& e) {
+      std::cerr << e.what() << "\n";
+      return -1;
+    }
+    Debugger dbg { programm, std::move(target), loader_options };
+    dbg.run();
+    return 0;
+  }
 
 // Test a breakpoint setting on some address:
 //    1. Use objdump -d <exe> -o dump
@@ -26,20 +97,41 @@ int main(int argc, char** argv) {
 // Solution:
 //    To disable address space layout randomization for the programs we launch, and look up the correct load address.
 //    So call to personality(ADDR_NO_RANDOMIZE) before we call execute_debugee in the child process (main.cpp:33)
+//
+// The child could ask to be traced itself (PTRACE_TRACEME), but only a tracee attached with PTRACE_SEIZE can be
+// stopped later on with PTRACE_INTERRUPT (used by the profiler). So the child waits on a pipe until the parent
+// has seized it, then executes the program, which stops it with a SIGTRAP as with PTRACE_TRACEME.
+  int seized[2];
+  if (pipe(seized) != 0) {
+    std::cerr << "Can't create a pipe\n";
+    return -1;
+  }
   auto pid = fork();
   if (pid == 0) {
     std::cout << "Hello from debugee, pid " << getpid() << "\n";
 #if __linux__
     personality(ADDR_NO_RANDOMIZE);
 #endif
-    // ptrace allows us to observe and control the execution of another process by reading registers,
-    // reading memory, single stepping and more.
-    Ptrace::traceMe();
+    close(seized[1]);
+    char go;
+    if (read(seized[0], &go, 1) != 1) {
+      _exit(1);   // the debugger is gone
+    }
+    close(seized[0]);
     execl(programm, programm, nullptr);
+    _exit(1);
   } else if (pid >= 1)  {
     // we're in the parent process execute debugger
+    close(seized[0]);
+    // ptrace allows us to observe and control the execution of another process by reading registers,
+    // reading memory, single stepping and more.
+    Ptrace::seize(pid);
+    if (write(seized[1], "", 1) != 1) {
+      return -1;
+    }
+    close(seized[1]);
     std::cout << "Hello from debugger, pid " << getpid() << ", started debugging process " << pid << '\n';
-    Debugger dbg { programm, pid };
+    Debugger dbg { programm, std::make_unique<LiveTarget>(pid), loader_options };
     dbg.run();
   }
   return 0;
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memory_dump.h"
+#include "ptrace_impl.h"
+
+namespace {
+
+constexpr uint64_t CHUNK = 64 << 20;
+constexpr uint64_t PAGE = 4096;
+
+std::string describe(const std::string& what, const std::string& path) {
+  return what + " " + path + ": " + std::strerror(errno);
+}
+
+std::string hex(uint64_t value) {
+  char text[20];
+  snprintf(text, sizeof(text), "0x%lx", value);
+  return text;
+}
+
+} // namespace
+
+bool dumpMemory(pid_t pid, uint64_t address, uint64_t size, const std::string& path, TransferStatistics& statistics,
+                std::string& error, const TransferProgress& progress,
+                const std::function<void(uint64_t address, uint8_t* bytes, size_t size)>& patch) {
+  statistics = TransferStatistics();
+  const int file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (file < 0) {
+    error = describe("Cannot create", path);
+    return false;
+  }
+  const size_t capacity = std::min(CHUNK, (size + PAGE - 1) / PAGE * PAGE);
+  std::unique_ptr<uint8_t, decltype(&std::free)> buffer(
+    static_cast<uint8_t*>(std::aligned_alloc(PAGE, std::max<size_t>(capacity, PAGE))), &std::free);
+
+  bool complete = true;
+  while (statistics.bytes < size) {
+    const size_t wanted = std::min(CHUNK, size - statistics.bytes);
+    const size_t read = Ptrace::readAvailable(pid, address + statistics.bytes, buffer.get(), wanted);
+    ++statistics.calls;
+    if (read && patch) {
+      patch(address + statistics.bytes, buffer.get(), read);
+    }
+    for (size_t written = 0; written < read;) {
+      const ssize_t done = write(file, buffer.get() + written, read - written);
+      if (done < 0) {
+        error = describe("Cannot write", path);
+        close(file);
+        return false;
+      }
+      written += static_cast<size_t>(done);
+    }
+    statistics.bytes += read;
+    if (progress) {
+      progress(statistics.bytes, size);
+    }
+    if (read < wanted) {
+      error = "Cannot access memory at " + hex(address + statistics.bytes);
+      complete = false;
+      break;
+    }
+  }
+  if (close(file) != 0) {
+    error = describe("Cannot write", path);
+    return false;
+  }
+  return complete;
+}
+
+bool restoreMemory(const std::string& path, uint64_t address, TransferStatistics& statistics, std::string& error,
+                   const std::function<bool(uint64_t address, const uint8_t* bytes, size_t size)>& write,
+                   const TransferProgress& progress) {
+  statistics = TransferStatistics();
+  const int file = open(path.c_str(), O_RDONLY);
+  if (file < 0) {
+    error = describe("Cannot open", path);
+    return false;
+  }
+  struct stat status;
+  if (fstat(file, &status) != 0) {
+    error = describe("Cannot stat", path);
+    close(file);
+    return false;
+  }
+  const uint64_t size = status.st_size;
+  if (size == 0) {
+    close(file);
+    return true;
+  }
+  void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  if (mapped == MAP_FAILED) {
+    error = describe("Cannot map", path);
+    return false;
+  }
+  madvise(mapped, size, MADV_SEQUENTIAL);
+  const auto* bytes = static_cast<const uint8_t*>(mapped);
+
+  bool complete = true;
+  while (statistics.bytes < size) {
+    const size_t chunk = std::min(CHUNK, size - statistics.bytes);
+    ++statistics.calls;
+    if (!write(address + statistics.bytes, bytes + statistics.bytes, chunk)) {
+      error = "Cannot write " + std::to_string(chunk) + " bytes at " + hex(address + statistics.bytes);
+      complete = false;
+      break;
+    }
+    statistics.bytes += chunk;
+    if (progress) {
+      progress(statistics.bytes, size);
+    }
+  }
+  munmap(mapped, size);
+  return complete;
+}
@@ -0,0 +1,163 @@
+#include <cctype>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+
+#include "memory_format.h"
+#include "value_printer.h"
+
+namespace {
+
+constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+// 0x and exactly digits hex digits
+void appendHex(std::string& out, uint64_t value, unsigned digits) {
+  char text[16];
+  for (unsigned i = digits; i-- > 0; value >>= 4) {
+    text[i] = HEX_DIGITS[value & 0xf];
+  }
+  out += "0x";
+  out.append(text, digits);
+}
+
+template <class T>
+void appendNumber(std::string& out, T value, int base = 10) {
+  char text[72];
+  const auto result = std::to_chars(text, text + sizeof(text), value, base);
+  out.append(text, result.ptr);
+}
+
+uint64_t loadUnit(const uint8_t* bytes, unsigned unit) {
+  uint64_t value = 0;
+  std::memcpy(&value, bytes, unit);
+  return value;
+}
+
+int64_t signExtend(uint64_t value, unsigned unit) {
+  const unsigned shift = 64 - unit * 8;
+  return static_cast<int64_t>(value << shift) >> shift;
+}
+
+} // namespace
+
+bool parseExamineFormat(const std::string& spec, ExamineFormat& format) {
+  if (spec.empty()) {
+    format.count = 1;
+    return true;
+  }
+  if (spec[0] != '/' || spec.size() == 1) {
+    return false;
+  }
+  ExamineFormat parsed = format;
+  parsed.count = 1;
+  bool unit_given = false;
+  size_t i = 1;
+  if (std::isdigit(static_cast<unsigned char>(spec[i]))) {
+    const auto result = std::from_chars(spec.data() + i, spec.data() + spec.size(), parsed.count);
+    if (parsed.count == 0) {
+      return false;
+    }
+    i = result.ptr - spec.data();
+  }
+  for (; i < spec.size(); ++i) {
+    switch (spec[i]) {
+      case 'b': parsed.unit = 1; unit_given = true; break;
+      case 'h': parsed.unit = 2; unit_given = true; break;
+      case 'w': parsed.unit = 4; unit_given = true; break;
+      case 'g': parsed.unit = 8; unit_given = true; break;
+      case 'x': case 'd': case 'u': case 'o': case 't': case 'c': case 'a': case 'f': case 's': case 'i':
+        parsed.format = spec[i];
+        break;
+      default:
+        return false;
+    }
+  }
+  // Characters are bytes and addresses are pointers unless told otherwise, floats are floats or doubles
+  if (!unit_given && parsed.format == 'c') {
+    parsed.unit = 1;
+  } else if (parsed.format == 'a' || (parsed.format == 'f' && parsed.unit != 4)) {
+    parsed.unit = 8;
+  }
+  format = parsed;
+  return true;
+}
+
+size_t unitsPerLine(const ExamineFormat& format) {
+  return format.unit <= 2 ? 8 : 16 / format.unit;
+}
+
+void formatUnits(std::string& out, uint64_t address, const uint8_t* bytes, size_t size, const ExamineFormat& format,
+                 const std::function<std::string(uint64_t)>& symbolize) {
+  const unsigned unit = format.unit;
+  const size_t units = size / unit;
+  const size_t per_line = unitsPerLine(format);
+  out.reserve(out.size() + units * (unit * 2 + 4) + units / per_line * 20);
+
+  for (size_t i = 0; i < units; ++i) {
+    if (i % per_line == 0) {
+      if (i) {
+        out += '\n';
+      }
+      out += "0x";
+      appendNumber(out, address + i * unit, 16);
+      out += ':';
+    }
+    out += '\t';
+    const uint64_t value = loadUnit(bytes + i * unit, unit);
+    switch (format.format) {
+      case 'x':
+        appendHex(out, value, unit * 2);
+        break;
+      case 'd':
+        appendNumber(out, signExtend(value, unit));
+        break;
+      case 'u':
+        appendNumber(out, value);
+        break;
+      case 'o':
+        out += '0';
+        if (value) {
+          appendNumber(out, value, 8);
+        }
+        break;
+      case 't':
+        for (unsigned bit = unit * 8; bit-- > 0;) {
+          out += static_cast<char>('0' + ((value >> bit) & 1));
+        }
+        break;
+      case 'c':
+        appendNumber(out, signExtend(value, unit));
+        out += " '";
+        appendEscaped(out, static_cast<char>(value));
+        out += '\'';
+        break;
+      case 'a': {
+        appendHex(out, value, 16);
+        const std::string symbol = symbolize ? symbolize(value) : "";
+        if (!symbol.empty()) {
+          out += " <" + symbol + ">";
+        }
+        break;
+      }
+      case 'f': {
+        char text[32];
+        if (unit == 4) {
+          float number;
+          std::memcpy(&number, &value, sizeof(number));
+          snprintf(text, sizeof(text), "%.9g", number);
+        } else {
+          double number;
+          std::memcpy(&number, &value, sizeof(number));
+          snprintf(text, sizeof(text), "%.17g", number);
+        }
+        out += text;
+        break;
+      }
+      default:
+        appendHex(out, value, unit * 2);
+    }
+  }
+  if (units) {
+    out += '\n';
+  }
+}
@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "memory_search.h"
+#include "ptrace_impl.h"
+
+namespace {
+
+constexpr size_t CHUNK = 8 << 20;
+constexpr uint64_t PAGE = 4096;
+
+int hexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+bool parseString(const std::string& text, std::vector<uint8_t>& bytes, std::string& error) {
+  size_t i = 1;
+  for (; i < text.size() && text[i] != '"'; ++i) {
+    if (text[i] != '\\' || i + 1 == text.size()) {
+      bytes.push_back(text[i]);
+      continue;
+    }
+    switch (text[++i]) {
+      case 'n': bytes.push_back('\n'); break;
+      case 't': bytes.push_back('\t'); break;
+      case 'r': bytes.push_back('\r'); break;
+      case '0': bytes.push_back('\0'); break;
+      case 'x': {
+        int value = 0;
+        int digits = 0;
+        for (int digit; digits < 2 && i + 1 < text.size() && (digit = hexDigit(text[i + 1])) >= 0; ++digits, ++i) {
+          value = value * 16 + digit;
+        }
+        if (digits == 0) {
+          error = "\\x without hex digits";
+          return false;
+        }
+        bytes.push_back(value);
+        break;
+      }
+      default: bytes.push_back(text[i]);
+    }
+  }
+  if (i == text.size()) {
+    error = "Unterminated string";
+    return false;
+  }
+  return true;
+}
+
+// 7f 45 ?? 46, or 7f45??46
+bool parseBytes(const std::string& text, SearchPattern& pattern, std::string& error) {
+  bool masked = false;
+  std::string digits;
+  for (char c : text) {
+    if (std::isxdigit(static_cast<unsigned char>(c)) || c == '?') {
+      digits += c;
+    } else if (!std::isspace(static_cast<unsigned char>(c)) && c != ',') {
+      error = std::string("Not a hex digit: ") + c;
+      return false;
+    }
+  }
+  if (digits.size() % 2) {
+    error = "Odd number of hex digits";
+    return false;
+  }
+  for (size_t i = 0; i < digits.size(); i += 2) {
+    if (digits[i] == '?' || digits[i + 1] == '?') {
+      if (digits[i] != digits[i + 1]) {
+        error = "?? stands for a whole byte";
+        return false;
+      }
+      pattern.bytes.push_back(0);
+      pattern.mask.push_back(0);
+      masked = true;
+    } else {
+      pattern.bytes.push_back(hexDigit(digits[i]) * 16 + hexDigit(digits[i + 1]));
+      pattern.mask.push_back(0xff);
+    }
+  }
+  if (!masked) {
+    pattern.mask.clear();
+  }
+  return true;
+}
+
+bool parseInteger(const std::string& word, unsigned unit, uint64_t& value, std::string& error) {
+  size_t end = 0;
+  try {
+    value = word[0] == '-' ? static_cast<uint64_t>(std::stoll(word, &end, 0)) : std::stoull(word, &end, 0);
+  } catch (std::exception&) {
+    end = 0;
+  }
+  if (end != word.size() || end == 0) {
+    error = "Not an integer: " + word;
+    return false;
+  }
+  if (unit < 8) {
+    const uint64_t high = value >> (unit * 8);
+    const bool fits = word[0] == '-' ? high == (~0ULL >> (unit * 8)) : high == 0;
+    if (!fits) {
+      error = word + " doesn't fit in " + std::to_string(unit) + " bytes";
+      return false;
+    }
+  }
+  return true;
+}
+
+// 0x1234 -1, mask 0xff00
+bool parseValues(const std::string& text, unsigned unit, SearchPattern& pattern, std::string& error) {
+  std::string words = text;
+  for (char& c : words) {
+    if (c == ',') {
+      c = ' ';
+    }
+  }
+  std::istringstream in(words);
+  std::string word;
+  uint64_t mask = ~0ULL;
+  while (in >> word) {
+    if (word == "mask") {
+      if (!(in >> word) || !parseInteger(word, unit, mask, error)) {
+        error = error.empty() ? "mask needs a value" : error;
+        return false;
+      }
+      if (in >> word) {
+        error = "The mask comes last";
+        return false;
+      }
+      break;
+    }
+    uint64_t value;
+    if (!parseInteger(word, unit, value, error)) {
+      return false;
+    }
+    const size_t offset = pattern.bytes.size();
+    pattern.bytes.resize(offset + unit);
+    std::memcpy(pattern.bytes.data() + offset, &value, unit);
+  }
+  if (pattern.bytes.empty()) {
+    error = "No value to search";
+    return false;
+  }
+  if (unit < 8) {
+    mask &= (1ULL << (unit * 8)) - 1;
+  }
+  if (mask != (unit < 8 ? (1ULL << (unit * 8)) - 1 : ~0ULL)) {
+    pattern.mask.resize(pattern.bytes.size());
+    for (size_t offset = 0; offset < pattern.bytes.size(); offset += unit) {
+      std::memcpy(pattern.mask.data() + offset, &mask, unit);
+    }
+  }
+  return true;
+}
+
+// Where matches of pattern begin in [data, data + size), for the starts below limit
+template <class Found>
+bool scan(const uint8_t* data, size_t size, size_t limit, const SearchPattern& pattern, size_t anchor,
+          Found&& found) {
+  const size_t length = pattern.bytes.size();
+  if (size < length) {
+    return true;
+  }
+  limit = std::min(limit, size - length + 1);
+  if (pattern.mask.empty()) {
+    for (size_t start = 0; start < limit;) {
+      const auto* hit = static_cast<const uint8_t*>(memmem(data + start, limit - start + length - 1,
+                                                           pattern.bytes.data(), length));
+      if (!hit) {
+        break;
+      }
+      start = hit - data;
+      if (!found(start)) {
+        return false;
+      }
+      ++start;
+    }
+    return true;
+  }
+
+  auto matches = [&](size_t start) {
+    for (size_t i = 0; i < length; ++i) {
+      if ((data[start + i] ^ pattern.bytes[i]) & pattern.mask[i]) {
+        return false;
+      }
+    }
+    return true;
+  };
+  if (anchor == length) {   // no exact byte: every offset
+    for (size_t start = 0; start < limit; ++start) {
+      if (matches(start) && !found(start)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  for (size_t start = 0; start < limit;) {
+    const auto* hit = static_cast<const uint8_t*>(memchr(data + start + anchor, pattern.bytes[anchor], limit - start));
+    if (!hit) {
+      break;
+    }
+    start = hit - data - anchor;
+    if (matches(start) && !found(start)) {
+      return false;
+    }
+    ++start;
+  }
+  return true;
+}
+
+// The exact byte memchr looks for: one which is rarely in memory if possible, length if there is none
+size_t anchorOf(const SearchPattern& pattern) {
+  size_t anchor = pattern.bytes.size();
+  for (size_t i = 0; i < pattern.bytes.size(); ++i) {
+    if (pattern.mask[i] != 0xff) {
+      continue;
+    }
+    if (pattern.bytes[i] != 0 && pattern.bytes[i] != 0xff) {
+      return i;
+    }
+    anchor = std::min(anchor, i);
+  }
+  return anchor;
+}
+
+} // namespace
+
+bool parsePattern(const std::string& text, unsigned unit, SearchPattern& pattern, std::string& error) {
+  pattern = SearchPattern();
+  error.clear();
+  const size_t begin = text.find_first_not_of(" \t");
+  if (begin == std::string::npos) {
+    error = "No pattern";
+    return false;
+  }
+  const std::string trimmed = text.substr(begin);
+  bool parsed;
+  if (trimmed[0] == '"') {
+    parsed = parseString(trimmed, pattern.bytes, error);
+  } else if (trimmed.compare(0, 5, "bytes") == 0 && (trimmed.size() == 5 || std::isspace(trimmed[5]))) {
+    parsed = parseBytes(trimmed.substr(5), pattern, error);
+  } else {
+    parsed = parseValues(trimmed, unit, pattern, error);
+  }
+  if (parsed && pattern.bytes.empty()) {
+    error = "Empty pattern";
+    return false;
+  }
+  return parsed;
+}
+
+std::vector<MemoryRegion> readableRegions(pid_t pid, uint64_t low, uint64_t high) {
+  std::vector<MemoryRegion> regions;
+  std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+  std::string line;
+  while (std::getline(maps, line)) {
+    // 7ffff7dd3000-7ffff7dfc000 r-xp 00000000 08:01 1234   /usr/lib/x86_64-linux-gnu/ld-2.31.so
+    std::istringstream in(line);
+    std::string range, permissions, offset, device, inode;
+    in >> range >> permissions >> offset >> device >> inode;
+    MemoryRegion region;
+    std::getline(in >> std::ws, region.name);
+    const size_t dash = range.find('-');
+    if (permissions.empty() || permissions[0] != 'r' || dash == std::string::npos) {
+      continue;
+    }
+    // process_vm_readv can't read them: the vDSO's data is the kernel's, vsyscall is emulated
+    if (region.name == "[vvar]" || region.name == "[vvar_vclock]" || region.name == "[vsyscall]") {
+      continue;
+    }
+    region.low = std::max<uint64_t>(low, std::stoull(range.substr(0, dash), nullptr, 16));
+    region.high = std::min<uint64_t>(high, std::stoull(range.substr(dash + 1), nullptr, 16));
+    if (region.low < region.high) {
+      regions.push_back(std::move(region));
+    }
+  }
+  return regions;
+}
+
+SearchStatistics searchMemory(pid_t pid, const std::vector<MemoryRegion>& regions, const SearchPattern& pattern,
+                              const std::function<bool(uint64_t address, const MemoryRegion& region)>& found,
+                              const std::function<void(uint64_t address, uint8_t* bytes, size_t size)>& patch) {
+  SearchStatistics statistics;
+  const size_t length = pattern.bytes.size();
+  const size_t overlap = length - 1;
+  const size_t anchor = pattern.mask.empty() ? 0 : anchorOf(pattern);
+  std::vector<uint8_t> buffer(overlap + CHUNK);
+
+  for (const MemoryRegion& region : regions) {
+    ++statistics.regions;
+    // buffer holds [base, base + kept + read): the kept bytes are the end of the previous chunk
+    uint64_t base = region.low;
+    size_t kept = 0;
+    for (uint64_t address = region.low; address < region.high;) {
+      const size_t wanted = std::min<uint64_t>(CHUNK, region.high - address);
+      const size_t read = Ptrace::readAvailable(pid, address, buffer.data() + kept, wanted);
+      ++statistics.reads;
+      if (read && patch) {
+        patch(address, buffer.data() + kept, read);
+      }
+      statistics.bytes += read;
+      const size_t size = kept + read;
+      // Starts whose match would run past the chunk are left for the next one, unless the region ends there
+      const bool last = read < wanted || address + read == region.high;
+      const size_t limit = last ? size : size - std::min(size, overlap);
+      const bool go_on = scan(buffer.data(), size, limit, pattern, anchor, [&](size_t start) {
+        ++statistics.matches;
+        return found(base + start, region);
+      });
+      if (!go_on) {
+        return statistics;
+      }
+      if (read < wanted) {
+        // A hole in the mapping (a page of a file past its end): go on after it
+        address = (address + read) / PAGE * PAGE + PAGE;
+        base = address;
+        kept = 0;
+        continue;
+      }
+      address += read;
+      kept = std::min(size, overlap);
+      std::memmove(buffer.data(), buffer.data() + size - kept, kept);
+      base = address - kept;
+    }
+  }
+  return statistics;
+}
@@ -1,5 +1,12 @@
+#include <algorithm>
+#include <climits>
 #include <cstring>
 #include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "ptrace_impl.h"
 
@@ -23,6 +30,29 @@ void Ptrace::traceMe() {
   m_ptrace(PT_TRACE_ME, 0, 0, nullptr);
 }
 
+void Ptrace::seize(pid_t pid) {
+  m_ptrace(PTRACE_SEIZE, pid, 0, reinterpret_cast<uint64_t*>(PTRACE_O_EXITKILL | PTRACE_O_TRACEEXEC |
+                                                        PTRACE_O_TRACECLONE));
+}
+
+bool Ptrace::attach(pid_t tid) {
+  return ptrace(PTRACE_SEIZE, tid, nullptr, PTRACE_O_TRACEEXEC | PTRACE_O_TRACECLONE) == 0;
+}
+
+bool Ptrace::detach(pid_t tid, int signal) {
+  return ptrace(PTRACE_DETACH, tid, nullptr, signal) == 0;
+}
+
+bool Ptrace::interrupt(pid_t pid) {
+  return ptrace(PTRACE_INTERRUPT, pid, nullptr, nullptr) == 0;
+}
+
+pid_t Ptrace::getEventMessage(pid_t pid) {
+  unsigned long message = 0;
+  m_ptrace(PTRACE_GETEVENTMSG, pid, 0, reinterpret_cast<uint64_t*>(&message));
+  return static_cast<pid_t>(message);
+}
+
 void Ptrace::continueExec(pid_t m_pid) {
   m_ptrace(PT_CONTINUE, m_pid, 0, nullptr);
 }
@@ -31,6 +61,104 @@ uint64_t Ptrace::readMemory(uint64_t pid, uint64_t address) {
   return m_ptrace(PTRACE_PEEKDATA, pid, address, nullptr);
 }
 
+bool Ptrace::readBytes(pid_t pid, uint64_t address, void* buffer, size_t size) {
+  iovec local { buffer, size };
+  iovec remote { reinterpret_cast<void*>(address), size };
+  return process_vm_readv(pid, &local, 1, &remote, 1, 0) == static_cast<ssize_t>(size);
+}
+
+// A partial transfer never splits an iovec: after a failed read of the whole range, one iovec per page tells where
+// the mapped part ends
+size_t Ptrace::readAvailable(pid_t pid, uint64_t address, void* buffer, size_t size) {
+  constexpr uint64_t PAGE = 0x1000;
+  if (size == 0 || readBytes(pid, address, buffer, size)) {
+    return size;
+  }
+  std::vector<iovec> remote;
+  remote.reserve(std::min<size_t>(size / PAGE + 2, IOV_MAX));
+  size_t done = 0;
+  while (done < size) {
+    remote.clear();
+    size_t batch = 0;
+    for (uint64_t at = address + done; batch < size - done && remote.size() < IOV_MAX;) {
+      const size_t length = std::min<uint64_t>(PAGE - at % PAGE, size - done - batch);
+      remote.push_back({ reinterpret_cast<void*>(at), length });
+      at += length;
+      batch += length;
+    }
+    iovec local { static_cast<uint8_t*>(buffer) + done, batch };
+    const ssize_t read = process_vm_readv(pid, &local, 1, remote.data(), remote.size(), 0);
+    if (read <= 0) {
+      return done;
+    }
+    done += static_cast<size_t>(read);
+    if (static_cast<size_t>(read) < batch) {
+      return done;
+    }
+  }
+  return done;
+}
+
+bool Ptrace::writeBytes(pid_t pid, uint64_t address, const void* buffer, size_t size) {
+  iovec local { const_cast<void*>(buffer), size };
+  iovec remote { reinterpret_cast<void*>(address), size };
+  if (process_vm_writev(pid, &local, 1, &remote, 1, 0) == static_cast<ssize_t>(size)) {
+    return true;
+  }
+  // The tracer may write where the tracee can't, like PTRACE_POKEDATA does
+  const int mem = open(("/proc/" + std::to_string(pid) + "/mem").c_str(), O_RDWR);
+  if (mem < 0) {
+    return false;
+  }
+  size_t done = 0;
+  while (done < size) {
+    const ssize_t written = pwrite(mem, static_cast<const uint8_t*>(buffer) + done, size - done, address + done);
+    if (written <= 0) {
+      break;
+    }
+    done += static_cast<size_t>(written);
+  }
+  close(mem);
+  return done == size;
+}
+
+size_t Ptrace::writeBlocks(pid_t pid, const std::vector<std::pair<uint64_t, std::vector<uint8_t>>>& blocks) {
+  const int mem = open(("/proc/" + std::to_string(pid) + "/mem").c_str(), O_RDWR);
+  if (mem < 0) {
+    return 0;
+  }
+  size_t written = 0;
+  for (const auto& [address, bytes] : blocks) {
+    if (pwrite(mem, bytes.data(), bytes.size(), address) != static_cast<ssize_t>(bytes.size())) {
+      break;
+    }
+    ++written;
+  }
+  close(mem);
+  return written;
+}
+
+size_t Ptrace::readBlocks(pid_t pid, const uint64_t* addresses, size_t count, size_t size, void* buffer) {
+  std::vector<iovec> remote(std::min<size_t>(count, IOV_MAX));
+  size_t done = 0;
+  while (done < count) {
+    const size_t batch = std::min<size_t>(count - done, IOV_MAX);
+    for (size_t i = 0; i < batch; ++i) {
+      remote[i] = { reinterpret_cast<void*>(addresses[done + i]), size };
+    }
+    iovec local { static_cast<uint8_t*>(buffer) + done * size, batch * size };
+    const ssize_t read = process_vm_readv(pid, &local, 1, remote.data(), batch, 0);
+    if (read <= 0) {
+      return done;
+    }
+    done += static_cast<size_t>(read) / size;
+    if (static_cast<size_t>(read) < batch * size) {
+      return done;
+    }
+  }
+  return done;
+}
+
 void Ptrace::writeMemory(uint64_t pid, uint64_t address, uint64_t data) {
   m_ptrace(PTRACE_POKEDATA, pid, address, reinterpret_cast<uint64_t*>(data));
 }
@@ -39,10 +167,18 @@ void Ptrace::singleStep(pid_t m_pid) {
   m_ptrace(PTRACE_SINGLESTEP, m_pid, 0, nullptr);
 }
 
+void Ptrace::singleBlock(pid_t m_pid) {
+  m_ptrace(PTRACE_SINGLEBLOCK, m_pid, 0, nullptr);
+}
+
 void Ptrace::getRegisters(uint64_t pid, user_regs_struct* user_regs) {
   m_ptrace(PTRACE_GETREGS, pid, 0, reinterpret_cast<uint64_t*>(user_regs));
 }
 
+void Ptrace::getFpRegisters(pid_t pid, user_fpregs_struct* fp_regs) {
+  m_ptrace(PTRACE_GETFPREGS, pid, 0, reinterpret_cast<uint64_t*>(fp_regs));
+}
+
 void Ptrace::setRegisters(uint64_t pid, user_regs_struct* user_regs) {
   m_ptrace(PTRACE_SETREGS, pid, 0, reinterpret_cast<uint64_t*>(user_regs));
 }
@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+
+#include "internal.hh"
+#include "scope_index.h"
+
+namespace {
+
+// The name of a DIE, through DW_AT_abstract_origin (inlined code) and DW_AT_specification (members defined outside
+// of their class)
+std::string nameOf(const dwarf::die& die, unsigned depth = 0) {
+  if (die.has(dwarf::DW_AT::name)) {
+    return at_name(die);
+  }
+  for (const dwarf::DW_AT attribute : {dwarf::DW_AT::abstract_origin, dwarf::DW_AT::specification}) {
+    if (die.has(attribute) && depth < 4) {
+      return nameOf(die[attribute].as_reference(), depth + 1);
+    }
+  }
+  return "";
+}
+
+bool covers(const FunctionScopes::Scope& scope, uint64_t pc) {
+  for (const auto& [low, high] : scope.ranges) {
+    if (pc >= low && pc < high) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+const FunctionScopes* ScopeIndex::function(uint64_t pc) {
+  if (!m_indexed) {
+    m_indexed = true;
+    for (const auto& compilation_unit : m_dwarf.compilation_units()) {
+      indexFunctions(m_split_dwarf.resolve(compilation_unit).root());
+    }
+    std::sort(m_ranges.begin(), m_ranges.end(), [](const Range& a, const Range& b) { return a.low < b.low; });
+  }
+
+  auto after = std::upper_bound(m_ranges.begin(), m_ranges.end(), pc,
+                                [](uint64_t pc, const Range& range) { return pc < range.low; });
+  if (after == m_ranges.begin() || pc >= std::prev(after)->high) {
+    return nullptr;
+  }
+  FunctionScopes& function = *m_scopes[std::prev(after)->function];
+  if (function.scopes.empty()) {
+    function.name = nameOf(function.function);
+    if (function.function.has(dwarf::DW_AT::frame_base)) {
+      const dwarf::value frame_base = function.function[dwarf::DW_AT::frame_base];
+      if (frame_base.get_type() == dwarf::value::type::exprloc || frame_base.get_type() == dwarf::value::type::block) {
+        function.frame_base = static_cast<const uint8_t*>(frame_base.as_block(&function.frame_base_size));
+      }
+    }
+    flatten(function.function, function);
+    ++m_flattened;
+  }
+  return &function;
+}
+
+// Functions with code at namespace scope. Declarations (printf, the members of a class) have no pc.
+void ScopeIndex::indexFunctions(const dwarf::die& parent) {
+  for (const auto& die : parent) {
+    if (die.tag == dwarf::DW_TAG::subprogram && (die.has(dwarf::DW_AT::low_pc) || die.has(dwarf::DW_AT::ranges))) {
+      m_scopes.push_back(std::make_unique<FunctionScopes>());
+      m_scopes.back()->function = die;
+      for (const auto& range : die_pc_range(die)) {
+        m_ranges.push_back({range.low, range.high, m_scopes.size() - 1});
+      }
+    } else if (die.tag == dwarf::DW_TAG::namespace_) {
+      indexFunctions(die);
+    }
+  }
+}
+
+// The variables of a scope first (they must be contiguous), then the scopes inside
+void ScopeIndex::flatten(const dwarf::die& die, FunctionScopes& function) {
+  using dwarf::DW_AT;
+  using dwarf::DW_TAG;
+  const size_t index = function.scopes.size();
+  function.scopes.emplace_back();
+  if (die.has(DW_AT::low_pc) || die.has(DW_AT::ranges)) {
+    for (const auto& range : die_pc_range(die)) {
+      function.scopes[index].ranges.emplace_back(range.low, range.high);
+    }
+  }
+  if (die.tag == DW_TAG::inlined_subroutine) {
+    function.scopes[index].inlined = nameOf(die);
+  }
+
+  function.scopes[index].first = function.variables.size();
+  for (const auto& child : die) {
+    if (child.tag != DW_TAG::variable && child.tag != DW_TAG::formal_parameter) {
+      continue;
+    }
+    // "extern int x;" in a block: the global is found by name
+    if (child.has(DW_AT::declaration) && !child.has(DW_AT::location)) {
+      continue;
+    }
+    ScopeVariable variable;
+    variable.name = nameOf(child);
+    if (variable.name.empty()) {
+      continue;   // the unnamed parameters of a function
+    }
+    variable.die = child;
+    variable.declaration = child.has(DW_AT::abstract_origin) ? child[DW_AT::abstract_origin].as_reference() : child;
+    variable.parameter = child.tag == DW_TAG::formal_parameter;
+    function.variables.push_back(std::move(variable));
+  }
+  function.scopes[index].count = function.variables.size() - function.scopes[index].first;
+
+  for (const auto& child : die) {
+    if (child.tag == DW_TAG::lexical_block || child.tag == DW_TAG::inlined_subroutine) {
+      flatten(child, function);
+    }
+  }
+  function.scopes[index].end = function.scopes.size();
+}
+
+std::vector<const ScopeVariable*> ScopeIndex::visible(const FunctionScopes& function, uint64_t pc) const {
+  // Scopes don't overlap their siblings: the ones covering pc are the path from the function down
+  std::vector<uint32_t> path;
+  for (uint32_t i = 0; i < function.scopes.size();) {
+    if (covers(function.scopes[i], pc)) {
+      path.push_back(i++);
+    } else {
+      i = function.scopes[i].end;
+    }
+  }
+
+  std::vector<const ScopeVariable*> variables;
+  std::unordered_set<std::string> names;
+  for (auto scope = path.rbegin(); scope != path.rend(); ++scope) {
+    const FunctionScopes::Scope& current = function.scopes[*scope];
+    for (uint32_t i = current.first; i < current.first + current.count; ++i) {
+      if (names.insert(function.variables[i].name).second) {
+        variables.push_back(&function.variables[i]);
+      }
+    }
+    if (!current.inlined.empty()) {
+      break;
+    }
+  }
+  return variables;
+}
+
+// DWARF 4 .debug_loc: (begin, end) offsets from the base address (the low pc of the unit, or the last base address
+// selection entry: begin ~0), a 2-byte length and the expression, up to (0, 0)
+bool ScopeIndex::location(const dwarf::die& variable, uint64_t pc, const uint8_t*& expression, size_t& size) {
+  using dwarf::DW_AT;
+  if (!variable.has(DW_AT::location)) {
+    return false;
+  }
+  const dwarf::value location = variable[DW_AT::location];
+  if (location.get_type() == dwarf::value::type::exprloc || location.get_type() == dwarf::value::type::block) {
+    expression = static_cast<const uint8_t*>(location.as_block(&size));
+    return size > 0;
+  }
+  if (location.get_type() != dwarf::value::type::loclist) {
+    return false;
+  }
+
+  // Split units (-gsplit-dwarf) have their lists in .debug_loc.dwo, in another format
+  const elf::section& info = m_elf.get_section(".debug_info");
+  const char* unit_data = variable.get_unit().data()->begin;
+  const auto* info_data = static_cast<const char*>(info.data());
+  if (!info.valid() || unit_data < info_data || unit_data >= info_data + info.size()) {
+    return false;
+  }
+  const elf::section& section = m_elf.get_section(".debug_loc");
+  if (!section.valid()) {
+    return false;
+  }
+  const auto* data = static_cast<const uint8_t*>(section.data());
+  const dwarf::die& unit = variable.get_unit().root();
+  uint64_t base = unit.has(DW_AT::low_pc) ? at_low_pc(unit) : 0;
+
+  for (uint64_t offset = location.as_sec_offset(); offset + 2 * sizeof(uint64_t) <= section.size();) {
+    uint64_t begin;
+    uint64_t end;
+    std::memcpy(&begin, data + offset, sizeof(begin));
+    std::memcpy(&end, data + offset + sizeof(begin), sizeof(end));
+    offset += 2 * sizeof(uint64_t);
+    if (begin == 0 && end == 0) {
+      return false;
+    }
+    if (begin == ~0ULL) {
+      base = end;
+      continue;
+    }
+    uint16_t length;
+    if (offset + sizeof(length) > section.size()) {
+      return false;
+    }
+    std::memcpy(&length, data + offset, sizeof(length));
+    offset += sizeof(length);
+    if (offset + length > section.size()) {
+      return false;
+    }
+    if (pc >= base + begin && pc < base + end) {
+      expression = data + offset;
+      size = length;
+      return size > 0;
+    }
+    offset += length;
+  }
+  return false;
+}
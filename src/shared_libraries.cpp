@@ -0,0 +1,321 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <unistd.h>
+
+#include "shared_libraries.h"
+
+namespace {
+
+bool isSuffix(const std::string& suffix, const std::string& of) {
+  return suffix.size() <= of.size() && std::equal(suffix.rbegin(), suffix.rend(), of.rbegin());
+}
+
+// The link-time value of a function symbol of file (.symtab, then .dynsym), 0 if there is none
+uint64_t findSymbol(const elf::elf& file, const std::string& name) {
+  for (const char* section_name : { ".symtab", ".dynsym" }) {
+    const elf::section& section = file.get_section(section_name);
+    if (!section.valid()) {
+      continue;
+    }
+    for (const elf::sym symbol : section.as_symtab()) {
+      if (symbol.get_data().value != 0 && symbol.get_name() == name) {
+        return symbol.get_data().value;
+      }
+    }
+  }
+  return 0;
+}
+
+// The addresses the PT_LOAD segments of the file at path span, from its program headers alone
+bool readSpan(const std::string& path, uint64_t bias, uint64_t& low, uint64_t& high) {
+  const int file = open(path.c_str(), O_RDONLY);
+  if (file < 0) {
+    return false;
+  }
+  Elf64_Ehdr header;
+  std::vector<Elf64_Phdr> segments;
+  bool read = pread(file, &header, sizeof(header), 0) == sizeof(header) &&
+              std::memcmp(header.e_ident, ELFMAG, SELFMAG) == 0 && header.e_phentsize == sizeof(Elf64_Phdr);
+  if (read) {
+    segments.resize(header.e_phnum);
+    const auto size = static_cast<ssize_t>(segments.size() * sizeof(Elf64_Phdr));
+    read = pread(file, segments.data(), size, header.e_phoff) == size;
+  }
+  close(file);
+  low = UINT64_MAX;
+  high = 0;
+  for (const Elf64_Phdr& segment : segments) {
+    if (read && segment.p_type == PT_LOAD) {
+      low = std::min<uint64_t>(low, bias + (segment.p_vaddr & ~0xfffULL));
+      high = std::max<uint64_t>(high, bias + segment.p_vaddr + segment.p_memsz);
+    }
+  }
+  return low < high;
+}
+
+// On a thread of its own (std::async): the library's ELF and DWARF mapped, its functions by name
+std::shared_ptr<const LibraryIndex> buildIndex(const std::string& path) {
+  auto index = std::make_shared<LibraryIndex>();
+  const int file = open(path.c_str(), O_RDONLY);
+  if (file < 0) {
+    return index;
+  }
+  try {
+    index->file = elf::elf { elf::create_mmap_loader(file) };
+  } catch (std::exception&) {
+    return index;
+  }
+  try {
+    index->debug = dwarf::dwarf { dwarf::elf::create_loader(index->file) };
+    for (const auto& compilation_unit : index->debug.compilation_units()) {
+      const dwarf::line_table& line_table = compilation_unit.get_line_table();
+      for (const auto& die : compilation_unit.root()) {
+        if (die.tag != dwarf::DW_TAG::subprogram || !die.has(dwarf::DW_AT::name) || !die.has(dwarf::DW_AT::low_pc)) {
+          continue;
+        }
+        // As for the program's functions: the row after the one of low_pc is the first line of the body
+        auto entry = line_table.find_address(at_low_pc(die));
+        if (entry != line_table.end() && ++entry != line_table.end()) {
+          index->functions.emplace(at_name(die), entry->address);
+        }
+      }
+    }
+  } catch (std::exception&) {
+    // No .debug_info (a library from the distribution), or DWARF libdwarf can't read: the symbols only
+    index->debug = dwarf::dwarf {};
+  }
+  for (const char* section_name : { ".symtab", ".dynsym" }) {
+    const elf::section& section = index->file.get_section(section_name);
+    if (!section.valid()) {
+      continue;
+    }
+    bool any = false;
+    for (const elf::sym symbol : section.as_symtab()) {
+      const auto& data = symbol.get_data();
+      if (data.type() == elf::stt::func && data.value != 0) {
+        index->functions.emplace(symbol.get_name(), data.value);
+        any = true;
+      }
+    }
+    if (any) {
+      break;
+    }
+  }
+  return index;
+}
+
+} // namespace
+
+uint64_t SharedLibraries::locate(const elf::elf& program, uint64_t load_address) {
+  std::string interpreter;
+  for (const elf::segment& segment : program.segments()) {
+    const auto& header = segment.get_hdr();
+    if (header.type == elf::pt::dynamic) {
+      m_dynamic = load_address + header.vaddr;
+    } else if (header.type == elf::pt::interp) {
+      const char* path = static_cast<const char*>(segment.data());
+      interpreter.assign(path, strnlen(path, header.filesz));
+    }
+  }
+  if (m_dynamic == 0) {
+    return 0;
+  }
+
+  for (uint64_t address = m_dynamic;; address += sizeof(Elf64_Dyn)) {
+    Elf64_Dyn entry;
+    if (!m_target.readBytes(address, &entry, sizeof(entry)) || entry.d_tag == DT_NULL) {
+      break;
+    }
+    if (entry.d_tag == DT_DEBUG) {
+      m_r_debug = entry.d_un.d_ptr;
+      break;
+    }
+  }
+  r_debug rendezvous {};
+  if (m_r_debug && m_target.readBytes(m_r_debug, &rendezvous, sizeof(rendezvous)) && rendezvous.r_brk) {
+    m_break = rendezvous.r_brk;
+    return m_break;
+  }
+  if (interpreter.empty() || !m_target.live()) {
+    return 0;
+  }
+
+  // Stopped at exec: the loader hasn't run. Its own r_debug and r_brk, where the kernel mapped it.
+  uint64_t base = 0;
+  std::ifstream auxv("/proc/" + std::to_string(m_target.pid()) + "/auxv", std::ios::binary);
+  for (uint64_t pair[2]; auxv.read(reinterpret_cast<char*>(pair), sizeof(pair)) && pair[0] != AT_NULL;) {
+    if (pair[0] == AT_BASE) {
+      base = pair[1];
+    }
+  }
+  const int file = open(interpreter.c_str(), O_RDONLY);
+  if (base == 0 || file < 0) {
+    return 0;
+  }
+  try {
+    const elf::elf loader { elf::create_mmap_loader(file) };
+    const uint64_t debug_state = findSymbol(loader, "_dl_debug_state");
+    const uint64_t r_debug_address = findSymbol(loader, "_r_debug");
+    if (debug_state && r_debug_address) {
+      m_break = base + debug_state;
+      m_r_debug = base + r_debug_address;
+    }
+  } catch (std::exception&) {
+  }
+  return m_break;
+}
+
+bool SharedLibraries::readString(uint64_t address, std::string& text) {
+  text.clear();
+  char chunk[256];
+  while (text.size() < PATH_MAX) {
+    const size_t read = m_target.readAvailable(address + text.size(), chunk, sizeof(chunk));
+    const size_t length = strnlen(chunk, read);
+    text.append(chunk, length);
+    if (length < sizeof(chunk)) {
+      return length < read;
+    }
+  }
+  return false;
+}
+
+bool SharedLibraries::update(std::vector<const SharedLibrary*>& loaded, std::vector<SharedLibrary>& unloaded) {
+  r_debug rendezvous {};
+  if (m_r_debug == 0 || !m_target.readBytes(m_r_debug, &rendezvous, sizeof(rendezvous)) ||
+      rendezvous.r_state != r_debug::RT_CONSISTENT) {
+    return false;
+  }
+
+  struct Entry {
+    uint64_t link_map;
+    std::string path;
+    uint64_t bias;
+  };
+  std::vector<Entry> entries;
+  std::set<std::pair<uint64_t, std::string>> listed;
+  // A list being corrupted by the program mustn't loop forever
+  auto address = reinterpret_cast<uint64_t>(rendezvous.r_map);
+  for (size_t count = 0; address && count < 65536; ++count) {
+    link_map entry {};
+    std::string path;
+    if (!m_target.readBytes(address, &entry, sizeof(entry))) {
+      return false;
+    }
+    // The program's entry has no name, nor has the vDSO a file
+    if (readString(reinterpret_cast<uint64_t>(entry.l_name), path) && !path.empty() && path[0] == '/') {
+      entries.push_back({ address, path, entry.l_addr });
+      listed.emplace(address, path);
+    }
+    address = reinterpret_cast<uint64_t>(entry.l_next);
+  }
+
+  std::set<std::pair<uint64_t, std::string>> known;
+  for (auto library = m_libraries.begin(); library != m_libraries.end();) {
+    if (listed.count({ library->second.link_map, library->second.path })) {
+      known.emplace(library->second.link_map, library->second.path);
+      ++library;
+    } else {
+      unloaded.push_back(std::move(library->second));
+      library = m_libraries.erase(library);
+    }
+  }
+  for (const Entry& entry : entries) {
+    SharedLibrary library;
+    if (known.count({ entry.link_map, entry.path }) || !readSpan(entry.path, entry.bias, library.low, library.high)) {
+      continue;
+    }
+    library.path = entry.path;
+    library.bias = entry.bias;
+    library.link_map = entry.link_map;
+    library.index = std::async(std::launch::async, [this, path = entry.path, link_map = entry.link_map]() {
+      const auto start = std::chrono::steady_clock::now();
+      auto index = buildIndex(path);
+      const double milliseconds =
+          std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      m_events.post([this, path, link_map, milliseconds]() { indexed(link_map, path, milliseconds); });
+      return index;
+    }).share();
+    auto inserted = m_libraries.insert_or_assign(library.low, std::move(library)).first;
+    loaded.push_back(&inserted->second);
+  }
+  return true;
+}
+
+void SharedLibraries::indexed(uint64_t link_map, const std::string& path, double milliseconds) {
+  // Not there if it was unloaded meanwhile. Loaded again since, the first of its indexes to be done is taken.
+  for (auto& [low, library] : m_libraries) {
+    if (library.link_map == link_map && library.path == path && library.index_ms < 0) {
+      library.index_ms = milliseconds;
+      return;
+    }
+  }
+}
+
+const SharedLibrary* SharedLibraries::find(uint64_t address) const {
+  auto after = m_libraries.upper_bound(address);
+  if (after == m_libraries.begin() || address >= std::prev(after)->second.high) {
+    return nullptr;
+  }
+  return &std::prev(after)->second;
+}
+
+uint64_t SharedLibraries::functionAddress(const SharedLibrary& library, const std::string& name) const {
+  const LibraryIndex& found = index(library);
+  auto function = found.functions.find(name);
+  return function == found.functions.end() ? 0 : library.bias + function->second;
+}
+
+uint64_t SharedLibraries::lineAddress(const SharedLibrary& library, const std::string& file_name,
+                                      uint32_t line) const {
+  const LibraryIndex& found = index(library);
+  if (!found.debug.valid()) {
+    return 0;
+  }
+  try {
+    for (const auto& compilation_unit : found.debug.compilation_units()) {
+      if (!compilation_unit.root().has(dwarf::DW_AT::name) || !isSuffix(file_name, at_name(compilation_unit.root()))) {
+        continue;
+      }
+      for (const auto& entry : compilation_unit.get_line_table()) {
+        if (entry.is_stmt && entry.line == line) {
+          return library.bias + entry.address;
+        }
+      }
+    }
+  } catch (std::exception&) {
+  }
+  return 0;
+}
+
+bool SharedLibraries::sourceLine(const SharedLibrary& library, uint64_t address, std::string& file,
+                                 unsigned& line) const {
+  const LibraryIndex& found = index(library);
+  if (!found.debug.valid()) {
+    return false;
+  }
+  const uint64_t link_address = address - library.bias;
+  try {
+    for (const auto& compilation_unit : found.debug.compilation_units()) {
+      if (!die_pc_range(compilation_unit.root()).contains(link_address)) {
+        continue;
+      }
+      const dwarf::line_table& line_table = compilation_unit.get_line_table();
+      auto entry = line_table.find_address(link_address);
+      if (entry == line_table.end()) {
+        return false;
+      }
+      file = entry->file->path;
+      line = entry->line;
+      return true;
+    }
+  } catch (std::exception&) {
+  }
+  return false;
+}
@@ -0,0 +1,75 @@
+#include <fcntl.h>
+#include <iostream>
+
+#include "split_dwarf.h"
+
+dwarf::dwarf SplitDwarf::openDwo(const std::string& path) {
+  auto it = m_dwo_files.find(path);
+  if (it != m_dwo_files.end()) {
+    return it->second;
+  }
+
+  dwarf::dwarf dwo;
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    try {
+      // The mmap loader owns the descriptor from here on.
+      elf::elf dwo_elf { elf::create_mmap_loader(fd) };
+      dwo = dwarf::dwarf { dwarf::elf::create_dwo_loader(dwo_elf) };
+    } catch (const std::exception& e) {
+      std::cerr << "Cannot load split DWARF from " << path << ": " << e.what() << "\n";
+    }
+  }
+  m_dwo_files[path] = dwo;
+  return dwo;
+}
+
+const dwarf::compilation_unit& SplitDwarf::resolve(const dwarf::compilation_unit& cu) {
+  const dwarf::section_offset key = cu.get_section_offset();
+  auto it = m_units.find(key);
+  if (it != m_units.end()) {
+    return it->second;
+  }
+
+  if (!cu.is_skeleton()) {
+    return m_units[key] = cu;
+  }
+
+  const uint64_t dwo_id = cu.get_dwo_id();
+
+  // 1. A package next to the executable holds every split unit.
+  if (!m_package_checked) {
+    m_package = openDwo(m_prog_name + ".dwp");
+    m_package_checked = true;
+  }
+  if (m_package.valid()) {
+    try {
+      return m_units[key] = m_package.get_split_unit(dwo_id, cu);
+    } catch (const std::out_of_range&) {
+      // Not packaged, fall back to the .dwo
+    } catch (const dwarf::format_error& e) {
+      std::cerr << "Cannot read " << m_prog_name << ".dwp: " << e.what() << "\n";
+    }
+  }
+
+  // 2. DW_AT_GNU_dwo_name is relative to the compilation directory.
+  const dwarf::die& root = cu.root();
+  std::string dwo_name = root[dwarf::DW_AT::GNU_dwo_name].as_string();
+  if (dwo_name[0] != '/' && root.has(dwarf::DW_AT::comp_dir)) {
+    dwo_name = at_comp_dir(root) + "/" + dwo_name;
+  }
+
+  dwarf::dwarf dwo = openDwo(dwo_name);
+  if (dwo.valid()) {
+    try {
+      return m_units[key] = dwo.get_split_unit(dwo_id, cu);
+    } catch (const std::out_of_range&) {
+      std::cerr << dwo_name << " does not contain dwo id 0x" << std::hex << dwo_id << std::dec << "\n";
+    }
+  } else {
+    std::cerr << "Cannot open split DWARF object " << dwo_name << "\n";
+  }
+
+  // Keep the skeleton: its line table still works without the split unit.
+  return m_units[key] = cu;
+}
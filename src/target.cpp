@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <dirent.h>
+#include <elf.h>
+#include <unistd.h>
+
+#include "ptrace_impl.h"
+#include "target.h"
+
+std::vector<MemoryMapping> readProcessMappings(pid_t pid) {
+  std::vector<MemoryMapping> mappings;
+  std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+  std::string line;
+  while (std::getline(maps, line)) {
+    // 555555554000-555555555000 r--p 00000000 08:01 1234   /usr/bin/test
+    std::istringstream fields(line);
+    std::string range, offset, device, inode;
+    MemoryMapping mapping;
+    fields >> range >> mapping.permissions >> offset >> device >> inode;
+    std::getline(fields >> std::ws, mapping.path);
+    const size_t dash = range.find('-');
+    if (dash == std::string::npos || mapping.permissions.size() < 4) {
+      continue;
+    }
+    mapping.low = std::stoull(range.substr(0, dash), nullptr, 16);
+    mapping.high = std::stoull(range.substr(dash + 1), nullptr, 16);
+    mapping.offset = std::stoull(offset, nullptr, 16);
+    mappings.push_back(std::move(mapping));
+  }
+  return mappings;
+}
+
+std::vector<pid_t> readProcessThreads(pid_t pid) {
+  std::vector<pid_t> threads;
+  DIR* tasks = opendir(("/proc/" + std::to_string(pid) + "/task").c_str());
+  if (!tasks) {
+    return threads;
+  }
+  while (const dirent* entry = readdir(tasks)) {
+    if (entry->d_name[0] != '.') {
+      threads.push_back(std::stoi(entry->d_name));
+    }
+  }
+  closedir(tasks);
+  std::sort(threads.begin(), threads.end());
+  auto leader = std::find(threads.begin(), threads.end(), pid);
+  if (leader != threads.end()) {
+    std::rotate(threads.begin(), leader, leader + 1);
+  }
+  return threads;
+}
+
+bool isSignalPending(pid_t tid, int signal) {
+  std::ifstream status("/proc/" + std::to_string(tid) + "/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 7, "SigPnd:") == 0) {
+      return (std::stoull(line.substr(7), nullptr, 16) >> (signal - 1)) & 1;
+    }
+  }
+  return false;
+}
+
+bool LiveTarget::readBytes(uint64_t address, void* buffer, size_t size) {
+  return Ptrace::readBytes(m_thread, address, buffer, size);
+}
+
+size_t LiveTarget::readAvailable(uint64_t address, void* buffer, size_t size) {
+  return Ptrace::readAvailable(m_thread, address, buffer, size);
+}
+
+size_t LiveTarget::readBlocks(const uint64_t* addresses, size_t count, size_t size, void* buffer) {
+  return Ptrace::readBlocks(m_thread, addresses, count, size, buffer);
+}
+
+void LiveTarget::getRegisters(user_regs_struct& regs) {
+  Ptrace::getRegisters(m_thread, &regs);
+}
+
+std::vector<MemoryMapping> LiveTarget::mappings() {
+  return readProcessMappings(m_pid);
+}
+
+std::string LiveTarget::executable() {
+  char path[4096];
+  const ssize_t length = readlink(("/proc/" + std::to_string(m_pid) + "/exe").c_str(), path, sizeof(path) - 1);
+  return length > 0 ? std::string(path, length) : "";
+}
+
+// AT_ENTRY of the auxiliary vector less the entry point of the program's ELF header: where the kernel put the
+// program, randomized or not. The first line of /proc/pid/maps if they can't be read: the program is mapped first.
+uint64_t LiveTarget::loadAddress() {
+  const std::string proc = "/proc/" + std::to_string(m_pid);
+  uint64_t entry = 0;
+  std::ifstream auxv(proc + "/auxv", std::ios::binary);
+  for (uint64_t pair[2]; auxv.read(reinterpret_cast<char*>(pair), sizeof(pair)) && pair[0] != AT_NULL;) {
+    if (pair[0] == AT_ENTRY) {
+      entry = pair[1];
+    }
+  }
+  Elf64_Ehdr header;
+  std::ifstream program(proc + "/exe", std::ios::binary);
+  if (entry && program.read(reinterpret_cast<char*>(&header), sizeof(header)) && header.e_type == ET_DYN) {
+    return entry - header.e_entry;
+  }
+  std::ifstream maps(proc + "/maps");
+  std::string address;
+  std::getline(maps, address, '-');
+  return address.empty() ? 0 : std::stoull(address, nullptr, 16);
+}
@@ -0,0 +1,1179 @@
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "dwarf++.hh"
+#include "unwinder.h"
+
+namespace {
+
+// Pointer encodings of .eh_frame (DW_EH_PE_*): the low nibble is the format, the high one what it is relative to
+enum : uint8_t {
+  EH_PE_absptr = 0x00,
+  EH_PE_uleb128 = 0x01,
+  EH_PE_udata2 = 0x02,
+  EH_PE_udata4 = 0x03,
+  EH_PE_udata8 = 0x04,
+  EH_PE_sleb128 = 0x09,
+  EH_PE_sdata2 = 0x0a,
+  EH_PE_sdata4 = 0x0b,
+  EH_PE_sdata8 = 0x0c,
+  EH_PE_pcrel = 0x10,
+  EH_PE_datarel = 0x30,
+  EH_PE_omit = 0xff
+};
+
+// Call frame instructions, DWARF 4, 7.23. The first three keep their operand in the low 6 bits.
+enum : uint8_t {
+  CFA_advance_loc = 0x40,
+  CFA_offset = 0x80,
+  CFA_restore = 0xc0,
+  CFA_nop = 0x00,
+  CFA_set_loc = 0x01,
+  CFA_advance_loc1 = 0x02,
+  CFA_advance_loc2 = 0x03,
+  CFA_advance_loc4 = 0x04,
+  CFA_offset_extended = 0x05,
+  CFA_restore_extended = 0x06,
+  CFA_undefined = 0x07,
+  CFA_same_value = 0x08,
+  CFA_register = 0x09,
+  CFA_remember_state = 0x0a,
+  CFA_restore_state = 0x0b,
+  CFA_def_cfa = 0x0c,
+  CFA_def_cfa_register = 0x0d,
+  CFA_def_cfa_offset = 0x0e,
+  CFA_def_cfa_expression = 0x0f,
+  CFA_expression = 0x10,
+  CFA_offset_extended_sf = 0x11,
+  CFA_def_cfa_sf = 0x12,
+  CFA_def_cfa_offset_sf = 0x13,
+  CFA_val_offset = 0x14,
+  CFA_val_offset_sf = 0x15,
+  CFA_val_expression = 0x16,
+  CFA_GNU_args_size = 0x2e,
+  CFA_GNU_negative_offset_extended = 0x2f
+};
+
+// Reads little-endian values out of a section, never past its end
+struct Cursor {
+  const uint8_t* p;
+  const uint8_t* end;
+  bool overflow = false;
+
+  bool has(size_t n) {
+    if (static_cast<size_t>(end - p) < n) {
+      overflow = true;
+      p = end;
+      return false;
+    }
+    return true;
+  }
+
+  template <class T>
+  T fixed() {
+    T value = 0;
+    if (has(sizeof(T))) {
+      std::memcpy(&value, p, sizeof(T));
+      p += sizeof(T);
+    }
+    return value;
+  }
+
+  uint64_t uleb() {
+    uint64_t value = 0;
+    for (unsigned shift = 0; has(1); shift += 7) {
+      const uint8_t byte = *p++;
+      if (shift < 64) {
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      }
+      if (!(byte & 0x80)) {
+        break;
+      }
+    }
+    return value;
+  }
+
+  int64_t sleb() {
+    int64_t value = 0;
+    unsigned shift = 0;
+    uint8_t byte = 0;
+    while (has(1)) {
+      byte = *p++;
+      if (shift < 64) {
+        value |= static_cast<int64_t>(byte & 0x7f) << shift;
+      }
+      shift += 7;
+      if (!(byte & 0x80)) {
+        break;
+      }
+    }
+    if (shift < 64 && (byte & 0x40)) {
+      value |= -(static_cast<int64_t>(1) << shift);
+    }
+    return value;
+  }
+
+  const char* string() {
+    const char* start = reinterpret_cast<const char*>(p);
+    while (has(1) && *p) {
+      ++p;
+    }
+    if (has(1)) {
+      ++p;
+    }
+    return start;
+  }
+};
+
+// A pointer in the encoding given by a CIE or .eh_frame_hdr.
+// section_address is the address the section is linked at, base_of_section its first byte.
+uint64_t readEncoded(Cursor& cursor, uint8_t encoding, uint64_t section_address, const uint8_t* base_of_section,
+                     uint64_t data_base = 0) {
+  if (encoding == EH_PE_omit) {
+    return 0;
+  }
+  const uint64_t field_address = section_address + (cursor.p - base_of_section);
+  uint64_t value;
+  switch (encoding & 0x0f) {
+    case EH_PE_absptr: value = cursor.fixed<uint64_t>(); break;
+    case EH_PE_uleb128: value = cursor.uleb(); break;
+    case EH_PE_udata2: value = cursor.fixed<uint16_t>(); break;
+    case EH_PE_udata4: value = cursor.fixed<uint32_t>(); break;
+    case EH_PE_udata8: value = cursor.fixed<uint64_t>(); break;
+    case EH_PE_sleb128: value = cursor.sleb(); break;
+    case EH_PE_sdata2: value = static_cast<int64_t>(cursor.fixed<int16_t>()); break;
+    case EH_PE_sdata4: value = static_cast<int64_t>(cursor.fixed<int32_t>()); break;
+    case EH_PE_sdata8: value = cursor.fixed<int64_t>(); break;
+    default: cursor.overflow = true; return 0;
+  }
+  switch (encoding & 0x70) {
+    case EH_PE_pcrel: value += field_address; break;
+    case EH_PE_datarel: value += data_base; break;
+    default: break;
+  }
+  return value;
+}
+
+// Where an entry (CIE or FDE) is and what it is
+struct EntryHeader {
+  size_t id_offset;    // of the CIE id / CIE pointer field
+  size_t body;         // first byte after it
+  size_t end;
+  uint64_t id;
+  bool is_cie;
+};
+
+bool readEntryHeader(const uint8_t* data, size_t size, size_t offset, bool debug_frame, EntryHeader& header) {
+  Cursor cursor { data + offset, data + size };
+  uint64_t length = cursor.fixed<uint32_t>();
+  bool dwarf64 = false;
+  if (length == 0xffffffff) {
+    length = cursor.fixed<uint64_t>();
+    dwarf64 = true;
+  }
+  if (length == 0 || cursor.overflow) {
+    return false;   // the terminator of .eh_frame
+  }
+  header.id_offset = cursor.p - data;
+  header.end = header.id_offset + length;
+  if (header.end > size) {
+    return false;
+  }
+  header.id = dwarf64 ? cursor.fixed<uint64_t>() : cursor.fixed<uint32_t>();
+  header.body = cursor.p - data;
+  if (debug_frame) {
+    header.is_cie = header.id == (dwarf64 ? ~0ULL : 0xffffffffULL);
+  } else {
+    header.is_cie = header.id == 0;
+  }
+  return true;
+}
+
+struct Cie {
+  uint64_t code_alignment = 1;
+  int64_t data_alignment = 1;
+  uint32_t return_register = CFI_RA;
+  uint8_t fde_encoding = EH_PE_absptr;
+  bool augmentation_data = false;   // 'z': FDEs have an augmentation data length
+  bool signal_frame = false;
+  const uint8_t* instructions = nullptr;
+  const uint8_t* end = nullptr;
+};
+
+bool parseCie(const uint8_t* data, size_t size, uint64_t section_address, size_t offset, bool debug_frame, Cie& cie) {
+  EntryHeader header;
+  if (!readEntryHeader(data, size, offset, debug_frame, header) || !header.is_cie) {
+    return false;
+  }
+  Cursor cursor { data + header.body, data + header.end };
+  const uint8_t version = cursor.fixed<uint8_t>();
+  const char* augmentation = cursor.string();
+  if (debug_frame && version >= 4) {
+    cursor.fixed<uint8_t>();   // address size
+    cursor.fixed<uint8_t>();   // segment selector size
+  }
+  cie.code_alignment = cursor.uleb();
+  cie.data_alignment = cursor.sleb();
+  cie.return_register = version == 1 ? cursor.fixed<uint8_t>() : cursor.uleb();
+
+  if (augmentation[0] == 'z') {
+    cie.augmentation_data = true;
+    const uint64_t length = cursor.uleb();
+    const uint8_t* augmentation_end = cursor.p + length;
+    for (const char* c = augmentation + 1; *c && cursor.p < augmentation_end; ++c) {
+      switch (*c) {
+        case 'R':
+          cie.fde_encoding = cursor.fixed<uint8_t>();
+          break;
+        case 'P': {
+          const uint8_t encoding = cursor.fixed<uint8_t>();
+          readEncoded(cursor, encoding & 0x7f, section_address, data);   // personality routine, not needed
+          break;
+        }
+        case 'L':
+          cursor.fixed<uint8_t>();   // LSDA encoding
+          break;
+        case 'S':
+          cie.signal_frame = true;
+          break;
+        default:
+          break;
+      }
+    }
+    // 'S' comes after the data in the string but has no data of its own
+    cie.signal_frame = cie.signal_frame || std::strchr(augmentation, 'S') != nullptr;
+    cursor.p = augmentation_end;
+  } else if (augmentation[0] != '\0') {
+    return false;   // an augmentation we don't know the layout of
+  }
+  if (cursor.overflow || cursor.p > data + header.end) {
+    return false;
+  }
+  cie.instructions = cursor.p;
+  cie.end = data + header.end;
+  return true;
+}
+
+struct Fde {
+  uint64_t low = 0;
+  uint64_t high = 0;
+  const uint8_t* instructions = nullptr;
+  const uint8_t* end = nullptr;
+  size_t cie_offset = 0;
+};
+
+bool parseFde(const uint8_t* data, size_t size, uint64_t section_address, size_t offset, bool debug_frame,
+              const Cie& cie, const EntryHeader& header, Fde& fde) {
+  Cursor cursor { data + header.body, data + header.end };
+  const uint8_t encoding = debug_frame ? EH_PE_absptr : cie.fde_encoding;
+  fde.low = readEncoded(cursor, encoding, section_address, data);
+  fde.high = fde.low + readEncoded(cursor, encoding & 0x0f, section_address, data);
+  if (cie.augmentation_data) {
+    const uint64_t length = cursor.uleb();
+    cursor.p += std::min<uint64_t>(length, cursor.end - cursor.p);
+  }
+  fde.instructions = cursor.p;
+  fde.end = data + header.end;
+  return !cursor.overflow;
+}
+
+size_t cieOffset(const EntryHeader& header, bool debug_frame) {
+  // .debug_frame: offset from the start of the section, .eh_frame: distance back from the field itself
+  return debug_frame ? header.id : header.id_offset - header.id;
+}
+
+// Runs call frame instructions, appending a row for every address range they close
+void execute(Cursor cursor, const Cie& cie, uint64_t& location, CfiRow& row, const CfiRow* initial,
+             std::vector<CfiRow>& rows, uint64_t section_address, const uint8_t* section_data, bool debug_frame) {
+  std::vector<CfiRow> remembered;
+  auto advance = [&](uint64_t to) {
+    if (to > location) {
+      row.high = to;
+      rows.push_back(row);
+      row.low = to;
+    }
+    location = to;
+  };
+  auto set_rule = [&](uint64_t reg, CfiRule::Kind kind, int64_t value) {
+    if (reg < CFI_REGISTERS) {
+      row.registers[reg] = CfiRule { kind, value };
+    }
+  };
+  auto set_expression = [&](uint64_t reg, CfiRule::Kind kind, Cursor& c) {
+    const uint64_t length = c.uleb();
+    if (reg < CFI_REGISTERS && c.has(length)) {
+      row.registers[reg] = CfiRule { kind, 0, c.p, length };
+    }
+    c.p += std::min<uint64_t>(length, c.end - c.p);
+  };
+
+  while (cursor.p < cursor.end && !cursor.overflow) {
+    const uint8_t op = cursor.fixed<uint8_t>();
+    const uint8_t operand = op & 0x3f;
+    switch (op & 0xc0) {
+      case CFA_advance_loc:
+        advance(location + operand * cie.code_alignment);
+        continue;
+      case CFA_offset:
+        set_rule(operand, CfiRule::Kind::offset, cursor.uleb() * cie.data_alignment);
+        continue;
+      case CFA_restore:
+        if (initial && operand < CFI_REGISTERS) {
+          row.registers[operand] = initial->registers[operand];
+        }
+        continue;
+      default:
+        break;
+    }
+
+    switch (op) {
+      case CFA_nop:
+        break;
+      case CFA_set_loc:
+        advance(readEncoded(cursor, debug_frame ? EH_PE_absptr : cie.fde_encoding, section_address, section_data));
+        break;
+      case CFA_advance_loc1:
+        advance(location + cursor.fixed<uint8_t>() * cie.code_alignment);
+        break;
+      case CFA_advance_loc2:
+        advance(location + cursor.fixed<uint16_t>() * cie.code_alignment);
+        break;
+      case CFA_advance_loc4:
+        advance(location + cursor.fixed<uint32_t>() * cie.code_alignment);
+        break;
+      case CFA_offset_extended: {
+        const uint64_t reg = cursor.uleb();
+        set_rule(reg, CfiRule::Kind::offset, cursor.uleb() * cie.data_alignment);
+        break;
+      }
+      case CFA_offset_extended_sf: {
+        const uint64_t reg = cursor.uleb();
+        set_rule(reg, CfiRule::Kind::offset, cursor.sleb() * cie.data_alignment);
+        break;
+      }
+      case CFA_GNU_negative_offset_extended: {
+        const uint64_t reg = cursor.uleb();
+        set_rule(reg, CfiRule::Kind::offset, -static_cast<int64_t>(cursor.uleb()) * cie.data_alignment);
+        break;
+      }
+      case CFA_val_offset: {
+        const uint64_t reg = cursor.uleb();
+        set_rule(reg, CfiRule::Kind::val_offset, cursor.uleb() * cie.data_alignment);
+        break;
+      }
+      case CFA_val_offset_sf: {
+        const uint64_t reg = cursor.uleb();
+        set_rule(reg, CfiRule::Kind::val_offset, cursor.sleb() * cie.data_alignment);
+        break;
+      }
+      case CFA_restore_extended: {
+        const uint64_t reg = cursor.uleb();
+        if (initial && reg < CFI_REGISTERS) {
+          row.registers[reg] = initial->registers[reg];
+        }
+        break;
+      }
+      case CFA_undefined:
+        set_rule(cursor.uleb(), CfiRule::Kind::undefined, 0);
+        break;
+      case CFA_same_value:
+        set_rule(cursor.uleb(), CfiRule::Kind::same_value, 0);
+        break;
+      case CFA_register: {
+        const uint64_t reg = cursor.uleb();
+        set_rule(reg, CfiRule::Kind::reg, cursor.uleb());
+        break;
+      }
+      case CFA_remember_state:
+        remembered.push_back(row);
+        break;
+      case CFA_restore_state:
+        if (!remembered.empty()) {
+          const uint64_t low = row.low;
+          row = remembered.back();
+          row.low = low;
+          remembered.pop_back();
+        }
+        break;
+      case CFA_def_cfa:
+        row.cfa_register = cursor.uleb();
+        row.cfa_offset = cursor.uleb();
+        row.cfa_expression = nullptr;
+        break;
+      case CFA_def_cfa_sf:
+        row.cfa_register = cursor.uleb();
+        row.cfa_offset = cursor.sleb() * cie.data_alignment;
+        row.cfa_expression = nullptr;
+        break;
+      case CFA_def_cfa_register:
+        row.cfa_register = cursor.uleb();
+        row.cfa_expression = nullptr;
+        break;
+      case CFA_def_cfa_offset:
+        row.cfa_offset = cursor.uleb();
+        break;
+      case CFA_def_cfa_offset_sf:
+        row.cfa_offset = cursor.sleb() * cie.data_alignment;
+        break;
+      case CFA_def_cfa_expression: {
+        const uint64_t length = cursor.uleb();
+        if (cursor.has(length)) {
+          row.cfa_expression = cursor.p;
+          row.cfa_expression_size = length;
+          cursor.p += length;
+        }
+        break;
+      }
+      case CFA_expression:
+        set_expression(cursor.uleb(), CfiRule::Kind::expression, cursor);
+        break;
+      case CFA_val_expression:
+        set_expression(cursor.uleb(), CfiRule::Kind::val_expression, cursor);
+        break;
+      case CFA_GNU_args_size:
+        cursor.uleb();
+        break;
+      default:
+        return;   // can't skip an instruction we don't know: keep the rows so far
+    }
+  }
+}
+
+} // namespace
+
+// CallFrameInfo
+
+CallFrameInfo::CallFrameInfo(const elf::elf& file) : m_file(file) {
+  auto section = [&](const char* name) {
+    Section result;
+    const elf::section& found = m_file.get_section(name);
+    if (found.valid() && found.get_hdr().type != elf::sht::nobits) {
+      result.data = static_cast<const uint8_t*>(found.data());
+      result.size = found.size();
+      result.address = found.get_hdr().addr;
+    }
+    return result;
+  };
+  m_eh_frame = section(".eh_frame");
+  m_eh_frame_hdr = section(".eh_frame_hdr");
+  m_debug_frame = section(".debug_frame");
+
+  // .eh_frame_hdr: version, three encodings, eh_frame_ptr, fde_count, then the table.
+  // Only the usual table encoding (signed 4 bytes relative to the header) can be binary searched in place.
+  if (m_eh_frame_hdr.data && m_eh_frame.data && m_eh_frame_hdr.size >= 4 && m_eh_frame_hdr.data[0] == 1) {
+    Cursor cursor { m_eh_frame_hdr.data + 4, m_eh_frame_hdr.data + m_eh_frame_hdr.size };
+    const uint8_t eh_frame_ptr_encoding = m_eh_frame_hdr.data[1];
+    const uint8_t count_encoding = m_eh_frame_hdr.data[2];
+    const uint8_t table_encoding = m_eh_frame_hdr.data[3];
+    readEncoded(cursor, eh_frame_ptr_encoding, m_eh_frame_hdr.address, m_eh_frame_hdr.data);
+    const uint64_t count = readEncoded(cursor, count_encoding, m_eh_frame_hdr.address, m_eh_frame_hdr.data);
+    if (!cursor.overflow && table_encoding == (EH_PE_datarel | EH_PE_sdata4) &&
+        cursor.has(count * 2 * sizeof(int32_t))) {
+      m_header_table = cursor.p;
+      m_header_entries = count;
+    }
+  }
+}
+
+const CfiRow* CallFrameInfo::find(uint64_t pc, bool& signal_frame) {
+  const IndexEntry* fde = findFde(pc);
+  if (!fde) {
+    return nullptr;
+  }
+  const size_t key = fde->offset * 2 + fde->debug_frame;
+  auto it = m_rows.find(key);
+  if (it == m_rows.end()) {
+    it = m_rows.emplace(key, decode(*fde)).first;
+  }
+  const std::vector<CfiRow>& rows = it->second.rows;
+  auto row = std::upper_bound(rows.begin(), rows.end(), pc, [](uint64_t pc, const CfiRow& row) {
+    return pc < row.low;
+  });
+  if (row == rows.begin() || pc >= (--row)->high) {
+    return nullptr;
+  }
+  signal_frame = it->second.signal_frame;
+  return &*row;
+}
+
+const CallFrameInfo::IndexEntry* CallFrameInfo::findFde(uint64_t pc) {
+  auto search = [pc](const std::vector<IndexEntry>& index) -> const IndexEntry* {
+    auto it = std::upper_bound(index.begin(), index.end(), pc, [](uint64_t pc, const IndexEntry& entry) {
+      return pc < entry.low;
+    });
+    return it != index.begin() && pc < (it - 1)->high ? &*(it - 1) : nullptr;
+  };
+
+  if (m_eh_frame.data) {
+    if (m_header_table) {
+      if (const IndexEntry* found = searchHeader(pc)) {
+        return found;
+      }
+    } else {
+      if (!m_eh_indexed) {
+        buildIndex(m_eh_frame, false, m_eh_index);
+        m_eh_indexed = true;
+      }
+      if (const IndexEntry* found = search(m_eh_index)) {
+        return found;
+      }
+    }
+  }
+  if (m_debug_frame.data) {
+    if (!m_debug_indexed) {
+      buildIndex(m_debug_frame, true, m_debug_index);
+      m_debug_indexed = true;
+    }
+    return search(m_debug_index);
+  }
+  return nullptr;
+}
+
+// Binary search of the .eh_frame_hdr table: the last function starting at or below pc
+const CallFrameInfo::IndexEntry* CallFrameInfo::searchHeader(uint64_t pc) {
+  auto entry = [this](uint64_t i, unsigned field) {
+    int32_t value;
+    std::memcpy(&value, m_header_table + (i * 2 + field) * sizeof(int32_t), sizeof(value));
+    return m_eh_frame_hdr.address + value;
+  };
+  uint64_t low = 0;
+  uint64_t high = m_header_entries;
+  while (low < high) {
+    const uint64_t middle = low + (high - low) / 2;
+    if (entry(middle, 0) <= pc) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low == 0) {
+    return nullptr;
+  }
+
+  const size_t offset = entry(low - 1, 1) - m_eh_frame.address;
+  EntryHeader header;
+  Cie cie;
+  Fde fde;
+  if (offset >= m_eh_frame.size ||
+      !readEntryHeader(m_eh_frame.data, m_eh_frame.size, offset, false, header) || header.is_cie ||
+      !parseCie(m_eh_frame.data, m_eh_frame.size, m_eh_frame.address, cieOffset(header, false), false, cie) ||
+      !parseFde(m_eh_frame.data, m_eh_frame.size, m_eh_frame.address, offset, false, cie, header, fde) ||
+      pc >= fde.high) {
+    return nullptr;
+  }
+  m_found = { fde.low, fde.high, offset, false };
+  return &m_found;
+}
+
+// All FDEs of a section sorted by address
+void CallFrameInfo::buildIndex(const Section& section, bool debug_frame, std::vector<IndexEntry>& index) {
+  std::unordered_map<size_t, Cie> cies;
+  EntryHeader header;
+  for (size_t offset = 0; readEntryHeader(section.data, section.size, offset, debug_frame, header);
+       offset = header.end) {
+    if (header.is_cie) {
+      continue;
+    }
+    const size_t cie_offset = cieOffset(header, debug_frame);
+    auto cie = cies.find(cie_offset);
+    if (cie == cies.end()) {
+      Cie parsed;
+      if (!parseCie(section.data, section.size, section.address, cie_offset, debug_frame, parsed)) {
+        continue;
+      }
+      cie = cies.emplace(cie_offset, parsed).first;
+    }
+    Fde fde;
+    // FDEs of functions dropped by the linker (--gc-sections) are left behind at address 0
+    if (parseFde(section.data, section.size, section.address, offset, debug_frame, cie->second, header, fde) &&
+        fde.low != 0 && fde.high > fde.low) {
+      index.push_back({ fde.low, fde.high, offset, debug_frame });
+    }
+  }
+  std::sort(index.begin(), index.end(), [](const IndexEntry& a, const IndexEntry& b) { return a.low < b.low; });
+}
+
+// Runs the CIE's initial instructions, then the FDE's, into rows covering the whole function
+CallFrameInfo::DecodedFde CallFrameInfo::decode(const IndexEntry& entry) {
+  const Section& section = entry.debug_frame ? m_debug_frame : m_eh_frame;
+  DecodedFde decoded;
+  EntryHeader header;
+  Cie cie;
+  Fde fde;
+  if (!readEntryHeader(section.data, section.size, entry.offset, entry.debug_frame, header) ||
+      !parseCie(section.data, section.size, section.address, cieOffset(header, entry.debug_frame),
+                entry.debug_frame, cie) ||
+      !parseFde(section.data, section.size, section.address, entry.offset, entry.debug_frame, cie, header, fde)) {
+    return decoded;
+  }
+  decoded.signal_frame = cie.signal_frame;
+
+  CfiRow row;
+  row.low = fde.low;
+  uint64_t location = fde.low;
+  std::vector<CfiRow> ignored;
+  execute(Cursor { cie.instructions, cie.end }, cie, location, row, nullptr, ignored, section.address,
+          section.data, entry.debug_frame);
+  const CfiRow initial = row;
+  execute(Cursor { fde.instructions, fde.end }, cie, location, row, &initial, decoded.rows, section.address,
+          section.data, entry.debug_frame);
+  if (row.low < fde.high) {
+    row.high = fde.high;
+    decoded.rows.push_back(row);
+  }
+  return decoded;
+}
+
+// Unwinder
+
+std::vector<UnwindFrame> Unwinder::backtrace(const user_regs_struct& regs, size_t max_frames) {
+  UnwindFrame frame;
+  // DWARF numbering: rax, rdx, rcx, rbx, rsi, rdi, rbp, rsp, r8-r15, return address
+  const uint64_t values[CFI_REGISTERS] = {
+      regs.rax, regs.rdx, regs.rcx, regs.rbx, regs.rsi, regs.rdi, regs.rbp, regs.rsp,
+      regs.r8, regs.r9, regs.r10, regs.r11, regs.r12, regs.r13, regs.r14, regs.r15, regs.rip };
+  for (unsigned reg = 0; reg < CFI_REGISTERS; ++reg) {
+    frame.set(reg, values[reg]);
+  }
+  frame.pc = regs.rip;
+  takeSnapshot(regs.rsp);
+
+  std::vector<UnwindFrame> frames { frame };
+  while (frames.size() < max_frames) {
+    UnwindFrame caller;
+    if (!step(frames.back(), caller, frames.size() == 1)) {
+      break;
+    }
+    // The stack only grows down: a caller below its callee means garbage (except across a signal)
+    if (!caller.signal_frame && caller.registers[CFI_RSP] <= frames.back().registers[CFI_RSP]) {
+      break;
+    }
+    frames.push_back(caller);
+  }
+  m_snapshot.bytes.clear();   // the inferior runs on, don't let a later step read a stale copy
+  return frames;
+}
+
+// Copies [rsp, end of its mapping) with a single read. The mapping is looked up again only when rsp leaves the
+// last one (another thread's stack).
+void Unwinder::takeSnapshot(uint64_t stack_pointer) {
+  m_snapshot.low = stack_pointer;
+  m_snapshot.bytes.clear();
+  if (m_stack_limit == 0) {
+    return;
+  }
+  if (stack_pointer < m_stack_mapping.first || stack_pointer >= m_stack_mapping.second) {
+    m_stack_mapping = {};
+    for (const MemoryMapping& mapping : m_target.mappings()) {
+      if (stack_pointer >= mapping.low && stack_pointer < mapping.high) {
+        m_stack_mapping = { mapping.low, mapping.high };
+        break;
+      }
+    }
+    if (!m_stack_mapping.second) {
+      return;
+    }
+  }
+  m_snapshot.bytes.resize(std::min(m_stack_limit, m_stack_mapping.second - stack_pointer));
+  ++m_reads;
+  if (!m_target.readBytes(stack_pointer, m_snapshot.bytes.data(), m_snapshot.bytes.size())) {
+    m_snapshot.bytes.clear();
+  }
+}
+
+bool Unwinder::read(uint64_t address, uint64_t& value) {
+  if (m_snapshot.contains(address, sizeof(value))) {
+    value = m_snapshot.word(address);
+    return true;
+  }
+  ++m_reads;
+  return m_target.readBytes(address, &value, sizeof(value));
+}
+
+bool Unwinder::step(UnwindFrame& frame, UnwindFrame& caller, bool innermost) {
+  // A return address is the instruction after the call, which may belong to the next function or line (noreturn
+  // calls at the end of a function): look up the call itself. Not for the innermost frame and not for the frame
+  // interrupted by a signal, whose pc is where it stopped.
+  const uint64_t pc = innermost || frame.signal_frame ? frame.pc : frame.pc - 1;
+  Module* module = moduleAt(pc);
+  bool signal_frame = false;
+  const CfiRow* row = module && module->cfi ? module->cfi->find(pc - module->bias, signal_frame) : nullptr;
+  if (!row) {
+    return stepWithFramePointer(frame, caller);
+  }
+
+  if (row->cfa_expression) {
+    if (!evaluate(row->cfa_expression, row->cfa_expression_size, frame, nullptr, frame.cfa, nullptr, module->bias)) {
+      return false;
+    }
+  } else {
+    if (row->cfa_register >= CFI_REGISTERS || !frame.has(row->cfa_register)) {
+      return false;
+    }
+    frame.cfa = frame.registers[row->cfa_register] + row->cfa_offset;
+  }
+
+  caller = {};
+  for (unsigned reg = 0; reg < CFI_REGISTERS; ++reg) {
+    const CfiRule& rule = row->registers[reg];
+    uint64_t value;
+    switch (rule.kind) {
+      case CfiRule::Kind::same_value:
+        if (reg == CFI_RSP) {
+          caller.set(reg, frame.cfa);   // the CFA is the caller's rsp by definition
+        } else if (frame.has(reg)) {
+          caller.set(reg, frame.registers[reg]);
+        }
+        break;
+      case CfiRule::Kind::undefined:
+        break;
+      case CfiRule::Kind::offset:
+        if (!read(frame.cfa + rule.value, value)) {
+          return false;
+        }
+        caller.set(reg, value);
+        break;
+      case CfiRule::Kind::val_offset:
+        caller.set(reg, frame.cfa + rule.value);
+        break;
+      case CfiRule::Kind::reg:
+        if (rule.value < CFI_REGISTERS && frame.has(rule.value)) {
+          caller.set(reg, frame.registers[rule.value]);
+        }
+        break;
+      case CfiRule::Kind::expression:
+        if (!evaluate(rule.expression, rule.expression_size, frame, &frame.cfa, value, nullptr, module->bias) ||
+            !read(value, value)) {
+          return false;
+        }
+        caller.set(reg, value);
+        break;
+      case CfiRule::Kind::val_expression:
+        if (!evaluate(rule.expression, rule.expression_size, frame, &frame.cfa, value, nullptr, module->bias)) {
+          return false;
+        }
+        caller.set(reg, value);
+        break;
+    }
+  }
+
+  // The outermost frame (_start, clone) marks its return address undefined
+  if (!caller.has(CFI_RA) || caller.registers[CFI_RA] == 0) {
+    return false;
+  }
+  caller.pc = caller.registers[CFI_RA];
+  caller.signal_frame = signal_frame;
+  return true;
+}
+
+// Without CFI for pc: assume a frame pointer (push rbp; mov rbp, rsp)
+bool Unwinder::stepWithFramePointer(UnwindFrame& frame, UnwindFrame& caller) {
+  uint64_t saved_rbp;
+  uint64_t return_address;
+  if (!frame.has(CFI_RBP) || frame.registers[CFI_RBP] == 0 ||
+      !read(frame.registers[CFI_RBP], saved_rbp) || !read(frame.registers[CFI_RBP] + 8, return_address) ||
+      return_address == 0) {
+    return false;
+  }
+  frame.cfa = frame.registers[CFI_RBP] + 16;
+  caller = {};
+  // Callee-saved registers: hope they weren't touched
+  for (unsigned reg : { 3u, 12u, 13u, 14u, 15u }) {
+    if (frame.has(reg)) {
+      caller.set(reg, frame.registers[reg]);
+    }
+  }
+  caller.set(CFI_RBP, saved_rbp);
+  caller.set(CFI_RSP, frame.registers[CFI_RBP] + 16);
+  caller.set(CFI_RA, return_address);
+  caller.pc = return_address;
+  caller.from_cfi = false;
+  return true;
+}
+
+// DWARF expressions of CFI rules: a stack machine over the registers of frame and the memory of the inferior.
+// initial is pushed first for DW_CFA_expression and DW_CFA_val_expression (the CFA), nothing for the CFA itself.
+// DW_OP_addr is a link-time address: bias is added to it.
+bool Unwinder::evaluate(const uint8_t* expression, size_t size, const UnwindFrame& frame, const uint64_t* initial,
+                        uint64_t& result, bool* stack_value, uint64_t bias) {
+  using dwarf::DW_OP;
+  std::vector<uint64_t> stack;
+  if (initial) {
+    stack.push_back(*initial);
+  }
+  auto pop = [&stack]() {
+    const uint64_t value = stack.back();
+    stack.pop_back();
+    return value;
+  };
+  auto reg = [&frame](uint64_t number, uint64_t& value) {
+    if (number >= CFI_REGISTERS || !frame.has(number)) {
+      return false;
+    }
+    value = frame.registers[number];
+    return true;
+  };
+
+  Cursor cursor { expression, expression + size };
+  while (cursor.p < cursor.end && !cursor.overflow) {
+    const auto op = static_cast<DW_OP>(cursor.fixed<uint8_t>());
+    const auto raw = static_cast<uint8_t>(op);
+    uint64_t value;
+    if (op >= DW_OP::lit0 && op <= DW_OP::lit31) {
+      stack.push_back(raw - static_cast<uint8_t>(DW_OP::lit0));
+      continue;
+    }
+    if (op >= DW_OP::breg0 && op <= DW_OP::breg31) {
+      const int64_t offset = cursor.sleb();
+      if (!reg(raw - static_cast<uint8_t>(DW_OP::breg0), value)) {
+        return false;
+      }
+      stack.push_back(value + offset);
+      continue;
+    }
+    if (op >= DW_OP::reg0 && op <= DW_OP::reg31) {
+      if (!reg(raw - static_cast<uint8_t>(DW_OP::reg0), value)) {
+        return false;
+      }
+      stack.push_back(value);
+      continue;
+    }
+
+    // Binary operators need two operands, the others check for themselves
+    const bool binary = (op >= DW_OP::and_ && op <= DW_OP::xor_ && op != DW_OP::neg && op != DW_OP::not_ &&
+                         op != DW_OP::plus_uconst) || (op >= DW_OP::eq && op <= DW_OP::ne);
+    if (binary && stack.size() < 2) {
+      return false;
+    }
+    switch (op) {
+      case DW_OP::addr: stack.push_back(cursor.fixed<uint64_t>() + bias); break;
+      case DW_OP::const1u: stack.push_back(cursor.fixed<uint8_t>()); break;
+      case DW_OP::const1s: stack.push_back(static_cast<int64_t>(cursor.fixed<int8_t>())); break;
+      case DW_OP::const2u: stack.push_back(cursor.fixed<uint16_t>()); break;
+      case DW_OP::const2s: stack.push_back(static_cast<int64_t>(cursor.fixed<int16_t>())); break;
+      case DW_OP::const4u: stack.push_back(cursor.fixed<uint32_t>()); break;
+      case DW_OP::const4s: stack.push_back(static_cast<int64_t>(cursor.fixed<int32_t>())); break;
+      case DW_OP::const8u: stack.push_back(cursor.fixed<uint64_t>()); break;
+      case DW_OP::const8s: stack.push_back(cursor.fixed<int64_t>()); break;
+      case DW_OP::constu: stack.push_back(cursor.uleb()); break;
+      case DW_OP::consts: stack.push_back(cursor.sleb()); break;
+      case DW_OP::regx:
+        if (!reg(cursor.uleb(), value)) {
+          return false;
+        }
+        stack.push_back(value);
+        break;
+      case DW_OP::bregx: {
+        const uint64_t number = cursor.uleb();
+        const int64_t offset = cursor.sleb();
+        if (!reg(number, value)) {
+          return false;
+        }
+        stack.push_back(value + offset);
+        break;
+      }
+      case DW_OP::dup:
+        if (stack.empty()) return false;
+        stack.push_back(stack.back());
+        break;
+      case DW_OP::drop:
+        if (stack.empty()) return false;
+        stack.pop_back();
+        break;
+      case DW_OP::over:
+        if (stack.size() < 2) return false;
+        stack.push_back(stack[stack.size() - 2]);
+        break;
+      case DW_OP::pick: {
+        const uint8_t index = cursor.fixed<uint8_t>();
+        if (index >= stack.size()) return false;
+        stack.push_back(stack[stack.size() - 1 - index]);
+        break;
+      }
+      case DW_OP::swap:
+        if (stack.size() < 2) return false;
+        std::swap(stack[stack.size() - 1], stack[stack.size() - 2]);
+        break;
+      case DW_OP::rot:
+        if (stack.size() < 3) return false;
+        std::rotate(stack.end() - 3, stack.end() - 1, stack.end());
+        break;
+      case DW_OP::deref:
+        if (stack.empty() || !read(stack.back(), stack.back())) return false;
+        break;
+      case DW_OP::deref_size: {
+        const uint8_t bytes = cursor.fixed<uint8_t>();
+        if (stack.empty() || bytes == 0 || bytes > 8 || !read(stack.back(), value)) return false;
+        stack.back() = bytes == 8 ? value : value & ((1ULL << (bytes * 8)) - 1);
+        break;
+      }
+      case DW_OP::abs:
+        if (stack.empty()) return false;
+        stack.back() = static_cast<uint64_t>(std::llabs(static_cast<int64_t>(stack.back())));
+        break;
+      case DW_OP::neg:
+        if (stack.empty()) return false;
+        stack.back() = -stack.back();
+        break;
+      case DW_OP::not_:
+        if (stack.empty()) return false;
+        stack.back() = ~stack.back();
+        break;
+      case DW_OP::plus_uconst:
+        if (stack.empty()) return false;
+        stack.back() += cursor.uleb();
+        break;
+      case DW_OP::and_: value = pop(); stack.back() &= value; break;
+      case DW_OP::or_: value = pop(); stack.back() |= value; break;
+      case DW_OP::xor_: value = pop(); stack.back() ^= value; break;
+      case DW_OP::plus: value = pop(); stack.back() += value; break;
+      case DW_OP::minus: value = pop(); stack.back() -= value; break;
+      case DW_OP::mul: value = pop(); stack.back() *= value; break;
+      case DW_OP::div:
+        value = pop();
+        if (value == 0) return false;
+        stack.back() = static_cast<int64_t>(stack.back()) / static_cast<int64_t>(value);
+        break;
+      case DW_OP::mod:
+        value = pop();
+        if (value == 0) return false;
+        stack.back() %= value;
+        break;
+      case DW_OP::shl: value = pop(); stack.back() <<= value; break;
+      case DW_OP::shr: value = pop(); stack.back() >>= value; break;
+      case DW_OP::shra:
+        value = pop();
+        stack.back() = static_cast<int64_t>(stack.back()) >> value;
+        break;
+      case DW_OP::eq: value = pop(); stack.back() = stack.back() == value; break;
+      case DW_OP::ne: value = pop(); stack.back() = stack.back() != value; break;
+      case DW_OP::ge: value = pop(); stack.back() = static_cast<int64_t>(stack.back()) >= static_cast<int64_t>(value); break;
+      case DW_OP::gt: value = pop(); stack.back() = static_cast<int64_t>(stack.back()) > static_cast<int64_t>(value); break;
+      case DW_OP::le: value = pop(); stack.back() = static_cast<int64_t>(stack.back()) <= static_cast<int64_t>(value); break;
+      case DW_OP::lt: value = pop(); stack.back() = static_cast<int64_t>(stack.back()) < static_cast<int64_t>(value); break;
+      case DW_OP::skip: {
+        const int16_t offset = cursor.fixed<int16_t>();
+        cursor.p += offset;
+        if (cursor.p < expression || cursor.p > cursor.end) return false;
+        break;
+      }
+      case DW_OP::bra: {
+        const int16_t offset = cursor.fixed<int16_t>();
+        if (stack.empty()) return false;
+        if (pop() != 0) {
+          cursor.p += offset;
+          if (cursor.p < expression || cursor.p > cursor.end) return false;
+        }
+        break;
+      }
+      case DW_OP::nop:
+        break;
+      // Location descriptions only
+      case DW_OP::call_frame_cfa:
+        if (!frame.cfa) return false;
+        stack.push_back(frame.cfa);
+        break;
+      case DW_OP::stack_value:
+        if (!stack_value || cursor.p != cursor.end) return false;
+        *stack_value = true;
+        break;
+      default:
+        return false;
+    }
+  }
+  if (stack.empty() || cursor.overflow) {
+    return false;
+  }
+  result = stack.back();
+  return true;
+}
+
+// A register (DW_OP_reg*) is only a location alone, anything else is an address computed like a CFI expression,
+// or a value with DW_OP_stack_value at the end
+bool Unwinder::locate(const uint8_t* expression, size_t size, const UnwindFrame& frame, const uint64_t* frame_base,
+                      uint64_t bias, VariableLocation& location) {
+  using dwarf::DW_OP;
+  Cursor cursor { expression, expression + size };
+  const auto op = static_cast<DW_OP>(cursor.fixed<uint8_t>());
+  if ((op >= DW_OP::reg0 && op <= DW_OP::reg31) || op == DW_OP::regx) {
+    location.kind = VariableLocation::Kind::reg;
+    location.value = op == DW_OP::regx ? cursor.uleb() : static_cast<uint8_t>(op) - static_cast<uint8_t>(DW_OP::reg0);
+    return cursor.p == cursor.end && !cursor.overflow;   // DW_OP_piece: a variable split across places
+  }
+
+  uint64_t base = 0;
+  const uint64_t* initial = nullptr;
+  if (op == DW_OP::fbreg) {
+    if (!frame_base) {
+      return false;
+    }
+    base = *frame_base + cursor.sleb();
+    initial = &base;
+  } else {
+    cursor.p = expression;
+  }
+  bool stack_value = false;
+  if (cursor.overflow ||
+      !evaluate(cursor.p, cursor.end - cursor.p, frame, initial, location.value, &stack_value, bias)) {
+    return false;
+  }
+  location.kind = stack_value ? VariableLocation::Kind::value : VariableLocation::Kind::memory;
+  return true;
+}
+
+const Unwinder::Module* Unwinder::findModule(uint64_t pc) {
+  return moduleAt(pc);
+}
+
+Unwinder::Module* Unwinder::moduleAt(uint64_t pc) {
+  auto find = [this, pc]() -> Module* {
+    auto it = std::upper_bound(m_modules.begin(), m_modules.end(), pc, [](uint64_t pc, const Module& module) {
+      return pc < module.low;
+    });
+    return it != m_modules.begin() && pc < (it - 1)->high ? &*(it - 1) : nullptr;
+  };
+  if (Module* module = find()) {
+    return module;
+  }
+  // A library loaded since we last looked? Once per miss, not again until something is found.
+  if (!m_mappings_fresh) {
+    readMappings();
+    m_mappings_fresh = true;
+    if (Module* module = find()) {
+      m_mappings_fresh = false;
+      return module;
+    }
+  }
+  return nullptr;
+}
+
+// Executable file mappings of the target (/proc/pid/maps, or the segments and NT_FILE of a core):
+//   555555554000-555555555000 r--p 00000000 08:01 1234 /usr/bin/test
+//   555555555000-555555556000 r-xp 00001000 08:01 1234 /usr/bin/test
+void Unwinder::readMappings() {
+  const std::string program = m_target.executable();
+
+  std::vector<Module> modules;
+  for (const MemoryMapping& mapping : m_target.mappings()) {
+    const std::string& path = mapping.path;
+    if (mapping.permissions.size() < 3 || mapping.permissions[2] != 'x' || path.empty() || path[0] != '/') {
+      continue;
+    }
+
+    Module module;
+    module.path = path;
+    module.low = mapping.low;
+    module.high = mapping.high;
+    module.main_program = path == program;
+    const uint64_t offset = mapping.offset;
+
+    auto file = m_files.find(path);
+    if (file == m_files.end()) {
+      elf::elf elf_file;
+      std::shared_ptr<CallFrameInfo> cfi;
+      const int fd = open(path.c_str(), O_RDONLY);
+      if (fd >= 0) {
+        try {
+          elf_file = elf::elf { elf::create_mmap_loader(fd) };
+          cfi = std::make_shared<CallFrameInfo>(elf_file);
+        } catch (std::exception&) {
+          elf_file = elf::elf {};
+        }
+      }
+      file = m_files.emplace(path, std::make_pair(elf_file, cfi)).first;
+    }
+    module.file = file->second.first;
+    module.cfi = file->second.second;
+    if (!module.file.valid()) {
+      continue;
+    }
+
+    // The mapping at file offset `offset` belongs to the PT_LOAD segment which holds that offset:
+    // its code is linked at vaddr + (offset - p_offset)
+    for (const elf::segment& segment : module.file.segments()) {
+      const auto& header = segment.get_hdr();
+      if (header.type == elf::pt::load && offset >= (header.offset & ~0xfffULL) &&
+          offset < header.offset + header.filesz) {
+        module.bias = module.low - offset - (header.vaddr - header.offset);
+        break;
+      }
+    }
+    modules.push_back(std::move(module));
+  }
+  std::sort(modules.begin(), modules.end(), [](const Module& a, const Module& b) { return a.low < b.low; });
+  m_modules = std::move(modules);
+}
+
+// The function symbol of the module holding address (link-time), nullptr if there is none
+const Unwinder::Module::Symbol* Unwinder::symbolAt(Module& module, uint64_t address) {
+  if (!module.symbols_read) {
+    module.symbols_read = true;
+    // .symtab if it wasn't stripped, else the exported functions of .dynsym
+    for (const char* name : { ".symtab", ".dynsym" }) {
+      const elf::section& section = module.file.get_section(name);
+      if (!section.valid()) {
+        continue;
+      }
+      for (const elf::sym symbol : section.as_symtab()) {
+        const auto& data = symbol.get_data();
+        if (data.type() == elf::stt::func && data.value != 0) {
+          module.symbols.push_back({ data.value, data.size, symbol.get_name() });
+        }
+      }
+      if (!module.symbols.empty()) {
+        break;
+      }
+    }
+    std::sort(module.symbols.begin(), module.symbols.end(), [](const auto& a, const auto& b) {
+      return a.address < b.address;
+    });
+  }
+
+  auto it = std::upper_bound(module.symbols.begin(), module.symbols.end(), address, [](uint64_t address,
+                                                                                        const auto& symbol) {
+    return address < symbol.address;
+  });
+  if (it == module.symbols.begin() || address >= (it - 1)->address + std::max<uint64_t>((it - 1)->size, 1)) {
+    return nullptr;
+  }
+  return &*(it - 1);
+}
+
+std::string Unwinder::symbolize(uint64_t pc) {
+  Module* module = moduleAt(pc);
+  if (!module) {
+    return "";
+  }
+  const std::string file_name = module->path.substr(module->path.rfind('/') + 1);
+  const Module::Symbol* symbol = symbolAt(*module, pc - module->bias);
+  if (!symbol) {
+    return "in " + file_name;
+  }
+  const uint64_t offset = pc - module->bias - symbol->address;
+  return (offset ? symbol->name + "+" + std::to_string(offset) : symbol->name) + " in " + file_name;
+}
+
+std::string Unwinder::functionName(uint64_t pc) {
+  Module* module = moduleAt(pc);
+  if (!module) {
+    return "";
+  }
+  const Module::Symbol* symbol = symbolAt(*module, pc - module->bias);
+  return symbol ? symbol->name : "[" + module->path.substr(module->path.rfind('/') + 1) + "]";
+}
+
+void Unwinder::reset() {
+  m_modules.clear();
+  m_files.clear();
+  m_mappings_fresh = false;
+}
+
+size_t Unwinder::cachedFdes() const {
+  size_t count = 0;
+  for (const auto& [path, file] : m_files) {
+    count += file.second ? file.second->cachedFdes() : 0;
+  }
+  return count;
+}
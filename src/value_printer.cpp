@@ -0,0 +1,929 @@
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+#include <iomanip>
+#include <sstream>
+
+#include "value_printer.h"
+
+namespace {
+
+std::string nameOf(const dwarf::die& die) {
+  return die.has(dwarf::DW_AT::name) ? at_name(die) : "";
+}
+
+// "const char *", "int [42]", "test" for a type DIE, without laying it out
+std::string typeName(const dwarf::die& die, unsigned depth = 0) {
+  using dwarf::DW_TAG;
+  auto target = [&]() {
+    return die.has(dwarf::DW_AT::type) && depth < 8 ? typeName(die[dwarf::DW_AT::type].as_reference(), depth + 1)
+                                                    : std::string("void");
+  };
+  switch (die.tag) {
+    case DW_TAG::pointer_type: return target() + " *";
+    case DW_TAG::reference_type: return target() + " &";
+    case DW_TAG::rvalue_reference_type: return target() + " &&";
+    case DW_TAG::const_type: return "const " + target();
+    case DW_TAG::volatile_type: return "volatile " + target();
+    case DW_TAG::array_type: return target() + " []";
+    case DW_TAG::subroutine_type: return "function";
+    default: {
+      const std::string name = nameOf(die);
+      return name.empty() ? "<anonymous>" : name;
+    }
+  }
+}
+
+bool isCharacter(const TypeLayout& type) {
+  return type.kind == TypeLayout::Kind::base && type.size == 1 &&
+         (type.encoding == dwarf::DW_ATE::signed_char || type.encoding == dwarf::DW_ATE::unsigned_char);
+}
+
+uint64_t loadUnsigned(const uint8_t* bytes, size_t size) {
+  uint64_t value = 0;
+  std::memcpy(&value, bytes, std::min<size_t>(size, sizeof(value)));
+  return value;
+}
+
+int64_t loadSigned(const uint8_t* bytes, size_t size) {
+  const uint64_t value = loadUnsigned(bytes, size);
+  if (size == 0 || size >= 8) {
+    return static_cast<int64_t>(value);
+  }
+  const unsigned shift = 64 - size * 8;
+  return static_cast<int64_t>(value << shift) >> shift;
+}
+
+std::string hex(uint64_t value) {
+  std::ostringstream text;
+  text << "0x" << std::hex << value;
+  return text.str();
+}
+
+constexpr uint64_t PAGE_SIZE = 0x1000;
+
+uint64_t alignOf(const TypeLayout& type, unsigned depth = 0) {
+  using Kind = TypeLayout::Kind;
+  switch (type.kind) {
+    case Kind::array:
+      return type.element && depth < 8 ? alignOf(*type.element, depth + 1) : 1;
+    case Kind::structure: {
+      uint64_t align = 1;
+      for (const TypeLayout::Member& member : type.members) {
+        align = std::max(align, depth < 8 ? alignOf(*member.type, depth + 1) : 8);
+      }
+      return align;
+    }
+    default:
+      return std::min<uint64_t>(std::max<uint64_t>(type.size, 1), 16);
+  }
+}
+
+uint64_t alignUp(uint64_t value, uint64_t align) {
+  return (value + align - 1) / align * align;
+}
+
+// The layout of a chain of members ("_M_impl", "_M_start"): the last one, and its offset in type
+const TypeLayout* memberPath(const TypeLayout& type, std::initializer_list<const char*> path, uint64_t& offset) {
+  const TypeLayout* current = &type;
+  offset = 0;
+  for (const char* name : path) {
+    const TypeLayout::Member* member = ValuePrinter::findMember(*current, name, offset);
+    if (!member) {
+      return nullptr;
+    }
+    current = member->type;
+  }
+  return current;
+}
+
+// Counts the nested print() and format() calls, the page cache is only valid within the outermost
+struct Printing {
+  explicit Printing(unsigned& nesting) : nesting(nesting) { ++nesting; }
+  ~Printing() { --nesting; }
+  unsigned& nesting;
+};
+
+} // namespace
+
+void appendEscaped(std::string& out, char c) {
+  switch (c) {
+    case '\n': out += "\\n"; break;
+    case '\t': out += "\\t"; break;
+    case '\r': out += "\\r"; break;
+    case '"': out += "\\\""; break;
+    case '\\': out += "\\\\"; break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20 || static_cast<unsigned char>(c) >= 0x7f) {
+        char escaped[8];
+        snprintf(escaped, sizeof(escaped), "\\%03o", static_cast<unsigned char>(c));
+        out += escaped;
+      } else {
+        out += c;
+      }
+  }
+}
+
+const TypeLayout& ValuePrinter::layout(const dwarf::die& type) {
+  using dwarf::DW_TAG;
+  if (type.tag == DW_TAG::variable || type.tag == DW_TAG::formal_parameter || type.tag == DW_TAG::member) {
+    return type.has(dwarf::DW_AT::type) ? *build(type[dwarf::DW_AT::type].as_reference()) : m_void;
+  }
+  return *build(type);
+}
+
+const TypeLayout& ValuePrinter::pointee(const TypeLayout& pointer) {
+  if (pointer.target) {
+    return *pointer.target;
+  }
+  return pointer.pointee.valid() ? *build(pointer.pointee) : m_void;
+}
+
+const TypeLayout* ValuePrinter::builtin(const std::string& name) {
+  using dwarf::DW_ATE;
+  struct Builtin {
+    const char* name;
+    uint64_t size;
+    DW_ATE encoding;
+  };
+  static const Builtin builtins[] = {
+      {"char", 1, DW_ATE::signed_char}, {"signed char", 1, DW_ATE::signed_char},
+      {"unsigned char", 1, DW_ATE::unsigned_char}, {"bool", 1, DW_ATE::boolean},
+      {"short", 2, DW_ATE::signed_}, {"short int", 2, DW_ATE::signed_},
+      {"unsigned short", 2, DW_ATE::unsigned_}, {"short unsigned int", 2, DW_ATE::unsigned_},
+      {"int", 4, DW_ATE::signed_}, {"signed", 4, DW_ATE::signed_}, {"signed int", 4, DW_ATE::signed_},
+      {"unsigned", 4, DW_ATE::unsigned_}, {"unsigned int", 4, DW_ATE::unsigned_},
+      {"long", 8, DW_ATE::signed_}, {"long int", 8, DW_ATE::signed_}, {"long long", 8, DW_ATE::signed_},
+      {"long long int", 8, DW_ATE::signed_}, {"unsigned long", 8, DW_ATE::unsigned_},
+      {"long unsigned int", 8, DW_ATE::unsigned_}, {"unsigned long long", 8, DW_ATE::unsigned_},
+      {"long long unsigned int", 8, DW_ATE::unsigned_}, {"float", 4, DW_ATE::float_},
+      {"double", 8, DW_ATE::float_}, {"long double", 16, DW_ATE::float_}};
+
+  auto cached = m_builtins.find(name);
+  if (cached != m_builtins.end()) {
+    return cached->second.get();
+  }
+  if (name == "void") {
+    return &m_void;
+  }
+  for (const Builtin& type : builtins) {
+    if (name == type.name) {
+      auto layout = std::make_unique<TypeLayout>();
+      layout->kind = TypeLayout::Kind::base;
+      layout->name = name;
+      layout->size = type.size;
+      layout->encoding = type.encoding;
+      return (m_builtins[name] = std::move(layout)).get();
+    }
+  }
+  return nullptr;
+}
+
+const TypeLayout::Member* ValuePrinter::findMember(const TypeLayout& type, const std::string& name,
+                                                   uint64_t& offset) {
+  for (const TypeLayout::Member& member : type.members) {
+    if (member.name == name) {
+      offset += member.offset;
+      return &member;
+    }
+  }
+  for (const TypeLayout::Member& member : type.members) {
+    if ((member.name.empty() || member.name[0] == '<') && member.type->kind == TypeLayout::Kind::structure) {
+      uint64_t inner = offset + member.offset;
+      if (const TypeLayout::Member* found = findMember(*member.type, name, inner)) {
+        offset = inner;
+        return found;
+      }
+    }
+  }
+  return nullptr;
+}
+
+const TypeLayout& ValuePrinter::pointerTo(const TypeLayout& type) {
+  std::unique_ptr<TypeLayout>& pointer = m_pointers[&type];
+  if (!pointer) {
+    pointer = std::make_unique<TypeLayout>();
+    pointer->kind = TypeLayout::Kind::pointer;
+    pointer->name = (type.name.empty() ? std::string("void") : type.name) + " *";
+    pointer->size = sizeof(uint64_t);
+    pointer->target = &type;
+  }
+  return *pointer;
+}
+
+// Flattens the type chain starting at die. The layout is in the cache before its parts are built, so a type which
+// reaches itself (through a pointer, laid out lazily anyway) finds it instead of recursing forever.
+TypeLayout* ValuePrinter::build(const dwarf::die& die) {
+  using dwarf::DW_AT;
+  using dwarf::DW_TAG;
+  const Key key { die.get_unit().data().get(), die.get_section_offset() };
+  auto cached = m_layouts.find(key);
+  if (cached != m_layouts.end()) {
+    return cached->second.get();
+  }
+  TypeLayout* layout = (m_layouts[key] = std::make_unique<TypeLayout>()).get();
+  auto target = [this](const dwarf::die& die) -> TypeLayout* {
+    return die.has(DW_AT::type) ? build(die[DW_AT::type].as_reference()) : &m_void;
+  };
+  const uint64_t byte_size = die.has(DW_AT::byte_size) ? die[DW_AT::byte_size].as_uconstant() : 0;
+
+  switch (die.tag) {
+    case DW_TAG::base_type:
+      layout->kind = TypeLayout::Kind::base;
+      layout->name = nameOf(die);
+      layout->size = byte_size;
+      layout->encoding = static_cast<dwarf::DW_ATE>(die[DW_AT::encoding].as_uconstant());
+      break;
+
+    // Only names: the value is the one of the type they stand for
+    case DW_TAG::typedef_:
+    case DW_TAG::const_type:
+    case DW_TAG::volatile_type:
+    case DW_TAG::restrict_type: {
+      const TypeLayout* underlying = target(die);
+      *layout = *underlying;
+      layout->name = typeName(die);
+      break;
+    }
+
+    case DW_TAG::pointer_type:
+    case DW_TAG::reference_type:
+    case DW_TAG::rvalue_reference_type:
+      layout->kind = die.tag == DW_TAG::pointer_type ? TypeLayout::Kind::pointer : TypeLayout::Kind::reference;
+      layout->name = typeName(die);
+      layout->size = byte_size ? byte_size : sizeof(uint64_t);
+      if (die.has(DW_AT::type)) {
+        layout->pointee = die[DW_AT::type].as_reference();
+      }
+      break;
+
+    case DW_TAG::unspecified_type:   // decltype(nullptr)
+      layout->kind = TypeLayout::Kind::pointer;
+      layout->name = nameOf(die);
+      layout->size = sizeof(uint64_t);
+      break;
+
+    case DW_TAG::structure_type:
+    case DW_TAG::class_type:
+    case DW_TAG::union_type:
+      layout->kind = TypeLayout::Kind::structure;
+      layout->name = typeName(die);
+      layout->size = byte_size;
+      for (const dwarf::die& child : die) {
+        const bool base_class = child.tag == DW_TAG::inheritance;
+        if ((child.tag != DW_TAG::member && !base_class) || child.has(DW_AT::declaration) ||
+            child.has(DW_AT::external)) {
+          continue;   // static members have no storage in the object
+        }
+        TypeLayout::Member member;
+        member.type = target(child);
+        member.name = base_class ? "<" + member.type->name + ">" : nameOf(child);
+        if (child.has(DW_AT::data_member_location) &&
+            child[DW_AT::data_member_location].get_type() != dwarf::value::type::exprloc) {
+          member.offset = child[DW_AT::data_member_location].as_uconstant();
+        }
+        if (child.has(DW_AT::bit_size)) {
+          member.bit_size = child[DW_AT::bit_size].as_uconstant();
+          if (child.has(DW_AT::data_bit_offset)) {
+            const uint64_t bit = child[DW_AT::data_bit_offset].as_uconstant();
+            member.offset = bit / 8;
+            member.bit_offset = bit % 8;
+          } else if (child.has(DW_AT::bit_offset)) {
+            // DWARF 2/3: counted from the most significant bit of a storage unit of byte_size
+            const uint64_t storage = child.has(DW_AT::byte_size) ? child[DW_AT::byte_size].as_uconstant()
+                                                                 : member.type->size;
+            member.bit_offset = storage * 8 - child[DW_AT::bit_offset].as_uconstant() - member.bit_size;
+          }
+        }
+        layout->members.push_back(std::move(member));
+      }
+      detectContainer(die, *layout);
+      break;
+
+    case DW_TAG::array_type: {
+      // int a[2][3] is one DIE with two subranges: lay it out as an array of 2 arrays of 3
+      std::vector<uint64_t> counts;
+      for (const dwarf::die& child : die) {
+        if (child.tag != DW_TAG::subrange_type) {
+          continue;
+        }
+        uint64_t count = 0;
+        if (child.has(DW_AT::count)) {
+          count = child[DW_AT::count].as_uconstant();
+        } else if (child.has(DW_AT::upper_bound) &&
+                   child[DW_AT::upper_bound].get_type() != dwarf::value::type::exprloc) {
+          const uint64_t lower = child.has(DW_AT::lower_bound) ? child[DW_AT::lower_bound].as_uconstant() : 0;
+          count = child[DW_AT::upper_bound].as_uconstant() + 1 - lower;
+        }
+        counts.push_back(count);   // 0: flexible or variable length
+      }
+      if (counts.empty()) {
+        counts.push_back(0);
+      }
+      const TypeLayout* element = target(die);
+      for (size_t dimension = counts.size(); dimension-- > 1;) {
+        auto inner = std::make_unique<TypeLayout>();
+        inner->kind = TypeLayout::Kind::array;
+        inner->element = element;
+        inner->count = counts[dimension];
+        inner->size = element->size * inner->count;
+        inner->name = element->name + " [" + std::to_string(inner->count) + "]";
+        element = inner.get();
+        m_dimensions.push_back(std::move(inner));
+      }
+      layout->kind = TypeLayout::Kind::array;
+      layout->element = element;
+      layout->count = counts[0];
+      layout->size = byte_size ? byte_size : element->size * layout->count;
+      layout->name = element->name + " [" + std::to_string(layout->count) + "]";
+      break;
+    }
+
+    case DW_TAG::enumeration_type: {
+      layout->kind = TypeLayout::Kind::enumeration;
+      layout->name = typeName(die);
+      layout->size = byte_size;
+      const TypeLayout* underlying = die.has(DW_AT::type) ? target(die) : nullptr;
+      layout->encoding = underlying && underlying->kind == TypeLayout::Kind::base ? underlying->encoding
+                                                                                    : dwarf::DW_ATE::signed_;
+      for (const dwarf::die& child : die) {
+        if (child.tag == DW_TAG::enumerator && child.has(DW_AT::const_value)) {
+          const dwarf::value value = child[DW_AT::const_value];
+          const int64_t number = value.get_type() == dwarf::value::type::uconstant
+                                     ? static_cast<int64_t>(value.as_uconstant()) : value.as_sconstant();
+          layout->enumerators.emplace_back(number, nameOf(child));
+        }
+      }
+      break;
+    }
+
+    case DW_TAG::subroutine_type:
+      layout->kind = TypeLayout::Kind::function;
+      layout->name = "function";
+      break;
+
+    default:
+      layout->name = typeName(die);
+      layout->size = byte_size;
+      break;
+  }
+  return layout;
+}
+
+// std::vector<int> is "vector<int, std::allocator<int> >" in the DWARF of namespace std: recognized by its name and
+// then by its members, another class called vector won't have them
+void ValuePrinter::detectContainer(const dwarf::die& die, TypeLayout& layout) {
+  using Kind = TypeLayout::Container::Kind;
+  struct Known {
+    const char* prefix;
+    Kind kind;
+    bool mapped;
+  };
+  static const Known known[] = {
+      {"vector<", Kind::vector, false}, {"basic_string<", Kind::string, false},
+      {"map<", Kind::tree, true}, {"multimap<", Kind::tree, true},
+      {"set<", Kind::tree, false}, {"multiset<", Kind::tree, false},
+      {"unordered_map<", Kind::hashtable, true}, {"unordered_multimap<", Kind::hashtable, true},
+      {"unordered_set<", Kind::hashtable, false}, {"unordered_multiset<", Kind::hashtable, false}};
+
+  const std::string name = nameOf(die);
+  const Known* match = nullptr;
+  for (const Known& candidate : known) {
+    if (name.compare(0, std::strlen(candidate.prefix), candidate.prefix) == 0) {
+      match = &candidate;
+      break;
+    }
+  }
+  if (!match) {
+    return;
+  }
+  std::vector<dwarf::die> parameters;
+  for (const dwarf::die& child : die) {
+    if (child.tag == dwarf::DW_TAG::template_type_parameter && child.has(dwarf::DW_AT::type)) {
+      parameters.push_back(child[dwarf::DW_AT::type].as_reference());
+    }
+  }
+  if (parameters.size() < (match->mapped ? 2u : 1u)) {
+    return;
+  }
+
+  TypeLayout::Container container;
+  container.kind = match->kind;
+  container.name = "std::" + std::string(match->prefix, std::strlen(match->prefix) - 1);
+  container.key = parameters[0];
+  if (match->mapped) {
+    container.mapped = parameters[1];
+  }
+  auto isPointer = [](const TypeLayout* type) { return type && type->kind == TypeLayout::Kind::pointer; };
+  uint64_t offset = 0;
+  switch (match->kind) {
+    case Kind::vector:
+      // vector<bool> keeps bits, its _M_start is an iterator and not a pointer
+      if (!isPointer(memberPath(layout, {"_M_impl", "_M_start"}, container.first)) ||
+          !isPointer(memberPath(layout, {"_M_impl", "_M_finish"}, container.second)) ||
+          !isPointer(memberPath(layout, {"_M_impl", "_M_end_of_storage"}, container.third))) {
+        return;
+      }
+      break;
+    case Kind::string:
+      if (!isPointer(memberPath(layout, {"_M_dataplus", "_M_p"}, container.first)) ||
+          !memberPath(layout, {"_M_string_length"}, container.second)) {
+        return;
+      }
+      break;
+    case Kind::tree: {
+      // The header is a node without a value: its parent is the root, left and right the first and the last node
+      const TypeLayout* header = memberPath(layout, {"_M_t", "_M_impl", "_M_header"}, container.first);
+      if (!header || !memberPath(layout, {"_M_t", "_M_impl", "_M_node_count"}, container.second) ||
+          !memberPath(*header, {"_M_parent"}, container.links[0]) ||
+          !memberPath(*header, {"_M_left"}, container.links[1]) ||
+          !memberPath(*header, {"_M_right"}, container.links[2])) {
+        return;
+      }
+      container.third = header->size;   // the value follows the node base
+      break;
+    }
+    case Kind::hashtable: {
+      // The nodes are a singly linked list from _M_before_begin, a node without a value
+      const TypeLayout* before_begin = memberPath(layout, {"_M_h", "_M_before_begin"}, container.first);
+      if (!before_begin || !memberPath(*before_begin, {"_M_nxt"}, offset) || offset != 0 ||
+          !memberPath(layout, {"_M_h", "_M_element_count"}, container.second)) {
+        return;
+      }
+      container.third = before_begin->size;
+      break;
+    }
+    default:
+      return;
+  }
+  layout.container = std::move(container);
+}
+
+std::string ValuePrinter::print(const TypeLayout& type, uint64_t address) {
+  std::vector<uint8_t> bytes(std::min(type.size, max_read));
+  ++m_reads;
+  if (!bytes.empty() && !m_read(address, bytes.data(), bytes.size())) {
+    return "<unreadable at " + hex(address) + ">";
+  }
+  return format(type, bytes.data(), bytes.size());
+}
+
+std::string ValuePrinter::format(const TypeLayout& type, const uint8_t* bytes, size_t size) {
+  if (m_printing == 0) {
+    m_pages.clear();   // the program ran since the last value
+  }
+  Printing printing(m_printing);
+  std::string out;
+  formatValue(out, type, bytes, size, 0);
+  return out;
+}
+
+void ValuePrinter::formatValue(std::string& out, const TypeLayout& type, const uint8_t* bytes, size_t size,
+                               unsigned depth) {
+  using Kind = TypeLayout::Kind;
+  if (type.size > size && type.kind != Kind::array && type.kind != Kind::structure) {
+    out += "<unavailable>";
+    return;
+  }
+
+  switch (type.kind) {
+    case Kind::base: {
+      std::ostringstream text;
+      switch (type.encoding) {
+        case dwarf::DW_ATE::boolean:
+          text << (loadUnsigned(bytes, type.size) ? "true" : "false");
+          break;
+        case dwarf::DW_ATE::float_:
+          if (type.size == sizeof(float)) {
+            float value;
+            std::memcpy(&value, bytes, sizeof(value));
+            text << value;
+          } else if (type.size == sizeof(double)) {
+            double value;
+            std::memcpy(&value, bytes, sizeof(value));
+            text << value;
+          } else {
+            long double value = 0;   // x87 80-bit, padded to 16 bytes
+            std::memcpy(&value, bytes, std::min(type.size, sizeof(value)));
+            text << value;
+          }
+          break;
+        case dwarf::DW_ATE::signed_char:
+        case dwarf::DW_ATE::unsigned_char: {
+          const int64_t value = type.encoding == dwarf::DW_ATE::signed_char ? loadSigned(bytes, type.size)
+                                                                           : loadUnsigned(bytes, type.size);
+          std::string quoted = "'";
+          appendEscaped(quoted, static_cast<char>(value));
+          text << value << ' ' << quoted << "'";
+          break;
+        }
+        case dwarf::DW_ATE::signed_:
+          text << loadSigned(bytes, type.size);
+          break;
+        default:
+          text << loadUnsigned(bytes, type.size);
+          break;
+      }
+      out += text.str();
+      return;
+    }
+
+    case Kind::enumeration: {
+      const int64_t value = type.encoding == dwarf::DW_ATE::unsigned_ ? loadUnsigned(bytes, type.size)
+                                                                      : loadSigned(bytes, type.size);
+      for (const auto& [number, name] : type.enumerators) {
+        if (number == value) {
+          out += name;
+          return;
+        }
+      }
+      out += "(" + type.name + ") " + std::to_string(value);
+      return;
+    }
+
+    case Kind::pointer: {
+      const uint64_t address = loadUnsigned(bytes, type.size);
+      out += hex(address);
+      if (address && (type.pointee.valid() || type.target) && isCharacter(pointee(type))) {
+        out += " " + readString(address, max_characters);
+      }
+      return;
+    }
+
+    case Kind::reference: {
+      const uint64_t address = loadUnsigned(bytes, type.size);
+      out += "@" + hex(address);
+      if (depth < max_depth && address) {
+        out += ": " + print(pointee(type), address);
+      }
+      return;
+    }
+
+    case Kind::structure: {
+      if (type.container.kind != TypeLayout::Container::Kind::none && formatContainer(out, type, bytes, size, depth)) {
+        return;
+      }
+      if (depth >= max_depth) {
+        out += "{...}";
+        return;
+      }
+      out += "{";
+      for (size_t i = 0; i < type.members.size(); ++i) {
+        const TypeLayout::Member& member = type.members[i];
+        out += (i ? ", " : "") + (member.name.empty() ? std::string() : member.name + " = ");
+        if (member.offset + member.type->size > size && !(member.bit_size && member.offset < size)) {
+          out += "<unavailable>";
+        } else if (member.bit_size) {
+          uint64_t storage = 0;
+          std::memcpy(&storage, bytes + member.offset, std::min<size_t>(size - member.offset, sizeof(storage)));
+          uint64_t value = storage >> member.bit_offset;
+          if (member.bit_size < 64) {
+            value &= (1ULL << member.bit_size) - 1;
+          }
+          const bool is_signed = member.type->encoding == dwarf::DW_ATE::signed_ ||
+                                 member.type->encoding == dwarf::DW_ATE::signed_char;
+          if (is_signed && member.bit_size < 64 && (value >> (member.bit_size - 1)) & 1) {
+            out += std::to_string(static_cast<int64_t>(value | ~((1ULL << member.bit_size) - 1)));
+          } else {
+            out += std::to_string(value);
+          }
+        } else {
+          formatValue(out, *member.type, bytes + member.offset, size - member.offset, depth + 1);
+        }
+      }
+      out += "}";
+      return;
+    }
+
+    case Kind::array: {
+      const TypeLayout& element = *type.element;
+      // char arrays as strings, up to the first NUL
+      if (isCharacter(element)) {
+        const size_t length = std::min<size_t>(type.count, size);
+        out += "\"";
+        size_t i = 0;
+        for (; i < length && bytes[i]; ++i) {
+          appendEscaped(out, static_cast<char>(bytes[i]));
+        }
+        out += "\"";
+        return;
+      }
+      if (depth >= max_depth) {
+        out += "{...}";
+        return;
+      }
+      out += "{";
+      const uint64_t shown = std::min<uint64_t>(type.count, max_elements);
+      for (uint64_t i = 0; i < shown; ++i) {
+        out += i ? ", " : "";
+        const uint64_t offset = i * element.size;
+        if (offset + element.size > size) {
+          out += "<unavailable>";
+          break;
+        }
+        formatValue(out, element, bytes + offset, size - offset, depth + 1);
+      }
+      if (type.count > shown) {
+        out += ", ... (" + std::to_string(type.count) + " elements)";
+      }
+      out += "}";
+      return;
+    }
+
+    case Kind::function:
+      out += "{function}";
+      return;
+
+    default:
+      out += "<" + (type.name.empty() ? std::string("unknown type") : type.name) + ">";
+      return;
+  }
+}
+
+// A C string of at most limit characters: read in one piece, or up to the end of the page if that fails
+std::string ValuePrinter::readString(uint64_t address, size_t limit) {
+  std::vector<char> buffer(limit);
+  ++m_reads;
+  if (!m_read(address, buffer.data(), buffer.size())) {
+    const size_t to_page_end = 0x1000 - (address & 0xfff);
+    buffer.resize(std::min(limit, to_page_end));
+    ++m_reads;
+    if (!m_read(address, buffer.data(), buffer.size())) {
+      return "<unreadable>";
+    }
+  }
+  std::string out = "\"";
+  size_t i = 0;
+  for (; i < buffer.size() && buffer[i]; ++i) {
+    appendEscaped(out, buffer[i]);
+  }
+  out += i == buffer.size() ? "\"..." : "\"";
+  return out;
+}
+
+bool ValuePrinter::formatContainer(std::string& out, const TypeLayout& type, const uint8_t* bytes, size_t size,
+                                   unsigned depth) {
+  using Kind = TypeLayout::Container::Kind;
+  const TypeLayout::Container& container = type.container;
+  if (type.size > size) {
+    return false;
+  }
+  auto word = [bytes](uint64_t offset) { return loadUnsigned(bytes + offset, sizeof(uint64_t)); };
+
+  switch (container.kind) {
+    case Kind::string: {
+      const uint64_t data = word(container.first);
+      const uint64_t length = word(container.second);
+      const size_t shown = std::min<uint64_t>(length, max_characters);
+      std::vector<char> text(shown);
+      if (shown && !readCached(data, text.data(), shown)) {
+        out += "<unreadable string at " + hex(data) + ">";
+        return true;
+      }
+      out += "\"";
+      for (char c : text) {
+        appendEscaped(out, c);
+      }
+      out += length > shown ? "\"..." : "\"";
+      return true;
+    }
+
+    case Kind::vector: {
+      const TypeLayout& element = *build(container.key);
+      const uint64_t start = word(container.first);
+      const uint64_t finish = word(container.second);
+      const uint64_t end = word(container.third);
+      if (element.size == 0 || finish < start || end < finish) {
+        return false;
+      }
+      const uint64_t length = (finish - start) / element.size;
+      out += container.name + " of length " + std::to_string(length) + ", capacity " +
+             std::to_string((end - start) / element.size);
+      if (length == 0) {
+        return true;
+      }
+      if (depth >= max_depth) {
+        out += " = {...}";
+        return true;
+      }
+      // The elements shown in one read
+      const uint64_t shown = std::min<uint64_t>({length, max_elements, std::max<uint64_t>(max_read / element.size, 1)});
+      std::vector<uint8_t> elements(shown * element.size);
+      ++m_reads;
+      if (!m_read(start, elements.data(), elements.size())) {
+        out += " = <unreadable at " + hex(start) + ">";
+        return true;
+      }
+      out += " = {";
+      for (uint64_t i = 0; i < shown; ++i) {
+        out += i ? ", " : "";
+        formatValue(out, element, elements.data() + i * element.size, element.size, depth + 1);
+      }
+      out += length > shown ? ", ...}" : "}";
+      return true;
+    }
+
+    case Kind::tree:
+      formatTree(out, type, bytes, depth);
+      return true;
+
+    case Kind::hashtable:
+      formatHashtable(out, type, bytes, depth);
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// In order, from the leftmost node: a node's successor is the leftmost node of its right subtree, or else the first
+// ancestor it is on the left of. The pages of the children and parents met on the way are read along.
+void ValuePrinter::formatTree(std::string& out, const TypeLayout& type, const uint8_t* bytes, unsigned depth) {
+  const TypeLayout::Container& container = type.container;
+  const uint64_t count = loadUnsigned(bytes + container.second, sizeof(uint64_t));
+  out += container.name + " with " + std::to_string(count) + " elements";
+  if (count == 0) {
+    return;
+  }
+  if (depth >= max_depth) {
+    out += " = {...}";
+    return;
+  }
+  const TypeLayout& key = *build(container.key);
+  const TypeLayout* mapped = container.mapped.valid() ? build(container.mapped) : nullptr;
+  // _Rb_tree_node: the node base, then the key (and the value of a map: a std::pair)
+  const uint64_t value_offset = alignUp(container.third, std::max(alignOf(key), mapped ? alignOf(*mapped) : 1));
+  const uint64_t mapped_offset = mapped ? alignUp(key.size, alignOf(*mapped)) : 0;
+  const uint64_t node_size = value_offset + (mapped ? mapped_offset + mapped->size : key.size);
+  const uint64_t* links = container.links;   // parent, left, right
+
+  std::vector<uint8_t> node(node_size);
+  std::vector<uint64_t> next;
+  auto link = [&node](uint64_t offset) { return loadUnsigned(node.data() + offset, sizeof(uint64_t)); };
+  auto visit = [&](uint64_t address) {
+    if (!readNode(address, node.data(), node.size(), next)) {
+      return false;
+    }
+    for (unsigned i = 0; i < 3; ++i) {
+      if (link(links[i])) {
+        next.push_back(link(links[i]));
+      }
+    }
+    return true;
+  };
+
+  const uint64_t shown = std::min<uint64_t>(count, max_elements);
+  uint64_t current = loadUnsigned(bytes + container.first + links[1], sizeof(uint64_t));
+  out += " = {";
+  for (uint64_t i = 0; i < shown; ++i) {
+    if (!visit(current)) {
+      out += (i ? ", " : "") + std::string("<unreadable node at ") + hex(current) + ">";
+      break;
+    }
+    out += i ? ", " : "";
+    formatElement(out, key, mapped, node.data(), value_offset, depth);
+    if (i + 1 == shown) {
+      break;
+    }
+    if (link(links[2])) {
+      current = link(links[2]);
+      while (visit(current) && link(links[1])) {
+        current = link(links[1]);
+      }
+    } else {
+      uint64_t child = current;
+      current = link(links[0]);
+      while (visit(current) && link(links[2]) == child) {
+        child = current;
+        current = link(links[0]);
+      }
+    }
+  }
+  out += shown < count ? ", ...}" : "}";
+}
+
+// _Hashtable keeps all of its nodes in one singly linked list, the buckets point into it
+void ValuePrinter::formatHashtable(std::string& out, const TypeLayout& type, const uint8_t* bytes, unsigned depth) {
+  const TypeLayout::Container& container = type.container;
+  const uint64_t count = loadUnsigned(bytes + container.second, sizeof(uint64_t));
+  out += container.name + " with " + std::to_string(count) + " elements";
+  if (count == 0) {
+    return;
+  }
+  if (depth >= max_depth) {
+    out += " = {...}";
+    return;
+  }
+  const TypeLayout& key = *build(container.key);
+  const TypeLayout* mapped = container.mapped.valid() ? build(container.mapped) : nullptr;
+  // _Hash_node: the next pointer, the value, maybe the hash code
+  const uint64_t value_offset = alignUp(container.third, std::max(alignOf(key), mapped ? alignOf(*mapped) : 1));
+  const uint64_t mapped_offset = mapped ? alignUp(key.size, alignOf(*mapped)) : 0;
+  const uint64_t node_size = value_offset + (mapped ? mapped_offset + mapped->size : key.size);
+
+  std::vector<uint8_t> node(node_size);
+  std::vector<uint64_t> next;
+  const uint64_t shown = std::min<uint64_t>(count, max_elements);
+  uint64_t current = loadUnsigned(bytes + container.first, sizeof(uint64_t));
+  out += " = {";
+  for (uint64_t i = 0; i < shown && current; ++i) {
+    if (!readNode(current, node.data(), node.size(), next)) {
+      out += (i ? ", " : "") + std::string("<unreadable node at ") + hex(current) + ">";
+      break;
+    }
+    out += i ? ", " : "";
+    formatElement(out, key, mapped, node.data(), value_offset, depth);
+    current = loadUnsigned(node.data(), sizeof(uint64_t));
+  }
+  out += shown < count ? ", ...}" : "}";
+}
+
+// A set's key, or a map's "[key] = value"
+void ValuePrinter::formatElement(std::string& out, const TypeLayout& key, const TypeLayout* mapped,
+                                 const uint8_t* node, uint64_t offset, unsigned depth) {
+  if (!mapped) {
+    formatValue(out, key, node + offset, key.size, depth + 1);
+    return;
+  }
+  out += "[";
+  formatValue(out, key, node + offset, key.size, depth + 1);
+  out += "] = ";
+  const uint64_t mapped_offset = offset + alignUp(key.size, alignOf(*mapped));
+  formatValue(out, *mapped, node + mapped_offset, mapped->size, depth + 1);
+}
+
+// The pages of the node and those of the nodes in next which aren't read yet (the most recent first, at most 64
+// pages) in one transfer
+bool ValuePrinter::readCached(uint64_t address, void* buffer, size_t size) {
+  auto* out = static_cast<uint8_t*>(buffer);
+  for (uint64_t at = address; at < address + size;) {
+    const auto page = m_pages.find(at & ~(PAGE_SIZE - 1));
+    if (page == m_pages.end() || !page->second) {
+      ++m_reads;
+      return m_read(address, buffer, size);
+    }
+    const uint64_t chunk = std::min<uint64_t>(PAGE_SIZE - (at & (PAGE_SIZE - 1)), address + size - at);
+    std::memcpy(out + (at - address), page->second.get() + (at & (PAGE_SIZE - 1)), chunk);
+    at += chunk;
+  }
+  return true;
+}
+
+bool ValuePrinter::readNode(uint64_t address, void* buffer, size_t size, std::vector<uint64_t>& next) {
+  constexpr size_t MAX_PAGES = 64;
+  const uint64_t first = address & ~(PAGE_SIZE - 1);
+  const uint64_t last = (address + size - 1) & ~(PAGE_SIZE - 1);
+  if (address + size < address) {
+    return false;
+  }
+  std::vector<uint64_t> pages;
+  for (uint64_t page = first; page <= last; page += PAGE_SIZE) {
+    if (!m_pages.count(page)) {
+      pages.push_back(page);
+    }
+  }
+  if (!pages.empty()) {
+    while (!next.empty() && pages.size() < MAX_PAGES) {
+      const uint64_t page = next.back() & ~(PAGE_SIZE - 1);
+      next.pop_back();
+      if (!m_pages.count(page) && std::find(pages.begin(), pages.end(), page) == pages.end()) {
+        pages.push_back(page);
+      }
+    }
+    std::vector<uint8_t> contents(pages.size() * PAGE_SIZE);
+    for (size_t done = 0; done < pages.size();) {
+      size_t wanted = pages.size() - done;
+      size_t read = 0;
+      ++m_reads;
+      if (m_read_blocks) {
+        read = m_read_blocks(pages.data() + done, wanted, PAGE_SIZE, contents.data() + done * PAGE_SIZE);
+      } else {
+        wanted = 1;
+        read = m_read(pages[done], contents.data() + done * PAGE_SIZE, PAGE_SIZE) ? 1 : 0;
+      }
+      for (size_t i = done; i < done + read; ++i) {
+        auto page = std::make_unique<uint8_t[]>(PAGE_SIZE);
+        std::memcpy(page.get(), contents.data() + i * PAGE_SIZE, PAGE_SIZE);
+        m_pages[pages[i]] = std::move(page);
+      }
+      done += read;
+      if (read < wanted) {
+        m_pages[pages[done++]] = nullptr;   // unmapped: a bad pointer in a node, or the end of the heap
+      }
+    }
+  }
+
+  auto* out = static_cast<uint8_t*>(buffer);
+  for (uint64_t at = address; at < address + size;) {
+    const uint64_t page = at & ~(PAGE_SIZE - 1);
+    const uint8_t* contents = m_pages[page].get();
+    if (!contents) {
+      return false;
+    }
+    const size_t n = std::min<uint64_t>(page + PAGE_SIZE - at, address + size - at);
+    std::memcpy(out, contents + (at - page), n);
+    out += n;
+    at += n;
+  }
+  return true;
+}
\ No newline at end of file
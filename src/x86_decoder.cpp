@@ -0,0 +1,1330 @@
+#include <array>
+#include <deque>
+#include <sstream>
+#include <vector>
+
+#include "x86_decoder.h"
+
+namespace {
+  // Opcode attributes. The low bits describe the operand bytes which follow the opcode,
+  // the high bits tell how the opcode transfers control.
+  enum : uint16_t {
+    N  = 0x0000,   // nothing follows
+    M  = 0x0001,   // ModRM (+ SIB + displacement) follows
+    Ib = 0x0010,   // 8-bit immediate
+    Iw = 0x0020,   // 16-bit immediate
+    Iz = 0x0030,   // 16/32-bit immediate (operand size)
+    Iv = 0x0040,   // 16/32/64-bit immediate (operand size, REX.W)
+    Ie = 0x0050,   // enter: imm16 + imm8
+    Io = 0x0060,   // moffs: 32/64-bit address (address size)
+    Jb = 0x0070,   // 8-bit relative branch displacement
+    Jz = 0x0080,   // 32-bit relative branch displacement
+    Gi = 0x0090,   // immediate depends on ModRM.reg (F6/F7 group 3)
+    IMM_MASK = 0x00f0,
+
+    X  = 0x0100,   // invalid in 64-bit mode
+    P  = 0x0200,   // legacy prefix / REX / VEX / EVEX escape, handled by the decoder
+
+    FJ  = 0x1000,  // jump
+    FC  = 0x2000,  // conditional jump
+    FL  = 0x3000,  // call
+    FR  = 0x4000,  // return
+    FG  = 0x5000,  // group 5 (FF): indirect call/jump depending on ModRM.reg
+    FS  = 0x6000,  // enters the kernel and comes back
+    FT  = 0x7000,  // trap
+    FLOW_MASK = 0xf000
+  };
+
+  // One-byte opcode map (Intel SDM Vol. 2, Table A-2)
+  constexpr uint16_t ONE_BYTE_MAP[256] = {
+    //  x0       x1       x2       x3       x4       x5       x6       x7       x8       x9       xA       xB       xC       xD       xE       xF
+    /*0*/ M,     M,       M,       M,       Ib,      Iz,      X,       X,       M,       M,       M,       M,       Ib,      Iz,      X,       P,
+    /*1*/ M,     M,       M,       M,       Ib,      Iz,      X,       X,       M,       M,       M,       M,       Ib,      Iz,      X,       X,
+    /*2*/ M,     M,       M,       M,       Ib,      Iz,      P,       X,       M,       M,       M,       M,       Ib,      Iz,      P,       X,
+    /*3*/ M,     M,       M,       M,       Ib,      Iz,      P,       X,       M,       M,       M,       M,       Ib,      Iz,      P,       X,
+    /*4*/ P,     P,       P,       P,       P,       P,       P,       P,       P,       P,       P,       P,       P,       P,       P,       P,
+    /*5*/ N,     N,       N,       N,       N,       N,       N,       N,       N,       N,       N,       N,       N,       N,       N,       N,
+    /*6*/ X,     X,       P,       M,       P,       P,       P,       P,       Iz,      M|Iz,    Ib,      M|Ib,    N,       N,       N,       N,
+    /*7*/ Jb|FC, Jb|FC,   Jb|FC,   Jb|FC,   Jb|FC,   Jb|FC,   Jb|FC,   Jb|FC,   Jb|FC,   Jb|FC,   Jb|FC,   Jb|FC,   Jb|FC,   Jb|FC,   Jb|FC,   Jb|FC,
+    /*8*/ M|Ib,  M|Iz,    X,       M|Ib,    M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,
+    /*9*/ N,     N,       N,       N,       N,       N,       N,       N,       N,       N,       X,       N,       N,       N,       N,       N,
+    /*A*/ Io,    Io,      Io,      Io,      N,       N,       N,       N,       Ib,      Iz,      N,       N,       N,       N,       N,       N,
+    /*B*/ Ib,    Ib,      Ib,      Ib,      Ib,      Ib,      Ib,      Ib,      Iv,      Iv,      Iv,      Iv,      Iv,      Iv,      Iv,      Iv,
+    /*C*/ M|Ib,  M|Ib,    Iw|FR,   FR,      P,       P,       M|Ib,    M|Iz,    Ie,      N,       Iw|FR,   FR,      FT,      Ib|FS,   X,       FR,
+    /*D*/ M,     M,       M,       M,       X,       X,       X,       N,       M,       M,       M,       M,       M,       M,       M,       M,
+    /*E*/ Jb|FC, Jb|FC,   Jb|FC,   Jb|FC,   Ib,      Ib,      Ib,      Ib,      Jz|FL,   Jz|FJ,   X,       Jb|FJ,   N,       N,       N,       N,
+    /*F*/ P,     FT,      P,       P,       FT,      N,       M|Gi,    M|Gi,    N,       N,       N,       N,       N,       N,       M,       M|FG,
+  };
+
+  // Two-byte opcode map, 0F xx (Intel SDM Vol. 2, Table A-3)
+  constexpr uint16_t TWO_BYTE_MAP[256] = {
+    //  x0       x1       x2       x3       x4       x5       x6       x7       x8       x9       xA       xB       xC       xD       xE       xF
+    /*0*/ M,     M,       M,       M,       X,       FS,      N,       FR,      N,       N,       X,       FT,      X,       M,       N,       M|Ib,
+    /*1*/ M,     M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,
+    /*2*/ M,     M,       M,       M,       X,       X,       X,       X,       M,       M,       M,       M,       M,       M,       M,       M,
+    /*3*/ N,     N,       N,       N,       FS,      FR,      X,       N,       P,       X,       P,       X,       X,       X,       X,       X,
+    /*4*/ M,     M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,
+    /*5*/ M,     M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,
+    /*6*/ M,     M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,
+    /*7*/ M|Ib,  M|Ib,    M|Ib,    M|Ib,    M,       M,       M,       N,       M,       M,       M,       M,       M,       M,       M,       M,
+    /*8*/ Jz|FC, Jz|FC,   Jz|FC,   Jz|FC,   Jz|FC,   Jz|FC,   Jz|FC,   Jz|FC,   Jz|FC,   Jz|FC,   Jz|FC,   Jz|FC,   Jz|FC,   Jz|FC,   Jz|FC,   Jz|FC,
+    /*9*/ M,     M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,
+    /*A*/ N,     N,       N,       M,       M|Ib,    M,       X,       X,       N,       N,       N,       M,       M|Ib,    M,       M,       M,
+    /*B*/ M,     M,       M,       M,       M,       M,       M,       M,       M,       FT|M,    M|Ib,    M,       M,       M,       M,       M,
+    /*C*/ M,     M,       M|Ib,    M,       M|Ib,    M|Ib,    M|Ib,    M,       N,       N,       N,       N,       N,       N,       N,       N,
+    /*D*/ M,     M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,
+    /*E*/ M,     M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,
+    /*F*/ M,     M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       M,       FT|M,
+  };
+
+  // Mnemonics and operand templates, in the notation of the SDM opcode maps:
+  //  E  ModRM.rm: general register or memory      G  ModRM.reg: general register
+  //  M  ModRM.rm: memory                          R  ModRM.rm: general register
+  //  S  ModRM.reg: segment register               C, D  ModRM.reg: control/debug register
+  //  V  ModRM.reg: vector register                W  ModRM.rm: vector register or memory
+  //  U  ModRM.rm: vector register                 H  VEX.vvvv: vector register (VEX/EVEX only)
+  //  B  VEX.vvvv: general register (VEX only)     P, Q, N  as V, W, U for MMX registers
+  //  Z  general register in the opcode's low bits I  immediate, J  branch target, O  absolute address (moffs)
+  //  T  st(ModRM.rm)
+  // followed by the size: b byte, w word, d dword, q qword, t tbyte, o 16 bytes, x vector (VEX.L),
+  // v operand size (16/32/64), z 16/32, y 32/64 (REX.W).
+  // Fixed operands: AL, AX, CL, DX, rAX, eAX, FS, GS, ST, 1; sIb is an imm8 sign-extended to the operand size.
+  //
+  // "mnemonic operands": the mnemonic may list "16|32|64" forms by operand size.
+  // Forms selected by a mandatory prefix follow ';' as "66:", "F3:", "F2:" ...
+  // "@n" takes the mnemonic (and the operands, if the group lists them) from group n by ModRM.reg.
+  // A leading '~' marks MMX instructions which work on XMM registers with a 66 prefix,
+  // '!' a VEX instruction whose mnemonic doesn't get the 'v'.
+  const char* const ONE_BYTE_TEMPLATES[256] = {
+    /*00*/ "add Eb,Gb", "add Ev,Gv", "add Gb,Eb", "add Gv,Ev", "add AL,Ib", "add rAX,Iz", nullptr, nullptr,
+    /*08*/ "or Eb,Gb", "or Ev,Gv", "or Gb,Eb", "or Gv,Ev", "or AL,Ib", "or rAX,Iz", nullptr, nullptr,
+    /*10*/ "adc Eb,Gb", "adc Ev,Gv", "adc Gb,Eb", "adc Gv,Ev", "adc AL,Ib", "adc rAX,Iz", nullptr, nullptr,
+    /*18*/ "sbb Eb,Gb", "sbb Ev,Gv", "sbb Gb,Eb", "sbb Gv,Ev", "sbb AL,Ib", "sbb rAX,Iz", nullptr, nullptr,
+    /*20*/ "and Eb,Gb", "and Ev,Gv", "and Gb,Eb", "and Gv,Ev", "and AL,Ib", "and rAX,Iz", nullptr, nullptr,
+    /*28*/ "sub Eb,Gb", "sub Ev,Gv", "sub Gb,Eb", "sub Gv,Ev", "sub AL,Ib", "sub rAX,Iz", nullptr, nullptr,
+    /*30*/ "xor Eb,Gb", "xor Ev,Gv", "xor Gb,Eb", "xor Gv,Ev", "xor AL,Ib", "xor rAX,Iz", nullptr, nullptr,
+    /*38*/ "cmp Eb,Gb", "cmp Ev,Gv", "cmp Gb,Eb", "cmp Gv,Ev", "cmp AL,Ib", "cmp rAX,Iz", nullptr, nullptr,
+    /*40*/ nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+    /*48*/ nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+    /*50*/ "push Zq", "push Zq", "push Zq", "push Zq", "push Zq", "push Zq", "push Zq", "push Zq",
+    /*58*/ "pop Zq", "pop Zq", "pop Zq", "pop Zq", "pop Zq", "pop Zq", "pop Zq", "pop Zq",
+    /*60*/ nullptr, nullptr, nullptr, "movsxd Gv,Ed", nullptr, nullptr, nullptr, nullptr,
+    /*68*/ "push Iz", "imul Gv,Ev,Iz", "push sIb", "imul Gv,Ev,sIb", "insb", "insw|insd|insd", "outsb", "outsw|outsd|outsd",
+    /*70*/ "jo Jb", "jno Jb", "jb Jb", "jae Jb", "je Jb", "jne Jb", "jbe Jb", "ja Jb",
+    /*78*/ "js Jb", "jns Jb", "jp Jb", "jnp Jb", "jl Jb", "jge Jb", "jle Jb", "jg Jb",
+    /*80*/ "@1 Eb,Ib", "@1 Ev,Iz", nullptr, "@1 Ev,sIb", "test Eb,Gb", "test Ev,Gv", "xchg Eb,Gb", "xchg Ev,Gv",
+    /*88*/ "mov Eb,Gb", "mov Ev,Gv", "mov Gb,Eb", "mov Gv,Ev", "mov Ev,Sw", "lea Gv,M", "mov Sw,Ew", "@7",
+    /*90*/ "nop;F3:pause", "xchg Zv,rAX", "xchg Zv,rAX", "xchg Zv,rAX", "xchg Zv,rAX", "xchg Zv,rAX", "xchg Zv,rAX", "xchg Zv,rAX",
+    /*98*/ "cbw|cwde|cdqe", "cwd|cdq|cqo", nullptr, "fwait", "pushfw|pushfq|pushfq", "popfw|popfq|popfq", "sahf", "lahf",
+    /*A0*/ "mov AL,Ob", "mov rAX,Ov", "mov Ob,AL", "mov Ov,rAX", "movsb", "movsw|movsd|movsq", "cmpsb", "cmpsw|cmpsd|cmpsq",
+    /*A8*/ "test AL,Ib", "test rAX,Iz", "stosb", "stosw|stosd|stosq", "lodsb", "lodsw|lodsd|lodsq", "scasb", "scasw|scasd|scasq",
+    /*B0*/ "mov Zb,Ib", "mov Zb,Ib", "mov Zb,Ib", "mov Zb,Ib", "mov Zb,Ib", "mov Zb,Ib", "mov Zb,Ib", "mov Zb,Ib",
+    /*B8*/ "mov Zv,Iv", "mov Zv,Iv", "mov Zv,Iv", "mov Zv,Iv", "mov Zv,Iv", "mov Zv,Iv", "mov Zv,Iv", "mov Zv,Iv",
+    /*C0*/ "@2 Eb,Ib", "@2 Ev,Ib", "ret Iw", "ret", nullptr, nullptr, "@8", "@9",
+    /*C8*/ "enter Iw,Ib", "leave", "retf Iw", "retf", "int3", "int Ib", nullptr, "iretw|iretd|iretq",
+    /*D0*/ "@2 Eb,1", "@2 Ev,1", "@2 Eb,CL", "@2 Ev,CL", nullptr, nullptr, nullptr, "xlatb",
+    /*D8*/ nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,   // x87, see X87_MEMORY_TEMPLATES
+    /*E0*/ "loopne Jb", "loope Jb", "loop Jb", "jrcxz Jb", "in AL,Ib", "in eAX,Ib", "out Ib,AL", "out Ib,eAX",
+    /*E8*/ "call Jz", "jmp Jz", nullptr, "jmp Jb", "in AL,DX", "in eAX,DX", "out DX,AL", "out DX,eAX",
+    /*F0*/ nullptr, "int1", nullptr, nullptr, "hlt", "cmc", "@3", "@4",
+    /*F8*/ "clc", "stc", "cli", "sti", "cld", "std", "@5", "@6",
+  };
+
+  const char* const TWO_BYTE_TEMPLATES[256] = {
+    /*00*/ "@10", "@11", "lar Gv,Ew", "lsl Gv,Ew", nullptr, "syscall", "clts", "sysretd|sysretd|sysretq",
+    /*08*/ "invd", "wbinvd", nullptr, "ud2", nullptr, "@19", "femms", nullptr,
+    /*10*/ "movups Vx,Wx;66:movupd Vx,Wx;F3:movss Vx,Wd;F2:movsd Vx,Wq",
+    /*11*/ "movups Wx,Vx;66:movupd Wx,Vx;F3:movss Wd,Vx;F2:movsd Wq,Vx",
+    /*12*/ "movlps Vx,Hx,Mq;66:movlpd Vx,Hx,Mq;F3:movsldup Vx,Wx;F2:movddup Vx,Wq",
+    /*13*/ "movlps Mq,Vx;66:movlpd Mq,Vx",
+    /*14*/ "unpcklps Vx,Hx,Wx;66:unpcklpd Vx,Hx,Wx",
+    /*15*/ "unpckhps Vx,Hx,Wx;66:unpckhpd Vx,Hx,Wx",
+    /*16*/ "movhps Vx,Hx,Mq;66:movhpd Vx,Hx,Mq;F3:movshdup Vx,Wx",
+    /*17*/ "movhps Mq,Vx;66:movhpd Mq,Vx",
+    /*18*/ "@18", "nop Ev", "nop Ev", "nop Ev", "nop Ev", "nop Ev", "nop Ev", "nop Ev",
+    /*20*/ "mov Rq,Cq", "mov Rq,Dq", "mov Cq,Rq", "mov Dq,Rq", nullptr, nullptr, nullptr, nullptr,
+    /*28*/ "movaps Vx,Wx;66:movapd Vx,Wx",
+    /*29*/ "movaps Wx,Vx;66:movapd Wx,Vx",
+    /*2A*/ "cvtpi2ps Vx,Q;66:cvtpi2pd Vx,Q;F3:cvtsi2ss Vx,Hx,Ey;F2:cvtsi2sd Vx,Hx,Ey",
+    /*2B*/ "movntps Mx,Vx;66:movntpd Mx,Vx",
+    /*2C*/ "cvttps2pi P,Wq;66:cvttpd2pi P,Wx;F3:cvttss2si Gy,Wd;F2:cvttsd2si Gy,Wq",
+    /*2D*/ "cvtps2pi P,Wq;66:cvtpd2pi P,Wx;F3:cvtss2si Gy,Wd;F2:cvtsd2si Gy,Wq",
+    /*2E*/ "ucomiss Vx,Wd;66:ucomisd Vx,Wq",
+    /*2F*/ "comiss Vx,Wd;66:comisd Vx,Wq",
+    /*30*/ "wrmsr", "rdtsc", "rdmsr", "rdpmc", "sysenter", "sysexit", nullptr, "getsec",
+    /*38*/ nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+    /*40*/ "cmovo Gv,Ev", "cmovno Gv,Ev", "cmovb Gv,Ev", "cmovae Gv,Ev", "cmove Gv,Ev", "cmovne Gv,Ev", "cmovbe Gv,Ev", "cmova Gv,Ev",
+    /*48*/ "cmovs Gv,Ev", "cmovns Gv,Ev", "cmovp Gv,Ev", "cmovnp Gv,Ev", "cmovl Gv,Ev", "cmovge Gv,Ev", "cmovle Gv,Ev", "cmovg Gv,Ev",
+    /*50*/ "movmskps Gd,Ux;66:movmskpd Gd,Ux",
+    /*51*/ "sqrtps Vx,Wx;66:sqrtpd Vx,Wx;F3:sqrtss Vx,Hx,Wd;F2:sqrtsd Vx,Hx,Wq",
+    /*52*/ "rsqrtps Vx,Wx;F3:rsqrtss Vx,Hx,Wd",
+    /*53*/ "rcpps Vx,Wx;F3:rcpss Vx,Hx,Wd",
+    /*54*/ "andps Vx,Hx,Wx;66:andpd Vx,Hx,Wx",
+    /*55*/ "andnps Vx,Hx,Wx;66:andnpd Vx,Hx,Wx",
+    /*56*/ "orps Vx,Hx,Wx;66:orpd Vx,Hx,Wx",
+    /*57*/ "xorps Vx,Hx,Wx;66:xorpd Vx,Hx,Wx",
+    /*58*/ "addps Vx,Hx,Wx;66:addpd Vx,Hx,Wx;F3:addss Vx,Hx,Wd;F2:addsd Vx,Hx,Wq",
+    /*59*/ "mulps Vx,Hx,Wx;66:mulpd Vx,Hx,Wx;F3:mulss Vx,Hx,Wd;F2:mulsd Vx,Hx,Wq",
+    /*5A*/ "cvtps2pd Vx,Wq;66:cvtpd2ps Vx,Wx;F3:cvtss2sd Vx,Hx,Wd;F2:cvtsd2ss Vx,Hx,Wq",
+    /*5B*/ "cvtdq2ps Vx,Wx;66:cvtps2dq Vx,Wx;F3:cvttps2dq Vx,Wx",
+    /*5C*/ "subps Vx,Hx,Wx;66:subpd Vx,Hx,Wx;F3:subss Vx,Hx,Wd;F2:subsd Vx,Hx,Wq",
+    /*5D*/ "minps Vx,Hx,Wx;66:minpd Vx,Hx,Wx;F3:minss Vx,Hx,Wd;F2:minsd Vx,Hx,Wq",
+    /*5E*/ "divps Vx,Hx,Wx;66:divpd Vx,Hx,Wx;F3:divss Vx,Hx,Wd;F2:divsd Vx,Hx,Wq",
+    /*5F*/ "maxps Vx,Hx,Wx;66:maxpd Vx,Hx,Wx;F3:maxss Vx,Hx,Wd;F2:maxsd Vx,Hx,Wq",
+    /*60*/ "~punpcklbw P,H,Q", "~punpcklwd P,H,Q", "~punpckldq P,H,Q", "~packsswb P,H,Q",
+    /*64*/ "~pcmpgtb P,H,Q", "~pcmpgtw P,H,Q", "~pcmpgtd P,H,Q", "~packuswb P,H,Q",
+    /*68*/ "~punpckhbw P,H,Q", "~punpckhwd P,H,Q", "~punpckhdq P,H,Q", "~packssdw P,H,Q",
+    /*6C*/ "66:punpcklqdq Vx,Hx,Wx", "66:punpckhqdq Vx,Hx,Wx", "~movd|movd|movq P,Ey", "movq P,Q;66:movdqa Vx,Wx;F3:movdqu Vx,Wx",
+    /*70*/ "pshufw P,Q,Ib;66:pshufd Vx,Wx,Ib;F3:pshufhw Vx,Wx,Ib;F2:pshuflw Vx,Wx,Ib", "@14", "@15", "@16",
+    /*74*/ "~pcmpeqb P,H,Q", "~pcmpeqw P,H,Q", "~pcmpeqd P,H,Q", "emms",
+    /*78*/ nullptr, nullptr, nullptr, nullptr,
+    /*7C*/ "66:haddpd Vx,Hx,Wx;F2:haddps Vx,Hx,Wx", "66:hsubpd Vx,Hx,Wx;F2:hsubps Vx,Hx,Wx",
+    /*7E*/ "~movd|movd|movq Ey,P;F3:movq Vx,Wq", "movq Q,P;66:movdqa Wx,Vx;F3:movdqu Wx,Vx",
+    /*80*/ "jo Jz", "jno Jz", "jb Jz", "jae Jz", "je Jz", "jne Jz", "jbe Jz", "ja Jz",
+    /*88*/ "js Jz", "jns Jz", "jp Jz", "jnp Jz", "jl Jz", "jge Jz", "jle Jz", "jg Jz",
+    /*90*/ "seto Eb", "setno Eb", "setb Eb", "setae Eb", "sete Eb", "setne Eb", "setbe Eb", "seta Eb",
+    /*98*/ "sets Eb", "setns Eb", "setp Eb", "setnp Eb", "setl Eb", "setge Eb", "setle Eb", "setg Eb",
+    /*A0*/ "push FS", "pop FS", "cpuid", "bt Ev,Gv", "shld Ev,Gv,Ib", "shld Ev,Gv,CL", nullptr, nullptr,
+    /*A8*/ "push GS", "pop GS", "rsm", "bts Ev,Gv", "shrd Ev,Gv,Ib", "shrd Ev,Gv,CL", "@17", "imul Gv,Ev",
+    /*B0*/ "cmpxchg Eb,Gb", "cmpxchg Ev,Gv", "lss Gv,M", "btr Ev,Gv", "lfs Gv,M", "lgs Gv,M", "movzx Gv,Eb", "movzx Gv,Ew",
+    /*B8*/ "F3:popcnt Gv,Ev", "ud1 Gv,Ev", "@12 Ev,Ib", "btc Ev,Gv",
+    /*BC*/ "bsf Gv,Ev;F3:tzcnt Gv,Ev", "bsr Gv,Ev;F3:lzcnt Gv,Ev", "movsx Gv,Eb", "movsx Gv,Ew",
+    /*C0*/ "xadd Eb,Gb", "xadd Ev,Gv",
+    /*C2*/ "cmpps Vx,Hx,Wx,Ib;66:cmppd Vx,Hx,Wx,Ib;F3:cmpss Vx,Hx,Wd,Ib;F2:cmpsd Vx,Hx,Wq,Ib",
+    /*C3*/ "movnti My,Gy", "~pinsrw P,H,Ed,Ib", "~pextrw Gd,N,Ib", "shufps Vx,Hx,Wx,Ib;66:shufpd Vx,Hx,Wx,Ib", "@13",
+    /*C8*/ "bswap Zy", "bswap Zy", "bswap Zy", "bswap Zy", "bswap Zy", "bswap Zy", "bswap Zy", "bswap Zy",
+    /*D0*/ "66:addsubpd Vx,Hx,Wx;F2:addsubps Vx,Hx,Wx", "~psrlw P,H,Q", "~psrld P,H,Q", "~psrlq P,H,Q",
+    /*D4*/ "~paddq P,H,Q", "~pmullw P,H,Q", "66:movq Wq,Vx", "~pmovmskb Gd,N",
+    /*D8*/ "~psubusb P,H,Q", "~psubusw P,H,Q", "~pminub P,H,Q", "~pand P,H,Q",
+    /*DC*/ "~paddusb P,H,Q", "~paddusw P,H,Q", "~pmaxub P,H,Q", "~pandn P,H,Q",
+    /*E0*/ "~pavgb P,H,Q", "~psraw P,H,Q", "~psrad P,H,Q", "~pavgw P,H,Q",
+    /*E4*/ "~pmulhuw P,H,Q", "~pmulhw P,H,Q", "66:cvttpd2dq Vx,Wx;F3:cvtdq2pd Vx,Wq;F2:cvtpd2dq Vx,Wx", "movntq Mq,P;66:movntdq Mx,Vx",
+    /*E8*/ "~psubsb P,H,Q", "~psubsw P,H,Q", "~pminsw P,H,Q", "~por P,H,Q",
+    /*EC*/ "~paddsb P,H,Q", "~paddsw P,H,Q", "~pmaxsw P,H,Q", "~pxor P,H,Q",
+    /*F0*/ "F2:lddqu Vx,Mx", "~psllw P,H,Q", "~pslld P,H,Q", "~psllq P,H,Q",
+    /*F4*/ "~pmuludq P,H,Q", "~pmaddwd P,H,Q", "~psadbw P,H,Q", "~maskmovq P,N",
+    /*F8*/ "~psubb P,H,Q", "~psubw P,H,Q", "~psubd P,H,Q", "~psubq P,H,Q",
+    /*FC*/ "~paddb P,H,Q", "~paddw P,H,Q", "~paddd P,H,Q", "ud0 Gv,Ev",
+  };
+
+  // 0F 38 xx and 0F 3A xx, the commonly emitted part (SSSE3 and later, AVX2, FMA, BMI)
+  struct MapEntry {
+    uint8_t opcode;
+    const char* text;
+  };
+
+  const MapEntry THREE_BYTE_38_TEMPLATES[] = {
+    {0x00, "~pshufb P,H,Q"}, {0x01, "~phaddw P,H,Q"}, {0x02, "~phaddd P,H,Q"}, {0x03, "~phaddsw P,H,Q"},
+    {0x04, "~pmaddubsw P,H,Q"}, {0x05, "~phsubw P,H,Q"}, {0x06, "~phsubd P,H,Q"}, {0x07, "~phsubsw P,H,Q"},
+    {0x08, "~psignb P,H,Q"}, {0x09, "~psignw P,H,Q"}, {0x0a, "~psignd P,H,Q"}, {0x0b, "~pmulhrsw P,H,Q"},
+    {0x0c, "66:permilps Vx,Hx,Wx"}, {0x0d, "66:permilpd Vx,Hx,Wx"}, {0x0e, "66:testps Vx,Wx"}, {0x0f, "66:testpd Vx,Wx"},
+    {0x10, "66:pblendvb Vx,Wx"}, {0x14, "66:blendvps Vx,Wx"}, {0x15, "66:blendvpd Vx,Wx"},
+    {0x16, "66:permps Vx,Hx,Wx"}, {0x17, "66:ptest Vx,Wx"},
+    {0x18, "66:broadcastss Vx,Wd"}, {0x19, "66:broadcastsd Vx,Wq"}, {0x1a, "66:broadcastf128 Vx,Mo"},
+    {0x1c, "~pabsb P,Q"}, {0x1d, "~pabsw P,Q"}, {0x1e, "~pabsd P,Q"},
+    {0x20, "66:pmovsxbw Vx,Wq"}, {0x21, "66:pmovsxbd Vx,Wd"}, {0x22, "66:pmovsxbq Vx,Ww"},
+    {0x23, "66:pmovsxwd Vx,Wq"}, {0x24, "66:pmovsxwq Vx,Wd"}, {0x25, "66:pmovsxdq Vx,Wq"},
+    {0x28, "66:pmuldq Vx,Hx,Wx"}, {0x29, "66:pcmpeqq Vx,Hx,Wx"}, {0x2a, "66:movntdqa Vx,Mx"}, {0x2b, "66:packusdw Vx,Hx,Wx"},
+    {0x2c, "66:maskmovps Vx,Hx,Mx"}, {0x2d, "66:maskmovpd Vx,Hx,Mx"}, {0x2e, "66:maskmovps Mx,Hx,Vx"}, {0x2f, "66:maskmovpd Mx,Hx,Vx"},
+    {0x30, "66:pmovzxbw Vx,Wq"}, {0x31, "66:pmovzxbd Vx,Wd"}, {0x32, "66:pmovzxbq Vx,Ww"},
+    {0x33, "66:pmovzxwd Vx,Wq"}, {0x34, "66:pmovzxwq Vx,Wd"}, {0x35, "66:pmovzxdq Vx,Wq"},
+    {0x36, "66:permd Vx,Hx,Wx"}, {0x37, "66:pcmpgtq Vx,Hx,Wx"},
+    {0x38, "66:pminsb Vx,Hx,Wx"}, {0x39, "66:pminsd Vx,Hx,Wx"}, {0x3a, "66:pminuw Vx,Hx,Wx"}, {0x3b, "66:pminud Vx,Hx,Wx"},
+    {0x3c, "66:pmaxsb Vx,Hx,Wx"}, {0x3d, "66:pmaxsd Vx,Hx,Wx"}, {0x3e, "66:pmaxuw Vx,Hx,Wx"}, {0x3f, "66:pmaxud Vx,Hx,Wx"},
+    {0x40, "66:pmulld Vx,Hx,Wx"}, {0x41, "66:phminposuw Vx,Wx"},
+    {0x45, "66:psrlvd|psrlvd|psrlvq Vx,Hx,Wx"}, {0x46, "66:psravd Vx,Hx,Wx"}, {0x47, "66:psllvd|psllvd|psllvq Vx,Hx,Wx"},
+    {0x58, "66:pbroadcastd Vx,Wd"}, {0x59, "66:pbroadcastq Vx,Wq"}, {0x5a, "66:broadcasti128 Vx,Mo"},
+    {0x78, "66:pbroadcastb Vx,Wb"}, {0x79, "66:pbroadcastw Vx,Ww"},
+    {0x8c, "66:pmaskmovd|pmaskmovd|pmaskmovq Vx,Hx,Mx"}, {0x8e, "66:pmaskmovd|pmaskmovd|pmaskmovq Mx,Hx,Vx"},
+    {0x96, "66:fmaddsub132ps|fmaddsub132ps|fmaddsub132pd Vx,Hx,Wx"}, {0x97, "66:fmsubadd132ps|fmsubadd132ps|fmsubadd132pd Vx,Hx,Wx"},
+    {0x98, "66:fmadd132ps|fmadd132ps|fmadd132pd Vx,Hx,Wx"}, {0x99, "66:fmadd132ss|fmadd132ss|fmadd132sd Vx,Hx,Wx"},
+    {0x9a, "66:fmsub132ps|fmsub132ps|fmsub132pd Vx,Hx,Wx"}, {0x9b, "66:fmsub132ss|fmsub132ss|fmsub132sd Vx,Hx,Wx"},
+    {0x9c, "66:fnmadd132ps|fnmadd132ps|fnmadd132pd Vx,Hx,Wx"}, {0x9d, "66:fnmadd132ss|fnmadd132ss|fnmadd132sd Vx,Hx,Wx"},
+    {0x9e, "66:fnmsub132ps|fnmsub132ps|fnmsub132pd Vx,Hx,Wx"}, {0x9f, "66:fnmsub132ss|fnmsub132ss|fnmsub132sd Vx,Hx,Wx"},
+    {0xa6, "66:fmaddsub213ps|fmaddsub213ps|fmaddsub213pd Vx,Hx,Wx"}, {0xa7, "66:fmsubadd213ps|fmsubadd213ps|fmsubadd213pd Vx,Hx,Wx"},
+    {0xa8, "66:fmadd213ps|fmadd213ps|fmadd213pd Vx,Hx,Wx"}, {0xa9, "66:fmadd213ss|fmadd213ss|fmadd213sd Vx,Hx,Wx"},
+    {0xaa, "66:fmsub213ps|fmsub213ps|fmsub213pd Vx,Hx,Wx"}, {0xab, "66:fmsub213ss|fmsub213ss|fmsub213sd Vx,Hx,Wx"},
+    {0xac, "66:fnmadd213ps|fnmadd213ps|fnmadd213pd Vx,Hx,Wx"}, {0xad, "66:fnmadd213ss|fnmadd213ss|fnmadd213sd Vx,Hx,Wx"},
+    {0xae, "66:fnmsub213ps|fnmsub213ps|fnmsub213pd Vx,Hx,Wx"}, {0xaf, "66:fnmsub213ss|fnmsub213ss|fnmsub213sd Vx,Hx,Wx"},
+    {0xb6, "66:fmaddsub231ps|fmaddsub231ps|fmaddsub231pd Vx,Hx,Wx"}, {0xb7, "66:fmsubadd231ps|fmsubadd231ps|fmsubadd231pd Vx,Hx,Wx"},
+    {0xb8, "66:fmadd231ps|fmadd231ps|fmadd231pd Vx,Hx,Wx"}, {0xb9, "66:fmadd231ss|fmadd231ss|fmadd231sd Vx,Hx,Wx"},
+    {0xba, "66:fmsub231ps|fmsub231ps|fmsub231pd Vx,Hx,Wx"}, {0xbb, "66:fmsub231ss|fmsub231ss|fmsub231sd Vx,Hx,Wx"},
+    {0xbc, "66:fnmadd231ps|fnmadd231ps|fnmadd231pd Vx,Hx,Wx"}, {0xbd, "66:fnmadd231ss|fnmadd231ss|fnmadd231sd Vx,Hx,Wx"},
+    {0xbe, "66:fnmsub231ps|fnmsub231ps|fnmsub231pd Vx,Hx,Wx"}, {0xbf, "66:fnmsub231ss|fnmsub231ss|fnmsub231sd Vx,Hx,Wx"},
+    {0xdb, "66:aesimc Vx,Wx"}, {0xdc, "66:aesenc Vx,Hx,Wx"}, {0xdd, "66:aesenclast Vx,Hx,Wx"},
+    {0xde, "66:aesdec Vx,Hx,Wx"}, {0xdf, "66:aesdeclast Vx,Hx,Wx"},
+    {0xf0, "movbe Gv,Mv;F2:crc32 Gd,Eb"}, {0xf1, "movbe Mv,Gv;F2:crc32 Gd,Ev"},
+    {0xf2, "!andn Gy,By,Ey"}, {0xf3, "@20"},
+    {0xf5, "!bzhi Gy,Ey,By;F3:!pext Gy,By,Ey;F2:!pdep Gy,By,Ey"},
+    {0xf6, "66:adcx Gy,Ey;F3:adox Gy,Ey;F2:!mulx Gy,By,Ey"},
+    {0xf7, "!bextr Gy,Ey,By;66:!shlx Gy,Ey,By;F3:!sarx Gy,Ey,By;F2:!shrx Gy,Ey,By"},
+  };
+
+  const MapEntry THREE_BYTE_3A_TEMPLATES[] = {
+    {0x00, "66:permq Vx,Wx,Ib"}, {0x01, "66:permpd Vx,Wx,Ib"}, {0x02, "66:pblendd Vx,Hx,Wx,Ib"},
+    {0x04, "66:permilps Vx,Wx,Ib"}, {0x05, "66:permilpd Vx,Wx,Ib"}, {0x06, "66:perm2f128 Vx,Hx,Wx,Ib"},
+    {0x08, "66:roundps Vx,Wx,Ib"}, {0x09, "66:roundpd Vx,Wx,Ib"}, {0x0a, "66:roundss Vx,Hx,Wd,Ib"}, {0x0b, "66:roundsd Vx,Hx,Wq,Ib"},
+    {0x0c, "66:blendps Vx,Hx,Wx,Ib"}, {0x0d, "66:blendpd Vx,Hx,Wx,Ib"}, {0x0e, "66:pblendw Vx,Hx,Wx,Ib"}, {0x0f, "~palignr P,H,Q,Ib"},
+    {0x14, "66:pextrb Ed,Vo,Ib"}, {0x15, "66:pextrw Ed,Vo,Ib"}, {0x16, "66:pextrd|pextrd|pextrq Ey,Vo,Ib"}, {0x17, "66:extractps Ed,Vo,Ib"},
+    {0x18, "66:insertf128 Vx,Hx,Wo,Ib"}, {0x19, "66:extractf128 Wo,Vx,Ib"},
+    {0x20, "66:pinsrb Vo,Ho,Ed,Ib"}, {0x21, "66:insertps Vo,Ho,Wd,Ib"}, {0x22, "66:pinsrd|pinsrd|pinsrq Vo,Ho,Ey,Ib"},
+    {0x38, "66:inserti128 Vx,Hx,Wo,Ib"}, {0x39, "66:extracti128 Wo,Vx,Ib"},
+    {0x40, "66:dpps Vx,Hx,Wx,Ib"}, {0x41, "66:dppd Vx,Hx,Wx,Ib"}, {0x42, "66:mpsadbw Vx,Hx,Wx,Ib"},
+    {0x44, "66:pclmulqdq Vx,Hx,Wx,Ib"}, {0x46, "66:perm2i128 Vx,Hx,Wx,Ib"},
+    {0x4a, "66:blendvps Vx,Hx,Wx,Ib"}, {0x4b, "66:blendvpd Vx,Hx,Wx,Ib"}, {0x4c, "66:pblendvb Vx,Hx,Wx,Ib"},
+    {0x60, "66:pcmpestrm Vx,Wx,Ib"}, {0x61, "66:pcmpestri Vx,Wx,Ib"}, {0x62, "66:pcmpistrm Vx,Wx,Ib"}, {0x63, "66:pcmpistri Vx,Wx,Ib"},
+    {0xdf, "66:aeskeygenassist Vx,Wx,Ib"},
+    {0xf0, "F2:!rorx Gy,Ey,Ib"},
+  };
+
+  // Opcode extensions by ModRM.reg (SDM Table A-6), indexed by the number after '@'
+  const char* const GROUP_TEMPLATES[][8] = {
+    /*0*/  {},
+    /*1*/  {"add", "or", "adc", "sbb", "and", "sub", "xor", "cmp"},
+    /*2*/  {"rol", "ror", "rcl", "rcr", "shl", "shr", "sal", "sar"},
+    /*3*/  {"test Eb,Ib", "test Eb,Ib", "not Eb", "neg Eb", "mul Eb", "imul Eb", "div Eb", "idiv Eb"},
+    /*4*/  {"test Ev,Iz", "test Ev,Iz", "not Ev", "neg Ev", "mul Ev", "imul Ev", "div Ev", "idiv Ev"},
+    /*5*/  {"inc Eb", "dec Eb"},
+    /*6*/  {"inc Ev", "dec Ev", "call Eq", "callf M", "jmp Eq", "jmpf M", "push Eq"},
+    /*7*/  {"pop Eq"},
+    /*8*/  {"mov Eb,Ib", nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, "xabort Ib"},
+    /*9*/  {"mov Ev,Iz", nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, "xbegin Jz"},
+    /*10*/ {"sldt Ew", "str Ew", "lldt Ew", "ltr Ew", "verr Ew", "verw Ew"},
+    /*11*/ {"sgdt M", "sidt M", "lgdt M", "lidt M", "smsw Ew", nullptr, "lmsw Ew", "invlpg Mb"},
+    /*12*/ {nullptr, nullptr, nullptr, nullptr, "bt", "bts", "btr", "btc"},
+    /*13*/ {nullptr, "cmpxchg8b|cmpxchg8b|cmpxchg16b Mq", nullptr, nullptr, nullptr, nullptr, "rdrand Rv", "rdseed Rv"},
+    /*14*/ {nullptr, nullptr, "~psrlw H,N,Ib", nullptr, "~psraw H,N,Ib", nullptr, "~psllw H,N,Ib"},
+    /*15*/ {nullptr, nullptr, "~psrld H,N,Ib", nullptr, "~psrad H,N,Ib", nullptr, "~pslld H,N,Ib"},
+    /*16*/ {nullptr, nullptr, "~psrlq H,N,Ib", "66:psrldq Hx,Ux,Ib", nullptr, nullptr, "~psllq H,N,Ib", "66:pslldq Hx,Ux,Ib"},
+    /*17*/ {"fxsave M", "fxrstor M", "ldmxcsr Md", "stmxcsr Md", "xsave M", "xrstor M", "xsaveopt M", "clflush Mb"},
+    /*18*/ {"prefetchnta Mb", "prefetcht0 Mb", "prefetcht1 Mb", "prefetcht2 Mb", "nop Ev", "nop Ev", "nop Ev", "nop Ev"},
+    /*19*/ {"prefetch Mb", "prefetchw Mb", "prefetchwt1 Mb", "prefetch Mb", "prefetch Mb", "prefetch Mb", "prefetch Mb", "prefetch Mb"},
+    /*20*/ {nullptr, "!blsr By,Ey", "!blsmsk By,Ey", "!blsi By,Ey"},
+  };
+
+  // x87 escapes D8..DF: memory forms by ModRM.reg, register forms by ModRM.reg with st(ModRM.rm)
+  const char* const X87_MEMORY_TEMPLATES[8][8] = {
+    {"fadd Md", "fmul Md", "fcom Md", "fcomp Md", "fsub Md", "fsubr Md", "fdiv Md", "fdivr Md"},
+    {"fld Md", nullptr, "fst Md", "fstp Md", "fldenv M", "fldcw Mw", "fnstenv M", "fnstcw Mw"},
+    {"fiadd Md", "fimul Md", "ficom Md", "ficomp Md", "fisub Md", "fisubr Md", "fidiv Md", "fidivr Md"},
+    {"fild Md", "fisttp Md", "fist Md", "fistp Md", nullptr, "fld Mt", nullptr, "fstp Mt"},
+    {"fadd Mq", "fmul Mq", "fcom Mq", "fcomp Mq", "fsub Mq", "fsubr Mq", "fdiv Mq", "fdivr Mq"},
+    {"fld Mq", "fisttp Mq", "fst Mq", "fstp Mq", "frstor M", nullptr, "fnsave M", "fnstsw Mw"},
+    {"fiadd Mw", "fimul Mw", "ficom Mw", "ficomp Mw", "fisub Mw", "fisubr Mw", "fidiv Mw", "fidivr Mw"},
+    {"fild Mw", "fisttp Mw", "fist Mw", "fistp Mw", "fbld Mt", "fild Mq", "fbstp Mt", "fistp Mq"},
+  };
+
+  const char* const X87_REGISTER_TEMPLATES[8][8] = {
+    {"fadd ST,T", "fmul ST,T", "fcom ST,T", "fcomp ST,T", "fsub ST,T", "fsubr ST,T", "fdiv ST,T", "fdivr ST,T"},
+    {"fld T", "fxch T"},
+    {"fcmovb ST,T", "fcmove ST,T", "fcmovbe ST,T", "fcmovu ST,T"},
+    {"fcmovnb ST,T", "fcmovne ST,T", "fcmovnbe ST,T", "fcmovnu ST,T", nullptr, "fucomi ST,T", "fcomi ST,T"},
+    {"fadd T,ST", "fmul T,ST", nullptr, nullptr, "fsubr T,ST", "fsub T,ST", "fdivr T,ST", "fdiv T,ST"},
+    {"ffree T", nullptr, "fst T", "fstp T", "fucom T", "fucomp T"},
+    {"faddp T,ST", "fmulp T,ST", nullptr, nullptr, "fsubrp T,ST", "fsubp T,ST", "fdivrp T,ST", "fdivp T,ST"},
+    {nullptr, nullptr, nullptr, nullptr, nullptr, "fucomip ST,T", "fcomip ST,T"},
+  };
+
+  // Whole ModRM bytes which name an instruction of their own
+  struct ModRMEntry {
+    uint8_t map;
+    uint8_t opcode;
+    uint8_t modrm;
+    const char* text;
+  };
+
+  const ModRMEntry MODRM_TEMPLATES[] = {
+    {0, 0xd9, 0xd0, "fnop"}, {0, 0xd9, 0xe0, "fchs"}, {0, 0xd9, 0xe1, "fabs"}, {0, 0xd9, 0xe4, "ftst"},
+    {0, 0xd9, 0xe5, "fxam"}, {0, 0xd9, 0xe8, "fld1"}, {0, 0xd9, 0xe9, "fldl2t"}, {0, 0xd9, 0xea, "fldl2e"},
+    {0, 0xd9, 0xeb, "fldpi"}, {0, 0xd9, 0xec, "fldlg2"}, {0, 0xd9, 0xed, "fldln2"}, {0, 0xd9, 0xee, "fldz"},
+    {0, 0xd9, 0xf0, "f2xm1"}, {0, 0xd9, 0xf1, "fyl2x"}, {0, 0xd9, 0xf2, "fptan"}, {0, 0xd9, 0xf3, "fpatan"},
+    {0, 0xd9, 0xf4, "fxtract"}, {0, 0xd9, 0xf5, "fprem1"}, {0, 0xd9, 0xf6, "fdecstp"}, {0, 0xd9, 0xf7, "fincstp"},
+    {0, 0xd9, 0xf8, "fprem"}, {0, 0xd9, 0xf9, "fyl2xp1"}, {0, 0xd9, 0xfa, "fsqrt"}, {0, 0xd9, 0xfb, "fsincos"},
+    {0, 0xd9, 0xfc, "frndint"}, {0, 0xd9, 0xfd, "fscale"}, {0, 0xd9, 0xfe, "fsin"}, {0, 0xd9, 0xff, "fcos"},
+    {0, 0xda, 0xe9, "fucompp"}, {0, 0xdb, 0xe2, "fnclex"}, {0, 0xdb, 0xe3, "fninit"}, {0, 0xde, 0xd9, "fcompp"},
+    {0, 0xdf, 0xe0, "fnstsw AX"},
+    {1, 0x01, 0xc1, "vmcall"}, {1, 0x01, 0xc2, "vmlaunch"}, {1, 0x01, 0xc3, "vmresume"}, {1, 0x01, 0xc4, "vmxoff"},
+    {1, 0x01, 0xc8, "monitor"}, {1, 0x01, 0xc9, "mwait"}, {1, 0x01, 0xca, "clac"}, {1, 0x01, 0xcb, "stac"},
+    {1, 0x01, 0xd0, "xgetbv"}, {1, 0x01, 0xd1, "xsetbv"}, {1, 0x01, 0xd5, "xend"}, {1, 0x01, 0xd6, "xtest"},
+    {1, 0x01, 0xee, "rdpkru"}, {1, 0x01, 0xef, "wrpkru"}, {1, 0x01, 0xf8, "swapgs"}, {1, 0x01, 0xf9, "rdtscp"},
+  };
+
+  struct OperandTemplate {
+    char kind = 0;
+    char size = 0;
+    bool sign_extend = false;
+  };
+
+  struct Form {
+    bool valid = false;
+    bool mmx = false;                 // '~'
+    uint8_t group = 0;                // '@n'
+    std::string_view mnemonic;        // "16|32|64" forms, or a single one
+    std::string_view vex_mnemonic;
+    uint8_t operand_count = 0;
+    OperandTemplate operands[4];
+  };
+
+  // Forms without a mandatory prefix and with 66, F3, F2
+  struct Template {
+    Form forms[4];
+  };
+
+  // The text tables parsed once into something quick to look up
+  struct Tables {
+    std::deque<std::string> strings;  // storage for the VEX mnemonics, addresses must stay put
+    Template one_byte[256];
+    Template two_byte[256];
+    Template three_byte_38[256];
+    Template three_byte_3a[256];
+    std::vector<std::array<Template, 8>> groups;
+    Template x87_memory[8][8];
+    Template x87_register[8][8];
+    std::vector<std::pair<uint32_t, Template>> modrm;  // (map << 16 | opcode << 8 | modrm)
+    Template movhlps;
+    Template movlhps;
+
+    Tables();
+    std::string_view keep(std::string s) { return strings.emplace_back(std::move(s)); }
+    Form parseForm(std::string_view text);
+    Template parse(const char* text);
+  };
+
+  OperandTemplate parseOperand(std::string_view token) {
+    if (token == "AL") return {'a', 'b'};
+    if (token == "AX") return {'a', 'w'};
+    if (token == "rAX") return {'a', 'v'};
+    if (token == "eAX") return {'a', 'z'};
+    if (token == "CL") return {'c', 'b'};
+    if (token == "DX") return {'d', 'w'};
+    if (token == "FS") return {'s', 4};
+    if (token == "GS") return {'s', 5};
+    if (token == "ST") return {'t', 0};
+    if (token == "1") return {'1', 'b'};
+    if (token == "sIb") return {'I', 'b', true};
+    return {token[0], token.size() > 1 ? token[1] : char(0)};
+  }
+
+  Form Tables::parseForm(std::string_view text) {
+    Form form;
+    form.valid = true;
+    bool keep_name = false;
+    while (!text.empty() && (text[0] == '~' || text[0] == '!')) {
+      (text[0] == '~' ? form.mmx : keep_name) = true;
+      text.remove_prefix(1);
+    }
+
+    const size_t space = text.find(' ');
+    const std::string_view mnemonic = text.substr(0, space);
+    if (mnemonic[0] == '@') {
+      form.group = static_cast<uint8_t>(std::stoi(std::string(mnemonic.substr(1))));
+    } else {
+      form.mnemonic = mnemonic;
+      if (keep_name) {
+        form.vex_mnemonic = mnemonic;
+      } else {
+        std::string vex = "v";
+        for (char c : mnemonic) {
+          vex += c;
+          if (c == '|') {
+            vex += 'v';
+          }
+        }
+        form.vex_mnemonic = keep(std::move(vex));
+      }
+    }
+
+    if (space != std::string_view::npos) {
+      std::string_view operands = text.substr(space + 1);
+      while (!operands.empty() && form.operand_count < 4) {
+        const size_t comma = operands.find(',');
+        form.operands[form.operand_count++] = parseOperand(operands.substr(0, comma));
+        operands = comma == std::string_view::npos ? std::string_view {} : operands.substr(comma + 1);
+      }
+    }
+    return form;
+  }
+
+  Template Tables::parse(const char* text) {
+    Template result;
+    if (!text) {
+      return result;
+    }
+    std::string_view rest = text;
+    while (!rest.empty()) {
+      const size_t end = rest.find(';');
+      std::string_view form = rest.substr(0, end);
+      rest = end == std::string_view::npos ? std::string_view {} : rest.substr(end + 1);
+
+      int slot = 0;
+      if (form.size() > 3 && form[2] == ':') {
+        const std::string_view prefix = form.substr(0, 2);
+        slot = prefix == "66" ? 1 : prefix == "F3" ? 2 : 3;
+        form.remove_prefix(3);
+      }
+      result.forms[slot] = parseForm(form);
+    }
+    return result;
+  }
+
+  Tables::Tables() {
+    for (int i = 0; i < 256; ++i) {
+      one_byte[i] = parse(ONE_BYTE_TEMPLATES[i]);
+      two_byte[i] = parse(TWO_BYTE_TEMPLATES[i]);
+    }
+    for (const MapEntry& entry : THREE_BYTE_38_TEMPLATES) {
+      three_byte_38[entry.opcode] = parse(entry.text);
+    }
+    for (const MapEntry& entry : THREE_BYTE_3A_TEMPLATES) {
+      three_byte_3a[entry.opcode] = parse(entry.text);
+    }
+    for (const auto& group : GROUP_TEMPLATES) {
+      std::array<Template, 8> parsed;
+      for (int reg = 0; reg < 8; ++reg) {
+        parsed[reg] = parse(group[reg]);
+      }
+      groups.push_back(parsed);
+    }
+    for (int escape = 0; escape < 8; ++escape) {
+      for (int reg = 0; reg < 8; ++reg) {
+        x87_memory[escape][reg] = parse(X87_MEMORY_TEMPLATES[escape][reg]);
+        x87_register[escape][reg] = parse(X87_REGISTER_TEMPLATES[escape][reg]);
+      }
+    }
+    for (const ModRMEntry& entry : MODRM_TEMPLATES) {
+      modrm.emplace_back(entry.map << 16 | entry.opcode << 8 | entry.modrm, parse(entry.text));
+    }
+    movhlps = parse("movhlps Vx,Hx,Ux");
+    movlhps = parse("movlhps Vx,Hx,Ux");
+  }
+
+  const Tables& tables() {
+    static const Tables instance;
+    return instance;
+  }
+
+  struct Cursor {
+    const uint8_t* begin;
+    const uint8_t* pos;
+    const uint8_t* end;
+
+    bool has(size_t n) const { return static_cast<size_t>(end - pos) >= n; }
+    uint8_t offset() const { return static_cast<uint8_t>(pos - begin); }
+
+    int64_t readSigned(size_t n) {
+      int64_t value = 0;
+      for (size_t i = 0; i < n; ++i) {
+        value |= static_cast<int64_t>(pos[i]) << (8 * i);
+      }
+      pos += n;
+      // sign-extend
+      const int shift = 64 - 8 * static_cast<int>(n);
+      return (value << shift) >> shift;
+    }
+  };
+
+  // What the length pass learned about the prefixes, needed to name the operands
+  struct Encoding {
+    uint8_t map = 0;            // 0: one-byte, 1: 0F, 2: 0F 38, 3: 0F 3A
+    uint8_t opcode = 0;
+    bool operand_size_16 = false;
+    bool address_size_32 = false;
+    bool rex = false;
+    bool rex_w = false;
+    bool rex_r = false;
+    bool rex_x = false;
+    bool rex_b = false;
+    bool evex_r = false;        // EVEX.R': 5th bit of ModRM.reg for vector registers
+    bool lock = false;
+    bool operand_size_prefix = false;  // 66, mandatory or not
+    uint8_t rep = 0;            // the last of F2/F3
+    uint8_t segment = 0;
+    uint8_t vex = 0;            // 0, 0xc4/0xc5 (VEX) or 0x62 (EVEX)
+    uint8_t vex_prefix = 0;     // prefix implied by VEX.pp
+    uint8_t vector_length = 0;  // 0: xmm, 1: ymm, 2: zmm
+    uint8_t vvvv = 0;
+  };
+
+  // Walk ModRM, SIB and the displacement. ModRM must be available at cur.pos.
+  // 32-bit addressing (67 prefix) uses the same ModRM forms as 64-bit addressing in long mode.
+  bool decodeModRM(Cursor& cur, Instruction& out) {
+    if (!cur.has(1)) {
+      return false;
+    }
+    out.has_modrm = true;
+    out.modrm_offset = cur.offset();
+    const uint8_t modrm = *cur.pos++;
+    const uint8_t mod = modrm >> 6;
+    const uint8_t rm = modrm & 7;
+
+    if (mod == 3) {
+      return true;
+    }
+
+    uint8_t disp_size = (mod == 1) ? 1 : (mod == 2) ? 4 : 0;
+    if (rm == 4) {
+      if (!cur.has(1)) {
+        return false;
+      }
+      const uint8_t sib = *cur.pos++;
+      if (mod == 0 && (sib & 7) == 5) {
+        disp_size = 4;  // no base, disp32
+      }
+    } else if (mod == 0 && rm == 5) {
+      disp_size = 4;    // RIP + disp32
+      out.rip_relative = true;
+    }
+
+    if (disp_size) {
+      if (!cur.has(disp_size)) {
+        return false;
+      }
+      out.disp_offset = cur.offset();
+      out.disp_size = disp_size;
+      cur.pos += disp_size;
+    }
+    return true;
+  }
+
+  bool readImmediate(Cursor& cur, uint8_t size, Instruction& out) {
+    if (!size) {
+      return true;
+    }
+    if (!cur.has(size)) {
+      return false;
+    }
+    out.imm_offset = cur.offset();
+    out.imm_size = size;
+    cur.pos += size;
+    return true;
+  }
+
+  // VEX/EVEX encoded instructions: every opcode has ModRM, the 0F3A map and a few 0F opcodes take an imm8.
+  bool decodeVex(Cursor& cur, uint8_t map, Instruction& out) {
+    if (!cur.has(1)) {
+      return false;
+    }
+    out.opcode_offset = cur.offset();
+    const uint8_t opcode = *cur.pos++;
+    // vzeroupper/vzeroall are the only VEX opcodes without ModRM
+    if (map == 1 && opcode == 0x77) {
+      return true;
+    }
+    if (!decodeModRM(cur, out)) {
+      return false;
+    }
+    bool has_imm8 = map == 3;
+    if (map == 1) {
+      has_imm8 = (opcode >= 0x70 && opcode <= 0x73) || opcode == 0xc2 || (opcode >= 0xc4 && opcode <= 0xc6);
+    }
+    return readImmediate(cur, has_imm8 ? 1 : 0, out);
+  }
+
+  // Second pass: fill in the mnemonic and the operands from the bytes found by the length pass
+  class OperandDecoder {
+    const uint8_t* m_code;
+    Encoding m_enc;
+    Instruction& m_out;
+    uint8_t m_imm_offset;     // next immediate byte to consume
+    bool m_xmm = false;       // MMX template used with XMM registers
+
+  public:
+    OperandDecoder(const uint8_t* code, const Encoding& enc, Instruction& out)
+        : m_code(code), m_enc(enc), m_out(out), m_imm_offset(out.imm_offset) {}
+
+    void decode();
+
+  private:
+    uint8_t modrm() const { return m_out.has_modrm ? m_code[m_out.modrm_offset] : 0; }
+    uint8_t mod() const { return modrm() >> 6; }
+    uint8_t modrmReg() const { return (modrm() >> 3) & 7; }
+    uint8_t modrmRm() const { return modrm() & 7; }
+
+    const Form* select(const Template& t);
+    uint8_t size(char size) const;
+    Operand gpr(uint8_t reg, uint8_t size) const;
+    Operand vector(uint8_t reg, uint8_t size) const;
+    Operand memory(uint8_t size) const;
+    int64_t immediate(uint8_t size);
+    bool operand(const OperandTemplate& t, Operand& op);
+  };
+
+  // Pick the form for the mandatory prefix. A prefix the template doesn't know about keeps its usual meaning.
+  const Form* OperandDecoder::select(const Template& t) {
+    const uint8_t prefix = m_enc.vex ? m_enc.vex_prefix : m_enc.rep ? m_enc.rep : m_enc.operand_size_prefix ? 0x66 : 0;
+    const int slot = prefix == 0x66 ? 1 : prefix == 0xf3 ? 2 : prefix == 0xf2 ? 3 : 0;
+    if (slot && t.forms[slot].valid) {
+      if (prefix == 0x66) {
+        m_enc.operand_size_16 = false;
+      } else {
+        m_enc.rep = 0;
+      }
+      return &t.forms[slot];
+    }
+    if (!m_enc.vex && m_enc.rep && m_enc.operand_size_prefix && t.forms[1].valid) {
+      m_enc.operand_size_16 = false;   // 66 F3 0F xx: F3 is a rep prefix, 66 selects the form
+      return &t.forms[1];
+    }
+    return t.forms[0].valid ? &t.forms[0] : nullptr;
+  }
+
+  uint8_t OperandDecoder::size(char size) const {
+    switch (size) {
+      case 'b': return 1;
+      case 'w': return 2;
+      case 'd': return 4;
+      case 'q': return 8;
+      case 't': return 10;
+      case 'o': return 16;
+      case 'x': return static_cast<uint8_t>(16 << m_enc.vector_length);
+      case 'v': return m_enc.rex_w ? 8 : m_enc.operand_size_16 ? 2 : 4;
+      case 'z': return m_enc.operand_size_16 ? 2 : 4;
+      case 'y': return m_enc.rex_w ? 8 : 4;
+      default: return 0;
+    }
+  }
+
+  Operand OperandDecoder::gpr(uint8_t reg, uint8_t size) const {
+    Operand op;
+    op.type = OperandType::reg;
+    op.size = size;
+    op.reg = reg;
+    op.reg_class = (size == 1 && !m_enc.rex && !m_enc.vex && reg >= 4 && reg < 8) ? RegClass::gpr8_legacy : RegClass::gpr;
+    return op;
+  }
+
+  Operand OperandDecoder::vector(uint8_t reg, uint8_t size) const {
+    Operand op;
+    op.type = OperandType::reg;
+    op.size = size;
+    op.reg = reg;
+    op.reg_class = size == 64 ? RegClass::zmm : size == 32 ? RegClass::ymm : RegClass::xmm;
+    return op;
+  }
+
+  Operand OperandDecoder::memory(uint8_t size) const {
+    Operand op;
+    op.type = OperandType::mem;
+    op.size = size;
+    op.address_size = m_enc.address_size_32 ? 4 : 8;
+    if (m_enc.segment == 0x64 || m_enc.segment == 0x65) {
+      op.segment = m_enc.segment;   // the others are ignored in long mode
+    }
+
+    if (modrmRm() == 4) {
+      const uint8_t sib = m_code[m_out.modrm_offset + 1];
+      op.scale = static_cast<uint8_t>(1 << (sib >> 6));
+      const uint8_t index = ((sib >> 3) & 7) | (m_enc.rex_x << 3);
+      if (index != 4) {
+        op.index = static_cast<int8_t>(index);
+      }
+      if (!((sib & 7) == 5 && mod() == 0)) {
+        op.base = static_cast<int8_t>((sib & 7) | (m_enc.rex_b << 3));
+      }
+    } else if (mod() == 0 && modrmRm() == 5) {
+      op.base = Operand::RIP_REGISTER;
+    } else {
+      op.base = static_cast<int8_t>(modrmRm() | (m_enc.rex_b << 3));
+    }
+
+    if (m_out.disp_size) {
+      Cursor disp { m_code, m_code + m_out.disp_offset, m_code + m_out.length };
+      op.disp = disp.readSigned(m_out.disp_size);
+      // EVEX compresses disp8 by the size of the memory operand
+      if (m_enc.vex == 0x62 && m_out.disp_size == 1 && size) {
+        op.disp *= size;
+      }
+    }
+    return op;
+  }
+
+  int64_t OperandDecoder::immediate(uint8_t size) {
+    if (!size || m_imm_offset + size > m_out.length) {
+      return 0;
+    }
+    Cursor imm { m_code, m_code + m_imm_offset, m_code + m_out.length };
+    m_imm_offset += size;
+    return imm.readSigned(size);
+  }
+
+  bool OperandDecoder::operand(const OperandTemplate& t, Operand& op) {
+    const uint8_t reg = modrmReg() | (m_enc.rex_r << 3);
+    const uint8_t rm = modrmRm() | (m_enc.rex_b << 3);
+    const uint8_t vector_reg = reg | (m_enc.evex_r << 4);
+    // EVEX.X extends ModRM.rm to 32 vector registers
+    const uint8_t vector_rm = rm | (m_enc.vex == 0x62 && m_enc.rex_x ? 16 : 0);
+
+    char kind = t.kind;
+    char size_code = t.size;
+    if (m_xmm && (kind == 'P' || kind == 'Q' || kind == 'N' || kind == 'H')) {
+      kind = kind == 'P' ? 'V' : kind == 'H' ? 'H' : 'W';
+      size_code = 'x';
+    }
+
+    switch (kind) {
+      case 'E':
+      case 'M':
+      case 'R':
+        op = mod() == 3 ? gpr(rm, size(size_code)) : memory(size(size_code));
+        return true;
+      case 'G':
+        op = gpr(reg, size(size_code));
+        return true;
+      case 'B':
+        op = gpr(m_enc.vvvv & 15, size(size_code));
+        return true;
+      case 'Z':
+        op = gpr((m_enc.opcode & 7) | (m_enc.rex_b << 3), size(size_code));
+        return true;
+      case 'a':
+      case 'c':
+      case 'd':
+        op = gpr(kind == 'a' ? 0 : kind == 'c' ? 1 : 2, size(size_code));
+        return true;
+      case 'S':
+      case 's':
+        op.type = OperandType::reg;
+        op.reg_class = RegClass::seg;
+        op.reg = kind == 'S' ? modrmReg() : static_cast<uint8_t>(size_code);
+        op.size = 2;
+        return true;
+      case 'C':
+      case 'D':
+        op.type = OperandType::reg;
+        op.reg_class = kind == 'C' ? RegClass::cr : RegClass::dr;
+        op.reg = reg;
+        op.size = 8;
+        return true;
+      case 'V':
+        op = vector(vector_reg, size_code == 'x' || size_code == 'o' ? size(size_code) : 16);
+        return true;
+      case 'H':
+        op = vector(m_enc.vvvv, size_code == 'x' || size_code == 'o' ? size(size_code) : 16);
+        return true;
+      case 'W':
+      case 'U':
+        if (mod() == 3) {
+          op = vector(vector_rm, size_code == 'x' || size_code == 'o' ? size(size_code) : 16);
+        } else {
+          op = memory(size(size_code));
+        }
+        return true;
+      case 'P':
+        op.type = OperandType::reg;
+        op.reg_class = RegClass::mmx;
+        op.reg = modrmReg();
+        op.size = 8;
+        return true;
+      case 'Q':
+      case 'N':
+        if (mod() == 3) {
+          op.type = OperandType::reg;
+          op.reg_class = RegClass::mmx;
+          op.reg = modrmRm();
+          op.size = 8;
+        } else {
+          op = memory(8);
+        }
+        return true;
+      case 'T':
+      case 't':
+        op.type = OperandType::reg;
+        op.reg_class = RegClass::x87;
+        op.reg = kind == 'T' ? modrmRm() : 0;
+        op.size = 10;
+        return true;
+      case '1':
+        op.type = OperandType::imm;
+        op.imm = 1;
+        op.size = 1;
+        return true;
+      case 'I': {
+        const uint8_t imm_size = size(size_code);
+        op.type = OperandType::imm;
+        op.imm = immediate(imm_size);
+        // sign-extended to the operand size
+        op.size = (t.sign_extend || size_code == 'z') ? size('v') : imm_size;
+        return true;
+      }
+      case 'J': {
+        const uint8_t imm_size = size_code == 'b' ? 1 : 4;
+        op.type = OperandType::rel;
+        op.imm = static_cast<int64_t>(m_out.next() + immediate(imm_size));
+        op.size = 8;
+        return true;
+      }
+      case 'O': {
+        op = Operand {};
+        op.type = OperandType::mem;
+        op.size = size(size_code);
+        op.segment = (m_enc.segment == 0x64 || m_enc.segment == 0x65) ? m_enc.segment : 0;
+        op.disp = immediate(m_out.imm_size);
+        if (m_out.imm_size == 4) {
+          op.disp &= 0xffffffff;
+        }
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+
+  void OperandDecoder::decode() {
+    const Tables& t = tables();
+    m_out.mnemonic = "(bad)";
+
+    // x87 escapes and other opcodes whose ModRM byte picks the instruction
+    const uint32_t key = m_enc.map << 16 | m_enc.opcode << 8 | modrm();
+    if (m_out.has_modrm && mod() == 3 && !m_enc.vex) {
+      for (const auto& entry : t.modrm) {
+        if (entry.first == key) {
+          m_out.mnemonic = entry.second.forms[0].mnemonic;
+          for (uint8_t i = 0; i < entry.second.forms[0].operand_count; ++i) {
+            operand(entry.second.forms[0].operands[i], m_out.operands[m_out.operand_count++]);
+          }
+          return;
+        }
+      }
+    }
+
+    const Template* table = nullptr;
+    if (m_enc.map == 0 && m_enc.opcode >= 0xd8 && m_enc.opcode <= 0xdf) {
+      const int escape = m_enc.opcode - 0xd8;
+      table = mod() == 3 ? &t.x87_register[escape][modrmReg()] : &t.x87_memory[escape][modrmReg()];
+    } else if (m_enc.map == 0) {
+      table = &t.one_byte[m_enc.opcode];
+    } else if (m_enc.map == 1) {
+      table = &t.two_byte[m_enc.opcode];
+    } else if (m_enc.map == 2) {
+      table = &t.three_byte_38[m_enc.opcode];
+    } else {
+      table = &t.three_byte_3a[m_enc.opcode];
+    }
+
+    // A few encodings the tables can't express
+    if (m_enc.map == 0 && m_enc.opcode == 0x90 && m_enc.rex_b) {
+      table = &t.one_byte[0x91];                           // xchg r8, rax
+    }
+    if (m_enc.map == 1 && m_enc.opcode == 0x1e && m_enc.rep == 0xf3 && (modrm() == 0xfa || modrm() == 0xfb)) {
+      m_out.mnemonic = modrm() == 0xfa ? "endbr64" : "endbr32";
+      return;
+    }
+    if (m_enc.map == 1 && m_enc.opcode == 0x77 && m_enc.vex) {
+      m_out.mnemonic = m_enc.vector_length ? "vzeroall" : "vzeroupper";
+      return;
+    }
+    if (m_enc.map == 1 && (m_enc.opcode == 0x12 || m_enc.opcode == 0x16) && mod() == 3 && !m_enc.rep &&
+        !(m_enc.vex ? m_enc.vex_prefix : m_enc.operand_size_prefix)) {
+      table = m_enc.opcode == 0x12 ? &t.movhlps : &t.movlhps;   // the register forms of movlps/movhps
+    }
+    if (m_enc.map == 1 && m_enc.opcode == 0xae && mod() == 3 && !m_enc.rep && modrmReg() >= 5) {
+      m_out.mnemonic = modrmReg() == 5 ? "lfence" : modrmReg() == 6 ? "mfence" : "sfence";
+      return;
+    }
+
+    const Form* form = select(*table);
+    if (!form) {
+      return;
+    }
+    const Form* operands = form;
+    if (form->group) {
+      const Form* member = select(t.groups[form->group][modrmReg()]);
+      if (!member) {
+        return;
+      }
+      if (member->operand_count) {
+        operands = member;
+      }
+      form = member;
+    }
+    m_xmm = operands->mmx && (m_enc.vex || m_enc.operand_size_prefix);
+
+    // VEX only encodes vector instructions and the few '!' ones. The rest of these opcodes are
+    // AVX-512 mask register instructions (kmov, kortest, ...), which the tables don't cover.
+    if (m_enc.vex && form->vex_mnemonic != form->mnemonic) {
+      bool has_vector_operand = false;
+      for (uint8_t i = 0; i < operands->operand_count; ++i) {
+        has_vector_operand |= std::string_view("VWUHPQN").find(operands->operands[i].kind) != std::string_view::npos;
+      }
+      if (!has_vector_operand && operands->operand_count) {
+        return;
+      }
+    }
+
+    // "16|32|64": by operand size
+    std::string_view mnemonic = m_enc.vex ? form->vex_mnemonic : form->mnemonic;
+    if (mnemonic.find('|') != std::string_view::npos) {
+      const size_t index = m_enc.rex_w ? 2 : m_enc.operand_size_16 ? 0 : 1;
+      for (size_t i = 0; i < index; ++i) {
+        mnemonic.remove_prefix(mnemonic.find('|') + 1);
+      }
+      mnemonic = mnemonic.substr(0, mnemonic.find('|'));
+    }
+    m_out.mnemonic = mnemonic;
+
+    for (uint8_t i = 0; i < operands->operand_count; ++i) {
+      const OperandTemplate& operand_template = operands->operands[i];
+      // vvvv operands only exist in VEX/EVEX encodings
+      if ((operand_template.kind == 'H' || operand_template.kind == 'B') && !m_enc.vex) {
+        continue;
+      }
+      if (!operand(operand_template, m_out.operands[m_out.operand_count])) {
+        m_out.mnemonic = "(bad)";
+        m_out.operand_count = 0;
+        return;
+      }
+      ++m_out.operand_count;
+    }
+
+    if (m_enc.lock) {
+      m_out.prefix = "lock";
+    }
+    const bool string_op = m_enc.map == 0 && ((m_enc.opcode >= 0x6c && m_enc.opcode <= 0x6f) ||
+                                              (m_enc.opcode >= 0xa4 && m_enc.opcode <= 0xa7) ||
+                                              (m_enc.opcode >= 0xaa && m_enc.opcode <= 0xaf));
+    if (string_op && m_enc.rep) {
+      const bool compares = m_enc.opcode == 0xa6 || m_enc.opcode == 0xa7 || m_enc.opcode == 0xae || m_enc.opcode == 0xaf;
+      m_out.prefix = m_enc.rep == 0xf2 ? "repne" : compares ? "repe" : "rep";
+    }
+  }
+}
+
+bool decodeInstruction(const uint8_t* code, size_t size, uint64_t address, Instruction& out) {
+  out = Instruction {};
+  out.address = address;
+
+  Cursor cur { code, code, code + (size > 15 ? 15 : size) };   // 15 bytes is the architectural limit
+  Encoding enc;
+
+  // 1. Legacy prefixes, then an optional REX which must come last
+  while (cur.has(1)) {
+    const uint8_t byte = *cur.pos;
+    if (byte == 0x66) {
+      enc.operand_size_16 = true;
+      enc.operand_size_prefix = true;
+    } else if (byte == 0x67) {
+      enc.address_size_32 = true;
+    } else if (byte == 0xf0) {
+      enc.lock = true;
+    } else if (byte == 0xf2 || byte == 0xf3) {
+      enc.rep = byte;
+    } else if (byte == 0x2e || byte == 0x36 || byte == 0x3e || byte == 0x26 || byte == 0x64 || byte == 0x65) {
+      enc.segment = byte;
+    } else {
+      break;
+    }
+    ++cur.pos;
+  }
+  if (cur.has(1) && (*cur.pos & 0xf0) == 0x40) {
+    enc.rex = true;
+    enc.rex_w = (*cur.pos & 0x08) != 0;
+    enc.rex_r = (*cur.pos & 0x04) != 0;
+    enc.rex_x = (*cur.pos & 0x02) != 0;
+    enc.rex_b = (*cur.pos & 0x01) != 0;
+    ++cur.pos;
+  }
+  if (!cur.has(1)) {
+    return false;
+  }
+
+  // 2. VEX / EVEX escapes
+  static constexpr uint8_t PP_PREFIX[4] = {0, 0x66, 0xf3, 0xf2};
+  const uint8_t first = *cur.pos;
+  if (first == 0xc5) {                      // 2-byte VEX: C5 [R vvvv L pp]
+    if (!cur.has(2)) {
+      return false;
+    }
+    const uint8_t p0 = cur.pos[1];
+    enc.vex = first;
+    enc.map = 1;
+    enc.rex_r = !(p0 & 0x80);
+    enc.vvvv = (~p0 >> 3) & 15;
+    enc.vector_length = (p0 >> 2) & 1;
+    enc.vex_prefix = PP_PREFIX[p0 & 3];
+    cur.pos += 2;
+    if (!decodeVex(cur, 1, out)) {
+      return false;
+    }
+    out.length = cur.offset();
+    enc.opcode = code[out.opcode_offset];
+    OperandDecoder(code, enc, out).decode();
+    return true;
+  }
+  if (first == 0xc4 || first == 0x62) {     // 3-byte VEX: C4 [RXB mmmmm] [W vvvv L pp], EVEX: 62 P0 P1 P2
+    const size_t prefix_size = first == 0xc4 ? 3 : 4;
+    if (!cur.has(prefix_size)) {
+      return false;
+    }
+    const uint8_t p0 = cur.pos[1];
+    const uint8_t p1 = cur.pos[2];
+    const uint8_t map = p0 & (first == 0xc4 ? 0x1f : 0x07);
+    enc.vex = first;
+    enc.map = map;
+    enc.rex_r = !(p0 & 0x80);
+    enc.rex_x = !(p0 & 0x40);
+    enc.rex_b = !(p0 & 0x20);
+    enc.rex_w = (p1 & 0x80) != 0;
+    enc.vvvv = (~p1 >> 3) & 15;
+    enc.vex_prefix = PP_PREFIX[p1 & 3];
+    if (first == 0xc4) {
+      enc.vector_length = (p1 >> 2) & 1;
+    } else {                                 // EVEX: P2 = [z L'L b V' aaa]
+      const uint8_t p2 = cur.pos[3];
+      enc.evex_r = !(p0 & 0x10);
+      enc.vvvv |= (p2 & 0x08) ? 0 : 16;
+      enc.vector_length = (p2 >> 5) & 3;
+    }
+    cur.pos += prefix_size;
+    if (map < 1 || map > 3 || !decodeVex(cur, map, out)) {
+      return false;
+    }
+    out.length = cur.offset();
+    enc.opcode = code[out.opcode_offset];
+    OperandDecoder(code, enc, out).decode();
+    return true;
+  }
+
+  // 3. Opcode
+  out.opcode_offset = cur.offset();
+  uint16_t attributes;
+  uint8_t opcode = *cur.pos++;
+  if (opcode == 0x0f) {
+    if (!cur.has(1)) {
+      return false;
+    }
+    opcode = *cur.pos++;
+    if (opcode == 0x38 || opcode == 0x3a) { // three-byte maps: all ModRM, 0F 3A takes an imm8
+      if (!cur.has(1)) {
+        return false;
+      }
+      enc.map = opcode == 0x38 ? 2 : 3;
+      enc.opcode = *cur.pos++;
+      if (!decodeModRM(cur, out) || !readImmediate(cur, opcode == 0x3a ? 1 : 0, out)) {
+        return false;
+      }
+      out.length = cur.offset();
+      OperandDecoder(code, enc, out).decode();
+      return true;
+    }
+    enc.map = 1;
+    attributes = TWO_BYTE_MAP[opcode];
+  } else {
+    attributes = ONE_BYTE_MAP[opcode];
+  }
+  enc.opcode = opcode;
+
+  if (attributes & (X | P)) {
+    return false;
+  }
+
+  // 4. ModRM, SIB, displacement
+  uint8_t modrm_reg = 0;
+  if (attributes & M) {
+    if (!decodeModRM(cur, out)) {
+      return false;
+    }
+    modrm_reg = (code[out.modrm_offset] >> 3) & 7;
+  }
+
+  // 5. Immediate
+  uint8_t imm_size = 0;
+  switch (attributes & IMM_MASK) {
+    case Ib: imm_size = 1; break;
+    case Iw: imm_size = 2; break;
+    case Iz: imm_size = enc.operand_size_16 ? 2 : 4; break;
+    case Iv: imm_size = enc.rex_w ? 8 : enc.operand_size_16 ? 2 : 4; break;
+    case Ie: imm_size = 3; break;
+    case Io: imm_size = enc.address_size_32 ? 4 : 8; break;
+    case Jb: imm_size = 1; break;
+    case Jz: imm_size = 4; break;                          // rel32 even with 66 in long mode
+    case Gi:
+      if (modrm_reg < 2) {                                 // test r/m, imm
+        imm_size = (opcode == 0xf6) ? 1 : enc.operand_size_16 ? 2 : 4;
+      }
+      break;
+    default:
+      break;
+  }
+  if (!readImmediate(cur, imm_size, out)) {
+    return false;
+  }
+  out.length = cur.offset();
+
+  // 6. Control flow
+  switch (attributes & FLOW_MASK) {
+    case FJ: out.flow = FlowType::jump; break;
+    case FC: out.flow = FlowType::conditional_jump; break;
+    case FL: out.flow = FlowType::call; break;
+    case FR: out.flow = FlowType::ret; break;
+    case FS: out.flow = FlowType::syscall; break;
+    case FT: out.flow = FlowType::trap; break;
+    case FG:
+      if (modrm_reg == 2 || modrm_reg == 3) {
+        out.flow = FlowType::indirect_call;
+      } else if (modrm_reg == 4 || modrm_reg == 5) {
+        out.flow = FlowType::indirect_jump;
+      }
+      break;
+    default:
+      break;
+  }
+  if (out.flow == FlowType::jump || out.flow == FlowType::conditional_jump || out.flow == FlowType::call) {
+    Cursor rel { code, code + out.imm_offset, code + out.length };
+    out.target = out.next() + rel.readSigned(out.imm_size);
+  }
+
+  // 7. Mnemonic and operands
+  OperandDecoder(code, enc, out).decode();
+  return true;
+}
+
+namespace {
+  const char* const GPR_64[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                                "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"};
+  const char* const GPR_32[] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+                                "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+  const char* const GPR_16[] = {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+                                "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"};
+  const char* const GPR_8[] = {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+                               "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+  const char* const GPR_8_LEGACY[] = {"al", "cl", "dl", "bl", "ah", "ch", "dh", "bh"};
+  const char* const SEGMENTS[] = {"es", "cs", "ss", "ds", "fs", "gs", "?", "?"};
+
+  std::string registerName(RegClass reg_class, uint8_t reg, uint8_t size) {
+    switch (reg_class) {
+      case RegClass::gpr:
+        switch (size) {
+          case 1: return GPR_8[reg & 15];
+          case 2: return GPR_16[reg & 15];
+          case 4: return GPR_32[reg & 15];
+          default: return GPR_64[reg & 15];
+        }
+      case RegClass::gpr8_legacy: return GPR_8_LEGACY[reg & 7];
+      case RegClass::seg: return SEGMENTS[reg & 7];
+      case RegClass::xmm: return "xmm" + std::to_string(reg);
+      case RegClass::ymm: return "ymm" + std::to_string(reg);
+      case RegClass::zmm: return "zmm" + std::to_string(reg);
+      case RegClass::mmx: return "mm" + std::to_string(reg);
+      case RegClass::cr: return "cr" + std::to_string(reg);
+      case RegClass::dr: return "dr" + std::to_string(reg);
+      case RegClass::x87: return "st(" + std::to_string(reg) + ")";
+    }
+    return "?";
+  }
+
+  const char* sizeName(uint8_t size) {
+    switch (size) {
+      case 1: return "byte ptr ";
+      case 2: return "word ptr ";
+      case 4: return "dword ptr ";
+      case 6: return "fword ptr ";
+      case 8: return "qword ptr ";
+      case 10: return "tbyte ptr ";
+      case 16: return "xmmword ptr ";
+      case 32: return "ymmword ptr ";
+      case 64: return "zmmword ptr ";
+      default: return "";
+    }
+  }
+
+  void printHex(std::ostream& os, uint64_t value) {
+    os << "0x" << std::hex << value << std::dec;
+  }
+
+  void printSymbol(std::ostream& os, uint64_t address, const Symbolizer& symbolize) {
+    if (symbolize) {
+      const std::string name = symbolize(address);
+      if (!name.empty()) {
+        os << " <" << name << ">";
+      }
+    }
+  }
+}
+
+std::string toString(const Instruction& instruction, const Symbolizer& symbolize) {
+  std::ostringstream os;
+  if (!instruction.prefix.empty()) {
+    os << instruction.prefix << ' ';
+  }
+  os << instruction.mnemonic;
+
+  uint64_t rip_target = 0;
+  bool has_rip_target = false;
+  for (uint8_t i = 0; i < instruction.operand_count; ++i) {
+    const Operand& op = instruction.operands[i];
+    os << (i == 0 ? std::string(instruction.mnemonic.size() < 6 ? 7 - instruction.mnemonic.size() : 1, ' ') : ", ");
+    switch (op.type) {
+      case OperandType::reg:
+        os << registerName(op.reg_class, op.reg, op.size);
+        break;
+      case OperandType::imm: {
+        const uint64_t mask = op.size >= 8 || op.size == 0 ? ~0ULL : (1ULL << (8 * op.size)) - 1;
+        printHex(os, static_cast<uint64_t>(op.imm) & mask);
+        break;
+      }
+      case OperandType::rel:
+        printHex(os, static_cast<uint64_t>(op.imm));
+        printSymbol(os, static_cast<uint64_t>(op.imm), symbolize);
+        break;
+      case OperandType::mem: {
+        os << sizeName(op.size);
+        if (op.segment) {
+          os << (op.segment == 0x64 ? "fs:" : "gs:");
+        }
+        os << '[';
+        bool first = true;
+        if (op.base == Operand::RIP_REGISTER) {
+          os << "rip";
+          first = false;
+          rip_target = instruction.next() + op.disp;
+          has_rip_target = true;
+        } else if (op.base != Operand::NO_REGISTER) {
+          os << registerName(RegClass::gpr, op.base, op.address_size);
+          first = false;
+        }
+        if (op.index != Operand::NO_REGISTER) {
+          os << (first ? "" : "+") << registerName(RegClass::gpr, op.index, op.address_size);
+          if (op.scale != 1) {
+            os << '*' << static_cast<int>(op.scale);
+          }
+          first = false;
+        }
+        if (first) {
+          printHex(os, static_cast<uint64_t>(op.disp));
+        } else if (op.disp) {
+          os << (op.disp < 0 ? '-' : '+');
+          printHex(os, op.disp < 0 ? -static_cast<uint64_t>(op.disp) : static_cast<uint64_t>(op.disp));
+        }
+        os << ']';
+        break;
+      }
+      case OperandType::none:
+        break;
+    }
+  }
+
+  if (has_rip_target) {
+    os << "        # ";
+    printHex(os, rip_target);
+    printSymbol(os, rip_target, symbolize);
+  }
+  return os.str();
+}
+
+void InstructionCache::invalidate(uint64_t address, size_t size) {
+  // An instruction is at most 15 bytes, so only the ones starting up to 14 bytes before can reach in
+  if (size > m_instructions.size()) {
+    for (auto it = m_instructions.begin(); it != m_instructions.end();) {
+      const Instruction& instruction = it->second;
+      const bool overlaps = instruction.address < address + size && instruction.next() > address;
+      it = overlaps ? m_instructions.erase(it) : std::next(it);
+    }
+    return;
+  }
+  for (uint64_t start = address >= 14 ? address - 14 : 0; start < address + size; ++start) {
+    auto it = m_instructions.find(start);
+    if (it != m_instructions.end() && it->second.next() > address) {
+      m_instructions.erase(it);
+    }
+  }
+}
@@ -13,6 +13,7 @@ resolve_type(DW_AT name, DW_FORM form)
 {
         switch (form) {
         case DW_FORM::addr:
+        case DW_FORM::GNU_addr_index:
                 return value::type::address;
 
         case DW_FORM::block:
@@ -102,6 +103,7 @@ resolve_type(DW_AT name, DW_FORM form)
 
         case DW_FORM::string:
         case DW_FORM::strp:
+        case DW_FORM::GNU_str_index:
                 return value::type::string;
 
         case DW_FORM::indirect:
@@ -133,6 +135,11 @@ resolve_type(DW_AT name, DW_FORM form)
                 case DW_AT::ranges:
                         return value::type::rangelist;
 
+                case DW_AT::GNU_addr_base:
+                case DW_AT::GNU_ranges_base:
+                        // Plain offsets; read with as_sec_offset
+                        return value::type::constant;
+
                 default:
                         throw format_error("DW_FORM_sec_offset not expected for attribute " +
                                            to_string(name));
@@ -173,6 +173,8 @@ cursor::skip_form(DW_FORM form)
         case DW_FORM::sdata:
         case DW_FORM::udata:
         case DW_FORM::ref_udata:
+        case DW_FORM::GNU_addr_index:
+        case DW_FORM::GNU_str_index:
                 while (pos < sec->end && (*(uint8_t*)pos & 0x80))
                         pos++;
                 pos++;
@@ -215,6 +215,14 @@ enum class DW_AT
 
         lo_user              = 0x2000,
         hi_user              = 0x3fff,
+
+        // GNU split DWARF extensions (pre-DWARF 5 "Fission")
+        GNU_dwo_name         = 0x2130, // string
+        GNU_dwo_id           = 0x2131, // constant
+        GNU_ranges_base      = 0x2132, // sec_offset
+        GNU_addr_base        = 0x2133, // sec_offset
+        GNU_pubnames         = 0x2134, // flag
+        GNU_pubtypes         = 0x2135, // flag
 };
 
 std::string
@@ -251,6 +259,10 @@ enum class DW_FORM
         exprloc      = 0x18,    // exprloc
         flag_present = 0x19,    // flag
         ref_sig8     = 0x20,    // reference
+
+        // GNU split DWARF extensions
+        GNU_addr_index = 0x1f01, // address
+        GNU_str_index  = 0x1f02, // string
 };
 
 std::string
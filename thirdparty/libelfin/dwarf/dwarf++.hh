@@ -82,7 +82,9 @@ public:
 enum class section_type
 {
         abbrev,
+        addr,
         aranges,
+        cu_index,
         frame,
         info,
         line,
@@ -92,7 +94,9 @@ enum class section_type
         pubtypes,
         ranges,
         str,
+        str_offsets,
         types,
+        tu_index,
 };
 
 std::string
@@ -160,6 +164,19 @@ public:
          */
         const type_unit &get_type_unit(uint64_t type_signature) const;
 
+        /**
+         * Return the split compilation unit with the given DWO ID
+         * from this split DWARF object (.dwo) or package (.dwp)
+         * file.  Indexed addresses and ranges in the returned unit
+         * are resolved through skeleton, the unit in the main
+         * executable that refers to it.  Package files are looked up
+         * through their .debug_cu_index hash table, so only the
+         * requested unit is read.  Throws out_of_range if this file
+         * has no such unit.
+         */
+        const compilation_unit &get_split_unit(uint64_t dwo_id,
+                                               const compilation_unit &skeleton) const;
+
         /**
          * \internal Retrieve the specified section from this file.
          * If the section does not exist, throws format_error.
@@ -248,6 +265,25 @@ public:
          */
         const abbrev_entry &get_abbrev(std::uint64_t acode) const;
 
+        /**
+         * \internal Return the address at the given index of this
+         * unit's .debug_addr contribution (DW_FORM_GNU_addr_index).
+         */
+        taddr get_indexed_address(std::uint64_t index) const;
+
+        /**
+         * \internal Return the string at the given index of this
+         * unit's string offsets table (DW_FORM_GNU_str_index).
+         */
+        const char *get_indexed_string(std::uint64_t index, size_t *size_out) const;
+
+        /**
+         * \internal Return the .debug_ranges section that
+         * DW_AT_ranges values in this unit refer to, and set
+         * *base_out to the offset they are relative to.
+         */
+        std::shared_ptr<section> get_ranges(section_offset *base_out) const;
+
 protected:
         friend struct ::std::hash<unit>;
         struct impl;
@@ -275,6 +311,30 @@ public:
          */
         compilation_unit(const dwarf &file, section_offset offset);
 
+        /**
+         * \internal Construct a split compilation unit whose header
+         * begins offset bytes into the .debug_info.dwo section of
+         * file.  abbrev_base and str_offsets_base locate this unit's
+         * contributions within a package file and are 0 for a
+         * standalone .dwo.
+         */
+        compilation_unit(const dwarf &file, section_offset offset,
+                         const compilation_unit &skeleton,
+                         section_offset abbrev_base = 0,
+                         section_offset str_offsets_base = 0);
+
+        /**
+         * Return true if this is a skeleton unit whose DIEs live in a
+         * separate split DWARF object (DW_AT_GNU_dwo_name).
+         */
+        bool is_skeleton() const;
+
+        /**
+         * Return the DWO ID that ties a skeleton unit to its split
+         * unit, or 0 if this unit has none.
+         */
+        uint64_t get_dwo_id() const;
+
         /**
          * Return the line number table of this compilation unit.
          * Returns an invalid line table if this unit has no line
@@ -839,6 +899,17 @@ public:
         {
                 throw expr_error("loclist operations not supported");
         }
+
+        /**
+         * Implement DW_OP_call_frame_cfa: the canonical frame
+         * address of the current frame (rsp before the call).  By
+         * default, assume an x86-64 frame pointer frame past its
+         * prologue: the CFA is rbp + 16.
+         */
+        virtual taddr call_frame_cfa()
+        {
+                return reg(6) + 16;
+        }
 };
 
 /**
@@ -1543,13 +1614,21 @@ namespace elf
         class elf_loader : public loader
         {
                 Elf f;
+                bool dwo;
 
         public:
-                elf_loader(const Elf &file) : f(file) { }
+                elf_loader(const Elf &file, bool dwo = false)
+                        : f(file), dwo(dwo) { }
 
                 const void *load(section_type section, size_t *size_out)
                 {
-                        auto sec = f.get_section(section_type_to_name(section));
+                        std::string name = section_type_to_name(section);
+                        // Split DWARF objects suffix their sections
+                        // with .dwo, except for the package indexes.
+                        if (dwo && section != section_type::cu_index &&
+                            section != section_type::tu_index)
+                                name += ".dwo";
+                        auto sec = f.get_section(name);
                         if (!sec.valid())
                                 return nullptr;
                         *size_out = sec.size();
@@ -1568,6 +1647,17 @@ namespace elf
         {
                 return std::make_shared<elf_loader<Elf> >(f);
         }
+
+        /**
+         * Create a DWARF section loader for a split DWARF object
+         * (.dwo) or package (.dwp) file, whose sections carry a
+         * .dwo suffix.
+         */
+        template<typename Elf>
+        std::shared_ptr<elf_loader<Elf> > create_dwo_loader(const Elf &f)
+        {
+                return std::make_shared<elf_loader<Elf> >(f, true);
+        }
 };
 
 DWARFPP_END_NAMESPACE
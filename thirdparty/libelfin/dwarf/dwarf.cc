@@ -15,7 +15,8 @@ DWARFPP_BEGIN_NAMESPACE
 struct dwarf::impl
 {
         impl(const std::shared_ptr<loader> &l)
-                : l(l), have_type_units(false) { }
+                : l(l), have_compilation_units(false),
+                  have_type_units(false) { }
 
         std::shared_ptr<loader> l;
 
@@ -23,10 +24,14 @@ struct dwarf::impl
         std::shared_ptr<section> sec_abbrev;
 
         std::vector<compilation_unit> compilation_units;
+        bool have_compilation_units;
 
         std::unordered_map<uint64_t, type_unit> type_units;
         bool have_type_units;
 
+        // Split units already resolved from this .dwo/.dwp, by DWO ID
+        std::unordered_map<uint64_t, compilation_unit> split_units;
+
         std::map<section_type, std::shared_ptr<section> > sections;
 };
 
@@ -60,18 +65,6 @@ dwarf::dwarf(const std::shared_ptr<loader> &l)
         if (!data)
                 throw format_error("required .debug_abbrev section missing");
         m->sec_abbrev = make_shared<section>(section_type::abbrev, data, size, m->sec_info->ord);
-
-        // Get compilation units.  Everything derives from these, so
-        // there's no point in doing it lazily.
-        cursor infocur(m->sec_info);
-        while (!infocur.end()) {
-                // XXX Circular reference.  Given that we now require
-                // the dwarf object to stick around for DIEs, maybe we
-                // might as well require that for units, too.
-                m->compilation_units.emplace_back(
-                        *this, infocur.get_section_offset());
-                infocur.subsection();
-        }
 }
 
 dwarf::~dwarf()
@@ -84,6 +77,22 @@ dwarf::compilation_units() const
         static std::vector<compilation_unit> empty;
         if (!m)
                 return empty;
+        // Get compilation units.  Everything derives from these, but
+        // a package file is only ever searched through its index, so
+        // don't walk .debug_info until someone asks.
+        if (!m->have_compilation_units) {
+                cursor infocur(m->sec_info);
+                while (!infocur.end()) {
+                        // XXX Circular reference.  Given that we now
+                        // require the dwarf object to stick around for
+                        // DIEs, maybe we might as well require that
+                        // for units, too.
+                        m->compilation_units.emplace_back(
+                                *this, infocur.get_section_offset());
+                        infocur.subsection();
+                }
+                m->have_compilation_units = true;
+        }
         return m->compilation_units;
 }
 
@@ -105,6 +114,104 @@ dwarf::get_type_unit(uint64_t type_signature) const
         return m->type_units[type_signature];
 }
 
+// DWARF package index section identifiers (DWARF4 Fission proposal,
+// version 2 of the .debug_cu_index format)
+enum class DW_SECT
+{
+        info = 1,
+        types = 2,
+        abbrev = 3,
+        line = 4,
+        loc = 5,
+        str_offsets = 6,
+        macinfo = 7,
+        macro = 8,
+};
+
+const compilation_unit &
+dwarf::get_split_unit(uint64_t dwo_id, const compilation_unit &skeleton) const
+{
+        auto cached = m->split_units.find(dwo_id);
+        if (cached != m->split_units.end())
+                return cached->second;
+
+        size_t size;
+        const void *data = m->l->load(section_type::cu_index, &size);
+        if (!data) {
+                // A standalone .dwo.  These hold a single unit (or a
+                // handful), so a scan of the unit headers is cheap.
+                for (auto &cu : compilation_units()) {
+                        if (cu.get_dwo_id() != dwo_id)
+                                continue;
+                        return m->split_units[dwo_id] = compilation_unit(
+                                *this, cu.get_section_offset(), skeleton);
+                }
+                throw out_of_range("dwo id 0x" + to_hex(dwo_id));
+        }
+
+        // A package file.  The index is an open-addressed hash table
+        // of unit signatures, followed by a table of per-unit section
+        // offsets into the .dwo sections.
+        auto idxsec = make_shared<section>(section_type::cu_index, data, size,
+                                           m->sec_info->ord);
+        cursor cur(idxsec);
+        uword version = cur.fixed<uword>();
+        if (version == 5)
+                throw format_error("DWARF 5 package index: only GNU .dwp files (version 2) are supported");
+        if (version != 2)
+                throw format_error("unknown package index version " + std::to_string(version));
+        uword ncolumns = cur.fixed<uword>();
+        uword nunits = cur.fixed<uword>();
+        uword nslots = cur.fixed<uword>();
+        section_offset sigs = cur.get_section_offset();
+        section_offset rows = sigs + nslots * 8;
+        section_offset columns = rows + nslots * 4;
+        section_offset offsets = columns + ncolumns * 4;
+        if (nslots & (nslots - 1))
+                throw format_error("package index slot count is not a power of two");
+
+        uint64_t mask = nslots - 1;
+        uint64_t slot = dwo_id & mask;
+        uint64_t step = ((dwo_id >> 32) & mask) | 1;
+        uword row = 0;
+        for (uword probe = 0; probe < nslots; ++probe) {
+                uword r = cursor(idxsec, rows + slot * 4).fixed<uword>();
+                if (r == 0)
+                        break;
+                if (cursor(idxsec, sigs + slot * 8).fixed<uint64_t>() == dwo_id) {
+                        row = r;
+                        break;
+                }
+                slot = (slot + step) & mask;
+        }
+        if (row == 0 || row > nunits)
+                throw out_of_range("dwo id 0x" + to_hex(dwo_id));
+
+        section_offset info = 0, abbrev = 0, str_offsets = 0;
+        cursor colcur(idxsec, columns);
+        cursor rowcur(idxsec, offsets + (row - 1) * ncolumns * 4);
+        for (uword col = 0; col < ncolumns; ++col) {
+                DW_SECT kind = (DW_SECT)colcur.fixed<uword>();
+                uword off = rowcur.fixed<uword>();
+                switch (kind) {
+                case DW_SECT::info:
+                        info = off;
+                        break;
+                case DW_SECT::abbrev:
+                        abbrev = off;
+                        break;
+                case DW_SECT::str_offsets:
+                        str_offsets = off;
+                        break;
+                default:
+                        break;
+                }
+        }
+
+        return m->split_units[dwo_id] = compilation_unit(
+                *this, info, skeleton, abbrev, str_offsets);
+}
+
 std::shared_ptr<section>
 dwarf::get_section(section_type type) const
 {
@@ -151,6 +258,16 @@ struct unit::impl
         // Lazily constructed line table
         line_table lt;
 
+        // Split DWARF state.  For a split unit, the address and
+        // ranges tables live in the skeleton's file, which must be
+        // kept live.
+        dwarf skeleton_file;
+        std::shared_ptr<section> sec_addr;
+        section_offset addr_base = 0;
+        section_offset ranges_base = 0;
+        section_offset str_offsets_base = 0;
+        bool have_split_bases = false;
+
         // Map from abbrev code to abbrev.  If the map is dense, it
         // will be stored in the vector; otherwise it will be stored
         // in the map.
@@ -168,6 +285,7 @@ struct unit::impl
                   type_offset(type_offset), have_abbrevs(false) { }
 
         void force_abbrevs();
+        void force_split_bases(const unit *u);
 };
 
 unit::~unit()
@@ -227,6 +345,57 @@ unknown:
         throw format_error("unknown abbrev code 0x" + to_hex(acode));
 }
 
+taddr
+unit::get_indexed_address(uint64_t index) const
+{
+        m->force_split_bases(this);
+        if (!m->sec_addr) {
+                const dwarf &f = m->skeleton_file.valid() ? m->skeleton_file : m->file;
+                m->sec_addr = f.get_section(section_type::addr);
+        }
+        unsigned addr_size = m->subsec->addr_size;
+        cursor cur(m->sec_addr->slice(0, m->sec_addr->size(), format::unknown, addr_size),
+                   m->addr_base + index * addr_size);
+        return cur.address();
+}
+
+const char *
+unit::get_indexed_string(uint64_t index, size_t *size_out) const
+{
+        m->force_split_bases(this);
+        // XXX Assumes 32-bit DWARF, which is all GCC emits for .dwo
+        cursor offcur(m->file.get_section(section_type::str_offsets),
+                      m->str_offsets_base + index * 4);
+        section_offset off = offcur.fixed<uword>();
+        cursor scur(m->file.get_section(section_type::str), off);
+        return scur.cstr(size_out);
+}
+
+std::shared_ptr<section>
+unit::get_ranges(section_offset *base_out) const
+{
+        m->force_split_bases(this);
+        *base_out = m->ranges_base;
+        if (m->skeleton_file.valid())
+                return m->skeleton_file.get_section(section_type::ranges);
+        return m->file.get_section(section_type::ranges);
+}
+
+void
+unit::impl::force_split_bases(const unit *u)
+{
+        // Split units have their bases filled in from the skeleton
+        // at construction.  A skeleton may itself use indexed forms.
+        if (have_split_bases)
+                return;
+        have_split_bases = true;
+        const die &d = u->root();
+        if (d.has(DW_AT::GNU_addr_base))
+                addr_base = d[DW_AT::GNU_addr_base].as_sec_offset();
+        if (d.has(DW_AT::GNU_ranges_base))
+                ranges_base = d[DW_AT::GNU_ranges_base].as_sec_offset();
+}
+
 void
 unit::impl::force_abbrevs()
 {
@@ -273,6 +442,15 @@ compilation_unit::compilation_unit(const dwarf &file, section_offset offset)
         cursor sub(subsec);
         sub.skip_initial_length();
         uhalf version = sub.fixed<uhalf>();
+        if (version == 5) {
+                // DWARF 5 split units (DW_UT_skeleton,
+                // DW_UT_split_compile) name their .dwo with
+                // DW_AT_dwo_name and use the addrx/strx forms: only
+                // the GNU extension of DWARF 4 is understood.
+                ubyte unit_type = sub.fixed<ubyte>();
+                if (unit_type == 0x04 || unit_type == 0x05)
+                        throw format_error("DWARF 5 split unit: only GNU split DWARF (-gdwarf-4 -gsplit-dwarf) is supported");
+        }
         if (version < 2 || version > 4)
                 throw format_error("unknown compilation unit version " + std::to_string(version));
         // .debug_abbrev-relative offset of this unit's abbrevs
@@ -284,12 +462,52 @@ compilation_unit::compilation_unit(const dwarf &file, section_offset offset)
                               sub.get_section_offset());
 }
 
+compilation_unit::compilation_unit(const dwarf &file, section_offset offset,
+                                   const compilation_unit &skeleton,
+                                   section_offset abbrev_base,
+                                   section_offset str_offsets_base)
+        : compilation_unit(file, offset)
+{
+        // Rebuild with this unit's contributions to the package's
+        // .debug_abbrev.dwo.  The header's abbrev offset is relative
+        // to that contribution.
+        m = make_shared<impl>(file, offset, m->subsec,
+                              m->debug_abbrev_offset + abbrev_base,
+                              m->root_offset);
+        m->str_offsets_base = str_offsets_base;
+
+        const die &skel = skeleton.root();
+        m->skeleton_file = skeleton.get_dwarf();
+        if (skel.has(DW_AT::GNU_addr_base))
+                m->addr_base = skel[DW_AT::GNU_addr_base].as_sec_offset();
+        if (skel.has(DW_AT::GNU_ranges_base))
+                m->ranges_base = skel[DW_AT::GNU_ranges_base].as_sec_offset();
+        m->have_split_bases = true;
+}
+
+bool
+compilation_unit::is_skeleton() const
+{
+        return root().has(DW_AT::GNU_dwo_name);
+}
+
+uint64_t
+compilation_unit::get_dwo_id() const
+{
+        const die &d = root();
+        if (!d.has(DW_AT::GNU_dwo_id))
+                return 0;
+        return d[DW_AT::GNU_dwo_id].as_uconstant();
+}
+
 const line_table &
 compilation_unit::get_line_table() const
 {
         if (!m->lt.valid()) {
                 const die &d = root();
-                if (!d.has(DW_AT::stmt_list) || !d.has(DW_AT::name))
+                // Skeleton units carry the line table but leave the
+                // name to their split unit.
+                if (!d.has(DW_AT::stmt_list))
                         goto done;
 
                 shared_ptr<section> sec;
@@ -301,9 +519,10 @@ compilation_unit::get_line_table() const
 
                 auto comp_dir = d.has(DW_AT::comp_dir) ? at_comp_dir(d) : "";
                 
+                auto name = d.has(DW_AT::name) ? at_name(d) : "";
+
                 m->lt = line_table(sec, d[DW_AT::stmt_list].as_sec_offset(),
-                                   m->subsec->addr_size, comp_dir,
-                                   at_name(d));
+                                   m->subsec->addr_size, comp_dir, name);
         }
 done:
         return m->lt;
@@ -16,7 +16,9 @@ static const struct
         section_type type;
 } sections[] = {
         {".debug_abbrev",   section_type::abbrev},
+        {".debug_addr",     section_type::addr},
         {".debug_aranges",  section_type::aranges},
+        {".debug_cu_index", section_type::cu_index},
         {".debug_frame",    section_type::frame},
         {".debug_info",     section_type::info},
         {".debug_line",     section_type::line},
@@ -26,7 +28,9 @@ static const struct
         {".debug_pubtypes", section_type::pubtypes},
         {".debug_ranges",   section_type::ranges},
         {".debug_str",      section_type::str},
+        {".debug_str_offsets", section_type::str_offsets},
         {".debug_types",    section_type::types},
+        {".debug_tu_index", section_type::tu_index},
 };
 
 bool
@@ -243,9 +243,7 @@ expr::evaluate(expr_context *ctx, const std::initializer_list<taddr> &arguments)
                         stack.back() = ctx->form_tls_address(stack.back());
                         break;
                 case DW_OP::call_frame_cfa:
-                        // Horrible hack which just reads the frame pointer on x86
-                        tmp1.u = 6;
-                        stack.push_back((int64_t)ctx->reg(tmp1.u));
+                        stack.push_back((int64_t)ctx->call_frame_cfa());
                         break;
                         // 2.5.1.4 Arithmetic and logical operations
 #define UBINOP(binop)                                                   \
@@ -10,7 +10,9 @@ to_string(section_type v)
 {
         switch (v) {
         case section_type::abbrev: return "section_type::abbrev";
+        case section_type::addr: return "section_type::addr";
         case section_type::aranges: return "section_type::aranges";
+        case section_type::cu_index: return "section_type::cu_index";
         case section_type::frame: return "section_type::frame";
         case section_type::info: return "section_type::info";
         case section_type::line: return "section_type::line";
@@ -20,7 +22,9 @@ to_string(section_type v)
         case section_type::pubtypes: return "section_type::pubtypes";
         case section_type::ranges: return "section_type::ranges";
         case section_type::str: return "section_type::str";
+        case section_type::str_offsets: return "section_type::str_offsets";
         case section_type::types: return "section_type::types";
+        case section_type::tu_index: return "section_type::tu_index";
         }
         return "(section_type)" + std::to_string((int)v);
 }
@@ -238,6 +242,12 @@ to_string(DW_AT v)
         case DW_AT::linkage_name: return "DW_AT_linkage_name";
         case DW_AT::lo_user: break;
         case DW_AT::hi_user: break;
+        case DW_AT::GNU_dwo_name: return "DW_AT_GNU_dwo_name";
+        case DW_AT::GNU_dwo_id: return "DW_AT_GNU_dwo_id";
+        case DW_AT::GNU_ranges_base: return "DW_AT_GNU_ranges_base";
+        case DW_AT::GNU_addr_base: return "DW_AT_GNU_addr_base";
+        case DW_AT::GNU_pubnames: return "DW_AT_GNU_pubnames";
+        case DW_AT::GNU_pubtypes: return "DW_AT_GNU_pubtypes";
         }
         return "(DW_AT)0x" + to_hex((int)v);
 }
@@ -271,6 +281,8 @@ to_string(DW_FORM v)
         case DW_FORM::exprloc: return "DW_FORM_exprloc";
         case DW_FORM::flag_present: return "DW_FORM_flag_present";
         case DW_FORM::ref_sig8: return "DW_FORM_ref_sig8";
+        case DW_FORM::GNU_addr_index: return "DW_FORM_GNU_addr_index";
+        case DW_FORM::GNU_str_index: return "DW_FORM_GNU_str_index";
         }
         return "(DW_FORM)0x" + to_hex((int)v);
 }
@@ -26,11 +26,15 @@ value::get_section_offset() const
 taddr
 value::as_address() const
 {
-        if (form != DW_FORM::addr)
-                throw value_type_mismatch("cannot read " + to_string(typ) + " as address");
-
         cursor cur(cu->data(), offset);
-        return cur.address();
+        switch (form) {
+        case DW_FORM::addr:
+                return cur.address();
+        case DW_FORM::GNU_addr_index:
+                return cu->get_indexed_address(cur.uleb128());
+        default:
+                throw value_type_mismatch("cannot read " + to_string(typ) + " as address");
+        }
 }
 
 const void *
@@ -161,9 +165,10 @@ value::as_rangelist() const
         // address.
         die cudie = cu->root();
         taddr cu_low_pc = cudie.has(DW_AT::low_pc) ? at_low_pc(cudie) : 0;
-        auto sec = cu->get_dwarf().get_section(section_type::ranges);
+        section_offset base;
+        auto sec = cu->get_ranges(&base);
         auto cusec = cu->data();
-        return rangelist(sec, off, cusec->addr_size, cu_low_pc);
+        return rangelist(sec, base + off, cusec->addr_size, cu_low_pc);
 }
 
 die
@@ -253,6 +258,8 @@ value::as_cstr(size_t *size_out) const
                 cursor scur(cu->get_dwarf().get_section(section_type::str), off);
                 return scur.cstr(size_out);
         }
+        case DW_FORM::GNU_str_index:
+                return cu->get_indexed_string(cur.uleb128(), size_out);
         default:
                 throw value_type_mismatch("cannot read " + to_string(typ) + " as string");
         }
@@ -119,6 +119,19 @@ private:
         std::shared_ptr<impl> m;
 };
 
+/**
+ * How a range of an ELF file is going to be accessed.  These map
+ * onto madvise(2) advice for loaders backed by mmap.
+ */
+enum class access_hint
+{
+        normal,
+        sequential,
+        random,
+        willneed,
+        dontneed,
+};
+
 /**
  * An interface for loading sections of an ELF file.
  */
@@ -135,6 +148,39 @@ public:
          * (including a premature EOF), it must throw an exception.
          */
         virtual const void *load(off_t offset, size_t size) = 0;
+
+        /**
+         * Hint how the given file range is about to be accessed.
+         * Loaders that don't page data in lazily can ignore this.
+         */
+        virtual void advise(off_t offset, size_t size, access_hint hint) { }
+
+        /**
+         * Start bringing the given file range into memory without
+         * blocking the caller.  Loaders that don't page data in
+         * lazily can ignore this.
+         */
+        virtual void prefault(off_t offset, size_t size) { }
+};
+
+/**
+ * Tuning knobs for the mmap-based loader.  The defaults only enable
+ * hints that are never worse than plain demand paging.
+ */
+struct mmap_loader_options
+{
+        // Pass loader::advise hints on to madvise.
+        bool advise = true;
+        // Service loader::prefault on a background thread that
+        // touches every page of the requested ranges.
+        bool prefault = true;
+        // Let access_hint::dontneed drop pages of ranges the caller
+        // is done with.  They are re-read from the page cache if
+        // touched again.
+        bool release = true;
+        // Map the whole file with MAP_POPULATE.  Only sensible for
+        // files that comfortably fit in memory.
+        bool populate = false;
 };
 
 /**
@@ -143,6 +189,7 @@ public:
  * descriptor if it intends to continue using it.
  */
 std::shared_ptr<loader> create_mmap_loader(int fd);
+std::shared_ptr<loader> create_mmap_loader(int fd, const mmap_loader_options &opts);
 
 /**
  * An exception indicating that a section is not of the requested type.
@@ -268,6 +315,17 @@ public:
          */
         size_t size() const;
 
+        /**
+         * Pass an access hint for this section's data to the loader.
+         */
+        void advise(access_hint hint) const;
+
+        /**
+         * Ask the loader to fault in this section's data in the
+         * background.
+         */
+        void prefault() const;
+
         /**
          * Return this section as a strtab.  Throws
          * section_type_mismatch if this section is not a string
@@ -167,7 +167,7 @@ elf::get_segment(unsigned index) const
 
 struct segment::impl {
         impl(const elf &f)
-                : f(f) { }
+                : f(f), data(nullptr) { }
 
         const elf f;
         Phdr<> hdr;
@@ -272,6 +272,22 @@ section::data() const
         return m->data;
 }
 
+void
+section::advise(access_hint hint) const
+{
+        if (m->hdr.type == sht::nobits)
+                return;
+        m->f.get_loader()->advise(m->hdr.offset, m->hdr.size, hint);
+}
+
+void
+section::prefault() const
+{
+        if (m->hdr.type == sht::nobits)
+                return;
+        m->f.get_loader()->prefault(m->hdr.offset, m->hdr.size);
+}
+
 size_t
 section::size() const
 {
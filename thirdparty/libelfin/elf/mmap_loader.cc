@@ -4,7 +4,12 @@
 
 #include "elf++.hh"
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <system_error>
+#include <thread>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -20,9 +25,21 @@ class mmap_loader : public loader
 {
         void *base;
         size_t lim;
+        size_t page_size;
+        mmap_loader_options opts;
+
+        // Background prefault state.  The helper thread is started
+        // on the first prefault request and drains ranges in order.
+        thread prefaulter;
+        mutex lock;
+        condition_variable cond;
+        deque<pair<size_t, size_t> > pending;
+        atomic<bool> stopping;
 
 public:
-        mmap_loader(int fd)
+        mmap_loader(int fd, const mmap_loader_options &opts)
+                : page_size(sysconf(_SC_PAGESIZE)), opts(opts),
+                  stopping(false)
         {
                 off_t end = lseek(fd, 0, SEEK_END);
                 if (end == (off_t)-1)
@@ -30,7 +47,10 @@ public:
                                            "finding file length");
                 lim = end;
 
-                base = mmap(nullptr, lim, PROT_READ, MAP_SHARED, fd, 0);
+                int flags = MAP_SHARED;
+                if (opts.populate)
+                        flags |= MAP_POPULATE;
+                base = mmap(nullptr, lim, PROT_READ, flags, fd, 0);
                 if (base == MAP_FAILED)
                         throw system_error(errno, system_category(),
                                            "mmap'ing file");
@@ -39,6 +59,14 @@ public:
 
         ~mmap_loader()
         {
+                if (prefaulter.joinable()) {
+                        {
+                                lock_guard<mutex> guard(lock);
+                                stopping = true;
+                        }
+                        cond.notify_one();
+                        prefaulter.join();
+                }
                 munmap(base, lim);
         }
 
@@ -48,12 +76,105 @@ public:
                         throw range_error("offset exceeds file size");
                 return (const char*)base + offset;
         }
+
+        void advise(off_t offset, size_t size, access_hint hint)
+        {
+                if (!opts.advise || !clip(&offset, &size))
+                        return;
+
+                int advice;
+                switch (hint) {
+                case access_hint::normal:
+                        advice = MADV_NORMAL;
+                        break;
+                case access_hint::sequential:
+                        advice = MADV_SEQUENTIAL;
+                        break;
+                case access_hint::random:
+                        advice = MADV_RANDOM;
+                        break;
+                case access_hint::willneed:
+                        advice = MADV_WILLNEED;
+                        break;
+                case access_hint::dontneed:
+                        if (!opts.release)
+                                return;
+                        advice = MADV_DONTNEED;
+                        break;
+                default:
+                        return;
+                }
+                // Hints are best-effort, so errors are ignored.
+                madvise((char*)base + offset, size, advice);
+        }
+
+        void prefault(off_t offset, size_t size)
+        {
+                if (!opts.prefault || !clip(&offset, &size))
+                        return;
+
+                {
+                        lock_guard<mutex> guard(lock);
+                        pending.emplace_back(offset, size);
+                        if (!prefaulter.joinable())
+                                prefaulter = thread(&mmap_loader::run_prefault, this);
+                }
+                cond.notify_one();
+        }
+
+private:
+        // Round [*offset, *offset + *size) out to whole pages and
+        // clamp it to the mapping.  Returns false if nothing is left.
+        bool clip(off_t *offset, size_t *size) const
+        {
+                if ((size_t)*offset >= lim || *size == 0)
+                        return false;
+                size_t start = *offset & ~(page_size - 1);
+                size_t end = min(lim, (size_t)*offset + *size);
+                *offset = start;
+                *size = end - start;
+                return true;
+        }
+
+        void run_prefault()
+        {
+                unique_lock<mutex> guard(lock);
+                while (true) {
+                        cond.wait(guard, [this] {
+                                return stopping || !pending.empty();
+                        });
+                        if (stopping)
+                                return;
+                        auto range = pending.front();
+                        pending.pop_front();
+                        guard.unlock();
+
+                        // Touch one byte per page.  Check for
+                        // shutdown now and then so a huge range
+                        // doesn't hold up the destructor.
+                        const volatile char *p = (const char*)base;
+                        size_t end = range.first + range.second;
+                        for (size_t off = range.first; off < end; off += page_size) {
+                                (void)p[off];
+                                if ((off & ((page_size << 10) - 1)) == 0 && stopping)
+                                        break;
+                        }
+
+                        guard.lock();
+                }
+        }
 };
 
 std::shared_ptr<loader>
 create_mmap_loader(int fd)
 {
-        return make_shared<mmap_loader>(fd);
+        return create_mmap_loader(fd, mmap_loader_options());
+}
+
+std::shared_ptr<loader>
+create_mmap_loader(int fd, const mmap_loader_options &opts)
+{
+        return make_shared<mmap_loader>(fd, opts);
 }
 
 ELFPP_END_NAMESPACE